@@ -12,11 +12,46 @@
 
 typedef void (*cmsg_broadcast_event_handler_t) (struct in_addr node_addr, bool joined);
 
+typedef struct _cmsg_broadcast_client_event
+{
+    /* IP address of the node that has joined/left the broadcast client. */
+    struct in_addr node_addr;
+
+    /* true if the given node has joined the broadcast client, false if
+     * it has left. */
+    bool joined;
+} cmsg_broadcast_client_event;
+
+/**
+ * How the child clients of a broadcast client are connected.
+ *
+ * CMSG_BROADCAST_CONNECT_ON_INVOKE - Children are connected when a method is invoked
+ *                                    on the broadcast client (the default).
+ * CMSG_BROADCAST_CONNECT_BACKGROUND - Children are connected in the background as soon
+ *                                     as they are discovered, and reconnected with an
+ *                                     increasing delay if they fail. Invokes still try
+ *                                     to connect any children that are not connected.
+ * CMSG_BROADCAST_CONNECT_BACKGROUND_SKIP - As above, except that invokes skip any
+ *                                          children that are not connected rather
+ *                                          than waiting for them to connect.
+ */
+typedef enum _cmsg_broadcast_connect_policy_e
+{
+    CMSG_BROADCAST_CONNECT_ON_INVOKE,
+    CMSG_BROADCAST_CONNECT_BACKGROUND,
+    CMSG_BROADCAST_CONNECT_BACKGROUND_SKIP,
+} cmsg_broadcast_connect_policy;
+
 cmsg_client *cmsg_broadcast_client_new (const ProtobufCServiceDescriptor *descriptor,
                                         const char *service_entry_name,
                                         struct in_addr my_node_addr,
                                         bool connect_to_self, bool oneway,
                                         cmsg_broadcast_event_handler_t event_handler);
+cmsg_client *cmsg_broadcast_client_new_multicast (const ProtobufCServiceDescriptor
+                                                  *descriptor,
+                                                  const char *service_entry_name,
+                                                  struct in_addr group,
+                                                  struct in_addr interface);
 void cmsg_broadcast_client_destroy (cmsg_client *client);
 
 int32_t cmsg_broadcast_client_add_loopback (cmsg_client *broadcast_client,
@@ -24,7 +59,11 @@ int32_t cmsg_broadcast_client_add_loopback (cmsg_client *broadcast_client,
 int32_t cmsg_broadcast_client_add_unix (cmsg_client *_broadcast_client,
                                         cmsg_client *unix_client);
 
+int32_t cmsg_broadcast_client_set_connect_policy (cmsg_client *_broadcast_client,
+                                                  cmsg_broadcast_connect_policy policy);
+
 int cmsg_broadcast_client_get_event_fd (cmsg_client *_broadcast_client);
 void cmsg_broadcast_event_queue_process (cmsg_client *_broadcast_client);
+GArray *cmsg_broadcast_event_queue_drain (cmsg_client *_broadcast_client);
 
 #endif /* __CMSG_BROADCAST_CLIENT_H_ */
@@ -29,6 +29,7 @@ typedef enum _cmsg_client_state_e
     CMSG_CLIENT_STATE_FAILED,       //after unsuccessful connect (todo: or unsuccessful send)
     CMSG_CLIENT_STATE_CLOSED,       //after successful send
     CMSG_CLIENT_STATE_QUEUED,       //after successful adding a packet to the queue
+    CMSG_CLIENT_STATE_CONNECTING,   //after starting a connect that has not yet completed
 } cmsg_client_state;
 
 typedef struct _cmsg_client_closure_data_s
@@ -36,8 +37,23 @@ typedef struct _cmsg_client_closure_data_s
     ProtobufCMessage *message;
     ProtobufCAllocator *allocator;
     int retval;
+    /* The replies received by a composite client, in the order they arrived */
+    GPtrArray *messages;
 } cmsg_client_closure_data;
 
+/* The set of replies received when invoking a method. This has no limit on the
+ * number of replies, unlike the array of replies used by the standard API. */
+typedef struct _cmsg_client_results_s
+{
+    GPtrArray *messages;
+} cmsg_client_results;
+
+typedef struct _cmsg_client_results_iter_s
+{
+    const cmsg_client_results *results;
+    guint index;
+} cmsg_client_results_iter;
+
 typedef int (*cmsg_queue_filter_func_t) (cmsg_client *, const char *,
                                          cmsg_queue_filter_type *);
 typedef void (*cmsg_queue_callback_func_t) (cmsg_client *, const char *);
@@ -232,6 +248,10 @@ cmsg_client *cmsg_create_client_tipc_broadcast (const ProtobufCServiceDescriptor
 void cmsg_client_tipc_broadcast_set_destination (cmsg_client *client, int lower_addr,
                                                  int upper_addr);
 
+cmsg_client *cmsg_create_client_multicast (const ProtobufCServiceDescriptor *descriptor,
+                                           const char *service_name, struct in_addr group,
+                                           struct in_addr interface);
+
 cmsg_client *cmsg_create_client_forwarding (const ProtobufCServiceDescriptor *descriptor,
                                             void *user_data,
                                             cmsg_forwarding_transport_send_f send_func);
@@ -259,6 +279,15 @@ typedef struct
 int cmsg_api_invoke (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
                      int method_index, const ProtobufCMessage *send_msg,
                      ProtobufCMessage **recv_msg);
+int cmsg_api_invoke_results (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
+                             int method_index, const ProtobufCMessage *send_msg,
+                             cmsg_client_results **results);
+guint cmsg_client_results_count (const cmsg_client_results *results);
+void cmsg_client_results_iter_init (cmsg_client_results_iter *iter,
+                                    const cmsg_client_results *results);
+bool cmsg_client_results_iter_next (cmsg_client_results_iter *iter,
+                                    ProtobufCMessage **message);
+void cmsg_client_results_free (cmsg_client_results *results);
 #ifdef HAVE_UNITTEST
 int cmsg_api_invoke_real (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
                           int method_index,
@@ -6,10 +6,20 @@
 
 #include "cmsg_client.h"
 
+/* Quorums for 'cmsg_composite_client_set_quorum' */
+#define CMSG_COMPOSITE_CLIENT_QUORUM_ALL        0
+#define CMSG_COMPOSITE_CLIENT_QUORUM_MAJORITY   UINT32_MAX
+
+typedef void (*cmsg_composite_client_error_func_t) (cmsg_client *composite_client,
+                                                   cmsg_client *child,
+                                                   const char *method_name, int32_t error);
+
 int32_t cmsg_composite_client_add_child (cmsg_client *composite_client,
                                          cmsg_client *client);
 int32_t cmsg_composite_client_delete_child (cmsg_client *composite_client,
                                             cmsg_client *client);
+int32_t cmsg_composite_client_delete_and_destroy_child (cmsg_client *composite_client,
+                                                        cmsg_client *client);
 cmsg_client *cmsg_composite_client_new (const ProtobufCServiceDescriptor *descriptor);
 cmsg_client *cmsg_composite_client_lookup_by_tcp_ipv4_addr (cmsg_client *_composite_client,
                                                             struct in_addr addr);
@@ -21,5 +31,10 @@ int cmsg_composite_client_num_children (cmsg_client *_composite_client);
 GList *cmsg_composite_client_get_children (cmsg_client *_composite_client);
 void cmsg_composite_client_free_all_children (cmsg_client *_composite_client);
 void cmsg_composite_client_destroy_full (cmsg_client *_composite_client);
+int32_t cmsg_composite_client_set_timeout (cmsg_client *_composite_client,
+                                           uint32_t timeout);
+int32_t cmsg_composite_client_set_quorum (cmsg_client *_composite_client, uint32_t quorum);
+void cmsg_composite_client_error_func_set (cmsg_client *_composite_client,
+                                           cmsg_composite_client_error_func_t func);
 
 #endif /* __CMSG_COMPOSITE_CLIENT_H_ */
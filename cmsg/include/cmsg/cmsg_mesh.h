@@ -37,6 +37,15 @@ cmsg_mesh_conn *cmsg_mesh_connection_init (ProtobufCService *service,
                                            struct in_addr my_node_addr,
                                            cmsg_mesh_local_type type, bool oneway,
                                            cmsg_broadcast_event_handler_t event_handler);
+cmsg_mesh_conn *cmsg_mesh_connection_init_optimised (ProtobufCService *service,
+                                                     const char *service_entry_name,
+                                                     struct in_addr my_node_addr,
+                                                     cmsg_mesh_local_type type,
+                                                     bool oneway,
+                                                     cmsg_broadcast_event_handler_t
+                                                     event_handler);
 void cmsg_mesh_connection_destroy (cmsg_mesh_conn *mesh);
+int32_t cmsg_mesh_connection_set_connect_policy (cmsg_mesh_conn *mesh,
+                                                 cmsg_broadcast_connect_policy policy);
 
 #endif /* __CMSG_MESH_H_ */
@@ -99,8 +99,9 @@ typedef struct _cmsg_object_s
 
 // NOTE: ECHO is used to implement a healthcheck of the server.
 // Header is sent big-endian/network byte order.
-// NOTE: CONN_OPEN is unused but previously was used to signify a pkt that
-// is being sent that the client needed to.  No response is to be sent.
+// NOTE: CONN_OPEN previously was used to signify a pkt that is being sent that
+// the client needed to.  It is now only used by publishers to wake subscribers
+// that receive published messages from shared memory.  No response is to be sent.
 
 // The fields involved in the header are:
 //    client method request header:
@@ -145,7 +146,7 @@ typedef enum _cmsg_msg_type_e
     CMSG_MSG_TYPE_METHOD_REPLY,     // Reply from server in response to a method request
     CMSG_MSG_TYPE_ECHO_REQ,         // Request to server for a reply - used for a ping/healthcheck
     CMSG_MSG_TYPE_ECHO_REPLY,       // Reply from server in response to an echo request
-    CMSG_MSG_TYPE_CONN_OPEN,        // Request from client to open the connection (unused)
+    CMSG_MSG_TYPE_CONN_OPEN,        // Wake a shared memory subscriber (no response sent)
 } cmsg_msg_type;
 
 typedef enum _cmsg_status_code_e
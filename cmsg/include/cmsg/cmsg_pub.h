@@ -14,6 +14,7 @@
 typedef struct cmsg_publisher cmsg_publisher;
 
 cmsg_publisher *cmsg_publisher_create (const ProtobufCServiceDescriptor *service);
+cmsg_publisher *cmsg_publisher_create_shm (const ProtobufCServiceDescriptor *service);
 void cmsg_publisher_destroy (cmsg_publisher *publisher);
 
 #endif /* __CMSG_PUB_H_ */
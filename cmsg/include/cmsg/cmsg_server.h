@@ -74,6 +74,10 @@ typedef struct _cmsg_server_accept_thread_info
     /* Thread used to accept any incoming connection attempts. */
     pthread_t server_accept_thread;
 
+    /* Whether the connections are accepted by the shared accept thread rather
+     * than by server_accept_thread. */
+    bool shared;
+
     /* Queue to store new accepted connection sockets. This is used to
      * pass the new socket descriptors back to the server user. */
     GAsyncQueue *accept_sd_queue;
@@ -253,6 +257,7 @@ void cmsg_server_invoke_direct (cmsg_server *server, const ProtobufCMessage *inp
                                 uint32_t method_index);
 
 int32_t cmsg_server_accept_thread_init (cmsg_server *server);
+int32_t cmsg_server_shared_accept_thread_init (cmsg_server *server);
 void cmsg_server_accept_thread_deinit (cmsg_server *server);
 
 void cmsg_server_suppress_error (cmsg_server *server, cmsg_bool_t enable);
@@ -276,6 +281,9 @@ cmsg_server *cmsg_create_server_tcp_ipv6_oneway (const char *service_name,
                                                  const ProtobufCService *service);
 cmsg_server *cmsg_create_server_tipc_broadcast (ProtobufCService *descriptor,
                                                 const char *service_name, int id);
+cmsg_server *cmsg_create_server_multicast (const ProtobufCService *service,
+                                           const char *service_name, struct in_addr group,
+                                           struct in_addr interface);
 
 const cmsg_server *cmsg_server_from_service_get (const void *service);
 
@@ -9,6 +9,7 @@
 
 #include <stdbool.h>
 #include <netinet/in.h>
+#include <glib.h>
 #include <cmsg/cmsg_transport.h>
 
 typedef struct _cmsg_sl_info_s cmsg_sl_info;
@@ -25,7 +26,13 @@ bool cmsg_service_listener_event_queue_process (const cmsg_sl_info *info);
 bool cmsg_service_listener_wait_for_unix_server (const char *service_name, long seconds);
 bool cmsg_service_listener_wait_for_tcp_server (const char *service_name,
                                                 struct in_addr *addr, int seconds);
+int cmsg_service_listener_wait_for_services (const char *const *service_names,
+                                             int num_services, int quorum, long seconds);
 void cmsg_service_listener_event_loop_data_set (const cmsg_sl_info *info, void *data);
 void *cmsg_service_listener_event_loop_data_get (const cmsg_sl_info *info);
+void cmsg_service_listener_batch_begin (void);
+int32_t cmsg_service_listener_batch_end (void);
+GList *cmsg_service_listener_lookup (const char *service_name);
+bool cmsg_service_listener_directory_lookup (const char *service_name, GList **transports);
 
 #endif /* __CMSG_SL_H_ */
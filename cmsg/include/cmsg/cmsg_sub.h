@@ -20,6 +20,12 @@ int cmsg_sub_unix_server_socket_get (cmsg_subscriber *subscriber);
 cmsg_server *cmsg_sub_tcp_server_get (cmsg_subscriber *subscriber);
 int cmsg_sub_tcp_server_socket_get (cmsg_subscriber *subscriber);
 
+/* A method name ending with CMSG_SUB_WILDCARD subscribes to every method of the
+ * service starting with the preceding prefix (e.g. "link_*"), and CMSG_SUB_ALL_METHODS
+ * subscribes to every method of the service. */
+#define CMSG_SUB_WILDCARD "*"
+#define CMSG_SUB_ALL_METHODS CMSG_SUB_WILDCARD
+
 int32_t cmsg_sub_subscribe_local (cmsg_subscriber *subscriber, const char *method_name);
 int32_t cmsg_sub_subscribe_remote (cmsg_subscriber *subscriber, const char *method_name,
                                    struct in_addr remote_addr);
@@ -38,6 +44,7 @@ cmsg_subscriber *cmsg_subscriber_create_tcp (const char *server_name, struct in_
                                              const char *vrf_bind_dev,
                                              const ProtobufCService *service);
 cmsg_subscriber *cmsg_subscriber_create_unix (const ProtobufCService *service);
+cmsg_subscriber *cmsg_subscriber_create_unix_shm (const ProtobufCService *service);
 void cmsg_subscriber_destroy (cmsg_subscriber *subscriber);
 
 #endif /* __CMSG_SUB_H_ */
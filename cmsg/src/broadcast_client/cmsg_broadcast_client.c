@@ -11,16 +11,6 @@
 #include "cmsg_composite_client.h"
 #include "transport/cmsg_transport_private.h"
 
-/**
- * When destroying the broadcast client event queue there may still be
- * events on there. Simply free them as required to avoid leaking memory.
- */
-static void
-_clear_event_queue (gpointer data)
-{
-    free (data);
-}
-
 /**
  * Create a broadcast client structure. Simply allocate the required memory
  * and initialise all fields to their default values.
@@ -33,6 +23,7 @@ static cmsg_broadcast_client *
 cmsg_broadcast_client_create (const ProtobufCServiceDescriptor *descriptor)
 {
     cmsg_broadcast_client *broadcast_client = NULL;
+    pthread_condattr_t cond_attr;
     int ret;
 
     broadcast_client =
@@ -50,9 +41,22 @@ cmsg_broadcast_client_create (const ProtobufCServiceDescriptor *descriptor)
         broadcast_client->oneway_children = false;
         broadcast_client->service_entry_name = NULL;
         broadcast_client->connect_to_self = false;
-        broadcast_client->event_queue.queue = NULL;
+        broadcast_client->multicast_client = NULL;
+        broadcast_client->event_queue.pending = NULL;
+        broadcast_client->event_queue.pending_index = NULL;
         broadcast_client->event_queue.eventfd = -1;
         broadcast_client->event_queue.handler = NULL;
+        broadcast_client->connect_policy = CMSG_BROADCAST_CONNECT_ON_INVOKE;
+        broadcast_client->connect_thread_running = false;
+        broadcast_client->connect_stop = false;
+        broadcast_client->connect_wakeup = false;
+
+        pthread_mutex_init (&broadcast_client->event_queue.mutex, NULL);
+        pthread_mutex_init (&broadcast_client->connect_mutex, NULL);
+        pthread_condattr_init (&cond_attr);
+        pthread_condattr_setclock (&cond_attr, CLOCK_MONOTONIC);
+        pthread_cond_init (&broadcast_client->connect_cond, &cond_attr);
+        pthread_condattr_destroy (&cond_attr);
     }
     else
     {
@@ -62,6 +66,23 @@ cmsg_broadcast_client_create (const ProtobufCServiceDescriptor *descriptor)
     return broadcast_client;
 }
 
+/**
+ * Free a broadcast client structure created by 'cmsg_broadcast_client_create'.
+ *
+ * @param broadcast_client - The broadcast client to free.
+ */
+static void
+cmsg_broadcast_client_free (cmsg_broadcast_client *broadcast_client)
+{
+    cmsg_composite_client_deinit (&broadcast_client->base_client);
+
+    pthread_cond_destroy (&broadcast_client->connect_cond);
+    pthread_mutex_destroy (&broadcast_client->connect_mutex);
+    pthread_mutex_destroy (&broadcast_client->event_queue.mutex);
+
+    CMSG_FREE (broadcast_client);
+}
+
 /**
  * Deinitialise the event handling functionality for the given broadcast client.
  *
@@ -77,10 +98,15 @@ cmsg_broadcast_client_deinit_events (cmsg_broadcast_client *broadcast_client)
         close (broadcast_client->event_queue.eventfd);
         broadcast_client->event_queue.eventfd = -1;
     }
-    if (broadcast_client->event_queue.queue)
+    if (broadcast_client->event_queue.pending)
+    {
+        g_array_free (broadcast_client->event_queue.pending, TRUE);
+        broadcast_client->event_queue.pending = NULL;
+    }
+    if (broadcast_client->event_queue.pending_index)
     {
-        g_async_queue_unref (broadcast_client->event_queue.queue);
-        broadcast_client->event_queue.queue = NULL;
+        g_hash_table_destroy (broadcast_client->event_queue.pending_index);
+        broadcast_client->event_queue.pending_index = NULL;
     }
 }
 
@@ -102,12 +128,10 @@ cmsg_broadcast_client_init_events (cmsg_broadcast_client *broadcast_client,
         return CMSG_RET_ERR;
     }
 
-    broadcast_client->event_queue.queue = g_async_queue_new_full (_clear_event_queue);
-    if (!broadcast_client->event_queue.queue)
-    {
-        close (broadcast_client->event_queue.eventfd);
-        return CMSG_RET_ERR;
-    }
+    broadcast_client->event_queue.pending =
+        g_array_new (FALSE, FALSE, sizeof (cmsg_broadcast_client_pending_event));
+    broadcast_client->event_queue.pending_index = g_hash_table_new (g_direct_hash,
+                                                                    g_direct_equal);
 
     broadcast_client->event_queue.handler = event_handler;
 
@@ -142,8 +166,7 @@ cmsg_broadcast_client_new (const ProtobufCServiceDescriptor *descriptor,
         ret = cmsg_broadcast_client_init_events (broadcast_client, event_handler);
         if (ret != CMSG_RET_OK)
         {
-            cmsg_composite_client_deinit (&broadcast_client->base_client);
-            CMSG_FREE (broadcast_client);
+            cmsg_broadcast_client_free (broadcast_client);
             return NULL;
         }
     }
@@ -151,14 +174,73 @@ cmsg_broadcast_client_new (const ProtobufCServiceDescriptor *descriptor,
     ret = cmsg_broadcast_conn_mgmt_init (broadcast_client);
     if (ret != CMSG_RET_OK)
     {
-        cmsg_composite_client_deinit (&broadcast_client->base_client);
-        CMSG_FREE (broadcast_client);
+        cmsg_broadcast_client_deinit_events (broadcast_client);
+        cmsg_broadcast_client_free (broadcast_client);
         return NULL;
     }
 
     return (cmsg_client *) broadcast_client;
 }
 
+/**
+ * Create a oneway broadcast client that sends each message to every node with a single
+ * UDP multicast datagram, rather than sending it over a TCP connection to each node.
+ * The cost of sending a message therefore does not depend on the number of nodes.
+ * Each node receives the messages with a server created by
+ * 'cmsg_create_server_multicast' for the same service and group. Nodes that miss a
+ * message request it again from the sender (see cmsg_transport_udp_multicast.c).
+ *
+ * The topology is not monitored, so no join/leave events are generated. Loopback and
+ * unix clients can still be added to the broadcast client.
+ *
+ * @param descriptor - The service descriptor the broadcast client is for.
+ * @param service_entry_name - The name of the service in the /etc/services file.
+ * @param group - The multicast group address to send to.
+ * @param interface - The address of the interface to send from.
+ *
+ * @returns A pointer to the created client on success. NULL otherwise.
+ */
+cmsg_client *
+cmsg_broadcast_client_new_multicast (const ProtobufCServiceDescriptor *descriptor,
+                                     const char *service_entry_name, struct in_addr group,
+                                     struct in_addr interface)
+{
+    cmsg_broadcast_client *broadcast_client = NULL;
+    cmsg_client *multicast_client = NULL;
+
+    CMSG_ASSERT_RETURN_VAL (descriptor != NULL, NULL);
+    CMSG_ASSERT_RETURN_VAL (service_entry_name != NULL, NULL);
+
+    broadcast_client = cmsg_broadcast_client_create (descriptor);
+    if (!broadcast_client)
+    {
+        return NULL;
+    }
+
+    broadcast_client->service_entry_name = service_entry_name;
+    broadcast_client->oneway_children = true;
+
+    multicast_client = cmsg_create_client_multicast (descriptor, service_entry_name, group,
+                                                     interface);
+    if (!multicast_client)
+    {
+        cmsg_broadcast_client_free (broadcast_client);
+        return NULL;
+    }
+
+    if (cmsg_composite_client_add_child ((cmsg_client *) &broadcast_client->base_client,
+                                         multicast_client) != CMSG_RET_OK)
+    {
+        cmsg_destroy_client_and_transport (multicast_client);
+        cmsg_broadcast_client_free (broadcast_client);
+        return NULL;
+    }
+
+    broadcast_client->multicast_client = multicast_client;
+
+    return (cmsg_client *) broadcast_client;
+}
+
 /**
  * Destroy the broadcast client.
  *
@@ -173,7 +255,11 @@ cmsg_broadcast_client_destroy (cmsg_client *client)
     cmsg_client *child;
 
     /* Connection management must be stopped before destroying client */
-    cmsg_broadcast_conn_mgmt_deinit (broadcast_client);
+    if (!broadcast_client->multicast_client)
+    {
+        cmsg_broadcast_conn_mgmt_deinit (broadcast_client);
+    }
+    cmsg_broadcast_conn_connect_stop (broadcast_client);
 
     children =
         cmsg_composite_client_get_children ((cmsg_client *) &broadcast_client->base_client);
@@ -183,11 +269,9 @@ cmsg_broadcast_client_destroy (cmsg_client *client)
         cmsg_destroy_client_and_transport (child);
     }
 
-    cmsg_composite_client_deinit (&broadcast_client->base_client);
-
     cmsg_broadcast_client_deinit_events (broadcast_client);
 
-    CMSG_FREE (broadcast_client);
+    cmsg_broadcast_client_free (broadcast_client);
 }
 
 /**
@@ -236,6 +320,44 @@ cmsg_broadcast_client_add_unix (cmsg_client *_broadcast_client, cmsg_client *uni
     return cmsg_composite_client_add_child (comp_client, unix_client);
 }
 
+/**
+ * Set how the child clients of a broadcast client are connected.
+ *
+ * @param _broadcast_client - The broadcast client to set the connection policy for.
+ * @param policy - The connection policy to use (see 'cmsg_broadcast_connect_policy').
+ *
+ * @returns CMSG_RET_OK on success, CMSG_RET_ERR on failure.
+ */
+int32_t
+cmsg_broadcast_client_set_connect_policy (cmsg_client *_broadcast_client,
+                                          cmsg_broadcast_connect_policy policy)
+{
+    cmsg_broadcast_client *broadcast_client = (cmsg_broadcast_client *) _broadcast_client;
+    int32_t ret = CMSG_RET_OK;
+
+    CMSG_ASSERT_RETURN_VAL (broadcast_client != NULL, CMSG_RET_ERR);
+
+    if (policy == CMSG_BROADCAST_CONNECT_ON_INVOKE)
+    {
+        broadcast_client->base_client.skip_unconnected = false;
+        cmsg_broadcast_conn_connect_stop (broadcast_client);
+    }
+    else
+    {
+        ret = cmsg_broadcast_conn_connect_start (broadcast_client);
+        if (ret != CMSG_RET_OK)
+        {
+            return ret;
+        }
+        broadcast_client->base_client.skip_unconnected =
+            (policy == CMSG_BROADCAST_CONNECT_BACKGROUND_SKIP);
+    }
+
+    broadcast_client->connect_policy = policy;
+
+    return ret;
+}
+
 /**
  * Get the eventfd descriptor for the event queue of the given broadcast client
  *
@@ -253,6 +375,63 @@ cmsg_broadcast_client_get_event_fd (cmsg_client *_broadcast_client)
     return broadcast_client->event_queue.eventfd;
 }
 
+/**
+ * Take the pending events from the event queue of the given broadcast client.
+ *
+ * The events are the net membership changes since the queue was last drained, with
+ * at most one event per node, in the order the nodes first changed. A node that left
+ * and joined again (or vice versa) in that time produces no event. Events are only
+ * queued if the broadcast client was created with an event handler.
+ *
+ * @param _broadcast_client - The broadcast client to drain the events of.
+ *
+ * @returns An array of 'cmsg_broadcast_client_event' that the caller must free with
+ *          'g_array_free', or NULL on failure.
+ */
+GArray *
+cmsg_broadcast_event_queue_drain (cmsg_client *_broadcast_client)
+{
+    cmsg_broadcast_client *broadcast_client = (cmsg_broadcast_client *) _broadcast_client;
+    cmsg_broadcast_client_pending_event *pending = NULL;
+    cmsg_broadcast_client_event event;
+    GArray *events = NULL;
+    eventfd_t value;
+    guint i;
+
+    CMSG_ASSERT_RETURN_VAL (broadcast_client != NULL, NULL);
+
+    events = g_array_new (FALSE, FALSE, sizeof (cmsg_broadcast_client_event));
+
+    if (broadcast_client->event_queue.eventfd < 0)
+    {
+        return events;
+    }
+
+    /* clear notification */
+    TEMP_FAILURE_RETRY (eventfd_read (broadcast_client->event_queue.eventfd, &value));
+
+    pthread_mutex_lock (&broadcast_client->event_queue.mutex);
+
+    for (i = 0; i < broadcast_client->event_queue.pending->len; i++)
+    {
+        pending = &g_array_index (broadcast_client->event_queue.pending,
+                                  cmsg_broadcast_client_pending_event, i);
+        if (pending->was_member != pending->is_member)
+        {
+            event.node_addr = pending->node_addr;
+            event.joined = pending->is_member;
+            g_array_append_val (events, event);
+        }
+    }
+
+    g_array_set_size (broadcast_client->event_queue.pending, 0);
+    g_hash_table_remove_all (broadcast_client->event_queue.pending_index);
+
+    pthread_mutex_unlock (&broadcast_client->event_queue.mutex);
+
+    return events;
+}
+
 /**
  * Process any events on the event queue of the given broadcast client.
  *
@@ -263,18 +442,26 @@ cmsg_broadcast_event_queue_process (cmsg_client *_broadcast_client)
 {
     cmsg_broadcast_client *broadcast_client = (cmsg_broadcast_client *) _broadcast_client;
     cmsg_broadcast_client_event *event = NULL;
-    eventfd_t value;
-    cmsg_broadcast_event_handler_t handler_func = broadcast_client->event_queue.handler;
+    cmsg_broadcast_event_handler_t handler_func = NULL;
+    GArray *events = NULL;
+    guint i;
 
     CMSG_ASSERT_RETURN_VOID (broadcast_client != NULL);
+
+    handler_func = broadcast_client->event_queue.handler;
     CMSG_ASSERT_RETURN_VOID (handler_func != NULL);
 
-    /* clear notification */
-    TEMP_FAILURE_RETRY (eventfd_read (broadcast_client->event_queue.eventfd, &value));
+    events = cmsg_broadcast_event_queue_drain (_broadcast_client);
+    if (!events)
+    {
+        return;
+    }
 
-    while ((event = g_async_queue_try_pop (broadcast_client->event_queue.queue)))
+    for (i = 0; i < events->len; i++)
     {
+        event = &g_array_index (events, cmsg_broadcast_client_event, i);
         handler_func (event->node_addr, event->joined);
-        CMSG_FREE (event);
     }
+
+    g_array_free (events, TRUE);
 }
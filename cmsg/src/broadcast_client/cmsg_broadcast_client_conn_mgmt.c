@@ -13,9 +13,32 @@
 #include "cmsg_pthread_helpers.h"
 #include "transport/cmsg_transport_private.h"
 
+/* How often the children are checked for connections that have been closed */
+#define CMSG_BROADCAST_CONNECT_CHECK_MS         1000
+
+/* The delay before retrying a failed connection, doubled after each failure */
+#define CMSG_BROADCAST_RECONNECT_MIN_MS         100
+#define CMSG_BROADCAST_RECONNECT_MAX_MS         30000
+
+typedef struct _cmsg_broadcast_client_backoff_s
+{
+    /* The delay before the next connection attempt */
+    uint32_t delay_ms;
+
+    /* When the next connection attempt is due */
+    struct timespec next_attempt;
+
+    /* The last pass of the connect thread the child was seen in */
+    uint32_t pass;
+} cmsg_broadcast_client_backoff;
+
 /**
  * Generate an event for the node/leave join.
  *
+ * Events for the same node are coalesced until the queue is drained so that only the
+ * net change for each node is kept, and the listener is only notified when the first
+ * event is queued.
+ *
  * @param broadcast_client - The broadcast client to queue the event on.
  * @param node_addr - The address of the node that has joined/left.
  * @param joined - true if the node has joined, false if it has left.
@@ -24,18 +47,42 @@ static void
 cmsg_broadcast_client_generate_event (cmsg_broadcast_client *broadcast_client,
                                       struct in_addr node_addr, bool joined)
 {
-    cmsg_broadcast_client_event *event = NULL;
+    cmsg_broadcast_client_pending_event *pending = NULL;
+    cmsg_broadcast_client_pending_event new_event;
+    gpointer key = GUINT_TO_POINTER (node_addr.s_addr);
+    guint index;
+    bool notify = false;
+
+    pthread_mutex_lock (&broadcast_client->event_queue.mutex);
 
-    if (broadcast_client->event_queue.queue)
+    if (broadcast_client->event_queue.pending)
     {
-        event = CMSG_MALLOC (sizeof (cmsg_broadcast_client_event));
-        if (event)
+        index = GPOINTER_TO_UINT (g_hash_table_lookup (broadcast_client->
+                                                       event_queue.pending_index, key));
+        if (index == 0)
         {
-            event->node_addr = node_addr;
-            event->joined = joined;
-            g_async_queue_push (broadcast_client->event_queue.queue, event);
-            TEMP_FAILURE_RETRY (eventfd_write (broadcast_client->event_queue.eventfd, 1));
+            new_event.node_addr = node_addr;
+            new_event.was_member = !joined;
+            new_event.is_member = joined;
+            g_array_append_val (broadcast_client->event_queue.pending, new_event);
+            index = broadcast_client->event_queue.pending->len;
+            g_hash_table_insert (broadcast_client->event_queue.pending_index, key,
+                                 GUINT_TO_POINTER (index));
+            notify = (index == 1);
         }
+        else
+        {
+            pending = &g_array_index (broadcast_client->event_queue.pending,
+                                      cmsg_broadcast_client_pending_event, index - 1);
+            pending->is_member = joined;
+        }
+    }
+
+    pthread_mutex_unlock (&broadcast_client->event_queue.mutex);
+
+    if (notify)
+    {
+        TEMP_FAILURE_RETRY (eventfd_write (broadcast_client->event_queue.eventfd, 1));
     }
 }
 
@@ -68,6 +115,12 @@ cmsg_broadcast_client_add_child (cmsg_broadcast_client *broadcast_client,
 
     cmsg_composite_client_add_child (comp_client, child);
 
+    /* Connect the new child straight away if connecting in the background */
+    pthread_mutex_lock (&broadcast_client->connect_mutex);
+    broadcast_client->connect_wakeup = true;
+    pthread_cond_signal (&broadcast_client->connect_cond);
+    pthread_mutex_unlock (&broadcast_client->connect_mutex);
+
     address = transport->config.socket.sockaddr.in.sin_addr;
     cmsg_broadcast_client_generate_event (broadcast_client, address, true);
 }
@@ -97,7 +150,9 @@ cmsg_broadcast_client_delete_child (cmsg_broadcast_client *broadcast_client,
         return;
     }
 
-    if (cmsg_composite_client_delete_child (comp_client, child) < 0)
+    /* The child is destroyed once any invoke using it completes, rather than
+     * blocking the topology thread until then */
+    if (cmsg_composite_client_delete_and_destroy_child (comp_client, child) < 0)
     {
         CMSG_LOG_GEN_ERROR
             ("Failed to remove child client from broadcast client (service %s).",
@@ -105,8 +160,6 @@ cmsg_broadcast_client_delete_child (cmsg_broadcast_client *broadcast_client,
         return;
     }
 
-    cmsg_destroy_client_and_transport (child);
-
     address = transport->config.socket.sockaddr.in.sin_addr;
     cmsg_broadcast_client_generate_event (broadcast_client, address, false);
 }
@@ -167,6 +220,258 @@ server_event_callback (const cmsg_transport *transport, bool added, void *user_c
     return true;
 }
 
+/**
+ * Get the number of milliseconds until the given time.
+ *
+ * @param now - The current time (CLOCK_MONOTONIC).
+ * @param then - The time to get the number of milliseconds until.
+ *
+ * @returns The number of milliseconds until 'then', negative if it has passed.
+ */
+static int64_t
+cmsg_broadcast_client_ms_until (const struct timespec *now, const struct timespec *then)
+{
+    return ((int64_t) (then->tv_sec - now->tv_sec) * 1000 +
+            (then->tv_nsec - now->tv_nsec) / 1000000);
+}
+
+static gboolean
+cmsg_broadcast_client_backoff_stale (gpointer key, gpointer value, gpointer user_data)
+{
+    cmsg_broadcast_client_backoff *backoff = (cmsg_broadcast_client_backoff *) value;
+
+    return backoff->pass != *(uint32_t *) user_data;
+}
+
+/**
+ * Record that connecting a child of a broadcast client failed, and schedule the
+ * next attempt to connect it.
+ *
+ * @param backoff_table - The connection backoff of the children.
+ * @param child - The child that failed to connect.
+ * @param pass - The current pass of the connect thread.
+ *
+ * @returns The number of milliseconds until the next attempt.
+ */
+static uint32_t
+cmsg_broadcast_client_backoff_update (GHashTable *backoff_table, cmsg_client *child,
+                                      uint32_t pass)
+{
+    cmsg_broadcast_client_backoff *backoff;
+
+    backoff = g_hash_table_lookup (backoff_table, child);
+    if (!backoff)
+    {
+        backoff = g_new0 (cmsg_broadcast_client_backoff, 1);
+        backoff->delay_ms = CMSG_BROADCAST_RECONNECT_MIN_MS;
+        g_hash_table_insert (backoff_table, child, backoff);
+    }
+    else
+    {
+        backoff->delay_ms = MIN (backoff->delay_ms * 2, CMSG_BROADCAST_RECONNECT_MAX_MS);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &backoff->next_attempt);
+    backoff->next_attempt.tv_sec += backoff->delay_ms / 1000;
+    backoff->next_attempt.tv_nsec += (backoff->delay_ms % 1000) * 1000000;
+    if (backoff->next_attempt.tv_nsec >= 1000000000)
+    {
+        backoff->next_attempt.tv_sec++;
+        backoff->next_attempt.tv_nsec -= 1000000000;
+    }
+    backoff->pass = pass;
+
+    return backoff->delay_ms;
+}
+
+/**
+ * Connect the children of a broadcast client that are not connected and are due
+ * a connection attempt. The children are connected in parallel.
+ *
+ * @param broadcast_client - The broadcast client to connect the children of.
+ * @param backoff_table - The connection backoff of the children.
+ * @param pass - The current pass of the connect thread.
+ *
+ * @returns The number of milliseconds until the children should next be checked.
+ */
+static uint32_t
+cmsg_broadcast_client_connect_pass (cmsg_broadcast_client *broadcast_client,
+                                    GHashTable *backoff_table, uint32_t pass)
+{
+    cmsg_composite_client_snapshot *snapshot;
+    cmsg_broadcast_client_backoff *backoff;
+    GPtrArray *connecting;
+    struct timespec now;
+    uint32_t next_ms = CMSG_BROADCAST_CONNECT_CHECK_MS;
+    uint32_t delay_ms;
+    int64_t due_ms;
+    cmsg_client *child;
+    guint i;
+
+    /* The snapshot stops the children from being destroyed while connecting */
+    snapshot = cmsg_composite_client_snapshot_get (&broadcast_client->base_client);
+    connecting = g_ptr_array_new ();
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    for (i = 0; i < snapshot->children->len; i++)
+    {
+        child = (cmsg_client *) g_ptr_array_index (snapshot->children, i);
+        if (child->_transport->type == CMSG_TRANSPORT_LOOPBACK)
+        {
+            continue;
+        }
+
+        if (child->state == CMSG_CLIENT_STATE_CONNECTED)
+        {
+            continue;
+        }
+
+        backoff = g_hash_table_lookup (backoff_table, child);
+        if (backoff)
+        {
+            backoff->pass = pass;
+            due_ms = cmsg_broadcast_client_ms_until (&now, &backoff->next_attempt);
+            if (due_ms > 0)
+            {
+                next_ms = MIN (next_ms, due_ms);
+                continue;
+            }
+        }
+
+        pthread_mutex_lock (&child->invoke_mutex);
+        g_ptr_array_add (connecting, child);
+    }
+
+    cmsg_composite_client_connect_children (connecting);
+
+    for (i = 0; i < connecting->len; i++)
+    {
+        child = (cmsg_client *) g_ptr_array_index (connecting, i);
+        if (child->state != CMSG_CLIENT_STATE_CONNECTED)
+        {
+            delay_ms = cmsg_broadcast_client_backoff_update (backoff_table, child, pass);
+            next_ms = MIN (next_ms, delay_ms);
+        }
+        pthread_mutex_unlock (&child->invoke_mutex);
+    }
+
+    /* Forget the children that have connected or been removed */
+    g_hash_table_foreach_remove (backoff_table, cmsg_broadcast_client_backoff_stale, &pass);
+
+    g_ptr_array_free (connecting, TRUE);
+    cmsg_composite_client_snapshot_unref (snapshot);
+
+    return next_ms;
+}
+
+/**
+ * Connect the children of a broadcast client in the background. Children are
+ * connected as soon as they are added, and children that fail to connect (or
+ * whose connection is closed) are reconnected with an exponential backoff.
+ *
+ * @param arg - The broadcast client.
+ */
+static void *
+cmsg_broadcast_client_connect_thread (void *arg)
+{
+    cmsg_broadcast_client *broadcast_client = (cmsg_broadcast_client *) arg;
+    GHashTable *backoff_table;
+    struct timespec wait_until;
+    uint32_t next_ms;
+    uint32_t pass = 0;
+
+    backoff_table = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+
+    pthread_mutex_lock (&broadcast_client->connect_mutex);
+
+    while (!broadcast_client->connect_stop)
+    {
+        broadcast_client->connect_wakeup = false;
+        pthread_mutex_unlock (&broadcast_client->connect_mutex);
+
+        next_ms = cmsg_broadcast_client_connect_pass (broadcast_client, backoff_table,
+                                                      ++pass);
+
+        pthread_mutex_lock (&broadcast_client->connect_mutex);
+
+        if (!broadcast_client->connect_wakeup && !broadcast_client->connect_stop)
+        {
+            clock_gettime (CLOCK_MONOTONIC, &wait_until);
+            wait_until.tv_sec += next_ms / 1000;
+            wait_until.tv_nsec += (next_ms % 1000) * 1000000;
+            if (wait_until.tv_nsec >= 1000000000)
+            {
+                wait_until.tv_sec++;
+                wait_until.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait (&broadcast_client->connect_cond,
+                                    &broadcast_client->connect_mutex, &wait_until);
+        }
+    }
+
+    pthread_mutex_unlock (&broadcast_client->connect_mutex);
+
+    g_hash_table_destroy (backoff_table);
+
+    return NULL;
+}
+
+/**
+ * Start connecting the children of a broadcast client in the background.
+ *
+ * @param broadcast_client - The broadcast client.
+ *
+ * @return CMSG_RET_OK on success, CMSG_RET_ERR otherwise.
+ */
+int32_t
+cmsg_broadcast_conn_connect_start (cmsg_broadcast_client *broadcast_client)
+{
+    if (broadcast_client->connect_thread_running)
+    {
+        return CMSG_RET_OK;
+    }
+
+    broadcast_client->connect_stop = false;
+
+    if (pthread_create (&broadcast_client->connect_thread, NULL,
+                        cmsg_broadcast_client_connect_thread, broadcast_client) != 0)
+    {
+        CMSG_LOG_GEN_ERROR ("Failed to start connect thread for broadcast client "
+                            "(service %s).", broadcast_client->service_entry_name);
+        return CMSG_RET_ERR;
+    }
+
+    cmsg_pthread_setname (broadcast_client->connect_thread,
+                          broadcast_client->service_entry_name, CMSG_BC_CLIENT_PREFIX);
+    broadcast_client->connect_thread_running = true;
+
+    return CMSG_RET_OK;
+}
+
+/**
+ * Stop connecting the children of a broadcast client in the background.
+ *
+ * @param broadcast_client - The broadcast client.
+ */
+void
+cmsg_broadcast_conn_connect_stop (cmsg_broadcast_client *broadcast_client)
+{
+    if (!broadcast_client->connect_thread_running)
+    {
+        return;
+    }
+
+    /* The thread is not cancelled as it may be holding the lock of a child */
+    pthread_mutex_lock (&broadcast_client->connect_mutex);
+    broadcast_client->connect_stop = true;
+    pthread_cond_signal (&broadcast_client->connect_cond);
+    pthread_mutex_unlock (&broadcast_client->connect_mutex);
+
+    pthread_join (broadcast_client->connect_thread, NULL);
+    broadcast_client->connect_thread_running = false;
+}
+
 /**
  * Initialise the cmsg broadcast connection management.
  *
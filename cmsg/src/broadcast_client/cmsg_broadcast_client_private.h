@@ -11,24 +11,35 @@
 #include "../cmsg_composite_client_private.h"
 #include "cmsg_broadcast_client.h"
 
-typedef struct _cmsg_broadcast_client_event
+typedef struct _cmsg_broadcast_client_pending_event
 {
     /* IP address of the node that has joined/left the broadcast client. */
     struct in_addr node_addr;
 
-    /* true if the given node has joined the broadcast client, false if
-     * it has left. */
-    bool joined;
-} cmsg_broadcast_client_event;
+    /* Whether the node was a member of the broadcast client when the events were
+     * last processed. */
+    bool was_member;
+
+    /* Whether the node is a member of the broadcast client now. */
+    bool is_member;
+} cmsg_broadcast_client_pending_event;
 
 typedef struct _cmsg_broadcast_client_event_queue
 {
-    /* Queue to store node join/leave events. This is used to
-     * pass the new socket descriptors back to the server user. */
-    GAsyncQueue *queue;
+    /* Protects the pending events. */
+    pthread_mutex_t mutex;
+
+    /* The nodes that have joined/left since the events were last processed, in
+     * the order they first did so. Only the net change for each node is kept, so
+     * a node that joins and then leaves before the events are processed does not
+     * generate an event. NULL if events are not generated. */
+    GArray *pending;
+
+    /* The index (plus one) in 'pending' of each node address. */
+    GHashTable *pending_index;
 
-    /* An eventfd object to notify the listener that there is a new
-     * event on the queue.  */
+    /* An eventfd object to notify the listener that there are pending
+     * events. Only written when the first event is pending. */
     int eventfd;
 
     /* Function to call on each event */
@@ -54,11 +65,28 @@ typedef struct _cmsg_broadcast_client_s
     /* Thread for monitoring the topology and creating clients as required */
     pthread_t topology_thread;
 
+    /* The child sending to every node with a single multicast datagram. The topology
+     * is not monitored when this is set. */
+    cmsg_client *multicast_client;
+
     /* Queue for storing node join/leave events to the broadcast client */
     cmsg_broadcast_client_event_queue event_queue;
+
+    /* How the child clients are connected */
+    cmsg_broadcast_connect_policy connect_policy;
+
+    /* Thread for connecting the child clients in the background */
+    pthread_t connect_thread;
+    bool connect_thread_running;
+    pthread_mutex_t connect_mutex;
+    pthread_cond_t connect_cond;
+    bool connect_stop;
+    bool connect_wakeup;
 } cmsg_broadcast_client;
 
 int32_t cmsg_broadcast_conn_mgmt_init (cmsg_broadcast_client *broadcast_client);
 void cmsg_broadcast_conn_mgmt_deinit (cmsg_broadcast_client *broadcast_client);
+int32_t cmsg_broadcast_conn_connect_start (cmsg_broadcast_client *broadcast_client);
+void cmsg_broadcast_conn_connect_stop (cmsg_broadcast_client *broadcast_client);
 
 #endif /* __CMSG_BROADCAST_PRIVATE_H_ */
@@ -67,6 +67,7 @@ cmsg_client_invoke_init (cmsg_client *client, cmsg_transport *transport)
         case CMSG_TRANSPORT_BROADCAST:
         case CMSG_TRANSPORT_ONEWAY_UNIX:
         case CMSG_TRANSPORT_FORWARDING:
+        case CMSG_TRANSPORT_ONEWAY_MULTICAST:
             client->invoke_send = cmsg_client_invoke_send;
             client->invoke_recv = NULL;
             break;
@@ -631,6 +632,12 @@ _cmsg_client_connect (cmsg_client *client)
     }
     else
     {
+        if (client->state == CMSG_CLIENT_STATE_CONNECTING)
+        {
+            /* Abandon the connect in progress and wait for a new one */
+            client->_transport->tport_funcs.socket_close (client->_transport);
+        }
+
         // count the connection attempt
         CMSG_COUNTER_INC (client, cntr_connect_attempts);
 
@@ -664,6 +671,92 @@ cmsg_client_connect (cmsg_client *client)
     return _cmsg_client_connect (client);
 }
 
+/**
+ * Start connecting the transport of the client without waiting for the connection
+ * to complete, unless it's already connected.
+ *
+ * @param client - The client to connect.
+ *
+ * @returns 0 if connected, -EINPROGRESS if the connection is in progress (in which
+ *          case 'cmsg_client_connect_finish' should be called once the socket of
+ *          the client is writable), or another negative integer on failure.
+ */
+int32_t
+cmsg_client_connect_start (cmsg_client *client)
+{
+    int32_t ret;
+
+    CMSG_ASSERT_RETURN_VAL (client != NULL, CMSG_RET_ERR);
+
+    if (client->state == CMSG_CLIENT_STATE_CONNECTED)
+    {
+        return CMSG_RET_OK;
+    }
+
+    if (client->state == CMSG_CLIENT_STATE_CONNECTING)
+    {
+        return cmsg_client_connect_finish (client);
+    }
+
+    CMSG_COUNTER_INC (client, cntr_connect_attempts);
+
+    ret = cmsg_transport_connect_start (client->_transport);
+    if (ret == -EINPROGRESS)
+    {
+        client->state = CMSG_CLIENT_STATE_CONNECTING;
+    }
+    else if (ret < 0)
+    {
+        CMSG_COUNTER_INC (client, cntr_connect_failures);
+        client->state = CMSG_CLIENT_STATE_FAILED;
+    }
+    else
+    {
+        client->state = CMSG_CLIENT_STATE_CONNECTED;
+    }
+
+    return ret;
+}
+
+/**
+ * Complete a connection started with 'cmsg_client_connect_start'.
+ *
+ * @param client - The client being connected.
+ *
+ * @returns 0 if connected, -EINPROGRESS if the connection is still in progress,
+ *          or another negative integer if the connection failed.
+ */
+int32_t
+cmsg_client_connect_finish (cmsg_client *client)
+{
+    int32_t ret;
+
+    CMSG_ASSERT_RETURN_VAL (client != NULL, CMSG_RET_ERR);
+
+    if (client->state != CMSG_CLIENT_STATE_CONNECTING)
+    {
+        return (client->state == CMSG_CLIENT_STATE_CONNECTED) ? CMSG_RET_OK : CMSG_RET_ERR;
+    }
+
+    ret = cmsg_transport_connect_finish (client->_transport);
+    if (ret == -EINPROGRESS)
+    {
+        return ret;
+    }
+
+    if (ret < 0)
+    {
+        CMSG_COUNTER_INC (client, cntr_connect_failures);
+        client->state = CMSG_CLIENT_STATE_FAILED;
+    }
+    else
+    {
+        client->state = CMSG_CLIENT_STATE_CONNECTED;
+    }
+
+    return ret;
+}
+
 /**
  * Configure send timeout for a cmsg client. This timeout will be applied immediately
  * to the client if it's already connected. Otherwise it will be applied when connected.
@@ -1063,6 +1156,32 @@ cmsg_client_invoke_send (cmsg_client *client, uint32_t method_index,
     return ret;
 }
 
+/**
+ * Send a packet that has already been created with 'cmsg_client_create_packet'
+ * for a method invoked on the client. This allows the same packet to be sent
+ * on many clients (i.e. the children of a composite client) without packing the
+ * message again for each of them. If encryption is enabled on the client the
+ * packet is encrypted as it is sent, the packet itself is not modified.
+ *
+ * @param client - The client to send the packet on.
+ * @param packet - The packet to send.
+ * @param packet_len - The length of the packet.
+ * @param method_name - The name of the method the packet was created for.
+ *
+ * @returns CMSG_RET_OK on success, related error code on failure.
+ */
+int32_t
+cmsg_client_invoke_send_packet (cmsg_client *client, uint8_t *packet, uint32_t packet_len,
+                                const char *method_name)
+{
+    // count every rpc call
+    CMSG_COUNTER_INC (client, cntr_rpc);
+
+    CMSG_DEBUG (CMSG_INFO, "[CLIENT] method: %s\n", method_name);
+
+    return cmsg_client_buffer_send_retry_once (client, packet, packet_len, method_name);
+}
+
 
 /**
  * Invoking like this will call the server invoke directly in the same
@@ -1087,7 +1206,8 @@ cmsg_client_get_socket (cmsg_client *client)
 
     CMSG_ASSERT_RETURN_VAL (client != NULL, -1);
 
-    if (client->state == CMSG_CLIENT_STATE_CONNECTED)
+    if (client->state == CMSG_CLIENT_STATE_CONNECTED ||
+        client->state == CMSG_CLIENT_STATE_CONNECTING)
     {
         sock = client->_transport->tport_funcs.get_socket (client->_transport);
     }
@@ -1758,6 +1878,57 @@ cmsg_create_client_tipc_broadcast (const ProtobufCServiceDescriptor *descriptor,
     return client;
 }
 
+/**
+ * Create a client that sends oneway messages to a UDP multicast group. Each message
+ * is sent to every member of the group with a single datagram.
+ *
+ * @param descriptor - The descriptor for the client.
+ * @param service_name - The service name in the /etc/services file to get
+ *                       the port number.
+ * @param group - The multicast group address to send to.
+ * @param interface - The address of the interface to send from.
+ *
+ * @returns Pointer to the client on success, NULL on failure.
+ */
+cmsg_client *
+cmsg_create_client_multicast (const ProtobufCServiceDescriptor *descriptor,
+                              const char *service_name, struct in_addr group,
+                              struct in_addr interface)
+{
+    cmsg_transport *transport;
+    cmsg_client *client;
+    uint16_t port;
+
+    CMSG_ASSERT_RETURN_VAL (descriptor != NULL, NULL);
+
+    port = cmsg_service_port_get (service_name, "udp");
+    if (port == 0)
+    {
+        CMSG_LOG_GEN_ERROR ("Unknown multicast service: %s", service_name);
+        return NULL;
+    }
+
+    transport = cmsg_transport_new (CMSG_TRANSPORT_ONEWAY_MULTICAST);
+    if (transport == NULL)
+    {
+        return NULL;
+    }
+
+    transport->config.socket.sockaddr.in.sin_addr = group;
+    transport->config.socket.sockaddr.in.sin_port = htons (port);
+    cmsg_transport_multicast_interface_set (transport, interface);
+
+    client = cmsg_client_new (transport, descriptor);
+    if (!client)
+    {
+        cmsg_transport_destroy (transport);
+        CMSG_LOG_GEN_ERROR ("[%s] Failed to create multicast client.", descriptor->name);
+        return NULL;
+    }
+
+    return client;
+}
+
 /**
  * Change the broadcast address for a TIPC broadcast client.
  *
@@ -1899,6 +2070,22 @@ cmsg_client_close_wrapper (cmsg_client *client)
     }
 }
 
+/**
+ * Close the connection of a client, for example when a reply was not received
+ * in time and the connection can no longer be relied upon. The client will
+ * reconnect the next time it is used.
+ *
+ * @param client - The client to close.
+ */
+void
+cmsg_client_close (cmsg_client *client)
+{
+    client->state = CMSG_CLIENT_STATE_CLOSED;
+    cmsg_client_close_wrapper (client);
+
+    CMSG_COUNTER_INC (client, cntr_recv_errors);
+}
+
 /**
  * Destroy a cmsg client and its transport
  *
@@ -2106,36 +2293,66 @@ cmsg_api_recv_ptr_null_check (cmsg_client *client, ProtobufCMessage **recv_msg,
     }
 }
 
+static void
+cmsg_client_results_message_free (ProtobufCMessage *msg, gpointer user_data)
+{
+    CMSG_FREE_RECV_MSG (msg);
+}
+
 /**
  * Helper function to set or free received response data for an API
  * @param closure_data received response
+ * @param messages the caller's set of responses (NULL if the caller uses an array)
  * @param recv_msg Message to update with responses (if a response is expected)
  * @returns CMSG API return code.
  */
 static int
 cmsg_api_process_closure_data (cmsg_client_closure_data *closure_data,
-                               ProtobufCMessage **recv_msg)
+                               GPtrArray *messages, ProtobufCMessage **recv_msg)
 {
-    int i = 0;
+    ProtobufCMessage *msg;
+    guint i;
+    int j = 0;
 
-    /* sanity check our returned message pointer */
-    while (closure_data[i].message != NULL)
+    if (closure_data->messages && closure_data->messages != messages)
     {
-        ProtobufCMessage *msg = (ProtobufCMessage *) closure_data[i].message;
+        /* The responses from a composite client have to be copied to the array of
+         * the caller, which only has room for a limited number of them */
+        for (i = 0; i < closure_data->messages->len; i++)
+        {
+            msg = (ProtobufCMessage *) g_ptr_array_index (closure_data->messages, i);
+            if (msg->descriptor->n_fields > 0 && j < CMSG_MAX_CLIENTS)
+            {
+                recv_msg[j++] = msg;
+            }
+            else
+            {
+                if (msg->descriptor->n_fields > 0)
+                {
+                    CMSG_LOG_GEN_ERROR ("Dropped response, more than %d responses received",
+                                        CMSG_MAX_CLIENTS);
+                }
+                CMSG_FREE_RECV_MSG (msg);
+            }
+        }
+        g_ptr_array_free (closure_data->messages, TRUE);
+    }
+    else if (closure_data->message != NULL)
+    {
+        msg = (ProtobufCMessage *) closure_data->message;
         if (msg->descriptor->n_fields > 0)
         {
             /* Update developer output msg to point to received message from invoke */
-            recv_msg[i] = msg;
+            recv_msg[0] = msg;
         }
         else
         {
             /* Free the received message since the caller does not expect to receive it */
             CMSG_FREE_RECV_MSG (msg);
         }
-        i++;
     }
 
-    return closure_data[0].retval;
+    return closure_data->retval;
 }
 
 
@@ -2202,22 +2419,22 @@ cmsg_supported_service_check (const service_support_parameters *check_params,
  * @param recv_msg array pointer to hold message responses
  * @returns API return code
  */
-int
-cmsg_api_invoke (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
-                 int method_index, const ProtobufCMessage *send_msg,
-                 ProtobufCMessage **recv_msg)
-#ifdef HAVE_UNITTEST
-{
-    /* This allows mock function for cmsg_api_invoke to still call the real code
-     * in some cases (if only certain APIs should be mocked and not others) */
-    return cmsg_api_invoke_real (client, cmsg_desc, method_index, send_msg, recv_msg);
-}
-
-int
-cmsg_api_invoke_real (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
-                      int method_index, const ProtobufCMessage *send_msg,
-                      ProtobufCMessage **recv_msg)
-#endif /*HAVE_UNITTEST */
+/**
+ * Invoke a method on a client and receive the responses.
+ *
+ * @param client - The client to invoke the method on.
+ * @param cmsg_desc - The API descriptor of the service.
+ * @param method_index - The index of the method to invoke.
+ * @param send_msg - The message to send.
+ * @param recv_msg - Array to store the responses in (if a response is expected).
+ * @param messages - Set to store the responses from a composite client in, or NULL
+ *                   to store them in 'recv_msg'.
+ * @returns CMSG API return code.
+ */
+static int
+_cmsg_api_invoke (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
+                  int method_index, const ProtobufCMessage *send_msg,
+                  ProtobufCMessage **recv_msg, GPtrArray *messages)
 {
     ProtobufCService *service = (ProtobufCService *) client;
     const ProtobufCServiceDescriptor *service_desc = cmsg_desc->service_desc;
@@ -2265,13 +2482,142 @@ cmsg_api_invoke_real (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
             send_msg = dummy;
         }
     }
-    cmsg_client_closure_data closure_data[CMSG_RECV_ARRAY_SIZE] =
-        { { NULL, NULL, CMSG_RET_ERR } };
+    cmsg_client_closure_data closure_data = { NULL, NULL, CMSG_RET_ERR, messages };
     /* Send! */
     service->invoke (service, method_index, send_msg, NULL, &closure_data);
     CMSG_FREE (dummy);
 
-    return cmsg_api_process_closure_data (closure_data, recv_msg);
+    return cmsg_api_process_closure_data (&closure_data, messages, recv_msg);
+}
+
+int
+cmsg_api_invoke (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
+                 int method_index, const ProtobufCMessage *send_msg,
+                 ProtobufCMessage **recv_msg)
+#ifdef HAVE_UNITTEST
+{
+    /* This allows mock function for cmsg_api_invoke to still call the real code
+     * in some cases (if only certain APIs should be mocked and not others) */
+    return cmsg_api_invoke_real (client, cmsg_desc, method_index, send_msg, recv_msg);
+}
+
+int
+cmsg_api_invoke_real (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
+                      int method_index, const ProtobufCMessage *send_msg,
+                      ProtobufCMessage **recv_msg)
+#endif /*HAVE_UNITTEST */
+{
+    return _cmsg_api_invoke (client, cmsg_desc, method_index, send_msg, recv_msg, NULL);
+}
+
+/**
+ * Invoke a method on a client and receive all of the responses into a set of
+ * responses. Unlike 'cmsg_api_invoke' there is no limit on the number of responses,
+ * which allows a composite client to have any number of children. The responses
+ * from a composite client are stored as they are received, without being copied.
+ *
+ * @param client - The client to invoke the method on.
+ * @param cmsg_desc - The API descriptor of the service.
+ * @param method_index - The index of the method to invoke.
+ * @param send_msg - The message to send.
+ * @param results - Pointer to store the set of responses. This must be freed with
+ *                  'cmsg_client_results_free', even if an error is returned.
+ * @returns CMSG API return code.
+ */
+int
+cmsg_api_invoke_results (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
+                         int method_index, const ProtobufCMessage *send_msg,
+                         cmsg_client_results **results)
+{
+    ProtobufCMessage *recv_msg = NULL;
+    GPtrArray *messages;
+    int ret;
+
+    messages = g_ptr_array_new ();
+
+    ret = _cmsg_api_invoke (client, cmsg_desc, method_index, send_msg, &recv_msg,
+                            messages);
+    if (recv_msg)
+    {
+        g_ptr_array_add (messages, recv_msg);
+    }
+
+    *results = (cmsg_client_results *) CMSG_CALLOC (1, sizeof (cmsg_client_results));
+    if (!*results)
+    {
+        g_ptr_array_foreach (messages, (GFunc) cmsg_client_results_message_free, NULL);
+        g_ptr_array_free (messages, TRUE);
+        return CMSG_RET_ERR;
+    }
+    (*results)->messages = messages;
+
+    return ret;
+}
+
+/**
+ * Get the number of responses in a set of responses.
+ *
+ * @param results - The set of responses.
+ * @returns The number of responses.
+ */
+guint
+cmsg_client_results_count (const cmsg_client_results *results)
+{
+    return results ? results->messages->len : 0;
+}
+
+/**
+ * Initialise an iterator over a set of responses.
+ *
+ * @param iter - The iterator to initialise.
+ * @param results - The set of responses to iterate over.
+ */
+void
+cmsg_client_results_iter_init (cmsg_client_results_iter *iter,
+                               const cmsg_client_results *results)
+{
+    iter->results = results;
+    iter->index = 0;
+}
+
+/**
+ * Get the next response from an iterator over a set of responses.
+ *
+ * @param iter - The iterator.
+ * @param message - Pointer to store the next response. The response remains owned
+ *                  by the set of responses.
+ * @returns true if there was another response, false otherwise.
+ */
+bool
+cmsg_client_results_iter_next (cmsg_client_results_iter *iter, ProtobufCMessage **message)
+{
+    if (!iter->results || iter->index >= iter->results->messages->len)
+    {
+        return false;
+    }
+
+    *message = (ProtobufCMessage *) g_ptr_array_index (iter->results->messages,
+                                                       iter->index);
+    iter->index++;
+
+    return true;
+}
+
+/**
+ * Free a set of responses, including all of the responses in it.
+ *
+ * @param results - The set of responses to free.
+ */
+void
+cmsg_client_results_free (cmsg_client_results *results)
+{
+    if (results)
+    {
+        g_ptr_array_foreach (results->messages, (GFunc) cmsg_client_results_message_free,
+                             NULL);
+        g_ptr_array_free (results->messages, TRUE);
+        CMSG_FREE (results);
+    }
 }
 
 /**
@@ -13,5 +13,10 @@ cmsg_client *cmsg_client_create (cmsg_transport *transport,
                                  const ProtobufCServiceDescriptor *descriptor);
 int32_t cmsg_client_send_bytes (cmsg_client *client, uint8_t *buffer, uint32_t buffer_len,
                                 const char *method_name);
+void cmsg_client_close (cmsg_client *client);
+int32_t cmsg_client_connect_start (cmsg_client *client);
+int32_t cmsg_client_connect_finish (cmsg_client *client);
+int32_t cmsg_client_invoke_send_packet (cmsg_client *client, uint8_t *packet,
+                                        uint32_t packet_len, const char *method_name);
 
 #endif /* __CMSG_CLIENT_PRIVATE_H_ */
@@ -48,83 +48,906 @@ do                                                                   \
     }                                                                \
 } while (0)
 
+/**
+ * Create a snapshot of the current children of a composite client.
+ *
+ * Note - Assumes the 'child_mutex' mutex is held.
+ *
+ * @param composite_client - The composite client to create the snapshot for.
+ * @param generation - The generation of the snapshot.
+ *
+ * @returns The snapshot, holding a single reference for the composite client.
+ */
+static cmsg_composite_client_snapshot *
+cmsg_composite_client_snapshot_new (cmsg_composite_client *composite_client,
+                                    uint32_t generation)
+{
+    cmsg_composite_client_snapshot *snapshot;
+    GList *l;
+
+    snapshot = g_new0 (cmsg_composite_client_snapshot, 1);
+    snapshot->ref_count = 1;
+    snapshot->generation = generation;
+    snapshot->composite_client = composite_client;
+    snapshot->children = g_ptr_array_new ();
+
+    for (l = composite_client->child_clients; l != NULL; l = l->next)
+    {
+        g_ptr_array_add (snapshot->children, l->data);
+    }
+
+    return snapshot;
+}
+
+/**
+ * Release a reference to a snapshot of the children of a composite client. Once
+ * the last reference is released the children that were removed when the snapshot
+ * was replaced are destroyed, as no invoke can be using them any longer.
+ *
+ * Note - Must not be called with the 'child_mutex' mutex held.
+ *
+ * @param snapshot - The snapshot to release.
+ */
+void
+cmsg_composite_client_snapshot_unref (cmsg_composite_client_snapshot *snapshot)
+{
+    cmsg_composite_client_snapshot *next;
+    cmsg_composite_client *composite_client;
+
+    while (snapshot && g_atomic_int_dec_and_test (&snapshot->ref_count))
+    {
+        next = snapshot->next;
+        composite_client = snapshot->composite_client;
+
+        g_list_free_full (snapshot->retired,
+                          (GDestroyNotify) cmsg_destroy_client_and_transport);
+
+        pthread_mutex_lock (&composite_client->child_mutex);
+        composite_client->released_generation = snapshot->generation;
+        pthread_cond_broadcast (&composite_client->snapshot_cond);
+        pthread_mutex_unlock (&composite_client->child_mutex);
+
+        g_ptr_array_free (snapshot->children, TRUE);
+        g_free (snapshot);
+
+        snapshot = next;
+    }
+}
+
+/**
+ * Replace the snapshot of the children of a composite client after the children
+ * have changed.
+ *
+ * Note - Assumes the 'child_mutex' mutex is held.
+ *
+ * @param composite_client - The composite client whose children have changed.
+ * @param retired - List of children to destroy once the replaced snapshot is released.
+ *
+ * @returns The replaced snapshot. The caller must release it with
+ *          'cmsg_composite_client_snapshot_unref' once 'child_mutex' is released.
+ */
+static cmsg_composite_client_snapshot *
+cmsg_composite_client_snapshot_update (cmsg_composite_client *composite_client,
+                                       GList *retired)
+{
+    cmsg_composite_client_snapshot *old = composite_client->snapshot;
+
+    composite_client->snapshot =
+        cmsg_composite_client_snapshot_new (composite_client, old->generation + 1);
+
+    old->retired = retired;
+    old->next = composite_client->snapshot;
+    g_atomic_int_inc (&old->next->ref_count);
+
+    return old;
+}
+
+/**
+ * Get a reference to the current snapshot of the children of a composite client.
+ *
+ * @param composite_client - The composite client.
+ *
+ * @returns The snapshot. This must be released with
+ *          'cmsg_composite_client_snapshot_unref'.
+ */
+cmsg_composite_client_snapshot *
+cmsg_composite_client_snapshot_get (cmsg_composite_client *composite_client)
+{
+    cmsg_composite_client_snapshot *snapshot;
+
+    pthread_mutex_lock (&composite_client->child_mutex);
+    snapshot = composite_client->snapshot;
+    g_atomic_int_inc (&snapshot->ref_count);
+    pthread_mutex_unlock (&composite_client->child_mutex);
+
+    return snapshot;
+}
+
+/**
+ * Whether a child client can be found by its transport, i.e. whether
+ * 'cmsg_transport_compare' can match the transport of the child.
+ *
+ * @param child - The child client.
+ *
+ * @returns true if the child can be indexed by its transport, false otherwise.
+ */
+static bool
+cmsg_composite_client_child_indexable (cmsg_client *child)
+{
+    switch (child->_transport->type)
+    {
+    case CMSG_TRANSPORT_RPC_TCP:
+    case CMSG_TRANSPORT_ONEWAY_TCP:
+    case CMSG_TRANSPORT_RPC_UNIX:
+    case CMSG_TRANSPORT_ONEWAY_UNIX:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Add a child client to the transport index of a composite client.
+ *
+ * Note - Assumes the 'child_mutex' mutex is held.
+ *
+ * @param composite_client - The composite client.
+ * @param link - The link of the child in the 'child_clients' list.
+ */
+static void
+cmsg_composite_client_index_add (cmsg_composite_client *composite_client, GList *link)
+{
+    cmsg_client *child = (cmsg_client *) link->data;
+
+    if (!cmsg_composite_client_child_indexable (child))
+    {
+        return;
+    }
+
+    if (g_hash_table_contains (composite_client->child_index, child->_transport))
+    {
+        composite_client->unindexed_children++;
+        return;
+    }
+
+    g_hash_table_insert (composite_client->child_index, child->_transport, link);
+}
+
+/**
+ * Index the first child client that has the given transport but is not indexed,
+ * after the indexed child with that transport has been removed.
+ *
+ * Note - Assumes the 'child_mutex' mutex is held.
+ *
+ * @param composite_client - The composite client.
+ * @param transport - The transport of the removed child.
+ */
+static void
+cmsg_composite_client_index_replace (cmsg_composite_client *composite_client,
+                                     const cmsg_transport *transport)
+{
+    GList *l;
+    cmsg_client *child;
+
+    for (l = composite_client->child_clients; l != NULL; l = l->next)
+    {
+        child = (cmsg_client *) l->data;
+        if (cmsg_transport_compare (child->_transport, transport))
+        {
+            g_hash_table_insert (composite_client->child_index, child->_transport, l);
+            composite_client->unindexed_children--;
+            return;
+        }
+    }
+}
+
+/**
+ * Remove a child client from the children of a composite client.
+ *
+ * Note - Assumes the 'child_mutex' mutex is held.
+ *
+ * @param composite_client - The composite client.
+ * @param client - The child client to remove.
+ *
+ * @returns true if the child was removed, false if it is not a child of the
+ *          composite client.
+ */
+static bool
+cmsg_composite_client_remove_child (cmsg_composite_client *composite_client,
+                                    cmsg_client *client)
+{
+    GList *link = NULL;
+    bool indexed = false;
+
+    if (cmsg_composite_client_child_indexable (client))
+    {
+        link = g_hash_table_lookup (composite_client->child_index, client->_transport);
+        indexed = (link && link->data == client);
+    }
+
+    if (indexed)
+    {
+        g_hash_table_remove (composite_client->child_index, client->_transport);
+    }
+    else
+    {
+        link = g_list_find (composite_client->child_clients, client);
+        if (!link)
+        {
+            return false;
+        }
+        if (cmsg_composite_client_child_indexable (client))
+        {
+            composite_client->unindexed_children--;
+        }
+    }
+
+    composite_client->child_clients = g_list_delete_link (composite_client->child_clients,
+                                                          link);
+
+    if (indexed && composite_client->unindexed_children > 0)
+    {
+        cmsg_composite_client_index_replace (composite_client, client->_transport);
+    }
+
+    return true;
+}
+
+/**
+ * Record that invoking a method on a child client of a composite client failed.
+ * The error is reported to the application if it has registered for errors.
+ *
+ * @param composite_client - The composite client the child belongs to.
+ * @param child - The child client that failed.
+ * @param method_name - The name of the method being invoked.
+ * @param ret - The error the child failed with.
+ * @param overall_result - Pointer to the overall result of the invoke.
+ */
+static void
+cmsg_composite_client_child_error (cmsg_composite_client *composite_client,
+                                   cmsg_client *child, const char *method_name,
+                                   int32_t ret, int *overall_result)
+{
+    /* Don't let any other error overwrite a previous CMSG_RET_ERR */
+    if (*overall_result != CMSG_RET_ERR)
+    {
+        *overall_result = ret;
+    }
+
+    if (composite_client->error_func)
+    {
+        composite_client->error_func (&composite_client->base_client, child, method_name,
+                                      ret);
+    }
+}
+
+/**
+ * Whether a child client of a composite client is a remote child that is not
+ * connected.
+ *
+ * @param child - The child client.
+ *
+ * @returns true if the child is not connected, false otherwise.
+ */
+static bool
+cmsg_composite_client_child_unconnected (cmsg_client *child)
+{
+    return (child->_transport->type != CMSG_TRANSPORT_LOOPBACK &&
+            child->state != CMSG_CLIENT_STATE_CONNECTED);
+}
+
+/**
+ * Send a message on a child client of a composite client. Children that send using
+ * the standard client path are sent a packet that is shared between all of the
+ * children, so that the message is only packed once for the whole composite client.
+ * The packet is created when it is first needed. Other children (i.e. loopback
+ * clients) are invoked with the message as normal.
+ *
+ * @param composite_client - The composite client the child belongs to.
+ * @param child - The child client to send on.
+ * @param method_index - The index of the method being invoked.
+ * @param input - The message to send.
+ * @param packet - Pointer to the shared packet, NULL if it has not been created yet.
+ * @param packet_len - Pointer to the length of the shared packet.
+ *
+ * @returns CMSG_RET_OK on success, related error code on failure.
+ */
+static int32_t
+cmsg_composite_client_child_send (cmsg_composite_client *composite_client,
+                                  cmsg_client *child, uint32_t method_index,
+                                  const ProtobufCMessage *input, uint8_t **packet,
+                                  uint32_t *packet_len)
+{
+    ProtobufCService *service = (ProtobufCService *) composite_client;
+    const char *method_name = service->descriptor->methods[method_index].name;
+    int32_t ret;
+
+    if (child->invoke_send != cmsg_client_invoke_send)
+    {
+        return child->invoke_send (child, method_index, input);
+    }
+
+    /* The child has just failed to connect, don't wait for it to fail again */
+    if (child->state == CMSG_CLIENT_STATE_FAILED)
+    {
+        return CMSG_RET_CLOSED;
+    }
+
+    if (*packet == NULL)
+    {
+        ret = cmsg_client_create_packet (&composite_client->base_client, method_name,
+                                         input, packet, packet_len);
+        if (ret != CMSG_RET_OK)
+        {
+            return ret;
+        }
+    }
+
+    return cmsg_client_invoke_send_packet (child, *packet, *packet_len, method_name);
+}
+
+/**
+ * Receive the reply from a child client of a composite client. The reply is added
+ * to the replies of the composite client as it is received.
+ *
+ * @param composite_client - The composite client the child belongs to.
+ * @param child - The child client to receive the reply from.
+ * @param method_index - The index of the method being invoked.
+ * @param closure - The closure to receive the reply with.
+ * @param closure_data - The closure data of the composite client.
+ * @param overall_result - Pointer to the overall result of the invoke.
+ *
+ * @returns true if the reply was received successfully, false otherwise.
+ */
+static bool
+cmsg_composite_client_child_recv (cmsg_composite_client *composite_client,
+                                  cmsg_client *child, uint32_t method_index,
+                                  ProtobufCClosure closure,
+                                  cmsg_client_closure_data *closure_data,
+                                  int *overall_result)
+{
+    ProtobufCService *service = (ProtobufCService *) composite_client;
+    const char *method_name = service->descriptor->methods[method_index].name;
+    cmsg_client_closure_data child_data = { NULL, NULL, CMSG_RET_ERR, NULL };
+    int32_t ret;
+
+    ret = child->invoke_recv (child, method_index, closure, &child_data);
+    if (ret != CMSG_RET_OK)
+    {
+        cmsg_composite_client_child_error (composite_client, child, method_name, ret,
+                                           overall_result);
+        return false;
+    }
+
+    if (child_data.message)
+    {
+        if (!closure_data->messages)
+        {
+            closure_data->messages = g_ptr_array_new ();
+        }
+        g_ptr_array_add (closure_data->messages, child_data.message);
+    }
+
+    return true;
+}
+
+/**
+ * Get the number of milliseconds that have passed since the given time.
+ */
+static int64_t
+cmsg_composite_client_elapsed_ms (const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    return ((int64_t) (now.tv_sec - start->tv_sec) * 1000 +
+            (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+/**
+ * Give up on a child client of a composite client that has not connected before
+ * its connect timeout expired.
+ *
+ * @param child - The child client.
+ */
+static void
+cmsg_composite_client_child_connect_failed (cmsg_client *child)
+{
+    CMSG_LOG_CLIENT_ERROR (child, "Failed to connect to server within %u seconds.",
+                           child->_transport->connect_timeout);
+    child->_transport->tport_funcs.socket_close (child->_transport);
+    child->state = CMSG_CLIENT_STATE_FAILED;
+    CMSG_COUNTER_INC (child, cntr_connect_failures);
+}
+
+/**
+ * Connect the children of a composite client that are not already connected.
+ * The children are connected in parallel without blocking, by starting each
+ * connection and then polling the sockets of all of the connecting children
+ * together. Unreachable children therefore only delay the caller by a single
+ * connect timeout, rather than a connect timeout each. A child that doesn't
+ * connect before its own connect timeout expires is left failed.
+ *
+ * Note - Assumes the 'invoke_mutex' of every child is held.
+ *
+ * @param children - The children to connect.
+ */
+void
+cmsg_composite_client_connect_children (GPtrArray *children)
+{
+    struct pollfd *pfds;
+    cmsg_client **pending;
+    int64_t *deadlines;
+    struct timespec start;
+    int64_t elapsed;
+    int64_t poll_timeout;
+    int num_pending = 0;
+    cmsg_client *child;
+    guint i;
+    int ret;
+    int j;
+    int k;
+
+    pfds = g_new0 (struct pollfd, children->len);
+    pending = g_new0 (cmsg_client *, children->len);
+    deadlines = g_new0 (int64_t, children->len);
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < children->len; i++)
+    {
+        child = (cmsg_client *) g_ptr_array_index (children, i);
+        if (!cmsg_composite_client_child_unconnected (child))
+        {
+            continue;
+        }
+
+        if (cmsg_client_connect_start (child) == -EINPROGRESS)
+        {
+            pending[num_pending] = child;
+            deadlines[num_pending] = (int64_t) child->_transport->connect_timeout * 1000;
+            num_pending++;
+        }
+    }
+
+    while (num_pending > 0)
+    {
+        elapsed = cmsg_composite_client_elapsed_ms (&start);
+        poll_timeout = -1;
+
+        for (j = 0, k = 0; j < num_pending; j++)
+        {
+            child = pending[j];
+            if (deadlines[j] <= elapsed)
+            {
+                cmsg_composite_client_child_connect_failed (child);
+                continue;
+            }
+
+            if (poll_timeout == -1 || deadlines[j] - elapsed < poll_timeout)
+            {
+                poll_timeout = deadlines[j] - elapsed;
+            }
+            pending[k] = child;
+            deadlines[k] = deadlines[j];
+            pfds[k].fd = child->_transport->socket;
+            pfds[k].events = POLLOUT;
+            pfds[k].revents = 0;
+            k++;
+        }
+        num_pending = k;
+
+        if (num_pending == 0)
+        {
+            break;
+        }
+
+        ret = poll (pfds, num_pending, poll_timeout);
+        if (ret < 0 && errno != EINTR)
+        {
+            /* Fall back to checking each child in turn */
+            for (j = 0; j < num_pending; j++)
+            {
+                pfds[j].revents = POLLOUT;
+            }
+        }
+        else if (ret <= 0)
+        {
+            continue;
+        }
+
+        /* Keep the children that are still connecting */
+        for (j = 0, k = 0; j < num_pending; j++)
+        {
+            if (pfds[j].revents == 0 ||
+                cmsg_client_connect_finish (pending[j]) == -EINPROGRESS)
+            {
+                pending[k] = pending[j];
+                deadlines[k] = deadlines[j];
+                k++;
+            }
+        }
+        num_pending = k;
+    }
+
+    g_free (deadlines);
+    g_free (pending);
+    g_free (pfds);
+}
+
+/**
+ * Get the number of milliseconds to wait for the reply from a child client of a
+ * composite client (the timeout of the composite client if set, otherwise the
+ * receive timeout of the child).
+ */
+static int64_t
+cmsg_composite_client_recv_timeout_ms (cmsg_composite_client *composite_client,
+                                       cmsg_client *child)
+{
+    return (int64_t) (composite_client->invoke_timeout ?
+                      composite_client->invoke_timeout :
+                      child->_transport->receive_peek_timeout) * 1000;
+}
+
+/**
+ * Receive the replies from the children of a composite client that a message was
+ * successfully sent to. Rather than waiting for each child in turn, the sockets of
+ * all of the children are polled together and each reply is read as it arrives.
+ * A child that doesn't reply before its deadline (the timeout of the composite
+ * client if set, otherwise the receive timeout of the child) has its connection
+ * closed, as any later reply would be read as the reply to the next invoke.
+ *
+ * The children that are still connecting are polled in the same way. Each is sent
+ * the message once it connects and its reply is then waited for, while a child
+ * that doesn't connect before its connect timeout expires is failed.
+ *
+ * If a quorum is given then receiving stops as soon as that many children have
+ * replied successfully. The remaining children have their connection closed for
+ * the same reason, without being reported as having failed.
+ *
+ * Note - Assumes the 'invoke_mutex' of every child is held.
+ *
+ * @param composite_client - The composite client the children belong to.
+ * @param recv_clients - The children to receive replies from.
+ * @param connecting - The children to send the message to once they connect.
+ * @param quorum - The number of successful replies to stop after, or 0 for all.
+ * @param method_index - The index of the method being invoked.
+ * @param input - The message to send to the connecting children.
+ * @param packet - Pointer to the shared packet, NULL if it has not been created yet.
+ * @param packet_len - Pointer to the length of the shared packet.
+ * @param closure - The closure to receive the replies with.
+ * @param closure_data - The closure data of the composite client.
+ * @param overall_result - Pointer to the overall result of the invoke.
+ */
+static void
+cmsg_composite_client_recv_all (cmsg_composite_client *composite_client,
+                                GPtrArray *recv_clients, GPtrArray *connecting,
+                                uint32_t quorum, uint32_t method_index,
+                                const ProtobufCMessage *input, uint8_t **packet,
+                                uint32_t *packet_len, ProtobufCClosure closure,
+                                cmsg_client_closure_data *closure_data,
+                                int *overall_result)
+{
+    ProtobufCService *service = (ProtobufCService *) composite_client;
+    const char *method_name = service->descriptor->methods[method_index].name;
+    guint max_pending = recv_clients->len + connecting->len;
+    struct pollfd *pfds;
+    cmsg_client **pending;
+    int64_t *deadlines;
+    bool *connect_pending;
+    struct timespec start;
+    int64_t elapsed;
+    int64_t poll_timeout;
+    int num_pending = 0;
+    uint32_t num_replies = 0;
+    cmsg_client *child;
+    int ret;
+    int j;
+    int k;
+
+    pfds = g_new0 (struct pollfd, max_pending);
+    pending = g_new0 (cmsg_client *, max_pending);
+    deadlines = g_new0 (int64_t, max_pending);
+    connect_pending = g_new0 (bool, max_pending);
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    for (j = 0; j < (int) recv_clients->len; j++)
+    {
+        child = (cmsg_client *) g_ptr_array_index (recv_clients, j);
+
+        /* Loopback children have already been invoked and have their reply ready */
+        if (child->_transport->type == CMSG_TRANSPORT_LOOPBACK)
+        {
+            if (cmsg_composite_client_child_recv (composite_client, child, method_index,
+                                                  closure, closure_data, overall_result))
+            {
+                num_replies++;
+            }
+            continue;
+        }
+
+        pending[num_pending] = child;
+        deadlines[num_pending] = cmsg_composite_client_recv_timeout_ms (composite_client,
+                                                                        child);
+        num_pending++;
+    }
+
+    for (j = 0; j < (int) connecting->len; j++)
+    {
+        child = (cmsg_client *) g_ptr_array_index (connecting, j);
+        pending[num_pending] = child;
+        deadlines[num_pending] = (int64_t) child->_transport->connect_timeout * 1000;
+        connect_pending[num_pending] = true;
+        num_pending++;
+    }
+
+    while (num_pending > 0 && (quorum == 0 || num_replies < quorum))
+    {
+        elapsed = cmsg_composite_client_elapsed_ms (&start);
+        poll_timeout = -1;
+
+        /* Give up on the children that have passed their deadline */
+        for (j = 0, k = 0; j < num_pending; j++)
+        {
+            child = pending[j];
+            if (deadlines[j] <= elapsed)
+            {
+                if (connect_pending[j])
+                {
+                    cmsg_composite_client_child_connect_failed (child);
+                }
+                else
+                {
+                    CMSG_LOG_CLIENT_ERROR (child, "No response from server. (method: %s)",
+                                           method_name);
+                    cmsg_client_close (child);
+                }
+                cmsg_composite_client_child_error (composite_client, child, method_name,
+                                                   CMSG_RET_CLOSED, overall_result);
+                continue;
+            }
+
+            if (poll_timeout == -1 || deadlines[j] - elapsed < poll_timeout)
+            {
+                poll_timeout = deadlines[j] - elapsed;
+            }
+            pending[k] = child;
+            deadlines[k] = deadlines[j];
+            connect_pending[k] = connect_pending[j];
+            pfds[k].fd = child->_transport->socket;
+            pfds[k].events = connect_pending[k] ? POLLOUT : POLLIN;
+            pfds[k].revents = 0;
+            k++;
+        }
+        num_pending = k;
+
+        if (num_pending == 0)
+        {
+            break;
+        }
+
+        ret = poll (pfds, num_pending, poll_timeout);
+        if (ret < 0 && errno != EINTR)
+        {
+            /* Fall back to checking each child in turn */
+            for (j = 0; j < num_pending; j++)
+            {
+                pfds[j].revents = pfds[j].events;
+            }
+        }
+        else if (ret <= 0)
+        {
+            continue;
+        }
+
+        /* Receive the replies that have arrived (or the errors that occurred), and
+         * send to the children that have connected */
+        for (j = 0, k = 0; j < num_pending; j++)
+        {
+            child = pending[j];
+            if (pfds[j].revents == 0 || (quorum != 0 && num_replies >= quorum))
+            {
+                pending[k] = child;
+                deadlines[k] = deadlines[j];
+                connect_pending[k] = connect_pending[j];
+                k++;
+                continue;
+            }
+
+            if (!connect_pending[j])
+            {
+                if (cmsg_composite_client_child_recv (composite_client, child,
+                                                      method_index, closure,
+                                                      closure_data, overall_result))
+                {
+                    num_replies++;
+                }
+                continue;
+            }
+
+            ret = cmsg_client_connect_finish (child);
+            if (ret == -EINPROGRESS)
+            {
+                pending[k] = child;
+                deadlines[k] = deadlines[j];
+                connect_pending[k] = true;
+                k++;
+                continue;
+            }
+
+            if (ret == CMSG_RET_OK)
+            {
+                ret = cmsg_composite_client_child_send (composite_client, child,
+                                                        method_index, input, packet,
+                                                        packet_len);
+            }
+            else
+            {
+                ret = CMSG_RET_CLOSED;
+            }
+
+            if (ret != CMSG_RET_OK)
+            {
+                cmsg_composite_client_child_error (composite_client, child, method_name,
+                                                   ret, overall_result);
+            }
+            else if (child->invoke_recv)
+            {
+                /* The reply is waited for from when the message was sent */
+                pending[k] = child;
+                deadlines[k] = (cmsg_composite_client_elapsed_ms (&start) +
+                                cmsg_composite_client_recv_timeout_ms (composite_client,
+                                                                       child));
+                connect_pending[k] = false;
+                k++;
+            }
+        }
+        num_pending = k;
+    }
+
+    if (quorum != 0 && num_replies >= quorum)
+    {
+        /* The replies that are still to come are no longer needed */
+        for (j = 0; j < num_pending; j++)
+        {
+            cmsg_client_close (pending[j]);
+        }
+        *overall_result = CMSG_RET_OK;
+    }
+
+    g_free (connect_pending);
+    g_free (deadlines);
+    g_free (pending);
+    g_free (pfds);
+}
+
 /**
  * Send message to a group of clients. If any one message fails, an error is returned.
  * The caller must free any received data, which there may be some of even if an error
- * is returned, as the call may have work on one or more of the other clients.
+ * is returned, as the call may have work on one or more of the other clients. The
+ * children that failed are reported to the error function of the composite client
+ * if one is set. The replies are added to the 'messages' of the closure data, which
+ * is created if the caller did not supply it.
+ *
+ * The message is packed once and the resulting packet is sent to each child. The
+ * replies from the children are then received in parallel, so the invoke takes as
+ * long as the slowest child rather than the sum of the time taken by each child.
+ * Children that are not connected are connected without blocking and sent to as
+ * they connect, alongside receiving the replies from the other children.
+ * The invoke uses a snapshot of the children, so the children can be changed while
+ * the invoke is in progress. If the children are connected in the background then
+ * any children that are not connected are skipped rather than waited for. If a
+ * quorum is set the invoke returns once that many children have replied.
  */
 static void
 cmsg_composite_client_invoke (ProtobufCService *service, uint32_t method_index,
                               const ProtobufCMessage *input, ProtobufCClosure closure,
                               void *_closure_data)
 {
-    GList *l;
     cmsg_composite_client *composite_client = (cmsg_composite_client *) service;
+    const char *method_name = service->descriptor->methods[method_index].name;
+    cmsg_composite_client_snapshot *snapshot;
+    bool skip_unconnected = composite_client->skip_unconnected;
+    uint32_t quorum;
     cmsg_client *child;
-    int i = 0;
+    guint i;
     int ret;
-    GQueue *invoke_recv_clients;
+    GPtrArray *children;
+    GPtrArray *recv_clients;
+    GPtrArray *connecting;
     int overall_result = CMSG_RET_OK;
+    uint8_t *packet = NULL;
+    uint32_t packet_len = 0;
 
     cmsg_client_closure_data *closure_data = (cmsg_client_closure_data *) _closure_data;
 
-    if (composite_client->child_clients == NULL)
+    pthread_mutex_lock (&composite_client->child_mutex);
+    quorum = composite_client->quorum;
+    pthread_mutex_unlock (&composite_client->child_mutex);
+
+    snapshot = cmsg_composite_client_snapshot_get (composite_client);
+    if (snapshot->children->len == 0)
     {
+        cmsg_composite_client_snapshot_unref (snapshot);
         closure_data->retval = CMSG_RET_OK;
         return;
     }
 
-    invoke_recv_clients = g_queue_new ();
+    recv_clients = g_ptr_array_new ();
+    connecting = g_ptr_array_new ();
+    children = g_ptr_array_sized_new (snapshot->children->len);
 
-    pthread_mutex_lock (&composite_client->child_mutex);
-
-    for (l = composite_client->child_clients; l != NULL; l = l->next)
+    for (i = 0; i < snapshot->children->len; i++)
     {
-        child = (cmsg_client *) l->data;
-        pthread_mutex_lock (&child->invoke_mutex);
-
-        ret = child->invoke_send (child, method_index, input);
-        if (ret == CMSG_RET_OK)
+        child = (cmsg_client *) g_ptr_array_index (snapshot->children, i);
+        if (skip_unconnected && cmsg_composite_client_child_unconnected (child))
         {
-            g_queue_push_tail (invoke_recv_clients, child);
+            continue;
         }
-        else
+
+        pthread_mutex_lock (&child->invoke_mutex);
+
+        /* The child may have been closed while waiting for the lock */
+        if (skip_unconnected && cmsg_composite_client_child_unconnected (child))
         {
-            /* Don't let any other error overwrite a previous CMSG_RET_ERR */
-            if (overall_result != CMSG_RET_ERR)
-            {
-                overall_result = ret;
-            }
             pthread_mutex_unlock (&child->invoke_mutex);
+            continue;
         }
+
+        g_ptr_array_add (children, child);
     }
 
-    // For each message successfully sent, receive the reply
-    while ((child = g_queue_pop_head (invoke_recv_clients)) != NULL)
+    for (i = 0; i < children->len; i++)
     {
-        if (!child->invoke_recv)
+        child = (cmsg_client *) g_ptr_array_index (children, i);
+
+        /* A child that is slow to connect is sent to once it has connected */
+        if (cmsg_composite_client_child_unconnected (child) &&
+            cmsg_client_connect_start (child) == -EINPROGRESS)
         {
-            // invoke_recv is NULL so nothing to do here (e.g. ONEWAY_TCP transport type)
-            pthread_mutex_unlock (&child->invoke_mutex);
+            g_ptr_array_add (connecting, child);
             continue;
         }
 
-        ret = child->invoke_recv (child, method_index, closure, &closure_data[i]);
-        pthread_mutex_unlock (&child->invoke_mutex);
-
-        if (ret == CMSG_RET_OK)
+        ret = cmsg_composite_client_child_send (composite_client, child, method_index,
+                                                input, &packet, &packet_len);
+        if (ret != CMSG_RET_OK)
         {
-            i++;
+            cmsg_composite_client_child_error (composite_client, child, method_name, ret,
+                                               &overall_result);
         }
-        else
+        else if (child->invoke_recv)
         {
-            overall_result = ret;
+            /* invoke_recv is NULL for one-way transports, nothing to receive */
+            g_ptr_array_add (recv_clients, child);
         }
     }
 
-    pthread_mutex_unlock (&composite_client->child_mutex);
+    if (quorum == CMSG_COMPOSITE_CLIENT_QUORUM_MAJORITY)
+    {
+        quorum = children->len / 2 + 1;
+    }
 
-    g_queue_free (invoke_recv_clients);
+    // For each message successfully sent, receive the reply
+    cmsg_composite_client_recv_all (composite_client, recv_clients, connecting, quorum,
+                                    method_index, input, &packet, &packet_len, closure,
+                                    closure_data, &overall_result);
+
+    CMSG_FREE (packet);
+
+    for (i = 0; i < children->len; i++)
+    {
+        child = (cmsg_client *) g_ptr_array_index (children, i);
+        pthread_mutex_unlock (&child->invoke_mutex);
+    }
+
+    cmsg_composite_client_snapshot_unref (snapshot);
+
+    g_ptr_array_free (children, TRUE);
+    g_ptr_array_free (recv_clients, TRUE);
+    g_ptr_array_free (connecting, TRUE);
 
     closure_data->retval = overall_result;
 }
@@ -133,6 +956,7 @@ int32_t
 cmsg_composite_client_add_child (cmsg_client *_composite_client, cmsg_client *client)
 {
     cmsg_composite_client *composite_client = (cmsg_composite_client *) _composite_client;
+    cmsg_composite_client_snapshot *old;
 
     if (!composite_client || !client)
     {
@@ -156,19 +980,38 @@ cmsg_composite_client_add_child (cmsg_client *_composite_client, cmsg_client *cl
     {
         composite_client->child_clients = g_list_prepend (composite_client->child_clients,
                                                           client);
+        cmsg_composite_client_index_add (composite_client,
+                                         composite_client->child_clients);
     }
 
     client->parent.object = composite_client;
 
+    old = cmsg_composite_client_snapshot_update (composite_client, NULL);
+
     pthread_mutex_unlock (&composite_client->child_mutex);
 
+    cmsg_composite_client_snapshot_unref (old);
+
     return CMSG_RET_OK;
 }
 
+/**
+ * Remove a child client from a composite client. Once this returns no invoke on the
+ * composite client is using the child, so the child can be destroyed by the caller.
+ * This waits for any invoke in progress to complete, so a caller that is going to
+ * destroy the child should use 'cmsg_composite_client_delete_and_destroy_child'.
+ *
+ * @param _composite_client - The composite client to remove the child from.
+ * @param client - The child client to remove.
+ *
+ * @returns 0 on success, -1 on failure.
+ */
 int32_t
 cmsg_composite_client_delete_child (cmsg_client *_composite_client, cmsg_client *client)
 {
     cmsg_composite_client *composite_client = (cmsg_composite_client *) _composite_client;
+    cmsg_composite_client_snapshot *old;
+    uint32_t generation;
 
     if (!composite_client || !client)
     {
@@ -179,12 +1022,72 @@ cmsg_composite_client_delete_child (cmsg_client *_composite_client, cmsg_client
 
     pthread_mutex_lock (&composite_client->child_mutex);
 
-    composite_client->child_clients = g_list_remove (composite_client->child_clients,
-                                                     client);
+    if (cmsg_composite_client_remove_child (composite_client, client))
+    {
+        client->parent.object = NULL;
+    }
+
+    old = cmsg_composite_client_snapshot_update (composite_client, NULL);
+    generation = old->generation;
+
+    pthread_mutex_unlock (&composite_client->child_mutex);
+
+    cmsg_composite_client_snapshot_unref (old);
+
+    /* Wait for any invokes that may be using the child to complete */
+    pthread_mutex_lock (&composite_client->child_mutex);
+    while (composite_client->released_generation < generation)
+    {
+        pthread_cond_wait (&composite_client->snapshot_cond,
+                           &composite_client->child_mutex);
+    }
+    pthread_mutex_unlock (&composite_client->child_mutex);
+
+    return 0;
+}
+
+/**
+ * Remove a child client from a composite client and destroy the child (and its
+ * transport). Unlike 'cmsg_composite_client_delete_child' this doesn't wait for
+ * invokes that are using the child, instead the child is destroyed once the last
+ * of them completes.
+ *
+ * @param _composite_client - The composite client to remove the child from.
+ * @param client - The child client to remove and destroy.
+ *
+ * @returns 0 on success, -1 on failure.
+ */
+int32_t
+cmsg_composite_client_delete_and_destroy_child (cmsg_client *_composite_client,
+                                                cmsg_client *client)
+{
+    cmsg_composite_client *composite_client = (cmsg_composite_client *) _composite_client;
+    cmsg_composite_client_snapshot *old;
+
+    if (!composite_client || !client)
+    {
+        return -1;
+    }
+
+    CMSG_COMPOSITE_CLIENT_TYPE_CHECK (composite_client->base_client, -1);
+
+    pthread_mutex_lock (&composite_client->child_mutex);
+
+    if (!cmsg_composite_client_remove_child (composite_client, client))
+    {
+        pthread_mutex_unlock (&composite_client->child_mutex);
+        return -1;
+    }
+
     client->parent.object = NULL;
 
+    old = cmsg_composite_client_snapshot_update (composite_client,
+                                                 g_list_prepend (NULL, client));
+
     pthread_mutex_unlock (&composite_client->child_mutex);
 
+    cmsg_composite_client_snapshot_unref (old);
+
     return 0;
 }
 
@@ -193,11 +1096,17 @@ cmsg_composite_client_deinit (cmsg_composite_client *comp_client)
 {
     cmsg_client_deinit (&comp_client->base_client);
 
+    cmsg_composite_client_snapshot_unref (comp_client->snapshot);
+    comp_client->snapshot = NULL;
+
     if (comp_client->child_clients)
     {
         g_list_free (comp_client->child_clients);
     }
 
+    g_hash_table_destroy (comp_client->child_index);
+
+    pthread_cond_destroy (&comp_client->snapshot_cond);
     pthread_mutex_destroy (&comp_client->child_mutex);
 }
 
@@ -223,6 +1132,92 @@ cmsg_composite_client_destroy_full (cmsg_client *_composite_client)
     cmsg_composite_client_destroy (_composite_client);
 }
 
+/**
+ * Set how long the children of a composite client are given to reply when a
+ * method is invoked on the composite client. Any children that have not replied
+ * once the timeout expires are treated as having failed, while the replies from
+ * the other children are still returned.
+ *
+ * @param _composite_client - The composite client to set the timeout for.
+ * @param timeout - The timeout in seconds, or 0 to use the receive timeout
+ *                  of each child (the default).
+ *
+ * @returns CMSG_RET_OK on success, CMSG_RET_ERR on failure.
+ */
+int32_t
+cmsg_composite_client_set_timeout (cmsg_client *_composite_client, uint32_t timeout)
+{
+    cmsg_composite_client *composite_client = (cmsg_composite_client *) _composite_client;
+
+    if (!composite_client)
+    {
+        return CMSG_RET_ERR;
+    }
+
+    CMSG_COMPOSITE_CLIENT_TYPE_CHECK (composite_client->base_client, CMSG_RET_ERR);
+
+    pthread_mutex_lock (&composite_client->child_mutex);
+    composite_client->invoke_timeout = timeout;
+    pthread_mutex_unlock (&composite_client->child_mutex);
+
+    return CMSG_RET_OK;
+}
+
+/**
+ * Set how many of the children of a composite client must reply successfully
+ * before an invoke on the composite client returns. Once the quorum is reached
+ * the connections to the children that have not yet replied are closed, so the
+ * invoke is not held up by the slowest children. The invoke then succeeds even
+ * if other children failed (the failures are still reported to the error function).
+ *
+ * @param _composite_client - The composite client to set the quorum for.
+ * @param quorum - The number of successful replies to wait for, 1 to return with the
+ *                 first reply, CMSG_COMPOSITE_CLIENT_QUORUM_MAJORITY for a majority
+ *                 of the children invoked, or CMSG_COMPOSITE_CLIENT_QUORUM_ALL to
+ *                 wait for every child (the default).
+ *
+ * @returns CMSG_RET_OK on success, CMSG_RET_ERR on failure.
+ */
+int32_t
+cmsg_composite_client_set_quorum (cmsg_client *_composite_client, uint32_t quorum)
+{
+    cmsg_composite_client *composite_client = (cmsg_composite_client *) _composite_client;
+
+    if (!composite_client)
+    {
+        return CMSG_RET_ERR;
+    }
+
+    CMSG_COMPOSITE_CLIENT_TYPE_CHECK (composite_client->base_client, CMSG_RET_ERR);
+
+    pthread_mutex_lock (&composite_client->child_mutex);
+    composite_client->quorum = quorum;
+    pthread_mutex_unlock (&composite_client->child_mutex);
+
+    return CMSG_RET_OK;
+}
+
+/**
+ * Set a function to be called for each child of a composite client that fails
+ * when a method is invoked on the composite client.
+ *
+ * @param _composite_client - The composite client to set the function for.
+ * @param func - The function to call, or NULL to stop reporting errors.
+ */
+void
+cmsg_composite_client_error_func_set (cmsg_client *_composite_client,
+                                      cmsg_composite_client_error_func_t func)
+{
+    cmsg_composite_client *composite_client = (cmsg_composite_client *) _composite_client;
+
+    if (composite_client)
+    {
+        CMSG_COMPOSITE_CLIENT_TYPE_CHECK_VOID_RETURN (composite_client->base_client);
+
+        composite_client->error_func = func;
+    }
+}
+
 /**
  * Send a buffer of bytes on a composite client. Note that sending anything other than
  * a well formed cmsg packet will be dropped by the server being sent to.
@@ -238,22 +1233,23 @@ static int32_t
 cmsg_composite_client_send_bytes (cmsg_client *client, uint8_t *buffer, uint32_t buffer_len,
                                   const char *method_name)
 {
-    GList *l;
     cmsg_composite_client *composite_client = (cmsg_composite_client *) client;
+    cmsg_composite_client_snapshot *snapshot;
     cmsg_client *child;
+    guint i;
     int ret;
     int overall_result = CMSG_RET_OK;
 
-    if (composite_client->child_clients == NULL)
-    {
-        return CMSG_RET_OK;
-    }
-
-    pthread_mutex_lock (&composite_client->child_mutex);
+    snapshot = cmsg_composite_client_snapshot_get (composite_client);
 
-    for (l = composite_client->child_clients; l != NULL; l = l->next)
+    for (i = 0; i < snapshot->children->len; i++)
     {
-        child = (cmsg_client *) l->data;
+        child = (cmsg_client *) g_ptr_array_index (snapshot->children, i);
+        if (composite_client->skip_unconnected &&
+            cmsg_composite_client_child_unconnected (child))
+        {
+            continue;
+        }
 
         ret = child->send_bytes (child, buffer, buffer_len, method_name);
         if (ret != CMSG_RET_OK)
@@ -266,7 +1262,7 @@ cmsg_composite_client_send_bytes (cmsg_client *client, uint8_t *buffer, uint32_t
         }
     }
 
-    pthread_mutex_unlock (&composite_client->child_mutex);
+    cmsg_composite_client_snapshot_unref (snapshot);
 
     return overall_result;
 }
@@ -289,6 +1285,10 @@ cmsg_composite_client_init (cmsg_composite_client *comp_client,
     comp_client->base_client.send_bytes = cmsg_composite_client_send_bytes;
 
     comp_client->child_clients = NULL;
+    comp_client->invoke_timeout = 0;
+    comp_client->error_func = NULL;
+    comp_client->skip_unconnected = false;
+    comp_client->quorum = CMSG_COMPOSITE_CLIENT_QUORUM_ALL;
 
     if (pthread_mutex_init (&comp_client->child_mutex, NULL) != 0)
     {
@@ -296,6 +1296,19 @@ cmsg_composite_client_init (cmsg_composite_client *comp_client,
         return CMSG_RET_ERR;
     }
 
+    if (pthread_cond_init (&comp_client->snapshot_cond, NULL) != 0)
+    {
+        CMSG_LOG_GEN_ERROR ("Init failed for snapshot_cond.");
+        pthread_mutex_destroy (&comp_client->child_mutex);
+        return CMSG_RET_ERR;
+    }
+
+    comp_client->child_index = g_hash_table_new (cmsg_transport_hash,
+                                                 cmsg_transport_equal);
+    comp_client->unindexed_children = 0;
+    comp_client->released_generation = 0;
+    comp_client->snapshot = cmsg_composite_client_snapshot_new (comp_client, 1);
+
     return CMSG_RET_OK;
 }
 
@@ -425,6 +1438,8 @@ void
 cmsg_composite_client_free_all_children (cmsg_client *_composite_client)
 {
     cmsg_composite_client *composite_client = (cmsg_composite_client *) _composite_client;
+    cmsg_composite_client_snapshot *old;
+    GList *children;
     GList *l;
     cmsg_client *child;
 
@@ -432,40 +1447,44 @@ cmsg_composite_client_free_all_children (cmsg_client *_composite_client)
 
     pthread_mutex_lock (&composite_client->child_mutex);
 
-    for (l = composite_client->child_clients; l != NULL; l = l->next)
+    children = composite_client->child_clients;
+    for (l = children; l != NULL; l = l->next)
     {
         child = (cmsg_client *) l->data;
-        cmsg_destroy_client_and_transport (child);
+        child->parent.object = NULL;
     }
 
-    g_list_free (composite_client->child_clients);
     composite_client->child_clients = NULL;
+    g_hash_table_remove_all (composite_client->child_index);
+    composite_client->unindexed_children = 0;
+
+    /* The new snapshot has no children. The children are destroyed once no
+     * invoke is using them. */
+    old = cmsg_composite_client_snapshot_update (composite_client, children);
 
     pthread_mutex_unlock (&composite_client->child_mutex);
+
+    cmsg_composite_client_snapshot_unref (old);
 }
 
 cmsg_client *
 cmsg_composite_client_lookup_by_transport (cmsg_client *_composite_client,
                                            const cmsg_transport *transport)
 {
-    GList *l;
-    cmsg_client *child;
+    GList *link;
+    cmsg_client *child = NULL;
     cmsg_composite_client *composite_client = (cmsg_composite_client *) _composite_client;
 
     CMSG_COMPOSITE_CLIENT_TYPE_CHECK (composite_client->base_client, NULL);
 
     pthread_mutex_lock (&composite_client->child_mutex);
 
-    for (l = composite_client->child_clients; l != NULL; l = l->next)
+    link = g_hash_table_lookup (composite_client->child_index, transport);
+    if (link)
     {
-        child = (cmsg_client *) l->data;
-        if (cmsg_transport_compare (child->_transport, transport))
-        {
-            pthread_mutex_unlock (&composite_client->child_mutex);
-            return child;
-        }
+        child = (cmsg_client *) link->data;
     }
 
     pthread_mutex_unlock (&composite_client->child_mutex);
-    return NULL;
+    return child;
 }
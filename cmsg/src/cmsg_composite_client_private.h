@@ -9,17 +9,53 @@
 
 #include "cmsg_client.h"
 
-typedef struct _cmsg_composite_client_s
+typedef struct _cmsg_composite_client_s cmsg_composite_client;
+
+/* An immutable copy of the children of a composite client. Invokes take a reference
+ * to the current snapshot rather than holding 'child_mutex', so that changing the
+ * children never has to wait for an invoke to complete. Each snapshot holds a
+ * reference to the snapshot that replaced it, so snapshots are always released in
+ * the order they were created. */
+typedef struct _cmsg_composite_client_snapshot_s
+{
+    gint ref_count;
+    uint32_t generation;
+    GPtrArray *children;
+    /* Children removed when this snapshot was replaced, destroyed on release */
+    GList *retired;
+    struct _cmsg_composite_client_snapshot_s *next;
+    cmsg_composite_client *composite_client;
+} cmsg_composite_client_snapshot;
+
+struct _cmsg_composite_client_s
 {
     cmsg_client base_client;
 
     // composite client information
     GList *child_clients;
+    /* Index of the children by transport, mapping to their link in 'child_clients'.
+     * Only the first of any children with the same transport is indexed. */
+    GHashTable *child_index;
+    uint32_t unindexed_children;
     pthread_mutex_t child_mutex;
-} cmsg_composite_client;
+    cmsg_composite_client_snapshot *snapshot;
+    uint32_t released_generation;
+    pthread_cond_t snapshot_cond;
+    uint32_t invoke_timeout;
+    cmsg_composite_client_error_func_t error_func;
+    /* Don't send to children that are not connected, rather than connecting them.
+     * Used when the children are connected in the background. */
+    bool skip_unconnected;
+    /* The number of successful replies an invoke waits for */
+    uint32_t quorum;
+};
 
 int32_t cmsg_composite_client_init (cmsg_composite_client *comp_client,
                                     const ProtobufCServiceDescriptor *descriptor);
 void cmsg_composite_client_deinit (cmsg_composite_client *comp_client);
+cmsg_composite_client_snapshot *cmsg_composite_client_snapshot_get (cmsg_composite_client
+                                                                    *composite_client);
+void cmsg_composite_client_snapshot_unref (cmsg_composite_client_snapshot *snapshot);
+void cmsg_composite_client_connect_children (GPtrArray *children);
 
 #endif /* __CMSG_COMPOSITE_CLIENT_PRIVATE_H_ */
@@ -4,23 +4,19 @@
 
 #include "cmsg_mesh.h"
 #include "cmsg_broadcast_client.h"
+#include "cmsg_error.h"
 
 /**
- * Create a mesh connection.
- *
- * @param service - The protobuf service for this connection.
- * @param service_entry_name - The name in the /etc/services file to get the TCP port number
- * @param my_node_addr - The IP address of this local node
- * @param type - The type of mesh connection to create.
- * @param oneway - Whether the connections are oneway or rpc.
- * @param event_handler - A function to run when a node joins/leaves the mesh connection (optional).
+ * Create a mesh connection (see 'cmsg_mesh_connection_init').
  *
- * @returns A pointer to the mesh connection structure on success, NULL otherwise.
+ * @param shared_accept - Whether the connections to the server are accepted by the
+ *                        shared accept thread rather than a thread of its own.
  */
-cmsg_mesh_conn *
-cmsg_mesh_connection_init (ProtobufCService *service, const char *service_entry_name,
-                           struct in_addr my_node_addr, cmsg_mesh_local_type type,
-                           bool oneway, cmsg_broadcast_event_handler_t event_handler)
+static cmsg_mesh_conn *
+_cmsg_mesh_connection_init (ProtobufCService *service, const char *service_entry_name,
+                            struct in_addr my_node_addr, cmsg_mesh_local_type type,
+                            bool oneway, cmsg_broadcast_event_handler_t event_handler,
+                            bool shared_accept)
 {
     cmsg_mesh_conn *mesh_info = NULL;
     cmsg_client *bcast_client = NULL;
@@ -88,7 +84,16 @@ cmsg_mesh_connection_init (ProtobufCService *service, const char *service_entry_
     }
     mesh_info->server = server;
 
-    if (cmsg_server_accept_thread_init (mesh_info->server) != CMSG_RET_OK)
+    if (shared_accept)
+    {
+        ret = cmsg_server_shared_accept_thread_init (mesh_info->server);
+    }
+    else
+    {
+        ret = cmsg_server_accept_thread_init (mesh_info->server);
+    }
+
+    if (ret != CMSG_RET_OK)
     {
         cmsg_destroy_server_and_transport (mesh_info->server);
         cmsg_broadcast_client_destroy (mesh_info->broadcast_client);
@@ -99,6 +104,55 @@ cmsg_mesh_connection_init (ProtobufCService *service, const char *service_entry_
     return mesh_info;
 }
 
+/**
+ * Create a mesh connection.
+ *
+ * @param service - The protobuf service for this connection.
+ * @param service_entry_name - The name in the /etc/services file to get the TCP port number
+ * @param my_node_addr - The IP address of this local node
+ * @param type - The type of mesh connection to create.
+ * @param oneway - Whether the connections are oneway or rpc.
+ * @param event_handler - A function to run when a node joins/leaves the mesh connection (optional).
+ *
+ * @returns A pointer to the mesh connection structure on success, NULL otherwise.
+ */
+cmsg_mesh_conn *
+cmsg_mesh_connection_init (ProtobufCService *service, const char *service_entry_name,
+                           struct in_addr my_node_addr, cmsg_mesh_local_type type,
+                           bool oneway, cmsg_broadcast_event_handler_t event_handler)
+{
+    return _cmsg_mesh_connection_init (service, service_entry_name, my_node_addr, type,
+                                       oneway, event_handler, false);
+}
+
+/**
+ * Create a mesh connection that is optimised for processes using many mesh
+ * connections. The connections to the server of every such mesh connection in the
+ * process are accepted by a single shared thread rather than by a thread for each
+ * mesh connection. The connections are otherwise used in the same way as those of a
+ * mesh connection created with 'cmsg_mesh_connection_init'. Use
+ * CMSG_MESH_LOCAL_LOOPBACK to invoke the implementation directly for this node.
+ *
+ * @param service - The protobuf service for this connection.
+ * @param service_entry_name - The name in the /etc/services file to get the TCP port number
+ * @param my_node_addr - The IP address of this local node
+ * @param type - The type of mesh connection to create.
+ * @param oneway - Whether the connections are oneway or rpc.
+ * @param event_handler - A function to run when a node joins/leaves the mesh connection (optional).
+ *
+ * @returns A pointer to the mesh connection structure on success, NULL otherwise.
+ */
+cmsg_mesh_conn *
+cmsg_mesh_connection_init_optimised (ProtobufCService *service,
+                                     const char *service_entry_name,
+                                     struct in_addr my_node_addr,
+                                     cmsg_mesh_local_type type, bool oneway,
+                                     cmsg_broadcast_event_handler_t event_handler)
+{
+    return _cmsg_mesh_connection_init (service, service_entry_name, my_node_addr, type,
+                                       oneway, event_handler, true);
+}
+
 /**
  * Destroy a mesh connection.
  *
@@ -114,3 +168,20 @@ cmsg_mesh_connection_destroy (cmsg_mesh_conn *mesh_info)
         CMSG_FREE (mesh_info);
     }
 }
+
+/**
+ * Set how the connections to the other nodes of a mesh connection are made.
+ *
+ * @param mesh_info - The pointer returned from the call to 'cmsg_mesh_connection_init'.
+ * @param policy - The connection policy to use (see 'cmsg_broadcast_connect_policy').
+ *
+ * @returns CMSG_RET_OK on success, CMSG_RET_ERR on failure.
+ */
+int32_t
+cmsg_mesh_connection_set_connect_policy (cmsg_mesh_conn *mesh_info,
+                                         cmsg_broadcast_connect_policy policy)
+{
+    CMSG_ASSERT_RETURN_VAL (mesh_info != NULL, CMSG_RET_ERR);
+
+    return cmsg_broadcast_client_set_connect_policy (mesh_info->broadcast_client, policy);
+}
@@ -2,6 +2,7 @@
  * Copyright 2016, Allied Telesis Labs New Zealand, Ltd
  */
 #include <sys/eventfd.h>
+#include <sys/epoll.h>
 #include "cmsg_private.h"
 #include "cmsg_server.h"
 #include "cmsg_error.h"
@@ -22,6 +23,25 @@
  * take a long time. */
 #define SERVER_RECV_HEADER_PEEK_TIMEOUT 10
 
+/* The maximum number of events handled by each wait of the shared accept thread */
+#define CMSG_SERVER_SHARED_ACCEPT_EVENTS 16
+
+/* A single thread accepting the incoming connections of many servers */
+typedef struct _cmsg_server_shared_accept_s
+{
+    pthread_t thread;
+    int epoll_fd;
+
+    /* Written to stop the thread */
+    int stop_eventfd;
+
+    /* The servers the thread is accepting connections for */
+    GHashTable *servers;
+} cmsg_server_shared_accept;
+
+static cmsg_server_shared_accept *shared_accept = NULL;
+static pthread_mutex_t shared_accept_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static void cmsg_server_queue_filter_init (cmsg_server *server);
 
 static cmsg_queue_filter_type cmsg_server_queue_filter_lookup (cmsg_server *server,
@@ -37,6 +57,11 @@ static int32_t cmsg_server_message_processor (int socket,
                                               cmsg_server_request *server_request,
                                               cmsg_server *server, uint8_t *buffer_data);
 
+static int32_t cmsg_server_method_req_invoke (int socket,
+                                              cmsg_server_request *server_request,
+                                              cmsg_server *server,
+                                              ProtobufCMessage *message);
+
 
 static ProtobufCClosure
 cmsg_server_get_closure_func (cmsg_transport *transport)
@@ -52,6 +77,7 @@ cmsg_server_get_closure_func (cmsg_transport *transport)
     case CMSG_TRANSPORT_BROADCAST:
     case CMSG_TRANSPORT_ONEWAY_UNIX:
     case CMSG_TRANSPORT_FORWARDING:
+    case CMSG_TRANSPORT_ONEWAY_MULTICAST:
         return cmsg_server_closure_oneway;
     }
 
@@ -1179,9 +1205,11 @@ cmsg_server_invoke_direct (cmsg_server *server, const ProtobufCMessage *input,
 
     method_name = service->descriptor->methods[method_index].name;
 
-    /* setup the server request, which is needed to get a response sent back */
+    /* setup the server request, which is needed to get a response sent back.
+     * The message length is only used to unpack a received message, so the
+     * message is not walked to calculate its packed size. */
     server_request.msg_type = CMSG_MSG_TYPE_METHOD_REQ;
-    server_request.message_length = protobuf_c_message_get_packed_size (input);
+    server_request.message_length = 0;
     server_request.method_index = method_index;
     strcpy (server_request.method_name_recvd, method_name);
 
@@ -1202,8 +1230,6 @@ static int32_t
 _cmsg_server_method_req_message_processor (int socket, cmsg_server_request *server_request,
                                            cmsg_server *server, uint8_t *buffer_data)
 {
-    cmsg_queue_filter_type action;
-    cmsg_method_processing_reason processing_reason = CMSG_METHOD_OK_TO_INVOKE;
     ProtobufCMessage *message = NULL;
     ProtobufCAllocator *allocator = &cmsg_memory_allocator;
     const char *method_name;
@@ -1251,6 +1277,31 @@ _cmsg_server_method_req_message_processor (int socket, cmsg_server_request *serv
         return CMSG_RET_ERR;
     }
 
+    return cmsg_server_method_req_invoke (socket, server_request, server, message);
+}
+
+/**
+ * Perform filtering (if applicable) on an unpacked METHOD_REQ message and then
+ * invoke the method.
+ *
+ * @param socket - The socket to reply on (-1 if no reply can be sent).
+ * @param server_request - The request information for the message.
+ * @param server - The server to invoke the method on.
+ * @param message - The unpacked message. This is owned by the server after this call.
+ *
+ * @returns CMSG_RET_OK on success, CMSG_RET_ERR on failure.
+ */
+static int32_t
+cmsg_server_method_req_invoke (int socket, cmsg_server_request *server_request,
+                               cmsg_server *server, ProtobufCMessage *message)
+{
+    cmsg_queue_filter_type action;
+    cmsg_method_processing_reason processing_reason = CMSG_METHOD_OK_TO_INVOKE;
+    ProtobufCAllocator *allocator = &cmsg_memory_allocator;
+    const char *method_name;
+
+    method_name = server->service->descriptor->methods[server_request->method_index].name;
+
     action = cmsg_server_queue_filter_lookup (server, method_name);
 
     if (action == CMSG_QUEUE_FILTER_ERROR)
@@ -1285,6 +1336,92 @@ _cmsg_server_method_req_message_processor (int socket, cmsg_server_request *serv
     return CMSG_RET_OK;
 }
 
+/**
+ * Process a METHOD_REQ packet that was received by some means other than the
+ * transport of the server (e.g. read in place from shared memory). No reply is
+ * ever sent for the packet.
+ *
+ * @param server - The server to invoke the method on.
+ * @param packet - The packet (CMSG header, TLV header(s) and packed message).
+ * @param packet_len - The length of the packet.
+ * @param check_func - Optional function called once the message has been unpacked
+ *                     and before it is invoked. The message is dropped if this
+ *                     returns false (i.e. the packet contents can no longer be
+ *                     trusted).
+ * @param user_data - Pointer passed to 'check_func'.
+ *
+ * @returns CMSG_RET_OK if the message was invoked, related error code otherwise.
+ */
+int32_t
+cmsg_server_packet_process (cmsg_server *server, uint8_t *packet, uint32_t packet_len,
+                            cmsg_server_packet_check_f check_func, void *user_data)
+{
+    cmsg_header header;
+    cmsg_server_request server_request;
+    const ProtobufCMessageDescriptor *desc;
+    ProtobufCMessage *message = NULL;
+    uint32_t extra_header_size;
+    int32_t ret;
+
+    CMSG_ASSERT_RETURN_VAL (server != NULL, CMSG_RET_ERR);
+    CMSG_ASSERT_RETURN_VAL (packet != NULL, CMSG_RET_ERR);
+
+    if (packet_len < sizeof (cmsg_header) ||
+        cmsg_header_process ((cmsg_header *) packet, &header) != CMSG_RET_OK ||
+        header.msg_type != CMSG_MSG_TYPE_METHOD_REQ ||
+        header.header_length < sizeof (cmsg_header) ||
+        header.header_length > packet_len ||
+        header.message_length > packet_len - header.header_length)
+    {
+        CMSG_COUNTER_INC (server, cntr_protocol_errors);
+        return CMSG_RET_ERR;
+    }
+
+    extra_header_size = header.header_length - sizeof (cmsg_header);
+
+    server_request.msg_type = header.msg_type;
+    server_request.message_length = header.message_length;
+    server_request.method_index = UNDEFINED_METHOD;
+    memset (&(server_request.method_name_recvd), 0, CMSG_SERVER_REQUEST_MAX_NAME_LENGTH);
+
+    ret = cmsg_tlv_header_process (packet + sizeof (cmsg_header), &server_request,
+                                   extra_header_size, server->service->descriptor);
+    if (ret != CMSG_RET_OK)
+    {
+        if (ret == CMSG_RET_METHOD_NOT_FOUND)
+        {
+            CMSG_COUNTER_INC (server, cntr_unknown_rpc);
+        }
+        return ret;
+    }
+
+    if (server_request.method_index >= server->service->descriptor->n_methods)
+    {
+        CMSG_COUNTER_INC (server, cntr_unknown_rpc);
+        return CMSG_RET_ERR;
+    }
+
+    desc = server->service->descriptor->methods[server_request.method_index].input;
+    message = protobuf_c_message_unpack (desc, &cmsg_memory_allocator,
+                                         server_request.message_length,
+                                         packet + header.header_length);
+    if (message == NULL)
+    {
+        CMSG_COUNTER_INC (server, cntr_pack_errors);
+        return CMSG_RET_ERR;
+    }
+
+    if (check_func && !check_func (user_data))
+    {
+        protobuf_c_message_free_unpacked (message, &cmsg_memory_allocator);
+        return CMSG_RET_ERR;
+    }
+
+    CMSG_COUNTER_INC (server, cntr_rpc);
+
+    return cmsg_server_method_req_invoke (-1, &server_request, server, message);
+}
+
 /**
  * Wrap the sending of a buffer so that the input buffer can be encrypted if required
  *
@@ -2029,6 +2166,56 @@ cmsg_create_server_tipc_broadcast (ProtobufCService *descriptor, const char *ser
     return server;
 }
 
+/**
+ * Create a server that receives oneway messages sent to a UDP multicast group.
+ *
+ * @param service - The service for the server.
+ * @param service_name - The service name in the /etc/services file to get
+ *                       the port number.
+ * @param group - The multicast group address to join.
+ * @param interface - The address of the interface to join the group on.
+ *
+ * @returns Pointer to the server on success, NULL on failure.
+ */
+cmsg_server *
+cmsg_create_server_multicast (const ProtobufCService *service, const char *service_name,
+                              struct in_addr group, struct in_addr interface)
+{
+    cmsg_transport *transport;
+    cmsg_server *server;
+    uint16_t port;
+
+    CMSG_ASSERT_RETURN_VAL (service != NULL, NULL);
+
+    port = cmsg_service_port_get (service_name, "udp");
+    if (port == 0)
+    {
+        CMSG_LOG_GEN_ERROR ("Unknown multicast service: %s", service_name);
+        return NULL;
+    }
+
+    transport = cmsg_transport_new (CMSG_TRANSPORT_ONEWAY_MULTICAST);
+    if (transport == NULL)
+    {
+        return NULL;
+    }
+
+    transport->config.socket.sockaddr.in.sin_addr = group;
+    transport->config.socket.sockaddr.in.sin_port = htons (port);
+    cmsg_transport_multicast_interface_set (transport, interface);
+
+    server = cmsg_server_new (transport, service);
+    if (server == NULL)
+    {
+        cmsg_transport_destroy (transport);
+        CMSG_LOG_GEN_ERROR ("[%s] Failed to create multicast server.",
+                            service->descriptor->name);
+        return NULL;
+    }
+
+    return server;
+}
+
 /**
  * Helper function for creating a CMSG server using TCP over IPv4.
  *
@@ -2251,6 +2438,29 @@ cmsg_server_app_owns_all_msgs_set (cmsg_server *server, cmsg_bool_t app_is_owner
     server->app_owns_all_msgs = app_is_owner;
 }
 
+/**
+ * Accept a connection on the listening socket of a server and pass it to the
+ * server user.
+ *
+ * @param server - The server to accept the connection for.
+ */
+static void
+cmsg_server_accept_and_queue (cmsg_server *server)
+{
+    cmsg_server_accept_thread_info *info = server->accept_thread_info;
+    int newfd;
+    int *newfd_ptr;
+
+    newfd = cmsg_server_accept (server, cmsg_server_get_socket (server));
+    if (newfd >= 0)
+    {
+        newfd_ptr = CMSG_CALLOC (1, sizeof (int));
+        *newfd_ptr = newfd;
+        g_async_queue_push (info->accept_sd_queue, newfd_ptr);
+        TEMP_FAILURE_RETRY (eventfd_write (info->accept_sd_eventfd, 1));
+    }
+}
+
 /**
  * Blocks waiting on an accept call for any incoming connections. Once
  * the accept completes the new socket is passed back to the broadcast
@@ -2260,10 +2470,7 @@ static void *
 cmsg_server_accept_thread (void *_server)
 {
     cmsg_server *server = (cmsg_server *) _server;
-    cmsg_server_accept_thread_info *info = server->accept_thread_info;
     int listen_socket = cmsg_server_get_socket (server);
-    int newfd = -1;
-    int *newfd_ptr;
     struct pollfd pfd = {
         .events = POLLIN,
         .fd = listen_socket,
@@ -2273,18 +2480,11 @@ cmsg_server_accept_thread (void *_server)
     {
         if (TEMP_FAILURE_RETRY (poll (&pfd, 1, -1)) > 0)
         {
+            /* Explicitly set where the thread can be cancelled. This ensures no
+             * sockets can be leaked if the thread is cancelled after accepting
+             * a connection. */
             pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
-            newfd = cmsg_server_accept (server, listen_socket);
-            if (newfd >= 0)
-            {
-                /* Explicitly set where the thread can be cancelled. This ensures no
-                 * sockets can be leaked if the thread is cancelled after accepting
-                 * a connection. */
-                newfd_ptr = CMSG_CALLOC (1, sizeof (int));
-                *newfd_ptr = newfd;
-                g_async_queue_push (info->accept_sd_queue, newfd_ptr);
-                TEMP_FAILURE_RETRY (eventfd_write (info->accept_sd_eventfd, 1));
-            }
+            cmsg_server_accept_and_queue (server);
             pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
         }
     }
@@ -2306,23 +2506,17 @@ _clear_accept_sd_queue (gpointer data)
 }
 
 /**
- * Start the server accept thread.
+ * Create the queue and eventfd used to pass accepted connections to the server user.
  *
  * @param server - The server to accept connections for.
  *
  * @return CMSG_RET_OK on success, CMSG_RET_ERR on failure.
  */
-int32_t
-cmsg_server_accept_thread_init (cmsg_server *server)
+static int32_t
+cmsg_server_accept_thread_info_init (cmsg_server *server)
 {
     cmsg_server_accept_thread_info *info = NULL;
 
-    if (server->accept_thread_info)
-    {
-        /* Already initialised */
-        return CMSG_RET_OK;
-    }
-
     info = CMSG_CALLOC (1, sizeof (cmsg_server_accept_thread_info));
     if (info == NULL)
     {
@@ -2346,13 +2540,46 @@ cmsg_server_accept_thread_init (cmsg_server *server)
 
     server->accept_thread_info = info;
 
+    return CMSG_RET_OK;
+}
+
+static void
+cmsg_server_accept_thread_info_deinit (cmsg_server *server)
+{
+    close (server->accept_thread_info->accept_sd_eventfd);
+    g_async_queue_unref (server->accept_thread_info->accept_sd_queue);
+    CMSG_FREE (server->accept_thread_info);
+    server->accept_thread_info = NULL;
+}
+
+/**
+ * Start the server accept thread.
+ *
+ * @param server - The server to accept connections for.
+ *
+ * @return CMSG_RET_OK on success, CMSG_RET_ERR on failure.
+ */
+int32_t
+cmsg_server_accept_thread_init (cmsg_server *server)
+{
+    cmsg_server_accept_thread_info *info = NULL;
+
+    if (server->accept_thread_info)
+    {
+        /* Already initialised */
+        return CMSG_RET_OK;
+    }
+
+    if (cmsg_server_accept_thread_info_init (server) != CMSG_RET_OK)
+    {
+        return CMSG_RET_ERR;
+    }
+    info = server->accept_thread_info;
+
     if (pthread_create (&info->server_accept_thread, NULL,
                         cmsg_server_accept_thread, server) != 0)
     {
-        close (info->accept_sd_eventfd);
-        g_async_queue_unref (info->accept_sd_queue);
-        CMSG_FREE (info);
-        server->accept_thread_info = NULL;
+        cmsg_server_accept_thread_info_deinit (server);
         return CMSG_RET_ERR;
     }
 
@@ -2361,6 +2588,204 @@ cmsg_server_accept_thread_init (cmsg_server *server)
     return CMSG_RET_OK;
 }
 
+/**
+ * Accepts the incoming connections of every server using the shared accept thread.
+ * The servers are only used while holding the lock, so a server that is removed
+ * while the thread is waiting is never used once removed.
+ */
+static void *
+cmsg_server_shared_accept_thread (void *_reactor)
+{
+    cmsg_server_shared_accept *reactor = (cmsg_server_shared_accept *) _reactor;
+    struct epoll_event events[CMSG_SERVER_SHARED_ACCEPT_EVENTS];
+    cmsg_server *server;
+    bool stop = false;
+    int num_events;
+    int i;
+
+    while (!stop)
+    {
+        num_events = epoll_wait (reactor->epoll_fd, events,
+                                 CMSG_SERVER_SHARED_ACCEPT_EVENTS, -1);
+        if (num_events < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        pthread_mutex_lock (&shared_accept_mutex);
+        for (i = 0; i < num_events; i++)
+        {
+            server = (cmsg_server *) events[i].data.ptr;
+            if (server == NULL)
+            {
+                stop = true;
+            }
+            else if (g_hash_table_contains (reactor->servers, server))
+            {
+                cmsg_server_accept_and_queue (server);
+            }
+        }
+        pthread_mutex_unlock (&shared_accept_mutex);
+    }
+
+    pthread_exit (NULL);
+}
+
+static void
+cmsg_server_shared_accept_free (cmsg_server_shared_accept *reactor)
+{
+    if (reactor->stop_eventfd >= 0)
+    {
+        close (reactor->stop_eventfd);
+    }
+    if (reactor->epoll_fd >= 0)
+    {
+        close (reactor->epoll_fd);
+    }
+    g_hash_table_destroy (reactor->servers);
+    CMSG_FREE (reactor);
+}
+
+/**
+ * Create the shared accept thread.
+ *
+ * @returns The shared accept thread on success, NULL on failure.
+ */
+static cmsg_server_shared_accept *
+cmsg_server_shared_accept_create (void)
+{
+    cmsg_server_shared_accept *reactor;
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = NULL,
+    };
+
+    reactor = CMSG_CALLOC (1, sizeof (cmsg_server_shared_accept));
+    if (reactor == NULL)
+    {
+        return NULL;
+    }
+
+    reactor->servers = g_hash_table_new (g_direct_hash, g_direct_equal);
+    reactor->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    reactor->stop_eventfd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->epoll_fd < 0 || reactor->stop_eventfd < 0 ||
+        epoll_ctl (reactor->epoll_fd, EPOLL_CTL_ADD, reactor->stop_eventfd, &event) < 0)
+    {
+        cmsg_server_shared_accept_free (reactor);
+        return NULL;
+    }
+
+    if (pthread_create (&reactor->thread, NULL, cmsg_server_shared_accept_thread,
+                        reactor) != 0)
+    {
+        cmsg_server_shared_accept_free (reactor);
+        return NULL;
+    }
+
+    cmsg_pthread_setname (reactor->thread, "shared", CMSG_ACCEPT_PREFIX);
+
+    return reactor;
+}
+
+/**
+ * Accept the incoming connections of a server with the accept thread shared by
+ * every server initialised with this function, rather than with a thread of its
+ * own. The accepted connections are passed to the server user in the same way as
+ * by 'cmsg_server_accept_thread_init'.
+ *
+ * Connections are accepted while holding the lock that protects the shared thread,
+ * so the 'crypto_sa_create_func' of a server with encryption enabled is called with
+ * that lock held. It must not block, and must not create or destroy a server that
+ * uses the shared accept thread.
+ *
+ * @param server - The server to accept connections for.
+ *
+ * @return CMSG_RET_OK on success, CMSG_RET_ERR on failure.
+ */
+int32_t
+cmsg_server_shared_accept_thread_init (cmsg_server *server)
+{
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = server,
+    };
+    int32_t ret = CMSG_RET_ERR;
+
+    if (server->accept_thread_info)
+    {
+        /* Already initialised */
+        return CMSG_RET_OK;
+    }
+
+    if (cmsg_server_accept_thread_info_init (server) != CMSG_RET_OK)
+    {
+        return CMSG_RET_ERR;
+    }
+    server->accept_thread_info->shared = true;
+
+    pthread_mutex_lock (&shared_accept_mutex);
+
+    if (!shared_accept)
+    {
+        shared_accept = cmsg_server_shared_accept_create ();
+    }
+
+    if (shared_accept &&
+        epoll_ctl (shared_accept->epoll_fd, EPOLL_CTL_ADD, cmsg_server_get_socket (server),
+                   &event) == 0)
+    {
+        g_hash_table_add (shared_accept->servers, server);
+        ret = CMSG_RET_OK;
+    }
+
+    pthread_mutex_unlock (&shared_accept_mutex);
+
+    if (ret != CMSG_RET_OK)
+    {
+        cmsg_server_accept_thread_info_deinit (server);
+    }
+
+    return ret;
+}
+
+/**
+ * Stop accepting the connections of a server with the shared accept thread. The
+ * thread is stopped once it is no longer accepting connections for any server.
+ *
+ * @param server - The server to stop accepting connections for.
+ */
+static void
+cmsg_server_shared_accept_thread_deinit (cmsg_server *server)
+{
+    cmsg_server_shared_accept *reactor = NULL;
+
+    pthread_mutex_lock (&shared_accept_mutex);
+
+    epoll_ctl (shared_accept->epoll_fd, EPOLL_CTL_DEL, cmsg_server_get_socket (server),
+               NULL);
+    g_hash_table_remove (shared_accept->servers, server);
+
+    if (g_hash_table_size (shared_accept->servers) == 0)
+    {
+        reactor = shared_accept;
+        shared_accept = NULL;
+    }
+
+    pthread_mutex_unlock (&shared_accept_mutex);
+
+    if (reactor)
+    {
+        TEMP_FAILURE_RETRY (eventfd_write (reactor->stop_eventfd, 1));
+        pthread_join (reactor->thread, NULL);
+        cmsg_server_shared_accept_free (reactor);
+    }
+}
+
 /**
  * Shutdown the server accept thread.
  *
@@ -2371,12 +2796,16 @@ cmsg_server_accept_thread_deinit (cmsg_server *server)
 {
     if (server && server->accept_thread_info)
     {
-        pthread_cancel (server->accept_thread_info->server_accept_thread);
-        pthread_join (server->accept_thread_info->server_accept_thread, NULL);
-        close (server->accept_thread_info->accept_sd_eventfd);
-        g_async_queue_unref (server->accept_thread_info->accept_sd_queue);
-        CMSG_FREE (server->accept_thread_info);
-        server->accept_thread_info = NULL;
+        if (server->accept_thread_info->shared)
+        {
+            cmsg_server_shared_accept_thread_deinit (server);
+        }
+        else
+        {
+            pthread_cancel (server->accept_thread_info->server_accept_thread);
+            pthread_join (server->accept_thread_info->server_accept_thread, NULL);
+        }
+        cmsg_server_accept_thread_info_deinit (server);
     }
 }
 
@@ -2551,7 +2980,9 @@ cmsg_server_thread_task (void *_info)
  *
  * @param server - The server to accept connections for.
  * @param create_func - The user supplied callback function to create a crypto sa
- *                      when the server accepts a connection.
+ *                      when the server accepts a connection. If the server uses the
+ *                      shared accept thread this is called with the shared accept
+ *                      lock held (see 'cmsg_server_shared_accept_thread_init').
  * @param derive_func - The user supplied callback function to derive the crypto sa
  *                      once the nonce is received from the client.
  *
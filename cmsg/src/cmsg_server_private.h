@@ -15,4 +15,10 @@ cmsg_server *cmsg_server_create (cmsg_transport *transport, ProtobufCService *se
 cmsg_service_info *cmsg_server_service_info_create (cmsg_server *server);
 void cmsg_server_service_info_free (cmsg_service_info *info);
 
+typedef bool (*cmsg_server_packet_check_f) (void *user_data);
+int32_t cmsg_server_packet_process (cmsg_server *server, uint8_t *packet,
+                                    uint32_t packet_len,
+                                    cmsg_server_packet_check_f check_func,
+                                    void *user_data);
+
 #endif /* __CMSG_SERVER_PRIVATE_H_ */
@@ -262,7 +262,8 @@ cmsg_ps_create_publisher_update_server (void)
 /**
  * Register a publisher with cmsg_psd.
  *
- * @param service - The service name the publisher is publishing events for.
+ * @param descriptor - The descriptor of the service the publisher is publishing
+ *                     events for.
  * @param server - The server the publisher is using to listen for updates from cmsg_psd.
  * @param subscribed_methods - Pointer to a 'cmsg_subscription_methods' message that stores
  *                             the subscriber information returned from cmsg_psd. This should
@@ -271,12 +272,15 @@ cmsg_ps_create_publisher_update_server (void)
  * @returns CMSG_RET_OK on success, CMSG_RET_ERR on failure.
  */
 int32_t
-cmsg_ps_register_publisher (const char *service, cmsg_server *server,
+cmsg_ps_register_publisher (const ProtobufCServiceDescriptor *descriptor,
+                            cmsg_server *server,
                             cmsg_subscription_methods **subscribed_methods)
 {
     cmsg_client *client = NULL;
-    cmsg_service_info send_msg = CMSG_SERVICE_INFO_INIT;
+    cmsg_psd_publisher_info send_msg = CMSG_PSD_PUBLISHER_INFO_INIT;
+    cmsg_service_info service_info = CMSG_SERVICE_INFO_INIT;
     int ret;
+    unsigned int i;
     cmsg_transport_info *transport_info = NULL;
 
     transport_info = cmsg_transport_info_create (server->_transport);
@@ -292,13 +296,27 @@ cmsg_ps_register_publisher (const char *service, cmsg_server *server,
         return CMSG_RET_ERR;
     }
 
-    CMSG_SET_FIELD_PTR (&send_msg, service, (char *) service);
-    CMSG_SET_FIELD_PTR (&send_msg, server_info, transport_info);
+    CMSG_SET_FIELD_PTR (&service_info, service,
+                        (char *) cmsg_service_name_get (descriptor));
+    CMSG_SET_FIELD_PTR (&service_info, server_info, transport_info);
+    CMSG_SET_FIELD_PTR (&send_msg, service_info, &service_info);
+    for (i = 0; i < descriptor->n_methods; i++)
+    {
+        CMSG_REPEATED_APPEND (&send_msg, methods, (char *) descriptor->methods[i].name);
+    }
 
     *subscribed_methods = NULL;
-    ret = cmsg_psd_configuration_api_add_publisher (client, &send_msg, subscribed_methods);
+    ret = cmsg_psd_configuration_api_add_publisher_v2 (client, &send_msg,
+                                                       subscribed_methods);
+    if (ret == CMSG_RET_METHOD_NOT_FOUND)
+    {
+        /* The daemon predates registering the published methods */
+        ret = cmsg_psd_configuration_api_add_publisher (client, &service_info,
+                                                        subscribed_methods);
+    }
     cmsg_destroy_client_and_transport (client);
     cmsg_transport_info_free (transport_info);
+    CMSG_REPEATED_FREE (send_msg.methods);
 
     return ret;
 }
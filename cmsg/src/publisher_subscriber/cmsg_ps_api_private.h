@@ -22,7 +22,8 @@ int32_t cmsg_ps_subscription_remove_remote (cmsg_server *sub_server,
                                             struct in_addr remote_addr);
 int32_t cmsg_ps_remove_subscriber (cmsg_server *sub_server);
 cmsg_server *cmsg_ps_create_publisher_update_server (void);
-int32_t cmsg_ps_register_publisher (const char *service, cmsg_server *server,
+int32_t cmsg_ps_register_publisher (const ProtobufCServiceDescriptor *descriptor,
+                                    cmsg_server *server,
                                     cmsg_subscription_methods **subscribed_methods);
 int32_t cmsg_ps_deregister_publisher (const char *service, cmsg_server *server);
 
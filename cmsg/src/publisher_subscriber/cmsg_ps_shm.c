@@ -0,0 +1,529 @@
+/**
+ * cmsg_ps_shm.c
+ *
+ * Implements the shared memory ring used by a CMSG publisher to publish each
+ * message once to all of the local subscribers of a service that were created
+ * to receive their messages from shared memory.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <simple_shm.h>
+#include "cmsg_ps_shm_private.h"
+#include "cmsg_private.h"
+#include "cmsg_error.h"
+#include "cmsg_server_private.h"
+
+/* The key of the shared memory for a service is this value combined with a hash
+ * of the service name. A collision is detected using the name stored in the ring. */
+#define CMSG_PS_SHM_KEY_BASE 0x436d5073 /* Hex value of "CmPs" */
+
+/* Records that are larger than this are sent to the subscribers on their unix
+ * sockets instead, so that a single message cannot flush the entire ring. */
+#define CMSG_PS_SHM_MAX_RECORD_SIZE (CMSG_PS_SHM_DATA_SIZE / 4)
+
+#define CMSG_PS_SHM_ALIGN(len) (((len) + 7) & ~((uint32_t) 7))
+
+typedef struct
+{
+    uint32_t length;            /* Length of the record including this header */
+    uint32_t packet_len;        /* Length of the packet, 0 for a padding record */
+    uint64_t consumers;         /* Bit mask of the consumer slots the packet is for */
+} cmsg_ps_shm_record;
+
+typedef struct
+{
+    char *service_name;
+    simple_shm_info shm_info;
+    cmsg_ps_shm_ring *ring;     /* NULL if the shared memory could not be used */
+} cmsg_ps_shm_mapping;
+
+typedef struct
+{
+    cmsg_ps_shm_ring *ring;
+    uint64_t pos;
+} cmsg_ps_shm_read_check;
+
+static GHashTable *mappings = NULL;
+static pthread_mutex_t mappings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Initialise a ring. Called once when the shared memory for the ring is first
+ * created (or directly on a ring allocated in process memory for testing).
+ *
+ * @param _ring - The ring to initialise.
+ */
+void
+cmsg_ps_shm_ring_init (void *_ring)
+{
+    cmsg_ps_shm_ring *ring = (cmsg_ps_shm_ring *) _ring;
+    pthread_mutexattr_t attr;
+
+    memset (ring, 0, sizeof (*ring));
+
+    pthread_mutexattr_init (&attr);
+    pthread_mutexattr_setpshared (&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust (&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init (&ring->lock, &attr);
+    pthread_mutexattr_destroy (&attr);
+}
+
+/**
+ * Lock a ring. If the previous owner of the lock died while holding it then any
+ * record it was writing was never published (the head was not moved) so the
+ * ring is still consistent.
+ *
+ * @param ring - The ring to lock.
+ */
+static void
+cmsg_ps_shm_lock (cmsg_ps_shm_ring *ring)
+{
+    if (pthread_mutex_lock (&ring->lock) == EOWNERDEAD)
+    {
+        pthread_mutex_consistent (&ring->lock);
+    }
+}
+
+static void
+cmsg_ps_shm_unlock (cmsg_ps_shm_ring *ring)
+{
+    pthread_mutex_unlock (&ring->lock);
+}
+
+/**
+ * Get the ring for the given service, attaching to (and creating if required)
+ * the shared memory for it. The mapping is shared by all publishers and
+ * subscribers of the service in this process and is never detached.
+ *
+ * @param service_name - The name of the service to get the ring for.
+ *
+ * @returns A pointer to the ring on success, NULL otherwise.
+ */
+cmsg_ps_shm_ring *
+cmsg_ps_shm_ring_get (const char *service_name)
+{
+    cmsg_ps_shm_mapping *mapping = NULL;
+    cmsg_ps_shm_ring *shared = NULL;
+    cmsg_ps_shm_ring *ring = NULL;
+    key_t key;
+
+    CMSG_ASSERT_RETURN_VAL (service_name != NULL, NULL);
+
+    pthread_mutex_lock (&mappings_mutex);
+
+    if (!mappings)
+    {
+        mappings = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+
+    mapping = (cmsg_ps_shm_mapping *) g_hash_table_lookup (mappings, service_name);
+    if (mapping)
+    {
+        ring = mapping->ring;
+        pthread_mutex_unlock (&mappings_mutex);
+        return ring;
+    }
+
+    key = CMSG_PS_SHM_KEY_BASE ^ g_str_hash (service_name);
+
+    mapping = (cmsg_ps_shm_mapping *) CMSG_CALLOC (1, sizeof (*mapping));
+    if (!mapping)
+    {
+        pthread_mutex_unlock (&mappings_mutex);
+        return NULL;
+    }
+
+    mapping->shm_info.shared_data = NULL;
+    mapping->shm_info.shared_data_size = sizeof (cmsg_ps_shm_ring);
+    mapping->shm_info.shared_mem_key = key;
+    mapping->shm_info.shared_sem_key = key;
+    mapping->shm_info.shared_sem_num = 1;
+    mapping->shm_info.shm_id = -1;
+    mapping->shm_info.sem_id = -1;
+    mapping->shm_info.init_func = cmsg_ps_shm_ring_init;
+
+    shared = (cmsg_ps_shm_ring *) get_shared_memory (&mapping->shm_info);
+    if (!shared)
+    {
+        CMSG_LOG_GEN_ERROR ("[%s] Unable to attach to publisher shared memory.",
+                            service_name);
+        CMSG_FREE (mapping);
+        pthread_mutex_unlock (&mappings_mutex);
+        return NULL;
+    }
+
+    cmsg_ps_shm_lock (shared);
+    if (shared->service_name[0] == '\0')
+    {
+        strncpy (shared->service_name, service_name, CMSG_PS_SHM_SERVICE_NAME_LEN - 1);
+    }
+    if (strncmp (shared->service_name, service_name, CMSG_PS_SHM_SERVICE_NAME_LEN - 1) == 0)
+    {
+        mapping->ring = shared;
+    }
+    else
+    {
+        CMSG_LOG_GEN_ERROR ("[%s] Publisher shared memory is in use by service %s.",
+                            service_name, shared->service_name);
+    }
+    cmsg_ps_shm_unlock (shared);
+
+    /* The mapping is remembered even if it cannot be used so that the attach is
+     * not retried for every publisher and subscriber of the service. */
+    mapping->service_name = CMSG_STRDUP (service_name);
+    g_hash_table_insert (mappings, mapping->service_name, mapping);
+    ring = mapping->ring;
+
+    pthread_mutex_unlock (&mappings_mutex);
+
+    return ring;
+}
+
+/**
+ * Check whether the process using a consumer slot still exists.
+ *
+ * @param consumer - The consumer slot to check.
+ *
+ * @returns true if the process no longer exists, false otherwise.
+ */
+static bool
+cmsg_ps_shm_consumer_is_stale (cmsg_ps_shm_consumer *consumer)
+{
+    return (kill (consumer->pid, 0) < 0 && errno == ESRCH);
+}
+
+/**
+ * Claim a consumer slot on the ring for a subscriber. Slots left behind by
+ * processes that have exited without releasing them are reclaimed.
+ *
+ * @param ring - The ring to claim the slot on.
+ * @param sun_path - The path of the unix server of the subscriber. Publishers
+ *                   use this to match the subscriptions they are told about by
+ *                   cmsg_psd to the slot.
+ *
+ * @returns The slot number on success, -1 if there are no free slots.
+ */
+int
+cmsg_ps_shm_consumer_add (cmsg_ps_shm_ring *ring, const char *sun_path)
+{
+    cmsg_ps_shm_consumer *consumer = NULL;
+    int slot;
+
+    cmsg_ps_shm_lock (ring);
+
+    for (slot = 0; slot < CMSG_PS_SHM_MAX_CONSUMERS; slot++)
+    {
+        consumer = &ring->consumers[slot];
+        if (consumer->pid == 0 || cmsg_ps_shm_consumer_is_stale (consumer))
+        {
+            break;
+        }
+    }
+
+    if (slot == CMSG_PS_SHM_MAX_CONSUMERS)
+    {
+        cmsg_ps_shm_unlock (ring);
+        return -1;
+    }
+
+    consumer->pid = getpid ();
+    consumer->generation++;
+    consumer->read_pos = ring->head;
+    consumer->lagged = 0;
+    strncpy (consumer->sun_path, sun_path, sizeof (consumer->sun_path) - 1);
+    consumer->sun_path[sizeof (consumer->sun_path) - 1] = '\0';
+
+    /* Nothing has been read yet so the first message must wake the subscriber */
+    __atomic_store_n (&consumer->waiting, 1, __ATOMIC_SEQ_CST);
+
+    cmsg_ps_shm_unlock (ring);
+
+    return slot;
+}
+
+/**
+ * Release a consumer slot that was claimed with 'cmsg_ps_shm_consumer_add'.
+ *
+ * @param ring - The ring the slot is on.
+ * @param slot - The slot to release.
+ */
+void
+cmsg_ps_shm_consumer_remove (cmsg_ps_shm_ring *ring, int slot)
+{
+    CMSG_ASSERT_RETURN_VOID (slot >= 0 && slot < CMSG_PS_SHM_MAX_CONSUMERS);
+
+    cmsg_ps_shm_lock (ring);
+    ring->consumers[slot].pid = 0;
+    ring->consumers[slot].sun_path[0] = '\0';
+    __atomic_store_n (&ring->consumers[slot].waiting, 0, __ATOMIC_SEQ_CST);
+    cmsg_ps_shm_unlock (ring);
+}
+
+/**
+ * Find the consumer slot of the subscriber with the given unix server path.
+ *
+ * @param ring - The ring to search.
+ * @param sun_path - The path of the unix server of the subscriber.
+ * @param generation - Pointer to return the generation of the slot in.
+ *
+ * @returns The slot number if found, -1 otherwise.
+ */
+int
+cmsg_ps_shm_consumer_find (cmsg_ps_shm_ring *ring, const char *sun_path,
+                           uint32_t *generation)
+{
+    int slot;
+
+    cmsg_ps_shm_lock (ring);
+
+    for (slot = 0; slot < CMSG_PS_SHM_MAX_CONSUMERS; slot++)
+    {
+        if (ring->consumers[slot].pid != 0 &&
+            strcmp (ring->consumers[slot].sun_path, sun_path) == 0)
+        {
+            *generation = ring->consumers[slot].generation;
+            cmsg_ps_shm_unlock (ring);
+            return slot;
+        }
+    }
+
+    cmsg_ps_shm_unlock (ring);
+
+    return -1;
+}
+
+/**
+ * Check that a consumer slot is still claimed by the same subscriber.
+ *
+ * @param ring - The ring the slot is on.
+ * @param slot - The slot to check.
+ * @param generation - The generation of the slot when it was found.
+ *
+ * @returns true if the slot is still used by the same subscriber, false otherwise.
+ */
+bool
+cmsg_ps_shm_consumer_valid (cmsg_ps_shm_ring *ring, int slot, uint32_t generation)
+{
+    cmsg_ps_shm_consumer *consumer = &ring->consumers[slot];
+
+    return (__atomic_load_n (&consumer->pid, __ATOMIC_RELAXED) != 0 &&
+            __atomic_load_n (&consumer->generation, __ATOMIC_RELAXED) == generation);
+}
+
+/**
+ * Write a packet to the ring. The publisher never waits for subscribers, any
+ * subscriber that has not yet read the oldest records in the ring will detect
+ * that it has been lapped when it next reads.
+ *
+ * @param ring - The ring to write to.
+ * @param packet - The CMSG packet to write.
+ * @param packet_len - The length of the packet.
+ * @param consumers - Bit mask of the consumer slots the packet is for.
+ * @param wake - Pointer to return the bit mask of the consumer slots that are
+ *               waiting and must be woken to read the packet.
+ *
+ * @returns CMSG_RET_OK on success, CMSG_RET_ERR if the packet is too large for
+ *          the ring and must be sent to the subscribers directly.
+ */
+int32_t
+cmsg_ps_shm_write (cmsg_ps_shm_ring *ring, const uint8_t *packet, uint32_t packet_len,
+                   uint64_t consumers, uint64_t *wake)
+{
+    cmsg_ps_shm_record *record = NULL;
+    uint32_t length = CMSG_PS_SHM_ALIGN (sizeof (cmsg_ps_shm_record) + packet_len);
+    uint32_t offset;
+    uint32_t space;
+    uint64_t pos;
+    int slot;
+
+    *wake = 0;
+
+    if (length > CMSG_PS_SHM_MAX_RECORD_SIZE)
+    {
+        return CMSG_RET_ERR;
+    }
+
+    cmsg_ps_shm_lock (ring);
+
+    pos = ring->head;
+    offset = pos % CMSG_PS_SHM_DATA_SIZE;
+    space = CMSG_PS_SHM_DATA_SIZE - offset;
+
+    /* Records are never split across the end of the ring so that subscribers
+     * can unpack them in place. Skip the remaining space if required. */
+    if (length > space)
+    {
+        __atomic_store_n (&ring->reserved, pos + space + length, __ATOMIC_SEQ_CST);
+        if (space >= sizeof (cmsg_ps_shm_record))
+        {
+            record = (cmsg_ps_shm_record *) &ring->data[offset];
+            record->length = space;
+            record->packet_len = 0;
+            record->consumers = 0;
+        }
+        pos += space;
+        offset = 0;
+    }
+    else
+    {
+        __atomic_store_n (&ring->reserved, pos + length, __ATOMIC_SEQ_CST);
+    }
+
+    record = (cmsg_ps_shm_record *) &ring->data[offset];
+    record->length = length;
+    record->packet_len = packet_len;
+    record->consumers = consumers;
+    memcpy (record + 1, packet, packet_len);
+
+    __atomic_store_n (&ring->head, pos + length, __ATOMIC_SEQ_CST);
+
+    for (slot = 0; slot < CMSG_PS_SHM_MAX_CONSUMERS; slot++)
+    {
+        if ((consumers & CMSG_PS_SHM_CONSUMER_BIT (slot)) &&
+            __atomic_exchange_n (&ring->consumers[slot].waiting, 0, __ATOMIC_SEQ_CST))
+        {
+            *wake |= CMSG_PS_SHM_CONSUMER_BIT (slot);
+        }
+    }
+
+    cmsg_ps_shm_unlock (ring);
+
+    return CMSG_RET_OK;
+}
+
+/**
+ * Check whether the record at the given position may have been overwritten
+ * by a publisher.
+ *
+ * @param ring - The ring the record is in.
+ * @param pos - The position of the record.
+ *
+ * @returns true if the record may have been overwritten, false otherwise.
+ */
+static bool
+cmsg_ps_shm_overwritten (cmsg_ps_shm_ring *ring, uint64_t pos)
+{
+    return (__atomic_load_n (&ring->reserved, __ATOMIC_SEQ_CST) - pos >
+            CMSG_PS_SHM_DATA_SIZE);
+}
+
+/**
+ * Called by the server once a message has been unpacked from the ring and
+ * before it is invoked.
+ */
+static bool
+cmsg_ps_shm_read_check_func (void *user_data)
+{
+    cmsg_ps_shm_read_check *check = (cmsg_ps_shm_read_check *) user_data;
+
+    return !cmsg_ps_shm_overwritten (check->ring, check->pos);
+}
+
+/**
+ * Resynchronise a consumer that has been lapped by the publishers to the newest
+ * record in the ring. The messages that were overwritten are lost.
+ *
+ * @param ring - The ring the consumer is reading.
+ * @param consumer - The consumer that has been lapped.
+ */
+static void
+cmsg_ps_shm_resync (cmsg_ps_shm_ring *ring, cmsg_ps_shm_consumer *consumer)
+{
+    consumer->lagged++;
+    consumer->read_pos = __atomic_load_n (&ring->head, __ATOMIC_SEQ_CST);
+
+    CMSG_LOG_GEN_ERROR ("[%s] Subscriber fell behind the publishers, messages dropped "
+                        "(%llu times).", ring->service_name,
+                        (unsigned long long) consumer->lagged);
+}
+
+/**
+ * Read and process all of the records in the ring for a consumer. Each message
+ * is unpacked in place from the shared memory and invoked on the server of the
+ * subscriber. Once the ring has been drained the consumer is marked as waiting
+ * so that the next publisher to write a record for it wakes it.
+ *
+ * @param ring - The ring to read from.
+ * @param slot - The consumer slot of the subscriber.
+ * @param server - The server of the subscriber to invoke the messages on.
+ *
+ * @returns The number of messages processed.
+ */
+int
+cmsg_ps_shm_read (cmsg_ps_shm_ring *ring, int slot, cmsg_server *server)
+{
+    cmsg_ps_shm_consumer *consumer = &ring->consumers[slot];
+    cmsg_ps_shm_read_check check = { .ring = ring };
+    cmsg_ps_shm_record record;
+    uint32_t offset;
+    uint32_t space;
+    uint64_t head;
+    uint64_t pos;
+    int processed = 0;
+
+    __atomic_store_n (&consumer->waiting, 0, __ATOMIC_SEQ_CST);
+
+    while (true)
+    {
+        head = __atomic_load_n (&ring->head, __ATOMIC_SEQ_CST);
+        pos = consumer->read_pos;
+
+        if (pos == head)
+        {
+            /* Mark the consumer as waiting before checking the head one last time,
+             * a publisher either sees the flag or the record is seen here. */
+            __atomic_store_n (&consumer->waiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n (&ring->head, __ATOMIC_SEQ_CST) == pos)
+            {
+                break;
+            }
+            __atomic_store_n (&consumer->waiting, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        if (head - pos > CMSG_PS_SHM_DATA_SIZE)
+        {
+            cmsg_ps_shm_resync (ring, consumer);
+            continue;
+        }
+
+        offset = pos % CMSG_PS_SHM_DATA_SIZE;
+        space = CMSG_PS_SHM_DATA_SIZE - offset;
+        if (space < sizeof (cmsg_ps_shm_record))
+        {
+            consumer->read_pos = pos + space;
+            continue;
+        }
+
+        memcpy (&record, &ring->data[offset], sizeof (record));
+        if (cmsg_ps_shm_overwritten (ring, pos) ||
+            record.length < sizeof (record) || record.length > space ||
+            record.packet_len > record.length - sizeof (record))
+        {
+            cmsg_ps_shm_resync (ring, consumer);
+            continue;
+        }
+
+        if (record.packet_len != 0 && (record.consumers & CMSG_PS_SHM_CONSUMER_BIT (slot)))
+        {
+            check.pos = pos;
+            if (cmsg_server_packet_process (server, &ring->data[offset + sizeof (record)],
+                                            record.packet_len, cmsg_ps_shm_read_check_func,
+                                            &check) == CMSG_RET_OK)
+            {
+                processed++;
+            }
+            else if (cmsg_ps_shm_overwritten (ring, pos))
+            {
+                cmsg_ps_shm_resync (ring, consumer);
+                continue;
+            }
+        }
+
+        consumer->read_pos = pos + record.length;
+    }
+
+    return processed;
+}
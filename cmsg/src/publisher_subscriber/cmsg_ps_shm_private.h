@@ -0,0 +1,62 @@
+/**
+ * cmsg_ps_shm_private.h
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#ifndef __CMSG_PS_SHM_PRIVATE_H_
+#define __CMSG_PS_SHM_PRIVATE_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include "cmsg_server.h"
+
+/* The maximum number of subscribers of a service that can receive published
+ * messages from shared memory. Any further subscribers use their unix socket. */
+#define CMSG_PS_SHM_MAX_CONSUMERS 64
+
+/* The number of bytes of published messages held in the ring of a service. */
+#define CMSG_PS_SHM_DATA_SIZE (256 * 1024)
+
+/* The name of the service a ring is for is checked when attaching to it. */
+#define CMSG_PS_SHM_SERVICE_NAME_LEN 128
+
+#define CMSG_PS_SHM_CONSUMER_BIT(slot) (((uint64_t) 1) << (slot))
+
+typedef struct
+{
+    pid_t pid;                  /* Process of the subscriber, 0 if the slot is free */
+    uint32_t generation;        /* Incremented each time the slot is claimed */
+    uint32_t waiting;           /* Set while the subscriber needs to be woken */
+    uint64_t read_pos;          /* Position of the next record to read */
+    uint64_t lagged;            /* Number of times the subscriber fell behind */
+    char sun_path[sizeof (((struct sockaddr_un *) 0)->sun_path)];
+} cmsg_ps_shm_consumer;
+
+/* A multi-producer, multi-consumer ring of published messages for a service.
+ * Positions increase monotonically and are reduced modulo the data size to get
+ * an offset. Publishers never wait for subscribers, a subscriber that is lapped
+ * by the publishers detects this and resynchronises to the newest message. */
+typedef struct
+{
+    char service_name[CMSG_PS_SHM_SERVICE_NAME_LEN];
+    pthread_mutex_t lock;       /* Serialises publishers and slot allocation */
+    uint64_t head;              /* End of the last completely written record */
+    uint64_t reserved;          /* End of the record currently being written */
+    cmsg_ps_shm_consumer consumers[CMSG_PS_SHM_MAX_CONSUMERS];
+    uint8_t data[CMSG_PS_SHM_DATA_SIZE] __attribute__ ((aligned (8)));
+} cmsg_ps_shm_ring;
+
+void cmsg_ps_shm_ring_init (void *_ring);
+cmsg_ps_shm_ring *cmsg_ps_shm_ring_get (const char *service_name);
+int cmsg_ps_shm_consumer_add (cmsg_ps_shm_ring *ring, const char *sun_path);
+void cmsg_ps_shm_consumer_remove (cmsg_ps_shm_ring *ring, int slot);
+int cmsg_ps_shm_consumer_find (cmsg_ps_shm_ring *ring, const char *sun_path,
+                               uint32_t *generation);
+bool cmsg_ps_shm_consumer_valid (cmsg_ps_shm_ring *ring, int slot, uint32_t generation);
+int32_t cmsg_ps_shm_write (cmsg_ps_shm_ring *ring, const uint8_t *packet,
+                           uint32_t packet_len, uint64_t consumers, uint64_t *wake);
+int cmsg_ps_shm_read (cmsg_ps_shm_ring *ring, int slot, cmsg_server *server);
+
+#endif /* __CMSG_PS_SHM_PRIVATE_H_ */
@@ -64,6 +64,290 @@ cmsg_publisher_get_client_for_method (cmsg_publisher *publisher, const char *met
     return client;
 }
 
+/**
+ * Get the bit mask of the shared memory consumer slots subscribed to the given
+ * method, or optionally create it first if it does not already exist.
+ *
+ * @param publisher - The publisher to get the mask from.
+ * @param method_name - The method name to get the mask for.
+ * @param create - Whether to create the mask if one didn't already exist or not.
+ *
+ * @returns A pointer to the mask or NULL.
+ */
+static uint64_t *
+cmsg_publisher_shm_mask_get (cmsg_publisher *publisher, const char *method_name,
+                             bool create)
+{
+    uint64_t *mask = NULL;
+
+    mask = (uint64_t *) g_hash_table_lookup (publisher->shm_methods, method_name);
+    if (!mask && create)
+    {
+        mask = (uint64_t *) CMSG_CALLOC (1, sizeof (*mask));
+        if (mask)
+        {
+            g_hash_table_insert (publisher->shm_methods, CMSG_STRDUP (method_name), mask);
+        }
+    }
+
+    return mask;
+}
+
+/**
+ * Get a client to one of the shared memory subscribers of the given method.
+ *
+ * @param publisher - The publisher to get the client from.
+ * @param method_name - The method name to get the client for.
+ *
+ * @returns A pointer to the client or NULL if there are no shared memory
+ *          subscribers for the method.
+ */
+static cmsg_client *
+cmsg_publisher_shm_client_for_method (cmsg_publisher *publisher, const char *method_name)
+{
+    uint64_t *mask = NULL;
+    int slot;
+
+    if (!publisher->shm_ring)
+    {
+        return NULL;
+    }
+
+    mask = cmsg_publisher_shm_mask_get (publisher, method_name, false);
+    if (!mask)
+    {
+        return NULL;
+    }
+
+    for (slot = 0; slot < CMSG_PS_SHM_MAX_CONSUMERS; slot++)
+    {
+        if (*mask & CMSG_PS_SHM_CONSUMER_BIT (slot))
+        {
+            return publisher->shm_consumers[slot].client;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Stop publishing to the subscriber using a shared memory consumer slot.
+ *
+ * @param publisher - The publisher.
+ * @param slot - The consumer slot of the subscriber.
+ */
+static void
+cmsg_publisher_shm_consumer_clear (cmsg_publisher *publisher, int slot)
+{
+    cmsg_pub_shm_consumer *consumer = &publisher->shm_consumers[slot];
+    GHashTableIter iter;
+    gpointer value;
+    uint64_t *mask;
+
+    g_hash_table_iter_init (&iter, publisher->shm_methods);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        mask = (uint64_t *) value;
+        *mask &= ~CMSG_PS_SHM_CONSUMER_BIT (slot);
+        if (*mask == 0)
+        {
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+
+    cmsg_destroy_client_and_transport (consumer->client);
+    CMSG_FREE (consumer->sun_path);
+    memset (consumer, 0, sizeof (*consumer));
+}
+
+/**
+ * Add a subscriber that receives published messages from shared memory.
+ *
+ * @param publisher - The publisher to add the subscriber to.
+ * @param method_name - The name of the method the subscriber has subscribed to.
+ * @param transport_info - The transport information for the subscriber.
+ *
+ * @returns true if the subscriber receives messages from shared memory,
+ *          false if it must be added as a socket subscriber instead.
+ */
+static bool
+cmsg_publisher_shm_add_subscriber (cmsg_publisher *publisher, const char *method_name,
+                                   cmsg_transport_info *transport_info)
+{
+    cmsg_pub_shm_consumer *consumer = NULL;
+    cmsg_transport *transport = NULL;
+    const char *sun_path = NULL;
+    uint32_t generation = 0;
+    uint64_t *mask = NULL;
+    int slot;
+
+    if (transport_info->type != CMSG_TRANSPORT_INFO_TYPE_UNIX || !transport_info->unix_info)
+    {
+        return false;
+    }
+
+    sun_path = transport_info->unix_info->path;
+    slot = cmsg_ps_shm_consumer_find (publisher->shm_ring, sun_path, &generation);
+    if (slot < 0)
+    {
+        return false;
+    }
+
+    consumer = &publisher->shm_consumers[slot];
+    if (consumer->sun_path && (consumer->generation != generation ||
+                               strcmp (consumer->sun_path, sun_path) != 0))
+    {
+        /* The slot has been reused by a new subscriber */
+        cmsg_publisher_shm_consumer_clear (publisher, slot);
+    }
+
+    if (!consumer->sun_path)
+    {
+        transport = cmsg_transport_info_to_transport (transport_info);
+        consumer->client = cmsg_client_create (transport, &cmsg_psd_pub_descriptor);
+        if (!consumer->client)
+        {
+            cmsg_transport_destroy (transport);
+            return false;
+        }
+        consumer->sun_path = CMSG_STRDUP (sun_path);
+        consumer->generation = generation;
+    }
+
+    mask = cmsg_publisher_shm_mask_get (publisher, method_name, true);
+    if (mask && !(*mask & CMSG_PS_SHM_CONSUMER_BIT (slot)))
+    {
+        *mask |= CMSG_PS_SHM_CONSUMER_BIT (slot);
+        consumer->num_methods++;
+    }
+
+    return true;
+}
+
+/**
+ * Remove a subscriber that receives published messages from shared memory.
+ *
+ * @param publisher - The publisher to remove the subscriber from.
+ * @param method_name - The name of the method the subscriber was subscribed to.
+ * @param transport_info - The transport information for the subscriber.
+ *
+ * @returns true if the subscriber received messages from shared memory,
+ *          false if it is a socket subscriber.
+ */
+static bool
+cmsg_publisher_shm_remove_subscriber (cmsg_publisher *publisher, const char *method_name,
+                                      cmsg_transport_info *transport_info)
+{
+    cmsg_pub_shm_consumer *consumer = NULL;
+    uint64_t *mask = NULL;
+    int slot;
+
+    if (transport_info->type != CMSG_TRANSPORT_INFO_TYPE_UNIX || !transport_info->unix_info)
+    {
+        return false;
+    }
+
+    for (slot = 0; slot < CMSG_PS_SHM_MAX_CONSUMERS; slot++)
+    {
+        consumer = &publisher->shm_consumers[slot];
+        if (consumer->sun_path &&
+            strcmp (consumer->sun_path, transport_info->unix_info->path) == 0)
+        {
+            break;
+        }
+    }
+
+    if (slot == CMSG_PS_SHM_MAX_CONSUMERS)
+    {
+        return false;
+    }
+
+    mask = cmsg_publisher_shm_mask_get (publisher, method_name, false);
+    if (mask && (*mask & CMSG_PS_SHM_CONSUMER_BIT (slot)))
+    {
+        *mask &= ~CMSG_PS_SHM_CONSUMER_BIT (slot);
+        if (*mask == 0)
+        {
+            g_hash_table_remove (publisher->shm_methods, method_name);
+        }
+
+        consumer->num_methods--;
+        if (consumer->num_methods == 0)
+        {
+            cmsg_publisher_shm_consumer_clear (publisher, slot);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Publish a queued packet to the shared memory subscribers of its method. The
+ * packet is written to the shared memory ring once and only the subscribers that
+ * are waiting for messages are woken.
+ *
+ * @param publisher - The publisher.
+ * @param queue_entry - The queued packet to publish.
+ */
+static void
+cmsg_publisher_shm_send (cmsg_publisher *publisher, cmsg_pub_queue_entry *queue_entry)
+{
+    cmsg_header header;
+    uint64_t *mask = NULL;
+    uint64_t consumers = 0;
+    uint64_t wake = 0;
+    int slot;
+
+    mask = cmsg_publisher_shm_mask_get (publisher, queue_entry->method_name, false);
+    if (!mask)
+    {
+        return;
+    }
+
+    for (slot = 0; slot < CMSG_PS_SHM_MAX_CONSUMERS; slot++)
+    {
+        if ((*mask & CMSG_PS_SHM_CONSUMER_BIT (slot)) &&
+            cmsg_ps_shm_consumer_valid (publisher->shm_ring, slot,
+                                        publisher->shm_consumers[slot].generation))
+        {
+            consumers |= CMSG_PS_SHM_CONSUMER_BIT (slot);
+        }
+    }
+
+    if (consumers == 0)
+    {
+        return;
+    }
+
+    if (cmsg_ps_shm_write (publisher->shm_ring, queue_entry->packet,
+                           queue_entry->packet_len, consumers, &wake) != CMSG_RET_OK)
+    {
+        /* The packet is too large for the ring so send it to each subscriber */
+        for (slot = 0; slot < CMSG_PS_SHM_MAX_CONSUMERS; slot++)
+        {
+            if (consumers & CMSG_PS_SHM_CONSUMER_BIT (slot))
+            {
+                cmsg_client_send_bytes (publisher->shm_consumers[slot].client,
+                                        queue_entry->packet, queue_entry->packet_len,
+                                        queue_entry->method_name);
+            }
+        }
+        return;
+    }
+
+    header = cmsg_header_create (CMSG_MSG_TYPE_CONN_OPEN, 0, 0, CMSG_STATUS_CODE_UNSET);
+
+    for (slot = 0; slot < CMSG_PS_SHM_MAX_CONSUMERS; slot++)
+    {
+        if (wake & CMSG_PS_SHM_CONSUMER_BIT (slot))
+        {
+            cmsg_client_send_bytes (publisher->shm_consumers[slot].client,
+                                    (uint8_t *) &header, sizeof (header),
+                                    queue_entry->method_name);
+        }
+    }
+}
+
 /**
  * Queue a CMSG packet on the send queue of the publisher so that it
  * can be sent by the send thread.
@@ -147,6 +431,10 @@ cmsg_pub_invoke (ProtobufCService *service,
 
     subscribers_client = cmsg_publisher_get_client_for_method (publisher, method_name,
                                                                false);
+    if (!subscribers_client)
+    {
+        subscribers_client = cmsg_publisher_shm_client_for_method (publisher, method_name);
+    }
 
     /* If there are no subscribers for this method then simply return */
     if (!subscribers_client)
@@ -217,6 +505,12 @@ cmsg_publisher_add_subscriber (cmsg_publisher *publisher, const char *method_nam
     cmsg_transport *transport = NULL;
     cmsg_client *client = NULL;
 
+    if (publisher->shm_ring &&
+        cmsg_publisher_shm_add_subscriber (publisher, method_name, transport_info))
+    {
+        return;
+    }
+
     comp_client = cmsg_publisher_get_client_for_method (publisher, method_name, true);
 
     transport = cmsg_transport_info_to_transport (transport_info);
@@ -242,6 +536,12 @@ cmsg_publisher_remove_subscriber (cmsg_publisher *publisher, const char *method_
     cmsg_client *child_client = NULL;
     GList *list_entry = NULL;
 
+    if (publisher->shm_ring &&
+        cmsg_publisher_shm_remove_subscriber (publisher, method_name, transport_info))
+    {
+        return;
+    }
+
     comp_client = cmsg_publisher_get_client_for_method (publisher, method_name, false);
     if (comp_client)
     {
@@ -253,8 +553,7 @@ cmsg_publisher_remove_subscriber (cmsg_publisher *publisher, const char *method_
         if (list_entry)
         {
             child_client = (cmsg_client *) list_entry->data;
-            cmsg_composite_client_delete_child (comp_client, child_client);
-            cmsg_destroy_client_and_transport (child_client);
+            cmsg_composite_client_delete_and_destroy_child (comp_client, child_client);
         }
         cmsg_transport_destroy (transport);
     }
@@ -265,6 +564,27 @@ cmsg_publisher_remove_subscriber (cmsg_publisher *publisher, const char *method_
     }
 }
 
+/**
+ * Remove all of the subscribers from the publisher.
+ *
+ * @param publisher - The publisher to remove the subscribers from.
+ */
+static void
+cmsg_publisher_remove_all_subscribers (cmsg_publisher *publisher)
+{
+    int i;
+
+    g_hash_table_remove_all (publisher->subscribed_methods);
+
+    for (i = 0; i < CMSG_PS_SHM_MAX_CONSUMERS; i++)
+    {
+        if (publisher->shm_consumers[i].sun_path)
+        {
+            cmsg_publisher_shm_consumer_clear (publisher, i);
+        }
+    }
+}
+
 /**
  * Initialises the subscribers for this publisher. The publisher first
  * registers itself with cmsg_psd and is returned the current subscribers
@@ -282,13 +602,10 @@ cmsg_publisher_init_subscribers (cmsg_publisher *publisher)
     cmsg_subscription_method_entry *entry = NULL;
     cmsg_transport_info *transport = NULL;
     int i, j;
-    const char *service_name = NULL;
-
-    service_name = cmsg_service_name_get (publisher->descriptor);
 
     pthread_mutex_lock (&publisher->subscribed_methods_mutex);
 
-    ret = cmsg_ps_register_publisher (service_name, publisher->update_server,
+    ret = cmsg_ps_register_publisher (publisher->descriptor, publisher->update_server,
                                       &subscribed_methods);
     if (ret == CMSG_RET_OK)
     {
@@ -335,6 +652,11 @@ cmsg_publisher_process_send_queue (cmsg_publisher *publisher)
                                     queue_entry->method_name);
         }
 
+        if (publisher->shm_ring)
+        {
+            cmsg_publisher_shm_send (publisher, queue_entry);
+        }
+
         pthread_mutex_unlock (&publisher->subscribed_methods_mutex);
 
         cmsg_publisher_queue_entry_free (queue_entry);
@@ -408,11 +730,12 @@ cmsg_publisher_init_pthread_structures (cmsg_publisher *publisher)
  * Create a cmsg publisher for the given service.
  *
  * @param service - The service to create the publisher for.
+ * @param shm - Whether to publish to local subscribers using shared memory.
  *
  * @returns A pointer to the publisher on success, NULL otherwise.
  */
-cmsg_publisher *
-cmsg_publisher_create (const ProtobufCServiceDescriptor *service)
+static cmsg_publisher *
+_cmsg_publisher_create (const ProtobufCServiceDescriptor *service, bool shm)
 {
     const char *service_name = NULL;
     GHashTable *hash_table = NULL;
@@ -456,6 +779,22 @@ cmsg_publisher_create (const ProtobufCServiceDescriptor *service)
         return NULL;
     }
 
+    hash_table = g_hash_table_new_full (g_str_hash, g_str_equal, cmsg_free, cmsg_free);
+    publisher->shm_methods = hash_table;
+    if (!publisher->shm_methods)
+    {
+        CMSG_LOG_GEN_ERROR ("[%s] Unable to create publisher.", service_name);
+        cmsg_publisher_destroy (publisher);
+        return NULL;
+    }
+
+    if (shm)
+    {
+        /* Fall back to publishing on the sockets of the subscribers if the shared
+         * memory cannot be used */
+        publisher->shm_ring = cmsg_ps_shm_ring_get (service_name);
+    }
+
     publisher->update_server = cmsg_ps_create_publisher_update_server ();
     if (!publisher->update_server)
     {
@@ -504,6 +843,35 @@ cmsg_publisher_create (const ProtobufCServiceDescriptor *service)
     return publisher;
 }
 
+/**
+ * Create a cmsg publisher for the given service.
+ *
+ * @param service - The service to create the publisher for.
+ *
+ * @returns A pointer to the publisher on success, NULL otherwise.
+ */
+cmsg_publisher *
+cmsg_publisher_create (const ProtobufCServiceDescriptor *service)
+{
+    return _cmsg_publisher_create (service, false);
+}
+
+/**
+ * Create a cmsg publisher for the given service that publishes each message once
+ * to shared memory for the local subscribers created with
+ * 'cmsg_subscriber_create_unix_shm'. All other subscribers are published to
+ * as usual.
+ *
+ * @param service - The service to create the publisher for.
+ *
+ * @returns A pointer to the publisher on success, NULL otherwise.
+ */
+cmsg_publisher *
+cmsg_publisher_create_shm (const ProtobufCServiceDescriptor *service)
+{
+    return _cmsg_publisher_create (service, true);
+}
+
 /**
  * Destroy a cmsg publisher.
  *
@@ -512,6 +880,8 @@ cmsg_publisher_create (const ProtobufCServiceDescriptor *service)
 void
 cmsg_publisher_destroy (cmsg_publisher *publisher)
 {
+    int i;
+
     CMSG_ASSERT_RETURN_VOID (publisher != NULL);
 
     cmsg_ps_deregister_publisher (cmsg_service_name_get (publisher->descriptor),
@@ -538,6 +908,20 @@ cmsg_publisher_destroy (cmsg_publisher *publisher)
         publisher->subscribed_methods = NULL;
     }
 
+    for (i = 0; i < CMSG_PS_SHM_MAX_CONSUMERS; i++)
+    {
+        if (publisher->shm_consumers[i].sun_path)
+        {
+            cmsg_publisher_shm_consumer_clear (publisher, i);
+        }
+    }
+
+    if (publisher->shm_methods)
+    {
+        g_hash_table_unref (publisher->shm_methods);
+        publisher->shm_methods = NULL;
+    }
+
     cmsg_destroy_server_and_transport (publisher->update_server);
     pthread_mutex_destroy (&publisher->subscribed_methods_mutex);
     pthread_mutex_destroy (&publisher->send_queue_mutex);
@@ -602,8 +986,7 @@ cmsg_publisher_remove_subscribers_from_host (gpointer key, gpointer value,
 
     while ((client = cmsg_composite_client_lookup_by_tcp_ipv4_addr (comp_client, addr)))
     {
-        cmsg_composite_client_delete_child (comp_client, client);
-        cmsg_destroy_client_and_transport (client);
+        cmsg_composite_client_delete_and_destroy_child (comp_client, client);
     }
 
     return (cmsg_composite_client_num_children (comp_client) == 0);
@@ -639,3 +1022,41 @@ cmsg_psd_update_impl_host_removal (const void *service, const cmsg_psd_host_info
 
     pthread_mutex_unlock (&publisher->subscribed_methods_mutex);
 }
+
+void
+cmsg_psd_update_impl_subscriptions_resync (const void *service,
+                                           const cmsg_subscription_methods *recv_msg)
+{
+    cmsg_publisher *publisher = NULL;
+    const cmsg_server *server;
+    cmsg_subscription_method_entry *entry = NULL;
+    cmsg_transport_info *transport = NULL;
+    int i, j;
+
+    server = cmsg_server_from_service_get (service);
+    if (!server || server->parent.object_type != CMSG_OBJ_TYPE_PUB)
+    {
+        CMSG_LOG_GEN_ERROR ("Failed to update subscriptions for CMSG publisher.");
+        cmsg_psd_update_server_subscriptions_resyncSend (service);
+        return;
+    }
+
+    publisher = (cmsg_publisher *) server->parent.object;
+
+    /* cmsg_psd has dropped updates for the publisher so replace the subscribers
+     * rather than trying to work out what has changed */
+    pthread_mutex_lock (&publisher->subscribed_methods_mutex);
+
+    cmsg_publisher_remove_all_subscribers (publisher);
+    CMSG_REPEATED_FOREACH (recv_msg, methods, entry, i)
+    {
+        CMSG_REPEATED_FOREACH (entry, transports, transport, j)
+        {
+            cmsg_publisher_add_subscriber (publisher, entry->method_name, transport);
+        }
+    }
+
+    pthread_mutex_unlock (&publisher->subscribed_methods_mutex);
+
+    cmsg_psd_update_server_subscriptions_resyncSend (service);
+}
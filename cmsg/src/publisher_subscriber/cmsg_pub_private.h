@@ -9,6 +9,7 @@
 
 #include "cmsg_server.h"
 #include "cmsg_client.h"
+#include "cmsg_ps_shm_private.h"
 
 typedef struct
 {
@@ -16,6 +17,14 @@ typedef struct
     cmsg_client *comp_client;   /* Client to subscribers of this method */
 } subscribed_method_entry;
 
+typedef struct
+{
+    char *sun_path;             /* NULL if the slot is not used by this publisher */
+    uint32_t generation;        /* Generation of the slot when it was found */
+    uint32_t num_methods;       /* Number of methods the subscriber is subscribed to */
+    cmsg_client *client;        /* Client used to wake the subscriber */
+} cmsg_pub_shm_consumer;
+
 struct cmsg_publisher
 {
     //this is a hack to get around a check when a client method is called
@@ -40,6 +49,12 @@ struct cmsg_publisher
     cmsg_server *update_server;
     pthread_t update_thread;
     bool update_thread_running;
+
+    /* Only used by publishers that publish to local subscribers using shared memory.
+     * Protected by 'subscribed_methods_mutex'. */
+    cmsg_ps_shm_ring *shm_ring;
+    GHashTable *shm_methods;    /* Method name -> bit mask of consumer slots */
+    cmsg_pub_shm_consumer shm_consumers[CMSG_PS_SHM_MAX_CONSUMERS];
 };
 
 #endif /* __CMSG_PUB_PRIVATE_H_ */
@@ -13,8 +13,60 @@
 #include "cmsg_error.h"
 #include "transport/cmsg_transport_private.h"
 
+/**
+ * Message processor for the unix server of a subscriber that receives local
+ * messages from shared memory. Any message received on the server (including
+ * the empty message publishers use to wake the subscriber) first causes all of
+ * the messages for the subscriber in shared memory to be processed.
+ */
+static int32_t
+cmsg_sub_shm_message_processor (int socket, cmsg_server_request *server_request,
+                                cmsg_server *server, uint8_t *buffer_data)
+{
+    cmsg_subscriber *subscriber = (cmsg_subscriber *) server->parent.object;
+
+    cmsg_ps_shm_read (subscriber->shm_ring, subscriber->shm_slot, server);
+
+    return subscriber->message_processor (socket, server_request, server, buffer_data);
+}
+
+/**
+ * Set up a subscriber to receive local messages from shared memory. If this is
+ * not possible the subscriber receives them on its unix server as usual.
+ *
+ * @param subscriber - The subscriber.
+ * @param service_name - The name of the service being subscribed to.
+ * @param sun_path - The path of the unix server of the subscriber.
+ */
+static void
+cmsg_sub_shm_init (cmsg_subscriber *subscriber, const char *service_name,
+                   const char *sun_path)
+{
+    cmsg_server *server = subscriber->local_server;
+
+    subscriber->shm_ring = cmsg_ps_shm_ring_get (service_name);
+    if (!subscriber->shm_ring)
+    {
+        return;
+    }
+
+    subscriber->shm_slot = cmsg_ps_shm_consumer_add (subscriber->shm_ring, sun_path);
+    if (subscriber->shm_slot < 0)
+    {
+        CMSG_LOG_GEN_INFO ("[%s] No free shared memory slot for subscriber.",
+                           service_name);
+        subscriber->shm_ring = NULL;
+        return;
+    }
+
+    server->parent.object_type = CMSG_OBJ_TYPE_SUB;
+    server->parent.object = subscriber;
+    subscriber->message_processor = server->message_processor;
+    server->message_processor = cmsg_sub_shm_message_processor;
+}
+
 static cmsg_subscriber *
-cmsg_sub_new (cmsg_transport *tcp_transport, const ProtobufCService *pub_service)
+cmsg_sub_new (cmsg_transport *tcp_transport, const ProtobufCService *pub_service, bool shm)
 {
     cmsg_transport *unix_transport = NULL;
 
@@ -43,6 +95,12 @@ cmsg_sub_new (cmsg_transport *tcp_transport, const ProtobufCService *pub_service
         return NULL;
     }
 
+    if (shm)
+    {
+        cmsg_sub_shm_init (subscriber, cmsg_service_name_get (pub_service->descriptor),
+                           unix_transport->config.socket.sockaddr.un.sun_path);
+    }
+
     if (tcp_transport)
     {
         subscriber->remote_server = cmsg_server_new (tcp_transport, pub_service);
@@ -50,6 +108,10 @@ cmsg_sub_new (cmsg_transport *tcp_transport, const ProtobufCService *pub_service
         {
             CMSG_LOG_GEN_ERROR ("[%s%s] Unable to create subscriber tcp server.",
                                 pub_service->descriptor->name, tcp_transport->tport_id);
+            if (subscriber->shm_ring)
+            {
+                cmsg_ps_shm_consumer_remove (subscriber->shm_ring, subscriber->shm_slot);
+            }
             cmsg_destroy_server_and_transport (subscriber->local_server);
             CMSG_FREE (subscriber);
             return NULL;
@@ -215,7 +277,7 @@ cmsg_subscriber_create_tcp (const char *server_name, struct in_addr addr,
         return NULL;
     }
 
-    subscriber = cmsg_sub_new (transport, service);
+    subscriber = cmsg_sub_new (transport, service, false);
     if (subscriber == NULL)
     {
         cmsg_transport_destroy (transport);
@@ -232,7 +294,33 @@ cmsg_subscriber_create_unix (const ProtobufCService *service)
 {
     cmsg_subscriber *subscriber = NULL;
 
-    subscriber = cmsg_sub_new (NULL, service);
+    subscriber = cmsg_sub_new (NULL, service, false);
+    if (!subscriber)
+    {
+        CMSG_LOG_GEN_ERROR ("Failed to initialize CMSG subscriber for %s",
+                            cmsg_service_name_get (service->descriptor));
+        return NULL;
+    }
+
+    return subscriber;
+}
+
+/**
+ * Create a subscriber for local subscriptions that receives the messages
+ * published by publishers created with 'cmsg_publisher_create_shm' directly
+ * from shared memory. Messages from all other publishers are received on the
+ * unix server of the subscriber as usual.
+ *
+ * @param service - The service to subscribe to.
+ *
+ * @returns A pointer to the subscriber on success, NULL otherwise.
+ */
+cmsg_subscriber *
+cmsg_subscriber_create_unix_shm (const ProtobufCService *service)
+{
+    cmsg_subscriber *subscriber = NULL;
+
+    subscriber = cmsg_sub_new (NULL, service, true);
     if (!subscriber)
     {
         CMSG_LOG_GEN_ERROR ("Failed to initialize CMSG subscriber for %s",
@@ -251,6 +339,10 @@ cmsg_subscriber_destroy (cmsg_subscriber *subscriber)
         if (subscriber->local_server)
         {
             cmsg_ps_remove_subscriber (subscriber->local_server);
+            if (subscriber->shm_ring)
+            {
+                cmsg_ps_shm_consumer_remove (subscriber->shm_ring, subscriber->shm_slot);
+            }
             cmsg_destroy_server_and_transport (subscriber->local_server);
         }
         if (subscriber->remote_server)
@@ -8,11 +8,17 @@
 #define __CMSG_SUB_PRIVATE_H_
 
 #include "cmsg_server.h"
+#include "cmsg_ps_shm_private.h"
 
 struct cmsg_subscriber
 {
     cmsg_server *local_server;  /* The unix server used for local subscriptions */
     cmsg_server *remote_server; /* The tcp server used for remote subscriptions */
+
+    /* Only used by subscribers that receive local messages from shared memory */
+    cmsg_ps_shm_ring *shm_ring;
+    int shm_slot;
+    server_message_processor_f message_processor;
 };
 
 #endif /* __CMSG_SUB_PRIVATE_H_ */
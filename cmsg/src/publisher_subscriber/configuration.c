@@ -40,6 +40,10 @@ cmsg_psd_configuration_impl_add_subscription (const void *service,
         /* The memory of the message was stolen so do not free the message. */
         cmsg_server_app_owns_current_msg_set (server);
     }
+    else
+    {
+        data_sync_publishers (recv_msg->service);
+    }
     cmsg_psd_configuration_server_add_subscriptionSend (service);
 }
 
@@ -51,6 +55,7 @@ cmsg_psd_configuration_impl_remove_subscription (const void *service,
                                                  const cmsg_subscription_info *recv_msg)
 {
     data_remove_subscription (recv_msg);
+    data_sync_publishers (recv_msg->service);
     cmsg_psd_configuration_server_remove_subscriptionSend (service);
 }
 
@@ -62,12 +67,16 @@ cmsg_psd_configuration_impl_remove_subscriber (const void *service,
                                                const cmsg_service_info *recv_msg)
 {
     data_remove_subscriber (recv_msg->service, recv_msg->server_info);
+    data_sync_publishers (recv_msg->service);
     cmsg_psd_configuration_server_remove_subscriberSend (service);
 }
 
 /**
  * Registers a new publisher with cmsg_psd and returns the methods that currently
- * have subscriptions for the service the publisher is publishing for.
+ * have subscriptions for the service the publisher is publishing for. This is
+ * used by publishers that predate 'add_publisher_v2', which do not tell cmsg_psd
+ * the methods they publish (so prefix subscriptions are only expanded for them to
+ * the methods published by other publishers of the service).
  */
 void
 cmsg_psd_configuration_impl_add_publisher (const void *service,
@@ -75,7 +84,7 @@ cmsg_psd_configuration_impl_add_publisher (const void *service,
 {
     cmsg_subscription_methods send_msg = CMSG_SUBSCRIPTION_METHODS_INIT;
 
-    data_add_publisher (recv_msg->service, recv_msg->server_info);
+    data_add_publisher (recv_msg->service, recv_msg->server_info, NULL, 0);
 
     data_get_subscription_info_for_service (recv_msg->service, &send_msg);
 
@@ -83,6 +92,33 @@ cmsg_psd_configuration_impl_add_publisher (const void *service,
     data_get_subscription_info_for_service_free (&send_msg);
 }
 
+/**
+ * Registers a new publisher with cmsg_psd, along with the methods it publishes,
+ * and returns the methods that currently have subscriptions for the service the
+ * publisher is publishing for.
+ */
+void
+cmsg_psd_configuration_impl_add_publisher_v2 (const void *service,
+                                              const cmsg_psd_publisher_info *recv_msg)
+{
+    cmsg_subscription_methods send_msg = CMSG_SUBSCRIPTION_METHODS_INIT;
+    const cmsg_service_info *service_info = recv_msg->service_info;
+
+    if (!service_info)
+    {
+        cmsg_psd_configuration_server_add_publisher_v2Send (service, &send_msg);
+        return;
+    }
+
+    data_add_publisher (service_info->service, service_info->server_info,
+                        recv_msg->methods, recv_msg->n_methods);
+
+    data_get_subscription_info_for_service (service_info->service, &send_msg);
+
+    cmsg_psd_configuration_server_add_publisher_v2Send (service, &send_msg);
+    data_get_subscription_info_for_service_free (&send_msg);
+}
+
 /**
  * Unregisters a publisher from cmsg_psd.
  */
@@ -12,15 +12,18 @@
 #include <cmsg/cmsg_glib_helpers.h>
 #include "data.h"
 #include "remote_sync.h"
+#include "publisher_update.h"
+#include "method_trie.h"
 #include "transport/cmsg_transport_private.h"
-#include <cmsg/cmsg_composite_client.h>
-#include "cmsg_client_private.h"
-#include "update_api_auto.h"
 
 typedef struct
 {
-    GList *methods;
-    cmsg_client *comp_client;   /* Client to publishers of this service */
+    GHashTable *methods;        /* Method name -> 'method_data_entry' */
+    GHashTable *subscribers;    /* Transport info -> 'subscriber_data_entry' */
+    const char *service;        /* The key of this entry in the hash table */
+    GHashTable *publishers;     /* Transport info -> 'publisher_update_queue' */
+    GHashTable *published;      /* Transport info -> set of method names published */
+    method_trie *trie;          /* Published method names and prefix subscriptions */
     const cmsg_sl_info *sl_info;
     GIOChannel *event_channel;  /* Listen to sld event notification */
     guint event_source_id;
@@ -29,29 +32,111 @@ typedef struct
 typedef struct
 {
     char *method_name;
-    GList *transports;
+    GHashTable *transports;     /* Transport info -> 'subscriber_data_entry' */
     service_data_entry *service_entry;
 } method_data_entry;
 
+typedef struct
+{
+    cmsg_transport_info *transport_info;
+    GHashTable *methods;        /* Set of 'method_data_entry' subscribed to */
+    GHashTable *patterns;       /* Set of method name prefixes subscribed to */
+    service_data_entry *service_entry;
+    uint32_t addr;              /* The address of a remote (IPv4 TCP) subscriber */
+    bool remote;
+} subscriber_data_entry;
+
+typedef struct
+{
+    char *service;
+    cmsg_transport_info *transport_info;
+    GList *links;               /* Links in 'remote_subscriptions_list' */
+} remote_subscriber_entry;
+
+/* A subscription to a method name ending with this character is a subscription to
+ * all methods with the preceding prefix (e.g. "link_*" or "*" for all methods). */
+#define METHOD_PATTERN_WILDCARD '*'
+
 GHashTable *local_subscriptions_table = NULL;
+static GHashTable *host_subscribers_table = NULL;
 static GList *remote_subscriptions_list = NULL;
+static GHashTable *remote_subscribers_table = NULL;
+
+/**
+ * Get the IPv4 address of a TCP subscriber from its transport information.
+ *
+ * @param transport_info - The transport information of the subscriber.
+ * @param addr - Pointer to store the address in.
+ *
+ * @returns true if the subscriber is an IPv4 TCP subscriber, false otherwise.
+ */
+static bool
+transport_info_ipv4_addr_get (const cmsg_transport_info *transport_info, uint32_t *addr)
+{
+    const cmsg_tcp_transport_info *tcp_info = NULL;
+
+    if (transport_info->type != CMSG_TRANSPORT_INFO_TYPE_TCP)
+    {
+        return false;
+    }
+
+    tcp_info = transport_info->tcp_info;
+    if (!tcp_info->ipv4 || tcp_info->addr.len != sizeof (*addr))
+    {
+        return false;
+    }
+
+    memcpy (addr, tcp_info->addr.data, sizeof (*addr));
+    return true;
+}
 
 /**
- * Called for each entry in the methods list of a service entry.
- * Simply frees all memory used by the method entry.
+ * Frees all memory used by the given method entry.
  *
- * @param data - The entry to free.
+ * @param data - The method entry to free.
  */
 static void
-service_entry_free_methods (gpointer data)
+method_entry_free (gpointer data)
 {
     method_data_entry *entry = (method_data_entry *) data;
 
-    g_list_free_full (entry->transports, (GDestroyNotify) cmsg_transport_info_free);
+    g_hash_table_unref (entry->transports);
     CMSG_FREE (entry->method_name);
     CMSG_FREE (entry);
 }
 
+/**
+ * Frees all memory used by the given subscriber entry and removes it from
+ * the index of subscribers on remote hosts.
+ *
+ * @param data - The subscriber entry to free.
+ */
+static void
+subscriber_entry_free (gpointer data)
+{
+    subscriber_data_entry *entry = (subscriber_data_entry *) data;
+    GHashTable *host_subscribers = NULL;
+
+    if (entry->remote && host_subscribers_table)
+    {
+        host_subscribers = g_hash_table_lookup (host_subscribers_table,
+                                                GUINT_TO_POINTER (entry->addr));
+        if (host_subscribers)
+        {
+            g_hash_table_remove (host_subscribers, entry);
+            if (g_hash_table_size (host_subscribers) == 0)
+            {
+                g_hash_table_remove (host_subscribers_table, GUINT_TO_POINTER (entry->addr));
+            }
+        }
+    }
+
+    g_hash_table_unref (entry->methods);
+    g_hash_table_unref (entry->patterns);
+    cmsg_transport_info_free (entry->transport_info);
+    CMSG_FREE (entry);
+}
+
 /**
  * Frees all memory used by the given service entry.
  *
@@ -70,14 +155,137 @@ service_entry_free (gpointer data)
         cmsg_service_listener_unlisten (entry->sl_info);
     }
 
-    g_list_free_full (entry->methods, service_entry_free_methods);
+    g_hash_table_unref (entry->methods);
     entry->methods = NULL;
-    cmsg_composite_client_free_all_children (entry->comp_client);
-    cmsg_client_destroy (entry->comp_client);
+    g_hash_table_unref (entry->subscribers);
+    entry->subscribers = NULL;
+    g_hash_table_unref (entry->publishers);
+    entry->publishers = NULL;
+    g_hash_table_unref (entry->published);
+    entry->published = NULL;
+    method_trie_destroy (entry->trie);
 
     CMSG_FREE (entry);
 }
 
+/**
+ * Frees all memory used by the given remote subscriber entry. The subscriptions
+ * themselves are owned by 'remote_subscriptions_list'.
+ *
+ * @param data - The remote subscriber entry to free.
+ */
+static void
+remote_subscriber_entry_free (gpointer data)
+{
+    remote_subscriber_entry *entry = (remote_subscriber_entry *) data;
+
+    g_list_free (entry->links);
+    if (entry->transport_info)
+    {
+        cmsg_transport_info_free (entry->transport_info);
+    }
+    CMSG_FREE (entry->service);
+    CMSG_FREE (entry);
+}
+
+/**
+ * Hash function for the remote subscriber entries, hashing the service name
+ * and transport information of the subscriber.
+ */
+static guint
+remote_subscriber_hash (gconstpointer key)
+{
+    const remote_subscriber_entry *entry = (const remote_subscriber_entry *) key;
+    guint hash = 0;
+
+    if (entry->service)
+    {
+        hash = g_str_hash (entry->service);
+    }
+    if (entry->transport_info)
+    {
+        hash ^= cmsg_transport_info_hash (entry->transport_info);
+    }
+
+    return hash;
+}
+
+/**
+ * Equality function for the remote subscriber entries.
+ */
+static gboolean
+remote_subscriber_equal (gconstpointer a, gconstpointer b)
+{
+    const remote_subscriber_entry *entry_a = (const remote_subscriber_entry *) a;
+    const remote_subscriber_entry *entry_b = (const remote_subscriber_entry *) b;
+
+    if (g_strcmp0 (entry_a->service, entry_b->service) != 0)
+    {
+        return FALSE;
+    }
+
+    if (!entry_a->transport_info || !entry_b->transport_info)
+    {
+        return entry_a->transport_info == entry_b->transport_info;
+    }
+
+    return cmsg_transport_info_compare (entry_a->transport_info, entry_b->transport_info);
+}
+
+/**
+ * Gets the 'remote_subscriber_entry' structure for the given subscriber
+ * or potentially create one if it doesn't already exist.
+ *
+ * @param service - The name of the service.
+ * @param transport_info - The transport information of the subscriber.
+ * @param create - Whether to create an entry if one didn't already exist or not.
+ *
+ * @returns A pointer to the related 'remote_subscriber_entry' structure.
+ */
+static remote_subscriber_entry *
+get_remote_subscriber_entry_or_create (const char *service,
+                                       const cmsg_transport_info *transport_info,
+                                       bool create)
+{
+    remote_subscriber_entry *entry = NULL;
+    remote_subscriber_entry key = {
+        .service = (char *) service,
+        .transport_info = (cmsg_transport_info *) transport_info,
+    };
+
+    entry = (remote_subscriber_entry *) g_hash_table_lookup (remote_subscribers_table,
+                                                             &key);
+    if (!entry && create)
+    {
+        entry = CMSG_CALLOC (1, sizeof (remote_subscriber_entry));
+        entry->service = service ? CMSG_STRDUP (service) : NULL;
+        entry->transport_info =
+            transport_info ? cmsg_transport_info_copy (transport_info) : NULL;
+        g_hash_table_add (remote_subscribers_table, entry);
+    }
+
+    return entry;
+}
+
+/**
+ * Remove a link from 'remote_subscriptions_list' and from the remote subscriber
+ * entry that it belongs to. The subscriber entry is removed once it is left empty.
+ *
+ * @param subscriber_entry - The remote subscriber entry of the subscription.
+ * @param link - The link of the subscription in 'remote_subscriptions_list'.
+ */
+static void
+remote_subscription_link_remove (remote_subscriber_entry *subscriber_entry, GList *link)
+{
+    subscriber_entry->links = g_list_remove (subscriber_entry->links, link);
+    remote_subscriptions_list = g_list_delete_link (remote_subscriptions_list, link);
+
+    if (!subscriber_entry->links)
+    {
+        g_hash_table_remove (remote_subscribers_table, subscriber_entry);
+    }
+}
+
 /**
  * Handle events from cmsg service listener daemon.
  *
@@ -146,9 +354,24 @@ get_service_entry_or_create (const char *service, bool create)
     if (!entry && create)
     {
         entry = CMSG_CALLOC (1, sizeof (service_data_entry));
-        entry->comp_client = cmsg_composite_client_new (CMSG_DESCRIPTOR (cmsg_psd, update));
+        entry->publishers = g_hash_table_new_full (cmsg_transport_info_hash,
+                                                   cmsg_transport_info_equal,
+                                                   (GDestroyNotify) cmsg_transport_info_free,
+                                                   (GDestroyNotify)
+                                                   publisher_update_queue_destroy);
+        entry->published = g_hash_table_new_full (cmsg_transport_info_hash,
+                                                  cmsg_transport_info_equal,
+                                                  (GDestroyNotify) cmsg_transport_info_free,
+                                                  (GDestroyNotify) g_hash_table_unref);
+        entry->trie = method_trie_new ();
+        entry->methods = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                                method_entry_free);
+        entry->subscribers = g_hash_table_new_full (cmsg_transport_info_hash,
+                                                    cmsg_transport_info_equal, NULL,
+                                                    subscriber_entry_free);
 
         service_key = CMSG_STRDUP (service);
+        entry->service = service_key;
 
         /* Register interest for event from service listener daemon regarding this service */
         entry->sl_info =
@@ -169,58 +392,48 @@ get_service_entry_or_create (const char *service, bool create)
 
 /**
  * Update the publishers registered for this service with the method
- * subscription change.
+ * subscription change. The update is queued for each publisher and sent
+ * asynchronously.
  *
- * @param comp_client - The composite client connected to the publishers.
+ * @param service_entry - The service entry the publishers are registered with.
  * @param method_name - The name of the method that has changed.
  * @param transport_info - The transport information of the subscriber
  * @param added - True if the method added a subscriber, false if it removed one.
  */
 static void
-update_publishers_with_method_change (cmsg_client *comp_client, const char *method_name,
+update_publishers_with_method_change (service_data_entry *service_entry,
+                                      const char *method_name,
                                       const cmsg_transport_info *transport_info, bool added)
 {
-    cmsg_psd_subscription_update send_msg = CMSG_PSD_SUBSCRIPTION_UPDATE_INIT;
-
-    CMSG_SET_FIELD_PTR (&send_msg, method_name, (char *) method_name);
-    CMSG_SET_FIELD_PTR (&send_msg, transport, (cmsg_transport_info *) transport_info);
-    CMSG_SET_FIELD_VALUE (&send_msg, added, added);
+    GHashTableIter iter;
+    gpointer value = NULL;
 
-    cmsg_psd_update_api_subscription_change (comp_client, &send_msg);
+    g_hash_table_iter_init (&iter, service_entry->publishers);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        publisher_update_queue_subscription_change ((publisher_update_queue *) value,
+                                                    method_name, transport_info, added);
+    }
 }
 
 /**
  * Update the publishers registered for this service with the host removal.
+ * The update is queued for each publisher and sent asynchronously.
  *
- * @param comp_client - The composite client connected to the publishers.
+ * @param service_entry - The service entry the publishers are registered with.
  * @param addr - The address specifying the host that has been removed.
  */
 static void
-update_publishers_with_host_removal (cmsg_client *comp_client, uint32_t addr)
+update_publishers_with_host_removal (service_data_entry *service_entry, uint32_t addr)
 {
-    cmsg_psd_host_info send_msg = CMSG_PSD_HOST_INFO_INIT;
-
-    CMSG_SET_FIELD_VALUE (&send_msg, addr, addr);
-
-    cmsg_psd_update_api_host_removal (comp_client, &send_msg);
-}
+    GHashTableIter iter;
+    gpointer value = NULL;
 
-/**
- * Helper function for use with 'g_list_find_custom'. Specifically compares a
- * 'method_data_entry' structure with a method name string to see if they match.
- *
- * @param a - The 'method_data_entry' structure to use in the comparison.
- * @param b - The method name string to use in the comparison.
- *
- * @returns 0 if they match, -1 otherwise.
- */
-static gint
-method_entry_compare (gconstpointer a, gconstpointer b)
-{
-    method_data_entry *entry = (method_data_entry *) a;
-    const char *method_name = (const char *) b;
-
-    return strcmp (entry->method_name, method_name);
+    g_hash_table_iter_init (&iter, service_entry->publishers);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        publisher_update_queue_host_removal ((publisher_update_queue *) value, addr);
+    }
 }
 
 /**
@@ -238,25 +451,325 @@ get_method_entry_or_create (service_data_entry *service_entry, const char *metho
                             bool create)
 {
     method_data_entry *entry = NULL;
-    GList *list_entry = NULL;
 
-    list_entry = g_list_find_custom (service_entry->methods, method, method_entry_compare);
-    if (list_entry)
-    {
-        entry = (method_data_entry *) list_entry->data;
-    }
-    else if (create)
+    entry = (method_data_entry *) g_hash_table_lookup (service_entry->methods, method);
+    if (!entry && create)
     {
         entry = CMSG_CALLOC (1, sizeof (method_data_entry));
         entry->service_entry = service_entry;
         entry->method_name = CMSG_STRDUP (method);
-        entry->transports = NULL;
-        service_entry->methods = g_list_prepend (service_entry->methods, entry);
+        entry->transports = g_hash_table_new (cmsg_transport_info_hash,
+                                              cmsg_transport_info_equal);
+        g_hash_table_insert (service_entry->methods, entry->method_name, entry);
+    }
+
+    return entry;
+}
+
+/**
+ * Gets the 'subscriber_data_entry' structure for the given subscriber
+ * or potentially create one if it doesn't already exist.
+ *
+ * @param service_entry - The service entry to get the subscriber entry from.
+ * @param transport_info - The transport information of the subscriber.
+ * @param create - Whether to create an entry if one didn't already exist or not.
+ *
+ * @returns A pointer to the related 'subscriber_data_entry' structure.
+ */
+static subscriber_data_entry *
+get_subscriber_entry_or_create (service_data_entry *service_entry,
+                                const cmsg_transport_info *transport_info, bool create)
+{
+    subscriber_data_entry *entry = NULL;
+    GHashTable *host_subscribers = NULL;
+
+    entry = (subscriber_data_entry *) g_hash_table_lookup (service_entry->subscribers,
+                                                           transport_info);
+    if (!entry && create)
+    {
+        entry = CMSG_CALLOC (1, sizeof (subscriber_data_entry));
+        entry->service_entry = service_entry;
+        entry->transport_info = cmsg_transport_info_copy (transport_info);
+        entry->methods = g_hash_table_new (g_direct_hash, g_direct_equal);
+        entry->patterns = g_hash_table_new_full (g_str_hash, g_str_equal, cmsg_free, NULL);
+        g_hash_table_insert (service_entry->subscribers, entry->transport_info, entry);
+
+        entry->remote = transport_info_ipv4_addr_get (transport_info, &entry->addr);
+        if (entry->remote)
+        {
+            host_subscribers = g_hash_table_lookup (host_subscribers_table,
+                                                    GUINT_TO_POINTER (entry->addr));
+            if (!host_subscribers)
+            {
+                host_subscribers = g_hash_table_new (g_direct_hash, g_direct_equal);
+                g_hash_table_insert (host_subscribers_table,
+                                     GUINT_TO_POINTER (entry->addr), host_subscribers);
+            }
+            g_hash_table_add (host_subscribers, entry);
+        }
     }
 
     return entry;
 }
 
+/**
+ * Remove the given service entry from the database if it no longer has
+ * any subscriptions or publishers.
+ *
+ * @param service_entry - The service entry to check.
+ *
+ * @returns true if the service entry was removed, false otherwise.
+ */
+static bool
+data_remove_service_entry_if_empty (service_data_entry *service_entry)
+{
+    if (g_hash_table_size (service_entry->methods) == 0 &&
+        method_trie_num_patterns (service_entry->trie) == 0 &&
+        g_hash_table_size (service_entry->publishers) == 0)
+    {
+        g_hash_table_remove (local_subscriptions_table, service_entry->service);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Remove the given subscriber entry from the database if it no longer has
+ * any subscriptions.
+ *
+ * @param subscriber_entry - The subscriber entry to check.
+ */
+static void
+data_remove_subscriber_entry_if_empty (subscriber_data_entry *subscriber_entry)
+{
+    service_data_entry *service_entry = subscriber_entry->service_entry;
+
+    if (g_hash_table_size (subscriber_entry->methods) == 0 &&
+        g_hash_table_size (subscriber_entry->patterns) == 0)
+    {
+        g_hash_table_remove (service_entry->subscribers, subscriber_entry->transport_info);
+    }
+}
+
+/**
+ * Check whether the given subscriber is subscribed to a method, either
+ * directly or through a prefix.
+ *
+ * @param subscriber_entry - The subscriber.
+ * @param method_name - The name of the method.
+ *
+ * @returns true if the subscriber is subscribed to the method, false otherwise.
+ */
+static bool
+data_subscriber_is_subscribed (subscriber_data_entry *subscriber_entry,
+                               const char *method_name)
+{
+    service_data_entry *service_entry = subscriber_entry->service_entry;
+    method_data_entry *method_entry = NULL;
+
+    method_entry = g_hash_table_lookup (service_entry->methods, method_name);
+    if (method_entry && g_hash_table_contains (subscriber_entry->methods, method_entry))
+    {
+        return true;
+    }
+
+    return method_trie_matches (service_entry->trie, method_name, subscriber_entry);
+}
+
+typedef struct
+{
+    subscriber_data_entry *subscriber_entry;
+    bool added;
+} pattern_change_data;
+
+/**
+ * Helper function called for each known method matching a prefix that a subscriber
+ * has subscribed to or unsubscribed from. Notifies the publishers if the subscriber
+ * is not (or no longer) otherwise subscribed to the method.
+ *
+ * @param data - The method name.
+ * @param user_data - The 'pattern_change_data' structure for the change.
+ */
+static void
+data_pattern_method_changed (gpointer data, gpointer user_data)
+{
+    const char *method_name = (const char *) data;
+    pattern_change_data *change = (pattern_change_data *) user_data;
+    subscriber_data_entry *subscriber_entry = change->subscriber_entry;
+
+    if (!data_subscriber_is_subscribed (subscriber_entry, method_name))
+    {
+        update_publishers_with_method_change (subscriber_entry->service_entry, method_name,
+                                              subscriber_entry->transport_info,
+                                              change->added);
+    }
+}
+
+/**
+ * Get the prefix of a method name subscription if it is a prefix subscription.
+ *
+ * @param method_name - The method name of the subscription.
+ *
+ * @returns The prefix (which must be freed by the caller), or NULL if the
+ *          subscription is for a single method.
+ */
+static char *
+data_method_pattern_prefix_get (const char *method_name)
+{
+    size_t len = strlen (method_name);
+    char *prefix = NULL;
+
+    if (len == 0 || method_name[len - 1] != METHOD_PATTERN_WILDCARD)
+    {
+        return NULL;
+    }
+
+    prefix = CMSG_STRDUP (method_name);
+    prefix[len - 1] = '\0';
+
+    return prefix;
+}
+
+/**
+ * Add a prefix subscription for a subscriber. The publishers are notified
+ * of each known method matching the prefix that the subscriber was not
+ * already subscribed to.
+ *
+ * @param subscriber_entry - The subscriber.
+ * @param prefix - The method name prefix.
+ */
+static void
+data_add_pattern_subscription (subscriber_data_entry *subscriber_entry,
+                               const char *prefix)
+{
+    service_data_entry *service_entry = subscriber_entry->service_entry;
+    pattern_change_data change = {
+        .subscriber_entry = subscriber_entry,
+        .added = true,
+    };
+
+    if (g_hash_table_contains (subscriber_entry->patterns, prefix))
+    {
+        return;
+    }
+
+    method_trie_foreach_method (service_entry->trie, prefix, data_pattern_method_changed,
+                                &change);
+
+    g_hash_table_add (subscriber_entry->patterns, CMSG_STRDUP (prefix));
+    method_trie_pattern_add (service_entry->trie, prefix, subscriber_entry);
+}
+
+/**
+ * Remove a prefix subscription for a subscriber. The subscriber entry is
+ * removed from the database if it is left empty.
+ *
+ * @param subscriber_entry - The subscriber.
+ * @param prefix - The method name prefix.
+ * @param notify - Whether to notify the publishers of the change.
+ */
+static void
+data_remove_pattern_subscription (subscriber_data_entry *subscriber_entry,
+                                  const char *prefix, bool notify)
+{
+    service_data_entry *service_entry = subscriber_entry->service_entry;
+    pattern_change_data change = {
+        .subscriber_entry = subscriber_entry,
+        .added = false,
+    };
+
+    method_trie_pattern_remove (service_entry->trie, prefix, subscriber_entry);
+
+    if (notify)
+    {
+        method_trie_foreach_method (service_entry->trie, prefix,
+                                    data_pattern_method_changed, &change);
+    }
+
+    /* The prefix may be the key in the set so remove it last */
+    g_hash_table_remove (subscriber_entry->patterns, prefix);
+
+    data_remove_subscriber_entry_if_empty (subscriber_entry);
+}
+
+/**
+ * Remove a subscriber from the given method entry. Any method or subscriber
+ * entry that is left empty is removed from the database.
+ *
+ * @param method_entry - The method entry to remove the subscriber from.
+ * @param subscriber_entry - The subscriber to remove.
+ * @param notify - Whether to notify the publishers of the change.
+ */
+static void
+data_remove_subscriber_from_method (method_data_entry *method_entry,
+                                    subscriber_data_entry *subscriber_entry, bool notify)
+{
+    service_data_entry *service_entry = method_entry->service_entry;
+
+    g_hash_table_remove (method_entry->transports, subscriber_entry->transport_info);
+    g_hash_table_remove (subscriber_entry->methods, method_entry);
+
+    /* The subscriber may still be subscribed to the method through a prefix */
+    if (notify && !method_trie_matches (service_entry->trie, method_entry->method_name,
+                                        subscriber_entry))
+    {
+        update_publishers_with_method_change (service_entry, method_entry->method_name,
+                                              subscriber_entry->transport_info, false);
+    }
+
+    if (g_hash_table_size (method_entry->transports) == 0)
+    {
+        g_hash_table_remove (service_entry->methods, method_entry->method_name);
+    }
+
+    data_remove_subscriber_entry_if_empty (subscriber_entry);
+}
+
+/**
+ * Remove all subscriptions of a subscriber from the database. The subscriber
+ * entry is freed by this function.
+ *
+ * @param subscriber_entry - The subscriber to remove.
+ * @param notify - Whether to notify the publishers of the changes.
+ */
+static void
+data_remove_subscriber_entry (subscriber_data_entry *subscriber_entry, bool notify)
+{
+    GList *methods = NULL;
+    GList *patterns = NULL;
+    GList *list = NULL;
+    bool has_methods = (g_hash_table_size (subscriber_entry->methods) > 0);
+
+    /* The subscriber entry is freed once its last method or prefix is removed.
+     * Take a copy of the prefixes as they are freed as they are removed. */
+    patterns = g_hash_table_get_keys (subscriber_entry->patterns);
+    for (list = patterns; list; list = g_list_next (list))
+    {
+        list->data = CMSG_STRDUP ((const char *) list->data);
+    }
+    for (list = patterns; list; list = g_list_next (list))
+    {
+        data_remove_pattern_subscription (subscriber_entry, (const char *) list->data,
+                                          notify);
+    }
+    g_list_free_full (patterns, cmsg_free);
+
+    /* Without any methods the subscriber entry has been freed with its last prefix */
+    if (!has_methods)
+    {
+        return;
+    }
+
+    methods = g_hash_table_get_keys (subscriber_entry->methods);
+    for (list = methods; list; list = g_list_next (list))
+    {
+        data_remove_subscriber_from_method ((method_data_entry *) list->data,
+                                            subscriber_entry, notify);
+    }
+    g_list_free (methods);
+}
+
 /**
  * Add a local subscription to the database.
  *
@@ -267,16 +780,44 @@ data_add_local_subscription (const cmsg_subscription_info *info)
 {
     service_data_entry *service_entry = NULL;
     method_data_entry *method_entry = NULL;
-    cmsg_transport_info *transport_copy = NULL;
+    subscriber_data_entry *subscriber_entry = NULL;
+    char *prefix = NULL;
+    bool notify;
 
     service_entry = get_service_entry_or_create (info->service, true);
+    subscriber_entry = get_subscriber_entry_or_create (service_entry, info->transport_info,
+                                                       true);
+
+    prefix = data_method_pattern_prefix_get (info->method_name);
+    if (prefix)
+    {
+        data_add_pattern_subscription (subscriber_entry, prefix);
+        CMSG_FREE (prefix);
+        return;
+    }
+
     method_entry = get_method_entry_or_create (service_entry, info->method_name, true);
 
-    transport_copy = cmsg_transport_info_copy (info->transport_info);
-    method_entry->transports = g_list_prepend (method_entry->transports, transport_copy);
+    /* The subscriber is already subscribed to this method */
+    if (g_hash_table_contains (subscriber_entry->methods, method_entry))
+    {
+        return;
+    }
+
+    /* The publishers already know about the subscriber if it is subscribed to
+     * the method through a prefix */
+    notify = !method_trie_matches (service_entry->trie, info->method_name,
+                                   subscriber_entry);
 
-    update_publishers_with_method_change (service_entry->comp_client, info->method_name,
-                                          info->transport_info, true);
+    g_hash_table_insert (method_entry->transports, subscriber_entry->transport_info,
+                         subscriber_entry);
+    g_hash_table_add (subscriber_entry->methods, method_entry);
+
+    if (notify)
+    {
+        update_publishers_with_method_change (service_entry, info->method_name,
+                                              info->transport_info, true);
+    }
 }
 
 /**
@@ -296,6 +837,8 @@ data_add_local_subscription (const cmsg_subscription_info *info)
 bool
 data_add_subscription (const cmsg_subscription_info *info)
 {
+    remote_subscriber_entry *subscriber_entry = NULL;
+
     if (CMSG_IS_FIELD_PRESENT (info, remote_addr))
     {
         if (remote_sync_get_local_ip () == info->remote_addr)
@@ -306,6 +849,11 @@ data_add_subscription (const cmsg_subscription_info *info)
 
         remote_subscriptions_list = g_list_prepend (remote_subscriptions_list,
                                                     (void *) info);
+        subscriber_entry = get_remote_subscriber_entry_or_create (info->service,
+                                                                  info->transport_info,
+                                                                  true);
+        subscriber_entry->links = g_list_prepend (subscriber_entry->links,
+                                                  remote_subscriptions_list);
         remote_sync_subscription_added (info);
         return true;
     }
@@ -355,75 +903,28 @@ remote_subscription_compare (gconstpointer a, gconstpointer b)
 static void
 data_remove_remote_subscription (const cmsg_subscription_info *info)
 {
-    GList *list_entry = NULL;
-
-    list_entry = g_list_find_custom (remote_subscriptions_list, info,
-                                     remote_subscription_compare);
-    if (list_entry)
-    {
-        CMSG_FREE_RECV_MSG (list_entry->data);
-        remote_subscriptions_list = g_list_remove (remote_subscriptions_list,
-                                                   list_entry->data);
-        remote_sync_subscription_removed (info);
-    }
-}
-
-/**
- * Helper function called for a list of cmsg clients. Compares each client
- * with the given transport.
- *
- * @param a - The client.
- * @param b - The transport.
- *
- * @returns 0 if the given transport matches the transport of the client.
- *          -1 otherwise.
- */
-static gint
-cmsg_client_transport_compare (gconstpointer a, gconstpointer b)
-{
-    const cmsg_client *client = (const cmsg_client *) a;
-    const cmsg_transport *transport = (const cmsg_transport *) b;
+    remote_subscriber_entry *subscriber_entry = NULL;
+    GList *list = NULL;
+    GList *link = NULL;
 
-    if (cmsg_transport_compare (client->_transport, transport))
+    subscriber_entry = get_remote_subscriber_entry_or_create (info->service,
+                                                              info->transport_info, false);
+    if (!subscriber_entry)
     {
-        return 0;
+        return;
     }
 
-    return -1;
-}
-
-/**
- * Remove a transport from the transports list on a given method entry.
- *
- * @param method_entry - The method entry to remove the transport from.
- * @param transport_info - A 'cmsg_transport_info' structure specifying
- *                         the transport to remove.
- */
-static void
-data_remove_transport_from_method (method_data_entry *method_entry,
-                                   const cmsg_transport_info *transport_info)
-{
-    GList *list = NULL;
-    cmsg_transport_info *entry_to_remove = NULL;
-
-    for (list = g_list_first (method_entry->transports); list; list = g_list_next (list))
+    for (list = subscriber_entry->links; list; list = g_list_next (list))
     {
-        if (cmsg_transport_info_compare (list->data, transport_info))
+        link = (GList *) list->data;
+        if (remote_subscription_compare (link->data, info) == 0)
         {
-            entry_to_remove = list->data;
-            break;
+            CMSG_FREE_RECV_MSG (link->data);
+            remote_subscription_link_remove (subscriber_entry, link);
+            remote_sync_subscription_removed (info);
+            return;
         }
     }
-
-    if (entry_to_remove)
-    {
-        method_entry->transports = g_list_remove (method_entry->transports,
-                                                  entry_to_remove);
-        cmsg_transport_info_free (entry_to_remove);
-        update_publishers_with_method_change (method_entry->service_entry->comp_client,
-                                              method_entry->method_name, transport_info,
-                                              false);
-    }
 }
 
 /**
@@ -438,29 +939,36 @@ data_remove_local_subscription (const cmsg_subscription_info *info)
 {
     service_data_entry *service_entry = NULL;
     method_data_entry *method_entry = NULL;
-    bool destroy_method_entry = false;
-    bool destroy_service_entry = false;
+    subscriber_data_entry *subscriber_entry = NULL;
+    char *prefix = NULL;
 
     service_entry = get_service_entry_or_create (info->service, false);
-    if (service_entry)
+    if (!service_entry)
     {
-        method_entry = get_method_entry_or_create (service_entry, info->method_name, false);
-        if (method_entry)
-        {
-            data_remove_transport_from_method (method_entry, info->transport_info);
-            destroy_method_entry = (g_list_length (method_entry->transports) == 0);
-        }
-        if (destroy_method_entry)
+        return;
+    }
+
+    subscriber_entry = get_subscriber_entry_or_create (service_entry, info->transport_info,
+                                                       false);
+
+    prefix = data_method_pattern_prefix_get (info->method_name);
+    if (prefix)
+    {
+        if (subscriber_entry && g_hash_table_contains (subscriber_entry->patterns, prefix))
         {
-            service_entry->methods = g_list_remove (service_entry->methods, method_entry);
-            CMSG_FREE (method_entry->method_name);
-            CMSG_FREE (method_entry);
-            destroy_service_entry = (g_list_length (service_entry->methods) == 0);
+            data_remove_pattern_subscription (subscriber_entry, prefix, true);
+            data_remove_service_entry_if_empty (service_entry);
         }
+        CMSG_FREE (prefix);
+        return;
     }
-    if (destroy_service_entry)
+
+    method_entry = get_method_entry_or_create (service_entry, info->method_name, false);
+    if (method_entry && subscriber_entry &&
+        g_hash_table_contains (subscriber_entry->methods, method_entry))
     {
-        g_hash_table_remove (local_subscriptions_table, info->service);
+        data_remove_subscriber_from_method (method_entry, subscriber_entry, true);
+        data_remove_service_entry_if_empty (service_entry);
     }
 }
 
@@ -491,240 +999,229 @@ static void
 data_remove_remote_entries_for_subscriber (const char *service,
                                            const cmsg_transport_info *transport_info)
 {
+    remote_subscriber_entry *subscriber_entry = NULL;
+    cmsg_subscription_info *info = NULL;
+    GList *links = NULL;
     GList *list = NULL;
-    GList *removal_list = NULL;
-    const cmsg_subscription_info *info = NULL;
+    GList *link = NULL;
 
-    for (list = g_list_first (remote_subscriptions_list); list; list = g_list_next (list))
+    subscriber_entry = get_remote_subscriber_entry_or_create (service, transport_info,
+                                                              false);
+    if (!subscriber_entry)
     {
-        info = (const cmsg_subscription_info *) list->data;
-        if (strcmp (info->service, service) == 0 &&
-            cmsg_transport_info_compare (info->transport_info, transport_info))
-        {
-            removal_list = g_list_prepend (removal_list, (void *) info);
-        }
+        return;
     }
 
-    for (list = g_list_first (removal_list); list; list = g_list_next (list))
-    {
-        remote_subscriptions_list = g_list_remove (remote_subscriptions_list, list->data);
+    links = subscriber_entry->links;
+    subscriber_entry->links = NULL;
+    g_hash_table_remove (remote_subscribers_table, subscriber_entry);
 
-        remote_sync_subscription_removed (list->data);
-        CMSG_FREE_RECV_MSG (list->data);
+    for (list = links; list; list = g_list_next (list))
+    {
+        link = (GList *) list->data;
+        info = (cmsg_subscription_info *) link->data;
+        remote_subscriptions_list = g_list_delete_link (remote_subscriptions_list, link);
+        remote_sync_subscription_removed (info);
+        CMSG_FREE_RECV_MSG (info);
     }
-    g_list_free (removal_list);
+    g_list_free (links);
 }
 
 /**
- * Helper function called for each method to potentially remove a specific
- * subscriber that is subscribed to it.
+ * Remove all subscriptions for the given service from the database for
+ * the given subscriber.
  *
- * @param data - The 'method_data_entry' structure for a method.
- * @param user_data - The transport information for the subscriber.
- */
-static void
-data_remove_subscriber_from_method (gpointer data, gpointer user_data)
-{
-    const cmsg_transport_info *sub_transport = (const cmsg_transport_info *) user_data;
-    method_data_entry *entry = (method_data_entry *) data;
-
-    data_remove_transport_from_method (entry, sub_transport);
-}
-
-/**
- * Helper function called for each method. Updates the GList to include this
- * method if the transports list is empty.
+ * @param service - The CMSG service name.
+ * @param transport_info - The transport information for the subscriber.
  *
- * @param data - The 'method_data_entry' structure for a method.
- * @param user_data - Pointer to the GList to update.
+ * @returns true if the service containing the subscriber was removed, false otherwise.
  */
-static void
-data_find_methods_without_transports (gpointer data, gpointer user_data)
+bool
+data_remove_subscriber (const char *service, const cmsg_transport_info *transport_info)
 {
-    GList **removal_list = (GList **) user_data;
-    method_data_entry *entry = (method_data_entry *) data;
+    service_data_entry *service_entry = NULL;
+    subscriber_data_entry *subscriber_entry = NULL;
+    bool ret = false;
 
-    if (g_list_length (entry->transports) == 0)
+    /* Remove the remote entries first as the service name may be the key of the
+     * service entry (and is therefore freed if the service entry is removed). */
+    data_remove_remote_entries_for_subscriber (service, transport_info);
+
+    service_entry = get_service_entry_or_create (service, false);
+    if (service_entry)
     {
-        *removal_list = g_list_prepend (*removal_list, entry);
+        subscriber_entry = get_subscriber_entry_or_create (service_entry, transport_info,
+                                                           false);
+        if (subscriber_entry)
+        {
+            data_remove_subscriber_entry (subscriber_entry, true);
+        }
+
+        ret = data_remove_service_entry_if_empty (service_entry);
     }
+
+    return ret;
 }
 
 /**
- * Prune any empty method entries from the given service data entry.
+ * Remove all subscriptions for any subscriber which is on the remote host with
+ * the given address. The publishers of each affected service are notified of
+ * the host removal (rather than of each individual subscription).
  *
- * @param service_entry - The service data entry to prune empty method entries from.
+ * @param addr - The address of the remote host.
  */
-static void
-data_prune_empty_methods (service_data_entry *service_entry)
+void
+data_remove_local_subscriptions_for_addr (uint32_t addr)
 {
+    GHashTable *host_subscribers = NULL;
+    GHashTable *affected_services = NULL;
+    GList *subscribers = NULL;
+    GList *services = NULL;
     GList *list = NULL;
-    GList *removal_list = NULL;
-    method_data_entry *method_entry = NULL;
+    subscriber_data_entry *subscriber_entry = NULL;
+    service_data_entry *service_entry = NULL;
 
-    g_list_foreach (service_entry->methods, data_find_methods_without_transports,
-                    &removal_list);
-    for (list = g_list_first (removal_list); list; list = g_list_next (list))
+    if (!local_subscriptions_table)
     {
-        method_entry = (method_data_entry *) list->data;
-
-        service_entry->methods = g_list_remove (service_entry->methods, method_entry);
-        CMSG_FREE (method_entry->method_name);
-        CMSG_FREE (method_entry);
+        return;
     }
-    g_list_free (removal_list);
-}
 
-/**
- * Helper function called for each entry in the hash table. Returns TRUE
- * if the service entry is empty, meaning the entry should be removed from
- * the hash table.
- *
- * @param key - The key from the hash table (service name)
- * @param value - The value associated with the key (service_data_entry structure)
- * @param user_data - NULL.
- *
- * @returns TRUE if the entry should be removed from the hash table, FALSE otherwise.
- */
-static gboolean
-data_remove_empty_services (gpointer key, gpointer value, gpointer user_data)
-{
-    service_data_entry *entry = (service_data_entry *) value;
+    host_subscribers = g_hash_table_lookup (host_subscribers_table, GUINT_TO_POINTER (addr));
+    if (!host_subscribers)
+    {
+        return;
+    }
 
-    if (g_list_length (entry->methods) == 0 &&
-        cmsg_composite_client_num_children (entry->comp_client) == 0)
+    /* The set of subscribers for the host is freed once the last subscriber
+     * is removed so take a copy of the subscribers before removing them. */
+    affected_services = g_hash_table_new (g_direct_hash, g_direct_equal);
+    subscribers = g_hash_table_get_keys (host_subscribers);
+    for (list = subscribers; list; list = g_list_next (list))
     {
-        return TRUE;
+        subscriber_entry = (subscriber_data_entry *) list->data;
+
+        g_hash_table_add (affected_services, subscriber_entry->service_entry);
+        data_remove_subscriber_entry (subscriber_entry, false);
     }
+    g_list_free (subscribers);
 
-    return FALSE;
+    services = g_hash_table_get_keys (affected_services);
+    for (list = services; list; list = g_list_next (list))
+    {
+        service_entry = (service_data_entry *) list->data;
+
+        /* At least one subscriber was removed for this service. Notify all
+         * publishers of this change. */
+        update_publishers_with_host_removal (service_entry, addr);
+        data_remove_service_entry_if_empty (service_entry);
+    }
+    g_list_free (services);
+    g_hash_table_unref (affected_services);
 }
 
 /**
- * Remove all subscriptions for the given service from the database for
- * the given subscriber.
+ * Create a 'cmsg_subscription_info' message for a subscription.
  *
- * @param service - The CMSG service name.
- * @param transport_info - The transport information for the subscriber.
+ * @param service - The name of the service.
+ * @param method_name - The name of the method.
+ * @param transport_info - The transport information of the subscriber.
  *
- * @returns true if the service containing the subscriber was removed, false otherwise.
+ * @returns The message. This should be freed using 'data_subscription_info_free'.
  */
-bool
-data_remove_subscriber (const char *service, const cmsg_transport_info *transport_info)
+cmsg_subscription_info *
+data_subscription_info_create (const char *service, const char *method_name,
+                               const cmsg_transport_info *transport_info)
 {
-    service_data_entry *service_entry = NULL;
-    bool ret = false;
-
-    service_entry = get_service_entry_or_create (service, false);
-    if (service_entry)
-    {
-        g_list_foreach (service_entry->methods, data_remove_subscriber_from_method,
-                        (void *) transport_info);
-        data_prune_empty_methods (service_entry);
+    cmsg_subscription_info *info = NULL;
 
-        if (g_list_length (service_entry->methods) == 0 &&
-            cmsg_composite_client_num_children (service_entry->comp_client) == 0)
-        {
-            g_hash_table_remove (local_subscriptions_table, service);
-            ret = true;
-        }
-    }
+    info = CMSG_CALLOC (1, sizeof (cmsg_subscription_info));
+    cmsg_subscription_info_init (info);
 
-    data_remove_remote_entries_for_subscriber (service, transport_info);
+    CMSG_SET_FIELD_PTR (info, service, CMSG_STRDUP (service));
+    CMSG_SET_FIELD_PTR (info, method_name, CMSG_STRDUP (method_name));
+    CMSG_SET_FIELD_PTR (info, transport_info, cmsg_transport_info_copy (transport_info));
 
-    return ret;
+    return info;
 }
 
 /**
- * Remove any client from the composite client on a given method entry
- * if it has the address of the given remote host.
+ * Free a 'cmsg_subscription_info' message created by 'data_subscription_info_create'.
  *
- * NOTE: This function does not notify any publishers of the removal.
- *
- * @param method_entry - The method entry to remove the client from.
- * @param addr - The address specifying any client to remove.
- *
- * @returns true if at least one client was removed, false otherwise.
+ * @param data - The message to free.
  */
-static bool
-data_remove_clients_with_addr_from_method (method_data_entry *method_entry, uint32_t addr)
+void
+data_subscription_info_free (gpointer data)
 {
-    GList *list = NULL;
-    GList *removal_list = NULL;
-    cmsg_transport_info *transport_info = NULL;
-    cmsg_transport *transport = NULL;
-    bool subscribers_removed = false;
-
-    for (list = g_list_first (method_entry->transports); list; list = g_list_next (list))
-    {
-        transport_info = (cmsg_transport_info *) list->data;
-        if (transport_info->type == CMSG_TRANSPORT_INFO_TYPE_TCP)
-        {
-            transport = cmsg_transport_info_to_transport (transport_info);
-            if (transport->config.socket.sockaddr.in.sin_addr.s_addr == addr)
-            {
-                removal_list = g_list_prepend (removal_list, transport_info);
-            }
-            cmsg_transport_destroy (transport);
-        }
-    }
-
-    for (list = g_list_first (removal_list); list; list = g_list_next (list))
-    {
-        method_entry->transports = g_list_remove (method_entry->transports, list->data);
-        cmsg_transport_info_free (list->data);
-    }
-    subscribers_removed = (removal_list != NULL);
-    g_list_free (removal_list);
+    cmsg_subscription_info *info = (cmsg_subscription_info *) data;
 
-    return subscribers_removed;
+    cmsg_transport_info_free (info->transport_info);
+    CMSG_FREE (info->method_name);
+    CMSG_FREE (info->service);
+    CMSG_FREE (info);
 }
 
 /**
- * Helper function called for each entry in the hash table. Removes entries
- * for any subscriber which is on a remote host with the given address.
+ * Get all local subscriptions for any subscriber which is on the remote host
+ * with the given address.
  *
- * @param key - The key from the hash table (service name)
- * @param value - The value associated with the key (service_data_entry structure)
- * @param user_data - The address of the remote host.
+ * @param addr - The address of the remote host.
+ *
+ * @returns A list of 'cmsg_subscription_info' messages. The list should be freed
+ *          using 'g_list_free_full' with 'data_subscription_info_free'.
  */
-static void
-data_remove_local_entries_for_addr (gpointer key, gpointer value, gpointer user_data)
+GList *
+data_get_local_subscriptions_for_addr (uint32_t addr)
 {
-    GList *iter;
-    service_data_entry *entry = (service_data_entry *) value;
-    uint32_t *addr = (uint32_t *) user_data;
-    bool subscriber_removed = false;
+    GHashTable *host_subscribers = NULL;
+    GHashTableIter subscriber_iter;
+    GHashTableIter method_iter;
+    gpointer key = NULL;
+    subscriber_data_entry *subscriber_entry = NULL;
+    method_data_entry *method_entry = NULL;
+    cmsg_subscription_info *info = NULL;
+    GList *subscriptions = NULL;
+    char *pattern = NULL;
 
-    for (iter = g_list_first (entry->methods); iter; iter = g_list_next (iter))
+    if (!host_subscribers_table)
     {
-        if (data_remove_clients_with_addr_from_method ((method_data_entry *) iter->data,
-                                                       *addr))
-        {
-            subscriber_removed = true;
-        }
+        return NULL;
     }
 
-    data_prune_empty_methods (entry);
-
-    if (subscriber_removed)
+    host_subscribers = g_hash_table_lookup (host_subscribers_table, GUINT_TO_POINTER (addr));
+    if (!host_subscribers)
     {
-        /* At least one subscriber was removed for this service. Notify all
-         * publishers of this change. */
-        update_publishers_with_host_removal (entry->comp_client, *addr);
+        return NULL;
     }
-}
 
-void
-data_remove_local_subscriptions_for_addr (uint32_t addr)
-{
-    if (local_subscriptions_table)
+    g_hash_table_iter_init (&subscriber_iter, host_subscribers);
+    while (g_hash_table_iter_next (&subscriber_iter, &key, NULL))
     {
-        g_hash_table_foreach (local_subscriptions_table,
-                              data_remove_local_entries_for_addr, (void *) &addr);
-        g_hash_table_foreach_remove (local_subscriptions_table, data_remove_empty_services,
-                                     NULL);
+        subscriber_entry = (subscriber_data_entry *) key;
+
+        g_hash_table_iter_init (&method_iter, subscriber_entry->methods);
+        while (g_hash_table_iter_next (&method_iter, &key, NULL))
+        {
+            method_entry = (method_data_entry *) key;
+            info = data_subscription_info_create (subscriber_entry->service_entry->service,
+                                                  method_entry->method_name,
+                                                  subscriber_entry->transport_info);
+            subscriptions = g_list_prepend (subscriptions, info);
+        }
+
+        g_hash_table_iter_init (&method_iter, subscriber_entry->patterns);
+        while (g_hash_table_iter_next (&method_iter, &key, NULL))
+        {
+            pattern = g_strdup_printf ("%s%c", (const char *) key,
+                                       METHOD_PATTERN_WILDCARD);
+            info = data_subscription_info_create (subscriber_entry->service_entry->service,
+                                                  pattern,
+                                                  subscriber_entry->transport_info);
+            subscriptions = g_list_prepend (subscriptions, info);
+            g_free (pattern);
+        }
     }
+
+    return subscriptions;
 }
 
 /**
@@ -772,42 +1269,94 @@ data_get_remote_subscriptions (void)
  * Fill a 'cmsg_transport_info' message and append it to the passed in
  * 'cmsg_subscription_method_entry' message.
  *
- * @param data - The client to fill a 'cmsg_transport_info' message for.
+ * @param key - The transport information of the subscriber.
+ * @param value - The 'subscriber_data_entry' structure for the subscriber.
  * @param user_data - The 'cmsg_subscription_method_entry' message to append to.
  */
 static void
-data_fill_subscriber_transport_info (gpointer data, gpointer user_data)
+data_fill_subscriber_transport_info (gpointer key, gpointer value, gpointer user_data)
 {
-    cmsg_transport_info *transport_info = (cmsg_transport_info *) data;
+    cmsg_transport_info *transport_info = (cmsg_transport_info *) key;
     cmsg_subscription_method_entry *msg = (cmsg_subscription_method_entry *) user_data;
 
     CMSG_REPEATED_APPEND (msg, transports, transport_info);
 }
 
 /**
- * Fill a 'cmsg_subscription_method_entry' message and append it to the passed in
- * 'cmsg_subscription_methods' message.
+ * Helper function called for each subscriber to a prefix matching a method.
+ * Adds the transport information of the subscriber to the set of transports.
+ *
+ * @param data - The 'subscriber_data_entry' structure for the subscriber.
+ * @param user_data - The set of transports to add to.
+ */
+static void
+data_add_pattern_subscriber_transport (gpointer data, gpointer user_data)
+{
+    subscriber_data_entry *subscriber_entry = (subscriber_data_entry *) data;
+    GHashTable *transports = (GHashTable *) user_data;
+
+    g_hash_table_add (transports, subscriber_entry->transport_info);
+}
+
+/**
+ * Helper function used to add a method name to a set of method names.
+ *
+ * @param data - The method name.
+ * @param user_data - The set of method names to add to.
+ */
+static void
+data_add_method_name (gpointer data, gpointer user_data)
+{
+    g_hash_table_add ((GHashTable *) user_data, data);
+}
+
+/**
+ * Fill a 'cmsg_subscription_method_entry' message with the subscribers to the
+ * given method (either directly or through a prefix) and append it to the passed
+ * in 'cmsg_subscription_methods' message. Nothing is appended if the method has
+ * no subscribers.
  *
- * @param data - The method entry to fill a 'cmsg_subscription_method_entry'
- *               message for.
- * @param user_data - The 'cmsg_subscription_methods' message to append to.
+ * @param service_entry - The service entry of the method.
+ * @param method_name - The method name.
+ * @param msg - The 'cmsg_subscription_methods' message to append to.
  */
 static void
-data_fill_method_info (gpointer data, gpointer user_data)
+data_fill_method_info (service_data_entry *service_entry, const char *method_name,
+                       cmsg_subscription_methods *msg)
 {
-    method_data_entry *method_entry = (method_data_entry *) data;
-    cmsg_subscription_methods *msg = (cmsg_subscription_methods *) user_data;
+    method_data_entry *method_entry = NULL;
     cmsg_subscription_method_entry *method_msg = NULL;
+    GHashTable *transports = NULL;
+    GHashTableIter iter;
+    gpointer key = NULL;
+
+    transports = g_hash_table_new (cmsg_transport_info_hash, cmsg_transport_info_equal);
+
+    method_entry = g_hash_table_lookup (service_entry->methods, method_name);
+    if (method_entry)
+    {
+        g_hash_table_iter_init (&iter, method_entry->transports);
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+        {
+            g_hash_table_add (transports, key);
+        }
+    }
+    method_trie_foreach_match (service_entry->trie, method_name,
+                               data_add_pattern_subscriber_transport, transports);
+
+    if (g_hash_table_size (transports) > 0)
+    {
+        method_msg = CMSG_CALLOC (1, sizeof (*method_msg));
+        cmsg_subscription_method_entry_init (method_msg);
 
-    method_msg = CMSG_CALLOC (1, sizeof (*method_msg));
-    cmsg_subscription_method_entry_init (method_msg);
+        CMSG_SET_FIELD_PTR (method_msg, method_name, (char *) method_name);
 
-    CMSG_SET_FIELD_PTR (method_msg, method_name, method_entry->method_name);
+        g_hash_table_foreach (transports, data_fill_subscriber_transport_info, method_msg);
 
-    g_list_foreach (method_entry->transports, data_fill_subscriber_transport_info,
-                    method_msg);
+        CMSG_REPEATED_APPEND (msg, methods, method_msg);
+    }
 
-    CMSG_REPEATED_APPEND (msg, methods, method_msg);
+    g_hash_table_unref (transports);
 }
 
 /**
@@ -823,6 +1372,9 @@ void
 data_get_subscription_info_for_service (const char *service, cmsg_subscription_methods *msg)
 {
     service_data_entry *service_entry = NULL;
+    GHashTable *method_names = NULL;
+    GHashTableIter iter;
+    gpointer key = NULL;
 
     service_entry = get_service_entry_or_create (service, false);
     if (!service_entry)
@@ -830,7 +1382,23 @@ data_get_subscription_info_for_service (const char *service, cmsg_subscription_m
         return;
     }
 
-    g_list_foreach (service_entry->methods, data_fill_method_info, msg);
+    /* The methods subscribed to directly and the published methods (which may be
+     * subscribed to through a prefix) */
+    method_names = g_hash_table_new (g_str_hash, g_str_equal);
+    g_hash_table_iter_init (&iter, service_entry->methods);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        g_hash_table_add (method_names, key);
+    }
+    method_trie_foreach_method (service_entry->trie, "", data_add_method_name,
+                                method_names);
+
+    g_hash_table_iter_init (&iter, method_names);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        data_fill_method_info (service_entry, (const char *) key, msg);
+    }
+    g_hash_table_unref (method_names);
 }
 
 /**
@@ -854,34 +1422,65 @@ data_get_subscription_info_for_service_free (cmsg_subscription_methods *msg)
 }
 
 /**
- * Add a client to the publisher's update server to the composite client
- * for the given service.
+ * Add a queue for sending updates to the publisher's update server to the
+ * given service, and record the methods the publisher publishes so that
+ * prefix subscriptions can be expanded to them.
  */
 void
-data_add_publisher (const char *service, cmsg_transport_info *transport_info)
+data_add_publisher (const char *service, cmsg_transport_info *transport_info,
+                    char **methods, size_t n_methods)
 {
     service_data_entry *service_entry = NULL;
-    cmsg_transport *transport = NULL;
-    cmsg_client *client = NULL;
+    publisher_update_queue *update_queue = NULL;
+    GHashTable *published = NULL;
+    size_t i;
 
     service_entry = get_service_entry_or_create (service, true);
-    transport = cmsg_transport_info_to_transport (transport_info);
-    client = cmsg_client_create (transport, CMSG_DESCRIPTOR (cmsg_psd, update));
-    cmsg_composite_client_add_child (service_entry->comp_client, client);
+
+    published = g_hash_table_lookup (service_entry->published, transport_info);
+    if (!published)
+    {
+        published = g_hash_table_new (g_str_hash, g_str_equal);
+        g_hash_table_insert (service_entry->published,
+                             cmsg_transport_info_copy (transport_info), published);
+    }
+
+    for (i = 0; i < n_methods; i++)
+    {
+        if (!g_hash_table_contains (published, methods[i]))
+        {
+            g_hash_table_add (published, (gpointer)
+                              method_trie_method_add (service_entry->trie, methods[i]));
+        }
+    }
+
+    if (g_hash_table_contains (service_entry->publishers, transport_info))
+    {
+        return;
+    }
+
+    update_queue =
+        publisher_update_queue_new (cmsg_transport_info_to_transport (transport_info),
+                                    service);
+    if (update_queue)
+    {
+        g_hash_table_insert (service_entry->publishers,
+                             cmsg_transport_info_copy (transport_info), update_queue);
+    }
 }
 
 /**
- * Remove the client to the publisher's update server from the composite client
- * for the given service.
+ * Remove the queue for sending updates to the publisher's update server from
+ * the given service. Any updates not yet sent to the publisher are dropped, and
+ * the methods only published by this publisher are forgotten.
  */
 void
 data_remove_publisher (const char *service, cmsg_transport_info *transport_info)
 {
     service_data_entry *service_entry = NULL;
-    cmsg_transport *transport = NULL;
-    GList *list_entry = NULL;
-    GList *client_list = NULL;
-    cmsg_client *child_client = NULL;
+    GHashTable *published = NULL;
+    GList *methods = NULL;
+    GList *list = NULL;
 
     service_entry = get_service_entry_or_create (service, false);
     if (!service_entry)
@@ -889,16 +1488,46 @@ data_remove_publisher (const char *service, cmsg_transport_info *transport_info)
         return;
     }
 
-    client_list = cmsg_composite_client_get_children (service_entry->comp_client);
-    transport = cmsg_transport_info_to_transport (transport_info);
-    list_entry = g_list_find_custom (client_list, transport, cmsg_client_transport_compare);
-    if (list_entry)
+    published = g_hash_table_lookup (service_entry->published, transport_info);
+    if (published)
     {
-        child_client = (cmsg_client *) list_entry->data;
-        cmsg_composite_client_delete_child (service_entry->comp_client, child_client);
-        cmsg_destroy_client_and_transport (child_client);
+        /* The method names are owned by the trie and may be freed as they are removed */
+        methods = g_hash_table_get_keys (published);
+        g_hash_table_remove (service_entry->published, transport_info);
+        for (list = methods; list; list = g_list_next (list))
+        {
+            method_trie_method_remove (service_entry->trie, (const char *) list->data);
+        }
+        g_list_free (methods);
+    }
+
+    g_hash_table_remove (service_entry->publishers, transport_info);
+}
+
+/**
+ * Wait (for a limited time) until the publishers registered for the given service
+ * have applied the updates queued for them.
+ *
+ * @param service - The service the publishers are publishing for.
+ */
+void
+data_sync_publishers (const char *service)
+{
+    service_data_entry *service_entry = NULL;
+    GHashTableIter iter;
+    gpointer value = NULL;
+
+    service_entry = get_service_entry_or_create (service, false);
+    if (!service_entry)
+    {
+        return;
+    }
+
+    g_hash_table_iter_init (&iter, service_entry->publishers);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        publisher_update_queue_sync ((publisher_update_queue *) value);
     }
-    cmsg_transport_destroy (transport);
 }
 
 /**
@@ -914,6 +1543,13 @@ data_init (void)
         syslog (LOG_ERR, "Failed to initialize hash table");
         return;
     }
+
+    host_subscribers_table = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                                    (GDestroyNotify) g_hash_table_unref);
+
+    remote_subscribers_table = g_hash_table_new_full (remote_subscriber_hash,
+                                                      remote_subscriber_equal,
+                                                      remote_subscriber_entry_free, NULL);
 }
 
 /**
@@ -931,6 +1567,18 @@ data_deinit (void)
         local_subscriptions_table = NULL;
     }
 
+    if (host_subscribers_table)
+    {
+        g_hash_table_unref (host_subscribers_table);
+        host_subscribers_table = NULL;
+    }
+
+    if (remote_subscribers_table)
+    {
+        g_hash_table_unref (remote_subscribers_table);
+        remote_subscribers_table = NULL;
+    }
+
     for (list = g_list_first (remote_subscriptions_list); list; list = g_list_next (list))
     {
         CMSG_FREE_RECV_MSG (list->data);
@@ -971,14 +1619,15 @@ tcp_transport_dump (FILE *fp, const cmsg_transport *transport)
  * Helper function called for each transport subscribed to a method.
  * Prints the transport details.
  *
- * @param data - The 'cmsg_transport_info' structure for the transport.
+ * @param key - The 'cmsg_transport_info' structure for the transport.
+ * @param value - The 'subscriber_data_entry' structure for the subscriber.
  * @param user_data - The file to print to.
  */
 static void
-transports_dump (gpointer data, gpointer user_data)
+transports_dump (gpointer key, gpointer value, gpointer user_data)
 {
     FILE *fp = (FILE *) user_data;
-    cmsg_transport_info *transport_info = (cmsg_transport_info *) data;
+    cmsg_transport_info *transport_info = (cmsg_transport_info *) key;
     cmsg_transport *transport = NULL;
 
     transport = cmsg_transport_info_to_transport (transport_info);
@@ -1002,18 +1651,33 @@ transports_dump (gpointer data, gpointer user_data)
  * Helper function called for each method that has been subscribed to from
  * a service running locally.
  *
- * @param data - The 'method_data_entry' structure for a method.
+ * @param key - The method name.
+ * @param value - The 'method_data_entry' structure for a method.
  * @param user_data - The file to print to.
  */
 static void
-methods_data_dump (gpointer data, gpointer user_data)
+methods_data_dump (gpointer key, gpointer value, gpointer user_data)
 {
     FILE *fp = (FILE *) user_data;
-    const method_data_entry *entry = (const method_data_entry *) data;
+    const method_data_entry *entry = (const method_data_entry *) value;
 
     fprintf (fp, "   %s:\n", entry->method_name);
     fprintf (fp, "    subscribers:\n");
-    g_list_foreach (entry->transports, transports_dump, fp);
+    g_hash_table_foreach (entry->transports, transports_dump, fp);
+}
+
+/**
+ * Helper function called for each publisher registered for a service.
+ *
+ * @param key - The 'cmsg_transport_info' structure for the publisher.
+ * @param value - The 'publisher_update_queue' structure for the publisher.
+ * @param user_data - The file to print to.
+ */
+static void
+publishers_dump (gpointer key, gpointer value, gpointer user_data)
+{
+    publisher_update_queue_debug_dump ((publisher_update_queue *) value,
+                                       (FILE *) user_data);
 }
 
 /**
@@ -1032,7 +1696,9 @@ local_subscriptions_dump (gpointer key, gpointer value, gpointer user_data)
 
     fprintf (fp, " service: %s\n", (char *) key);
     fprintf (fp, "  methods:\n");
-    g_list_foreach (entry->methods, methods_data_dump, fp);
+    g_hash_table_foreach (entry->methods, methods_data_dump, fp);
+    fprintf (fp, "  publishers:\n");
+    g_hash_table_foreach (entry->publishers, publishers_dump, fp);
 }
 
 /**
@@ -23,8 +23,16 @@ GList *data_get_remote_subscriptions (void);
 void data_add_local_subscription (const cmsg_subscription_info *info);
 void data_remove_local_subscription (const cmsg_subscription_info *info);
 void data_remove_local_subscriptions_for_addr (uint32_t addr);
-void data_add_publisher (const char *service, cmsg_transport_info *transport_info);
+GList *data_get_local_subscriptions_for_addr (uint32_t addr);
+cmsg_subscription_info *data_subscription_info_create (const char *service,
+                                                       const char *method_name,
+                                                       const cmsg_transport_info
+                                                       *transport_info);
+void data_subscription_info_free (gpointer data);
+void data_add_publisher (const char *service, cmsg_transport_info *transport_info,
+                         char **methods, size_t n_methods);
 void data_remove_publisher (const char *service, cmsg_transport_info *transport_info);
+void data_sync_publishers (const char *service);
 void data_get_subscription_info_for_service (const char *service,
                                              cmsg_subscription_methods *msg);
 void data_get_subscription_info_for_service_free (cmsg_subscription_methods *msg);
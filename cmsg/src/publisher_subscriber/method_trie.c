@@ -0,0 +1,429 @@
+/**
+ * method_trie.c
+ *
+ * Implements a prefix trie of the method names of a service. The trie stores
+ * both the method names known for the service (i.e. those published) and the
+ * subscribers to method name prefix patterns (e.g. "link_*" or "*"). This allows
+ * the subscribers matching a method name to be found, and the methods matching a
+ * prefix to be expanded, in time proportional to the length of the name.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <cmsg/cmsg_private.h>
+#include "method_trie.h"
+
+typedef struct _method_trie_node_s
+{
+    char c;
+    struct _method_trie_node_s *child;
+    struct _method_trie_node_s *sibling;
+    char *method_name;          /* Set if a known method name ends at this node */
+    guint method_refs;          /* The number of times the method name was added */
+    GHashTable *subscribers;    /* Subscribers to the prefix ending at this node */
+} method_trie_node;
+
+struct _method_trie_s
+{
+    method_trie_node root;
+    guint num_patterns;
+};
+
+/**
+ * Free a node of the trie and all of its descendants.
+ *
+ * @param node - The node to free.
+ */
+static void
+method_trie_node_free (method_trie_node *node)
+{
+    method_trie_node *child = NULL;
+    method_trie_node *next = NULL;
+
+    for (child = node->child; child; child = next)
+    {
+        next = child->sibling;
+        method_trie_node_free (child);
+    }
+
+    if (node->subscribers)
+    {
+        g_hash_table_unref (node->subscribers);
+    }
+    CMSG_FREE (node->method_name);
+    CMSG_FREE (node);
+}
+
+/**
+ * Find the child of a node for the given character or potentially create
+ * one if it doesn't already exist.
+ *
+ * @param node - The parent node.
+ * @param c - The character of the child.
+ * @param create - Whether to create the child if it didn't already exist or not.
+ *
+ * @returns A pointer to the child node, or NULL if it doesn't exist.
+ */
+static method_trie_node *
+method_trie_child_get (method_trie_node *node, char c, bool create)
+{
+    method_trie_node *child = NULL;
+
+    for (child = node->child; child; child = child->sibling)
+    {
+        if (child->c == c)
+        {
+            return child;
+        }
+    }
+
+    if (create)
+    {
+        child = CMSG_CALLOC (1, sizeof (method_trie_node));
+        child->c = c;
+        child->sibling = node->child;
+        node->child = child;
+    }
+
+    return child;
+}
+
+/**
+ * Find the node for the given string or potentially create it (and the nodes
+ * leading to it) if it doesn't already exist.
+ *
+ * @param trie - The trie.
+ * @param str - The string to find the node for.
+ * @param create - Whether to create the node if it didn't already exist or not.
+ *
+ * @returns A pointer to the node, or NULL if it doesn't exist.
+ */
+static method_trie_node *
+method_trie_node_get (method_trie *trie, const char *str, bool create)
+{
+    method_trie_node *node = &trie->root;
+    const char *c = NULL;
+
+    for (c = str; *c && node; c++)
+    {
+        node = method_trie_child_get (node, *c, create);
+    }
+
+    return node;
+}
+
+/**
+ * Free any nodes that have been left empty along the path to the given string.
+ *
+ * @param node - The node to prune below.
+ * @param str - The remaining characters of the string.
+ *
+ * @returns true if the node is now empty (and should be freed), false otherwise.
+ */
+static bool
+method_trie_node_prune (method_trie_node *node, const char *str)
+{
+    method_trie_node *child = NULL;
+    method_trie_node **link = NULL;
+
+    if (*str != '\0')
+    {
+        for (link = &node->child; *link; link = &(*link)->sibling)
+        {
+            child = *link;
+            if (child->c == *str)
+            {
+                if (method_trie_node_prune (child, str + 1))
+                {
+                    *link = child->sibling;
+                    CMSG_FREE (child);
+                }
+                break;
+            }
+        }
+    }
+
+    return (!node->child && !node->method_name && !node->subscribers);
+}
+
+/**
+ * Create a new method trie.
+ *
+ * @returns A pointer to the trie.
+ */
+method_trie *
+method_trie_new (void)
+{
+    return CMSG_CALLOC (1, sizeof (method_trie));
+}
+
+/**
+ * Destroy a method trie.
+ *
+ * @param trie - The trie to destroy.
+ */
+void
+method_trie_destroy (method_trie *trie)
+{
+    method_trie_node *child = NULL;
+    method_trie_node *next = NULL;
+
+    for (child = trie->root.child; child; child = next)
+    {
+        next = child->sibling;
+        method_trie_node_free (child);
+    }
+
+    if (trie->root.subscribers)
+    {
+        g_hash_table_unref (trie->root.subscribers);
+    }
+    CMSG_FREE (trie);
+}
+
+/**
+ * Add a known method name to the trie. The method name stays in the trie until
+ * it has been removed as many times as it has been added.
+ *
+ * @param trie - The trie.
+ * @param method_name - The method name to add.
+ *
+ * @returns The copy of the method name stored in the trie.
+ */
+const char *
+method_trie_method_add (method_trie *trie, const char *method_name)
+{
+    method_trie_node *node = NULL;
+
+    node = method_trie_node_get (trie, method_name, true);
+    if (!node->method_name)
+    {
+        node->method_name = CMSG_STRDUP (method_name);
+    }
+    node->method_refs++;
+
+    return node->method_name;
+}
+
+/**
+ * Remove a known method name from the trie. Any node that is left empty is freed.
+ *
+ * @param trie - The trie.
+ * @param method_name - The method name to remove.
+ *
+ * @returns true if the method name is no longer known, false otherwise.
+ */
+bool
+method_trie_method_remove (method_trie *trie, const char *method_name)
+{
+    method_trie_node *node = NULL;
+    char *name = NULL;
+
+    node = method_trie_node_get (trie, method_name, false);
+    if (!node || !node->method_name)
+    {
+        return false;
+    }
+
+    if (--node->method_refs > 0)
+    {
+        return false;
+    }
+
+    /* The method name passed in may be the copy stored in the trie */
+    name = node->method_name;
+    node->method_name = NULL;
+    method_trie_node_prune (&trie->root, method_name);
+    CMSG_FREE (name);
+
+    return true;
+}
+
+/**
+ * Add a subscriber to a method name prefix.
+ *
+ * @param trie - The trie.
+ * @param prefix - The method name prefix (an empty prefix matches every method).
+ * @param subscriber - The subscriber.
+ *
+ * @returns true if the subscriber was added, false if it was already subscribed
+ *          to the prefix.
+ */
+bool
+method_trie_pattern_add (method_trie *trie, const char *prefix, gpointer subscriber)
+{
+    method_trie_node *node = NULL;
+
+    node = method_trie_node_get (trie, prefix, true);
+    if (!node->subscribers)
+    {
+        node->subscribers = g_hash_table_new (g_direct_hash, g_direct_equal);
+    }
+
+    if (!g_hash_table_add (node->subscribers, subscriber))
+    {
+        return false;
+    }
+
+    trie->num_patterns++;
+    return true;
+}
+
+/**
+ * Remove a subscriber from a method name prefix. Any node that is left empty
+ * is freed.
+ *
+ * @param trie - The trie.
+ * @param prefix - The method name prefix.
+ * @param subscriber - The subscriber.
+ *
+ * @returns true if the subscriber was removed, false if it was not subscribed
+ *          to the prefix.
+ */
+bool
+method_trie_pattern_remove (method_trie *trie, const char *prefix, gpointer subscriber)
+{
+    method_trie_node *node = NULL;
+
+    node = method_trie_node_get (trie, prefix, false);
+    if (!node || !node->subscribers || !g_hash_table_remove (node->subscribers, subscriber))
+    {
+        return false;
+    }
+
+    if (g_hash_table_size (node->subscribers) == 0)
+    {
+        g_hash_table_unref (node->subscribers);
+        node->subscribers = NULL;
+        method_trie_node_prune (&trie->root, prefix);
+    }
+
+    trie->num_patterns--;
+    return true;
+}
+
+/**
+ * Get the number of prefix subscriptions stored in the trie.
+ *
+ * @param trie - The trie.
+ *
+ * @returns The number of prefix subscriptions.
+ */
+guint
+method_trie_num_patterns (method_trie *trie)
+{
+    return trie->num_patterns;
+}
+
+/**
+ * Check whether the given subscriber is subscribed to a prefix matching
+ * the given method name.
+ *
+ * @param trie - The trie.
+ * @param method_name - The method name.
+ * @param subscriber - The subscriber.
+ *
+ * @returns true if the subscriber matches, false otherwise.
+ */
+bool
+method_trie_matches (method_trie *trie, const char *method_name, gpointer subscriber)
+{
+    method_trie_node *node = &trie->root;
+    const char *c = method_name;
+
+    while (node)
+    {
+        if (node->subscribers && g_hash_table_contains (node->subscribers, subscriber))
+        {
+            return true;
+        }
+        if (*c == '\0')
+        {
+            break;
+        }
+        node = method_trie_child_get (node, *c++, false);
+    }
+
+    return false;
+}
+
+/**
+ * Call a function for each subscriber to a prefix matching the given method name.
+ * A subscriber to more than one matching prefix is passed to the function once
+ * for each prefix.
+ *
+ * @param trie - The trie.
+ * @param method_name - The method name.
+ * @param func - The function to call with each subscriber.
+ * @param user_data - User data to pass to the function.
+ */
+void
+method_trie_foreach_match (method_trie *trie, const char *method_name, GFunc func,
+                           gpointer user_data)
+{
+    method_trie_node *node = &trie->root;
+    const char *c = method_name;
+    GHashTableIter iter;
+    gpointer key = NULL;
+
+    while (node)
+    {
+        if (node->subscribers)
+        {
+            g_hash_table_iter_init (&iter, node->subscribers);
+            while (g_hash_table_iter_next (&iter, &key, NULL))
+            {
+                func (key, user_data);
+            }
+        }
+        if (*c == '\0')
+        {
+            break;
+        }
+        node = method_trie_child_get (node, *c++, false);
+    }
+}
+
+/**
+ * Call a function for each known method name below the given node.
+ *
+ * @param node - The node.
+ * @param func - The function to call with each method name.
+ * @param user_data - User data to pass to the function.
+ */
+static void
+method_trie_node_foreach_method (method_trie_node *node, GFunc func, gpointer user_data)
+{
+    method_trie_node *child = NULL;
+
+    if (node->method_name)
+    {
+        func (node->method_name, user_data);
+    }
+
+    for (child = node->child; child; child = child->sibling)
+    {
+        method_trie_node_foreach_method (child, func, user_data);
+    }
+}
+
+/**
+ * Call a function for each known method name matching the given prefix.
+ *
+ * @param trie - The trie.
+ * @param prefix - The method name prefix (an empty prefix matches every method).
+ * @param func - The function to call with each method name.
+ * @param user_data - User data to pass to the function.
+ */
+void
+method_trie_foreach_method (method_trie *trie, const char *prefix, GFunc func,
+                            gpointer user_data)
+{
+    method_trie_node *node = NULL;
+
+    node = method_trie_node_get (trie, prefix, false);
+    if (node)
+    {
+        method_trie_node_foreach_method (node, func, user_data);
+    }
+}
@@ -0,0 +1,30 @@
+/**
+ * method_trie.h
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#ifndef __METHOD_TRIE_H_
+#define __METHOD_TRIE_H_
+
+#include <stdbool.h>
+#include <glib.h>
+
+typedef struct _method_trie_s method_trie;
+
+method_trie *method_trie_new (void);
+void method_trie_destroy (method_trie *trie);
+const char *method_trie_method_add (method_trie *trie, const char *method_name);
+bool method_trie_method_remove (method_trie *trie, const char *method_name);
+bool method_trie_pattern_add (method_trie *trie, const char *prefix, gpointer subscriber);
+bool method_trie_pattern_remove (method_trie *trie, const char *prefix,
+                                 gpointer subscriber);
+guint method_trie_num_patterns (method_trie *trie);
+bool method_trie_matches (method_trie *trie, const char *method_name,
+                          gpointer subscriber);
+void method_trie_foreach_match (method_trie *trie, const char *method_name, GFunc func,
+                                gpointer user_data);
+void method_trie_foreach_method (method_trie *trie, const char *prefix, GFunc func,
+                                 gpointer user_data);
+
+#endif /* __METHOD_TRIE_H_ */
@@ -0,0 +1,815 @@
+/**
+ * publisher_update.c
+ *
+ * Implements the asynchronous delivery of subscription updates to the publishers
+ * registered with the daemon. Each publisher has its own queue of pending updates
+ * that is only written to the publisher's socket from the main loop while the socket
+ * is writable, so a slow or unresponsive publisher never blocks the daemon (or the
+ * updates for any other publisher). Connecting never blocks the daemon either: the
+ * connect is completed once the socket becomes writable. Subscription changes for
+ * the same method and subscriber that arrive before the earlier change has been sent
+ * are coalesced. If the connection to a publisher fails then the pending updates are
+ * dropped and the connection is retried with an increasing delay. Once reconnected
+ * the publisher is sent the full set of subscriptions for the service before any
+ * further updates. The replies from the publisher are counted so that a subscription
+ * request can wait (for a limited time) until the publishers have applied it.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <cmsg/cmsg_private.h>
+#include "publisher_update.h"
+#include "transport/cmsg_transport_private.h"
+#include "cmsg_client_private.h"
+#include "update_api_auto.h"
+#include "data.h"
+
+/* The size of the buffer used to read (and discard) the replies from a publisher */
+#define PUBLISHER_UPDATE_REPLY_BUF_LEN 256
+
+/* The delay in milliseconds before the first and (at most) any later reconnect */
+#define PUBLISHER_UPDATE_RETRY_MIN_MS 100
+#define PUBLISHER_UPDATE_RETRY_MAX_MS 10000
+
+/* The longest time in milliseconds to wait for a publisher to apply the updates
+ * sent to it when syncing with the publisher */
+#define PUBLISHER_UPDATE_SYNC_TIMEOUT_MS 1000
+
+typedef struct
+{
+    char *method_name;  /* NULL if this is a host removal update */
+    cmsg_transport_info *transport_info;
+    bool added;
+    uint32_t addr;
+} pending_update;
+
+struct _publisher_update_queue_s
+{
+    cmsg_client *client;
+    char *service;              /* The service the publisher is publishing for */
+    GQueue *queue;
+    GHashTable *pending;        /* Unsent subscription change -> link in queue */
+    uint8_t *packet;            /* The update being written, NULL if none */
+    uint32_t packet_len;
+    uint32_t offset;            /* Bytes of the packet already written */
+    guint out_source;           /* Writability watch, 0 if not waiting to write */
+    guint in_source;            /* Watch for the replies from the publisher */
+    uint32_t unacked;           /* Updates written but not yet replied to */
+    cmsg_header reply_header;   /* The header of the reply being read */
+    uint32_t reply_offset;      /* Bytes of the reply header already read */
+    uint32_t reply_skip;        /* Bytes of the reply body still to be discarded */
+    guint retry_source;         /* Reconnect timer, 0 if not waiting to reconnect */
+    uint32_t retry_delay;       /* Milliseconds to wait before the next reconnect */
+    bool resync_pending;
+    uint32_t failures;
+};
+
+/**
+ * Hash a pending subscription change by its method name and subscriber.
+ */
+static guint
+pending_update_hash (gconstpointer key)
+{
+    const pending_update *update = (const pending_update *) key;
+
+    return g_str_hash (update->method_name) ^
+        cmsg_transport_info_hash (update->transport_info);
+}
+
+/**
+ * Compare two pending subscription changes for the same method name and subscriber.
+ */
+static gboolean
+pending_update_equal (gconstpointer a, gconstpointer b)
+{
+    const pending_update *update_a = (const pending_update *) a;
+    const pending_update *update_b = (const pending_update *) b;
+
+    return (strcmp (update_a->method_name, update_b->method_name) == 0 &&
+            cmsg_transport_info_compare (update_a->transport_info,
+                                         update_b->transport_info));
+}
+
+/**
+ * Free all memory used by a pending update.
+ *
+ * @param data - The pending update to free.
+ */
+static void
+pending_update_free (gpointer data)
+{
+    pending_update *update = (pending_update *) data;
+
+    if (update->transport_info)
+    {
+        cmsg_transport_info_free (update->transport_info);
+    }
+    CMSG_FREE (update->method_name);
+    CMSG_FREE (update);
+}
+
+/**
+ * Pack a pending update into the packet to write to the publisher.
+ *
+ * @param update_queue - The update queue for the publisher.
+ * @param update - The update to pack.
+ *
+ * @returns true on success, false otherwise.
+ */
+static bool
+pending_update_pack (publisher_update_queue *update_queue, const pending_update *update)
+{
+    cmsg_psd_subscription_update subscription_msg = CMSG_PSD_SUBSCRIPTION_UPDATE_INIT;
+    cmsg_psd_host_info host_msg = CMSG_PSD_HOST_INFO_INIT;
+    const char *method_name = NULL;
+    const ProtobufCMessage *msg = NULL;
+
+    if (update->method_name)
+    {
+        CMSG_SET_FIELD_PTR (&subscription_msg, method_name, update->method_name);
+        CMSG_SET_FIELD_PTR (&subscription_msg, transport, update->transport_info);
+        CMSG_SET_FIELD_VALUE (&subscription_msg, added, update->added);
+        method_name = "subscription_change";
+        msg = (const ProtobufCMessage *) &subscription_msg;
+    }
+    else
+    {
+        CMSG_SET_FIELD_VALUE (&host_msg, addr, update->addr);
+        method_name = "host_removal";
+        msg = (const ProtobufCMessage *) &host_msg;
+    }
+
+    update_queue->offset = 0;
+    return (cmsg_client_create_packet (update_queue->client, method_name, msg,
+                                       &update_queue->packet,
+                                       &update_queue->packet_len) == CMSG_RET_OK);
+}
+
+/**
+ * Pack the full set of subscriptions for the service into the packet to write to
+ * the publisher. The set is read when the publisher is ready to receive it so that
+ * it includes every change made while the publisher was disconnected.
+ *
+ * @param update_queue - The update queue for the publisher.
+ *
+ * @returns true on success, false otherwise.
+ */
+static bool
+publisher_update_queue_pack_resync (publisher_update_queue *update_queue)
+{
+    cmsg_subscription_methods send_msg = CMSG_SUBSCRIPTION_METHODS_INIT;
+    int32_t ret;
+
+    update_queue->resync_pending = false;
+
+    data_get_subscription_info_for_service (update_queue->service, &send_msg);
+
+    update_queue->offset = 0;
+    ret = cmsg_client_create_packet (update_queue->client, "subscriptions_resync",
+                                     (const ProtobufCMessage *) &send_msg,
+                                     &update_queue->packet, &update_queue->packet_len);
+    data_get_subscription_info_for_service_free (&send_msg);
+
+    return (ret == CMSG_RET_OK);
+}
+
+/**
+ * Drop the queued updates, including an update that has been partially written.
+ *
+ * @param update_queue - The update queue for the publisher.
+ */
+static void
+publisher_update_queue_drop (publisher_update_queue *update_queue)
+{
+    g_hash_table_remove_all (update_queue->pending);
+    g_queue_free_full (update_queue->queue, pending_update_free);
+    update_queue->queue = g_queue_new ();
+
+    CMSG_FREE (update_queue->packet);
+    update_queue->packet = NULL;
+    update_queue->offset = 0;
+}
+
+/**
+ * Stop watching the connection to the publisher.
+ *
+ * @param update_queue - The update queue for the publisher.
+ */
+static void
+publisher_update_queue_unwatch (publisher_update_queue *update_queue)
+{
+    if (update_queue->out_source)
+    {
+        g_source_remove (update_queue->out_source);
+        update_queue->out_source = 0;
+    }
+    if (update_queue->in_source)
+    {
+        g_source_remove (update_queue->in_source);
+        update_queue->in_source = 0;
+    }
+}
+
+static void publisher_update_queue_send (publisher_update_queue *update_queue);
+
+/**
+ * Called when it is time to try reconnecting to the publisher.
+ */
+static gboolean
+publisher_update_queue_retry_timeout (gpointer data)
+{
+    publisher_update_queue *update_queue = (publisher_update_queue *) data;
+
+    update_queue->retry_source = 0;
+    publisher_update_queue_send (update_queue);
+
+    return FALSE;
+}
+
+/**
+ * Handle the connection to a publisher failing. The queued updates are dropped,
+ * the connection is closed and reconnecting is tried after a delay that doubles
+ * with each failure. The publisher is resynchronised once it has been reconnected.
+ *
+ * @param update_queue - The update queue for the publisher.
+ */
+static void
+publisher_update_queue_disconnected (publisher_update_queue *update_queue)
+{
+    publisher_update_queue_unwatch (update_queue);
+    publisher_update_queue_drop (update_queue);
+    cmsg_client_close (update_queue->client);
+    update_queue->unacked = 0;
+    update_queue->reply_offset = 0;
+    update_queue->reply_skip = 0;
+    update_queue->resync_pending = true;
+    update_queue->failures++;
+
+    if (update_queue->retry_delay == 0)
+    {
+        syslog (LOG_ERR, "Lost connection to publisher %s, reconnecting",
+                update_queue->client->_transport->tport_id);
+        update_queue->retry_delay = PUBLISHER_UPDATE_RETRY_MIN_MS;
+    }
+    else
+    {
+        update_queue->retry_delay = MIN (update_queue->retry_delay * 2,
+                                         PUBLISHER_UPDATE_RETRY_MAX_MS);
+    }
+
+    update_queue->retry_source = g_timeout_add (update_queue->retry_delay,
+                                                publisher_update_queue_retry_timeout,
+                                                update_queue);
+}
+
+/**
+ * Count a reply from the publisher against the updates written to it.
+ *
+ * @param update_queue - The update queue for the publisher.
+ */
+static void
+publisher_update_queue_ack (publisher_update_queue *update_queue)
+{
+    if (update_queue->unacked > 0)
+    {
+        update_queue->unacked--;
+    }
+}
+
+/**
+ * Read the replies the publisher has sent to updates. The replies carry no
+ * information so only their headers are parsed (to count them), and the rest
+ * of each reply is discarded.
+ *
+ * @param update_queue - The update queue for the publisher.
+ *
+ * @returns true if all of the available replies have been read, false if the
+ *          connection has failed.
+ */
+static bool
+publisher_update_queue_read_replies (publisher_update_queue *update_queue)
+{
+    uint8_t buf[PUBLISHER_UPDATE_REPLY_BUF_LEN];
+    int sock = cmsg_client_get_socket (update_queue->client);
+    cmsg_header header;
+    uint8_t *dest;
+    size_t len;
+    ssize_t ret;
+
+    while (true)
+    {
+        if (update_queue->reply_skip > 0)
+        {
+            dest = buf;
+            len = MIN (sizeof (buf), update_queue->reply_skip);
+        }
+        else
+        {
+            dest = (uint8_t *) &update_queue->reply_header + update_queue->reply_offset;
+            len = sizeof (cmsg_header) - update_queue->reply_offset;
+        }
+
+        ret = recv (sock, dest, len, MSG_DONTWAIT);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return true;
+        }
+        if (ret <= 0)
+        {
+            return false;
+        }
+
+        if (update_queue->reply_skip > 0)
+        {
+            update_queue->reply_skip -= ret;
+            if (update_queue->reply_skip == 0)
+            {
+                publisher_update_queue_ack (update_queue);
+            }
+            continue;
+        }
+
+        update_queue->reply_offset += ret;
+        if (update_queue->reply_offset < sizeof (cmsg_header))
+        {
+            continue;
+        }
+
+        update_queue->reply_offset = 0;
+        if (cmsg_header_process (&update_queue->reply_header, &header) != CMSG_RET_OK ||
+            header.header_length < sizeof (cmsg_header))
+        {
+            return false;
+        }
+
+        update_queue->reply_skip = header.header_length - sizeof (cmsg_header) +
+            header.message_length;
+        if (update_queue->reply_skip == 0)
+        {
+            publisher_update_queue_ack (update_queue);
+        }
+    }
+}
+
+/**
+ * Called when the publisher has replied to updates (or the connection has failed).
+ */
+static gboolean
+publisher_update_queue_readable (GIOChannel *source, GIOCondition condition,
+                                 gpointer data)
+{
+    publisher_update_queue *update_queue = (publisher_update_queue *) data;
+
+    if (publisher_update_queue_read_replies (update_queue))
+    {
+        return TRUE;
+    }
+
+    /* The watch is removed by returning FALSE rather than by the disconnect */
+    update_queue->in_source = 0;
+    publisher_update_queue_disconnected (update_queue);
+    return FALSE;
+}
+
+/**
+ * Start watching for the replies from the (connected) publisher if not already.
+ *
+ * @param update_queue - The update queue for the publisher.
+ */
+static void
+publisher_update_queue_watch_replies (publisher_update_queue *update_queue)
+{
+    GIOChannel *channel = NULL;
+
+    if (update_queue->in_source)
+    {
+        return;
+    }
+
+    channel = g_io_channel_unix_new (cmsg_client_get_socket (update_queue->client));
+    update_queue->in_source = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                              publisher_update_queue_readable,
+                                              update_queue);
+    g_io_channel_unref (channel);
+}
+
+/**
+ * Write as many of the queued updates to the publisher as its (connected) socket
+ * will accept without blocking.
+ *
+ * @param update_queue - The update queue for the publisher.
+ *
+ * @returns true if there is nothing left to write, false otherwise.
+ */
+static bool
+publisher_update_queue_flush (publisher_update_queue *update_queue)
+{
+    pending_update *update = NULL;
+    GList *link = NULL;
+    ssize_t ret;
+    int sock;
+
+    publisher_update_queue_watch_replies (update_queue);
+    sock = cmsg_client_get_socket (update_queue->client);
+
+    while (true)
+    {
+        if (!update_queue->packet && update_queue->resync_pending)
+        {
+            if (!publisher_update_queue_pack_resync (update_queue))
+            {
+                update_queue->packet = NULL;
+            }
+            continue;
+        }
+
+        if (!update_queue->packet)
+        {
+            link = g_queue_peek_head_link (update_queue->queue);
+            if (!link)
+            {
+                return true;
+            }
+
+            /* Once the update is being written it can no longer be coalesced */
+            update = (pending_update *) link->data;
+            if (update->method_name &&
+                g_hash_table_lookup (update_queue->pending, update) == link)
+            {
+                g_hash_table_remove (update_queue->pending, update);
+            }
+            g_queue_delete_link (update_queue->queue, link);
+
+            if (!pending_update_pack (update_queue, update))
+            {
+                update_queue->packet = NULL;
+            }
+            pending_update_free (update);
+            continue;
+        }
+
+        ret = send (sock, update_queue->packet + update_queue->offset,
+                    update_queue->packet_len - update_queue->offset,
+                    MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                publisher_update_queue_disconnected (update_queue);
+                return true;
+            }
+            return false;
+        }
+
+        update_queue->offset += ret;
+        if (update_queue->offset == update_queue->packet_len)
+        {
+            CMSG_FREE (update_queue->packet);
+            update_queue->packet = NULL;
+            update_queue->offset = 0;
+            update_queue->unacked++;
+        }
+    }
+}
+
+/**
+ * Handle the socket to the publisher becoming writable (or failing). Completes
+ * the connection if it is in progress and then writes the queued updates until the
+ * socket would block again.
+ *
+ * @param update_queue - The update queue for the publisher. The writability watch
+ *                       must already be cleared from the queue.
+ * @param failed - Whether the socket has reported an error or hang up.
+ *
+ * @returns true if the socket needs to be watched for writability again, false
+ *          otherwise.
+ */
+static bool
+publisher_update_queue_write (publisher_update_queue *update_queue, bool failed)
+{
+    int32_t ret;
+
+    /* A connection in progress reports its own failure */
+    ret = cmsg_client_connect_finish (update_queue->client);
+    if (ret == -EINPROGRESS)
+    {
+        return true;
+    }
+
+    if (ret < 0 || failed)
+    {
+        publisher_update_queue_disconnected (update_queue);
+        return false;
+    }
+    update_queue->retry_delay = 0;
+
+    return !publisher_update_queue_flush (update_queue);
+}
+
+/**
+ * Called when the socket to the publisher is writable (or has failed).
+ */
+static gboolean
+publisher_update_queue_writable (GIOChannel *source, GIOCondition condition,
+                                 gpointer data)
+{
+    publisher_update_queue *update_queue = (publisher_update_queue *) data;
+    guint watch = update_queue->out_source;
+
+    /* The watch is removed by returning FALSE rather than by the disconnect */
+    update_queue->out_source = 0;
+
+    if (publisher_update_queue_write (update_queue, condition & (G_IO_ERR | G_IO_HUP)))
+    {
+        update_queue->out_source = watch;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * Write the queued updates to the publisher, connecting to the publisher first if
+ * required. Waits for the socket to become writable if the connection is still in
+ * progress or the socket cannot accept all of the updates now.
+ *
+ * @param update_queue - The update queue for the publisher.
+ */
+static void
+publisher_update_queue_send (publisher_update_queue *update_queue)
+{
+    GIOChannel *channel = NULL;
+    int32_t ret;
+
+    /* Already waiting for the socket to become writable or to reconnect */
+    if (update_queue->out_source || update_queue->retry_source)
+    {
+        return;
+    }
+
+    ret = cmsg_client_connect_start (update_queue->client);
+    if (ret < 0 && ret != -EINPROGRESS)
+    {
+        publisher_update_queue_disconnected (update_queue);
+        return;
+    }
+
+    if (ret == 0)
+    {
+        update_queue->retry_delay = 0;
+        if (publisher_update_queue_flush (update_queue))
+        {
+            return;
+        }
+    }
+
+    channel = g_io_channel_unix_new (cmsg_client_get_socket (update_queue->client));
+    update_queue->out_source = g_io_add_watch (channel, G_IO_OUT,
+                                               publisher_update_queue_writable,
+                                               update_queue);
+    g_io_channel_unref (channel);
+}
+
+/**
+ * Create the queue used to send subscription updates to a publisher.
+ *
+ * @param transport - The transport for the publisher's update server. The queue
+ *                    takes ownership of the transport.
+ * @param service - The service the publisher is publishing for.
+ *
+ * @returns A pointer to the update queue on success, NULL otherwise.
+ */
+publisher_update_queue *
+publisher_update_queue_new (cmsg_transport *transport, const char *service)
+{
+    publisher_update_queue *update_queue = NULL;
+
+    update_queue = CMSG_CALLOC (1, sizeof (publisher_update_queue));
+    if (!update_queue)
+    {
+        cmsg_transport_destroy (transport);
+        return NULL;
+    }
+
+    update_queue->client = cmsg_client_create (transport, CMSG_DESCRIPTOR (cmsg_psd, update));
+    if (!update_queue->client)
+    {
+        cmsg_transport_destroy (transport);
+        CMSG_FREE (update_queue);
+        return NULL;
+    }
+    update_queue->service = CMSG_STRDUP (service);
+    update_queue->queue = g_queue_new ();
+    update_queue->pending = g_hash_table_new (pending_update_hash, pending_update_equal);
+
+    return update_queue;
+}
+
+/**
+ * Destroy the queue used to send subscription updates to a publisher. Any updates
+ * that have not yet been sent are dropped.
+ *
+ * @param update_queue - The update queue to destroy.
+ */
+void
+publisher_update_queue_destroy (publisher_update_queue *update_queue)
+{
+    publisher_update_queue_unwatch (update_queue);
+    if (update_queue->retry_source)
+    {
+        g_source_remove (update_queue->retry_source);
+    }
+    publisher_update_queue_drop (update_queue);
+    g_hash_table_unref (update_queue->pending);
+    g_queue_free (update_queue->queue);
+    cmsg_destroy_client_and_transport (update_queue->client);
+    CMSG_FREE (update_queue->service);
+    CMSG_FREE (update_queue);
+}
+
+/**
+ * Queue a subscription change to be sent to the publisher. If an opposite change for
+ * the same method and subscriber is still waiting to be sent then the two changes
+ * cancel each other out, and if the same change is already queued then this change
+ * is simply dropped.
+ *
+ * @param update_queue - The update queue for the publisher.
+ * @param method_name - The name of the method that has changed.
+ * @param transport_info - The transport information of the subscriber.
+ * @param added - True if the method added a subscriber, false if it removed one.
+ */
+void
+publisher_update_queue_subscription_change (publisher_update_queue *update_queue,
+                                            const char *method_name,
+                                            const cmsg_transport_info *transport_info,
+                                            bool added)
+{
+    pending_update lookup = {
+        .method_name = (char *) method_name,
+        .transport_info = (cmsg_transport_info *) transport_info,
+    };
+    pending_update *update = NULL;
+    GList *link = NULL;
+
+    /* The resync sent once the publisher is reconnected includes this change */
+    if (update_queue->resync_pending)
+    {
+        return;
+    }
+
+    link = (GList *) g_hash_table_lookup (update_queue->pending, &lookup);
+    if (link)
+    {
+        update = (pending_update *) link->data;
+        if (update->added != added)
+        {
+            g_hash_table_remove (update_queue->pending, update);
+            g_queue_delete_link (update_queue->queue, link);
+            pending_update_free (update);
+        }
+        return;
+    }
+
+    update = CMSG_CALLOC (1, sizeof (pending_update));
+    update->method_name = CMSG_STRDUP (method_name);
+    update->transport_info = cmsg_transport_info_copy (transport_info);
+    update->added = added;
+
+    g_queue_push_tail (update_queue->queue, update);
+    g_hash_table_insert (update_queue->pending, update,
+                         g_queue_peek_tail_link (update_queue->queue));
+
+    publisher_update_queue_send (update_queue);
+}
+
+/**
+ * Queue a host removal to be sent to the publisher. Subscription changes queued
+ * before the host removal are not coalesced with changes queued after it so that
+ * the publisher sees the changes in the same order as the daemon made them.
+ *
+ * @param update_queue - The update queue for the publisher.
+ * @param addr - The address specifying the host that has been removed.
+ */
+void
+publisher_update_queue_host_removal (publisher_update_queue *update_queue, uint32_t addr)
+{
+    pending_update *update = NULL;
+
+    /* The resync sent once the publisher is reconnected includes this change */
+    if (update_queue->resync_pending)
+    {
+        return;
+    }
+
+    update = CMSG_CALLOC (1, sizeof (pending_update));
+    update->addr = addr;
+
+    g_hash_table_remove_all (update_queue->pending);
+    g_queue_push_tail (update_queue->queue, update);
+
+    publisher_update_queue_send (update_queue);
+}
+
+/**
+ * Check whether every update queued for the publisher has been written to it and
+ * replied to.
+ *
+ * @param update_queue - The update queue for the publisher.
+ *
+ * @returns true if the publisher has applied every update, false otherwise.
+ */
+static bool
+publisher_update_queue_synced (const publisher_update_queue *update_queue)
+{
+    return (g_queue_is_empty (update_queue->queue) && !update_queue->packet &&
+            !update_queue->resync_pending && update_queue->unacked == 0);
+}
+
+/**
+ * Wait until the publisher has applied every update queued for it, so that a
+ * subscriber can rely on receiving the events published once subscribing has
+ * returned. The wait is limited so that a slow or unresponsive publisher cannot
+ * stall the daemon, and it ends early if the connection to the publisher fails
+ * (the publisher is resynchronised once it is reconnected). Any updates not
+ * applied by then are still sent as normal.
+ *
+ * @param update_queue - The update queue for the publisher.
+ */
+void
+publisher_update_queue_sync (publisher_update_queue *update_queue)
+{
+    gint64 deadline = g_get_monotonic_time () + PUBLISHER_UPDATE_SYNC_TIMEOUT_MS * 1000;
+    gint64 timeout_ms;
+    struct pollfd pfd;
+    guint watch;
+    int ret;
+
+    while (!update_queue->retry_source && !publisher_update_queue_synced (update_queue))
+    {
+        timeout_ms = (deadline - g_get_monotonic_time ()) / 1000;
+        if (timeout_ms <= 0)
+        {
+            return;
+        }
+
+        pfd.fd = cmsg_client_get_socket (update_queue->client);
+        pfd.events = update_queue->out_source ? POLLOUT : POLLIN;
+        pfd.revents = 0;
+
+        ret = poll (&pfd, 1, timeout_ms);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return;
+        }
+
+        if (update_queue->out_source)
+        {
+            watch = update_queue->out_source;
+            update_queue->out_source = 0;
+            if (publisher_update_queue_write (update_queue,
+                                              pfd.revents & (POLLERR | POLLHUP)))
+            {
+                update_queue->out_source = watch;
+            }
+            else
+            {
+                g_source_remove (watch);
+            }
+        }
+        else if (!publisher_update_queue_read_replies (update_queue))
+        {
+            publisher_update_queue_disconnected (update_queue);
+        }
+    }
+}
+
+/**
+ * Print the information about the publisher the update queue sends to.
+ *
+ * @param update_queue - The update queue for the publisher.
+ * @param fp - The file to print to.
+ */
+void
+publisher_update_queue_debug_dump (publisher_update_queue *update_queue, FILE *fp)
+{
+    fprintf (fp, "   %s (pending updates: %u) (failures: %u)%s%s\n",
+             update_queue->client->_transport->tport_id,
+             g_queue_get_length (update_queue->queue), update_queue->failures,
+             update_queue->resync_pending ? " (resync pending)" : "",
+             update_queue->retry_source ? " (reconnecting)" : "");
+}
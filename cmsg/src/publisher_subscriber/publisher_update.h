@@ -0,0 +1,28 @@
+/**
+ * publisher_update.h
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#ifndef __PUBLISHER_UPDATE_H_
+#define __PUBLISHER_UPDATE_H_
+
+#include <stdio.h>
+#include <cmsg/cmsg_transport.h>
+#include "cmsg_types_auto.h"
+
+typedef struct _publisher_update_queue_s publisher_update_queue;
+
+publisher_update_queue *publisher_update_queue_new (cmsg_transport *transport,
+                                                    const char *service);
+void publisher_update_queue_destroy (publisher_update_queue *update_queue);
+void publisher_update_queue_subscription_change (publisher_update_queue *update_queue,
+                                                 const char *method_name,
+                                                 const cmsg_transport_info *transport_info,
+                                                 bool added);
+void publisher_update_queue_host_removal (publisher_update_queue *update_queue,
+                                          uint32_t addr);
+void publisher_update_queue_sync (publisher_update_queue *update_queue);
+void publisher_update_queue_debug_dump (publisher_update_queue *update_queue, FILE *fp);
+
+#endif /* __PUBLISHER_UPDATE_H_ */
@@ -8,6 +8,7 @@
  */
 
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <cmsg/cmsg_glib_helpers.h>
 #include "remote_sync_api_auto.h"
 #include "remote_sync_impl_auto.h"
@@ -16,13 +17,270 @@
 #include <cmsg/cmsg_sl.h>
 #include "transport/cmsg_transport_private.h"
 
+/* The maximum number of changes kept in the change log for each remote host.
+ * A remote host that has missed more changes than this is sent a bulk sync. */
+#define REMOTE_SYNC_CHANGE_LOG_SIZE 1024
+
+typedef struct
+{
+    uint32_t seq;
+    bool added;
+    cmsg_subscription_info *info;
+} remote_sync_change;
+
+typedef struct
+{
+    /* The changes to the subscriptions on this host for the remote host */
+    uint32_t local_seq;
+    GQueue *change_log;         /* 'remote_sync_change' in sequence order */
+
+    /* The state of the subscriptions received from the remote host */
+    uint32_t remote_epoch;
+    uint32_t remote_seq;
+    bool synced;
+    bool request_sent;
+    GList *cached;              /* Subscriptions retained while the host is unavailable */
+
+    /* A sync request from the remote host that could not be answered yet */
+    bool request_pending;
+    uint32_t pending_epoch;
+    uint32_t pending_seq;
+
+    /* The remote host only supports the original bulk sync and unsequenced changes */
+    bool legacy;
+    bool legacy_sync_pending;
+} remote_sync_peer;
+
 cmsg_server *remote_sync_server = NULL;
 GList *remote_sync_client_list = NULL;
 static uint32_t remote_sync_local_ip_addr = 0;
+static uint32_t remote_sync_epoch = 0;
+static GHashTable *remote_sync_peers = NULL;
+
+/**
+ * Free a change in the change log.
+ *
+ * @param data - The change to free.
+ */
+static void
+remote_sync_change_free (gpointer data)
+{
+    remote_sync_change *change = (remote_sync_change *) data;
+
+    data_subscription_info_free (change->info);
+    CMSG_FREE (change);
+}
+
+/**
+ * Free the sync state for a remote host.
+ *
+ * @param data - The sync state to free.
+ */
+static void
+remote_sync_peer_free (gpointer data)
+{
+    remote_sync_peer *peer = (remote_sync_peer *) data;
+
+    g_queue_free_full (peer->change_log, remote_sync_change_free);
+    g_list_free_full (peer->cached, data_subscription_info_free);
+    CMSG_FREE (peer);
+}
+
+/**
+ * Get the sync state for the remote host with the given address or
+ * potentially create it if it doesn't already exist.
+ *
+ * @param addr - The address of the remote host.
+ * @param create - Whether to create the state if it didn't already exist or not.
+ *
+ * @returns A pointer to the sync state for the remote host.
+ */
+static remote_sync_peer *
+remote_sync_peer_get (uint32_t addr, bool create)
+{
+    remote_sync_peer *peer = NULL;
+
+    if (!remote_sync_peers)
+    {
+        remote_sync_peers = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                                   remote_sync_peer_free);
+    }
+
+    peer = (remote_sync_peer *) g_hash_table_lookup (remote_sync_peers,
+                                                     GUINT_TO_POINTER (addr));
+    if (!peer && create)
+    {
+        peer = CMSG_CALLOC (1, sizeof (remote_sync_peer));
+        peer->change_log = g_queue_new ();
+        g_hash_table_insert (remote_sync_peers, GUINT_TO_POINTER (addr), peer);
+    }
+
+    return peer;
+}
+
+/**
+ * Helper function called for each client in the GList. Finds the client that
+ * matches the input IP address.
+ *
+ * @param a - A client from the list.
+ * @param b - Pointer to the address to compare against.
+ *
+ * @returns 0 if the client matches, -1 otherwise.
+ */
+static gint
+remote_sync_find_client_by_address (gconstpointer a, gconstpointer b)
+{
+    cmsg_client *client = (cmsg_client *) a;
+    uint32_t *addr = (uint32_t *) b;
+
+    if (client->_transport->config.socket.sockaddr.in.sin_addr.s_addr == *addr)
+    {
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * Get the client to the remote host with the given address.
+ *
+ * @param addr - The address of the remote host.
+ *
+ * @returns The client, or NULL if the remote host is not known.
+ */
+static cmsg_client *
+remote_sync_client_get (uint32_t addr)
+{
+    GList *link = NULL;
+
+    link = g_list_find_custom (remote_sync_client_list, &addr,
+                               remote_sync_find_client_by_address);
+
+    return link ? (cmsg_client *) link->data : NULL;
+}
+
+/**
+ * Ask a remote host for the changes to its subscriptions for this host since the
+ * last change that was applied from it.
+ *
+ * @param client - The client to the remote host.
+ * @param peer - The sync state for the remote host.
+ */
+static void
+remote_sync_request_sync (cmsg_client *client, remote_sync_peer *peer)
+{
+    cmsg_psd_sync_request send_msg = CMSG_PSD_SYNC_REQUEST_INIT;
+
+    CMSG_SET_FIELD_VALUE (&send_msg, addr, remote_sync_local_ip_addr);
+    CMSG_SET_FIELD_VALUE (&send_msg, epoch, peer->remote_epoch);
+    CMSG_SET_FIELD_VALUE (&send_msg, seq, peer->remote_seq);
+
+    peer->request_sent = true;
+    cmsg_psd_remote_sync_api_sync_request (client, &send_msg);
+}
+
+/**
+ * Apply (and free) the subscriptions retained from a remote host while it was
+ * unavailable.
+ *
+ * @param peer - The sync state for the remote host.
+ */
+static void
+remote_sync_apply_cached (remote_sync_peer *peer)
+{
+    GList *list = NULL;
+
+    for (list = peer->cached; list; list = g_list_next (list))
+    {
+        data_add_local_subscription ((const cmsg_subscription_info *) list->data);
+    }
+    g_list_free_full (peer->cached, data_subscription_info_free);
+    peer->cached = NULL;
+}
+
+/**
+ * Get the address of the remote host that sent the message being processed.
+ *
+ * @param service - The service the message was received on.
+ *
+ * @returns The IPv4 address of the remote host, or zero if it is not known.
+ */
+static uint32_t
+remote_sync_sender_addr_get (const void *service)
+{
+    const cmsg_server_closure_info *closure_info = service;
+    const cmsg_server_closure_data *closure_data = NULL;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof (addr);
+
+    if (!closure_info)
+    {
+        return 0;
+    }
+
+    closure_data = closure_info->closure_data;
+    if (getpeername (closure_data->reply_socket, (struct sockaddr *) &addr, &len) < 0 ||
+        addr.sin_family != AF_INET)
+    {
+        return 0;
+    }
+
+    return addr.sin_addr.s_addr;
+}
+
+/**
+ * Apply a bulk sync from a remote host that only supports the original bulk sync.
+ * Such a host sends a bulk sync whenever this host joins, so this is also when
+ * the remote host is sent all of the subscriptions for it in return.
+ *
+ * @param service - The service the bulk sync was received on.
+ * @param recv_msg - The received bulk sync.
+ */
+static void
+remote_sync_legacy_bulk_sync (const void *service, const cmsg_psd_bulk_sync_data *recv_msg)
+{
+    int i;
+    cmsg_subscription_info *info;
+    remote_sync_peer *peer = NULL;
+    cmsg_client *client = NULL;
+    uint32_t addr;
+
+    addr = remote_sync_sender_addr_get (service);
+    if (addr)
+    {
+        peer = remote_sync_peer_get (addr, true);
+        g_list_free_full (peer->cached, data_subscription_info_free);
+        peer->cached = NULL;
+        data_remove_local_subscriptions_for_addr (addr);
+    }
+
+    CMSG_REPEATED_FOREACH (recv_msg, data, info, i)
+    {
+        data_add_local_subscription (info);
+    }
+
+    if (!peer)
+    {
+        return;
+    }
+
+    peer->legacy = true;
+    client = remote_sync_client_get (addr);
+    if (client)
+    {
+        remote_sync_bulk_sync_subscriptions (client);
+    }
+    else
+    {
+        /* Sync once the server on the remote host is known */
+        peer->legacy_sync_pending = true;
+    }
+}
 
 /**
  * Tell the daemon about all subscriptions from a remote host for services running
- * on this host.
+ * on this host. Any subscriptions previously received from the remote host are
+ * replaced.
  */
 void
 cmsg_psd_remote_sync_impl_bulk_sync (const void *service,
@@ -30,18 +288,142 @@ cmsg_psd_remote_sync_impl_bulk_sync (const void *service,
 {
     int i;
     cmsg_subscription_info *info;
+    remote_sync_peer *peer = NULL;
+
+    if (!CMSG_IS_FIELD_PRESENT (recv_msg, epoch))
+    {
+        remote_sync_legacy_bulk_sync (service, recv_msg);
+        cmsg_psd_remote_sync_server_bulk_syncSend (service);
+        return;
+    }
+
+    peer = remote_sync_peer_get (recv_msg->addr, true);
+    peer->legacy = false;
+
+    g_list_free_full (peer->cached, data_subscription_info_free);
+    peer->cached = NULL;
+    data_remove_local_subscriptions_for_addr (recv_msg->addr);
 
     CMSG_REPEATED_FOREACH (recv_msg, data, info, i)
     {
         data_add_local_subscription (info);
     }
 
+    peer->remote_epoch = recv_msg->epoch;
+    peer->remote_seq = recv_msg->seq;
+    peer->synced = true;
+    peer->request_sent = false;
+
     cmsg_psd_remote_sync_server_bulk_syncSend (service);
 }
 
+/**
+ * Tell the daemon about the changes to the subscriptions from a remote host for
+ * services running on this host since the last change applied from that host.
+ */
+void
+cmsg_psd_remote_sync_impl_delta_sync (const void *service,
+                                      const cmsg_psd_delta_sync_data *recv_msg)
+{
+    int i;
+    cmsg_psd_subscription_delta *delta;
+    remote_sync_peer *peer = NULL;
+    cmsg_client *client = NULL;
+
+    peer = remote_sync_peer_get (recv_msg->addr, true);
+    peer->legacy = false;
+
+    if (recv_msg->epoch != peer->remote_epoch || recv_msg->from_seq > peer->remote_seq)
+    {
+        /* The delta does not follow on from the state we hold. */
+        peer->synced = false;
+        client = remote_sync_client_get (recv_msg->addr);
+        if (client)
+        {
+            remote_sync_request_sync (client, peer);
+        }
+        cmsg_psd_remote_sync_server_delta_syncSend (service);
+        return;
+    }
+
+    remote_sync_apply_cached (peer);
+
+    CMSG_REPEATED_FOREACH (recv_msg, changes, delta, i)
+    {
+        if (delta->added)
+        {
+            data_add_local_subscription (delta->info);
+        }
+        else
+        {
+            data_remove_local_subscription (delta->info);
+        }
+    }
+
+    peer->remote_seq = recv_msg->seq;
+    peer->synced = true;
+    peer->request_sent = false;
+
+    cmsg_psd_remote_sync_server_delta_syncSend (service);
+}
+
+/**
+ * Apply a single subscription change from a remote host. If the change does not
+ * directly follow the last change applied from the host then the host is asked
+ * for the changes that have been missed.
+ *
+ * @param recv_msg - The received change.
+ * @param added - Whether the subscription has been added or removed.
+ */
+static void
+remote_sync_change_receive (const cmsg_psd_sync_change *recv_msg, bool added)
+{
+    remote_sync_peer *peer = NULL;
+    cmsg_client *client = NULL;
+
+    peer = remote_sync_peer_get (recv_msg->addr, true);
+    peer->legacy = false;
+
+    if (peer->synced && recv_msg->epoch == peer->remote_epoch)
+    {
+        if (recv_msg->seq == peer->remote_seq + 1)
+        {
+            if (added)
+            {
+                data_add_local_subscription (recv_msg->info);
+            }
+            else
+            {
+                data_remove_local_subscription (recv_msg->info);
+            }
+            peer->remote_seq = recv_msg->seq;
+            return;
+        }
+
+        if (recv_msg->seq <= peer->remote_seq)
+        {
+            /* Already applied */
+            return;
+        }
+    }
+
+    /* Any change received while waiting for a sync is included in the sync. */
+    if (peer->request_sent)
+    {
+        return;
+    }
+
+    peer->synced = false;
+    client = remote_sync_client_get (recv_msg->addr);
+    if (client)
+    {
+        remote_sync_request_sync (client, peer);
+    }
+}
+
 /**
  * Tell the daemon about a subscription for a service running on this host that has
- * been added on a remote host.
+ * been added on a remote host (that only supports unsequenced changes).
  */
 void
 cmsg_psd_remote_sync_impl_add_subscription (const void *service,
@@ -53,7 +435,7 @@ cmsg_psd_remote_sync_impl_add_subscription (const void *service,
 
 /**
  * Tell the daemon about a subscription for a service running on this host that has
- * been removed on a remote host.
+ * been removed on a remote host (that only supports unsequenced changes).
  */
 void
 cmsg_psd_remote_sync_impl_remove_subscription (const void *service,
@@ -64,26 +446,56 @@ cmsg_psd_remote_sync_impl_remove_subscription (const void *service,
 }
 
 /**
- * Helper function called for each client in the GList. Finds the client that
- * matches the input IP address.
- *
- * @param a - A client from the list.
- * @param b - Pointer to the address to compare against.
- *
- * @returns 0 if the client matches, -1 otherwise.
+ * Tell the daemon about a subscription for a service running on this host that has
+ * been added on a remote host.
  */
-static gint
-remote_sync_find_client_by_address (gconstpointer a, gconstpointer b)
+void
+cmsg_psd_remote_sync_impl_add_subscription_seq (const void *service,
+                                                const cmsg_psd_sync_change *recv_msg)
 {
-    cmsg_client *client = (cmsg_client *) a;
-    uint32_t *addr = (uint32_t *) b;
+    remote_sync_change_receive (recv_msg, true);
+    cmsg_psd_remote_sync_server_add_subscription_seqSend (service);
+}
 
-    if (client->_transport->config.socket.sockaddr.in.sin_addr.s_addr == *addr)
+/**
+ * Tell the daemon about a subscription for a service running on this host that has
+ * been removed on a remote host.
+ */
+void
+cmsg_psd_remote_sync_impl_remove_subscription_seq (const void *service,
+                                                   const cmsg_psd_sync_change *recv_msg)
+{
+    remote_sync_change_receive (recv_msg, false);
+    cmsg_psd_remote_sync_server_remove_subscription_seqSend (service);
+}
+
+/**
+ * Record a change to the subscriptions for a remote host in the change log
+ * for that host.
+ *
+ * @param peer - The sync state for the remote host.
+ * @param subscriber_info - The subscription that has changed.
+ * @param added - Whether the subscription has been added or removed.
+ */
+static void
+remote_sync_change_log_append (remote_sync_peer *peer,
+                               const cmsg_subscription_info *subscriber_info, bool added)
+{
+    remote_sync_change *change = NULL;
+
+    change = CMSG_CALLOC (1, sizeof (remote_sync_change));
+    change->seq = ++peer->local_seq;
+    change->added = added;
+    change->info = data_subscription_info_create (subscriber_info->service,
+                                                  subscriber_info->method_name,
+                                                  subscriber_info->transport_info);
+    CMSG_SET_FIELD_VALUE (change->info, remote_addr, subscriber_info->remote_addr);
+
+    g_queue_push_tail (peer->change_log, change);
+    while (g_queue_get_length (peer->change_log) > REMOTE_SYNC_CHANGE_LOG_SIZE)
     {
-        return 0;
+        remote_sync_change_free (g_queue_pop_head (peer->change_log));
     }
-
-    return -1;
 }
 
 /**
@@ -97,15 +509,16 @@ static void
 remote_sync_subscription_added_removed (const cmsg_subscription_info *subscriber_info,
                                         bool added)
 {
+    cmsg_psd_sync_change send_msg = CMSG_PSD_SYNC_CHANGE_INIT;
     cmsg_client *client = NULL;
-    GList *link = NULL;
+    remote_sync_peer *peer = NULL;
 
-    link = g_list_find_custom (remote_sync_client_list, &subscriber_info->remote_addr,
-                               remote_sync_find_client_by_address);
-    if (link)
-    {
-        client = (cmsg_client *) link->data;
+    peer = remote_sync_peer_get (subscriber_info->remote_addr, true);
+    remote_sync_change_log_append (peer, subscriber_info, added);
 
+    client = remote_sync_client_get (subscriber_info->remote_addr);
+    if (client && peer->legacy)
+    {
         if (added)
         {
             cmsg_psd_remote_sync_api_add_subscription (client, subscriber_info);
@@ -115,6 +528,22 @@ remote_sync_subscription_added_removed (const cmsg_subscription_info *subscriber
             cmsg_psd_remote_sync_api_remove_subscription (client, subscriber_info);
         }
     }
+    else if (client)
+    {
+        CMSG_SET_FIELD_VALUE (&send_msg, addr, remote_sync_local_ip_addr);
+        CMSG_SET_FIELD_VALUE (&send_msg, epoch, remote_sync_epoch);
+        CMSG_SET_FIELD_VALUE (&send_msg, seq, peer->local_seq);
+        CMSG_SET_FIELD_PTR (&send_msg, info, (cmsg_subscription_info *) subscriber_info);
+
+        if (added)
+        {
+            cmsg_psd_remote_sync_api_add_subscription_seq (client, &send_msg);
+        }
+        else
+        {
+            cmsg_psd_remote_sync_api_remove_subscription_seq (client, &send_msg);
+        }
+    }
 }
 
 /**
@@ -151,6 +580,7 @@ remote_sync_bulk_sync_subscriptions (cmsg_client *client)
     GList *list = NULL;
     const cmsg_subscription_info *info = NULL;
     uint32_t remote_addr = client->_transport->config.socket.sockaddr.in.sin_addr.s_addr;
+    remote_sync_peer *peer = NULL;
 
     for (list = g_list_first (data_get_remote_subscriptions ()); list;
          list = g_list_next (list))
@@ -162,10 +592,183 @@ remote_sync_bulk_sync_subscriptions (cmsg_client *client)
         }
     }
 
+    peer = remote_sync_peer_get (remote_addr, true);
+    CMSG_SET_FIELD_VALUE (&send_msg, addr, remote_sync_local_ip_addr);
+    CMSG_SET_FIELD_VALUE (&send_msg, epoch, remote_sync_epoch);
+    CMSG_SET_FIELD_VALUE (&send_msg, seq, peer->local_seq);
+
     cmsg_psd_remote_sync_api_bulk_sync (client, &send_msg);
     CMSG_REPEATED_FREE (send_msg.data);
 }
 
+/**
+ * Send the changes to the subscriptions on this node for a remote host since
+ * the given sequence number.
+ *
+ * @param client - The client to the remote host.
+ * @param peer - The sync state for the remote host.
+ * @param from_seq - The sequence number of the last change the remote host has applied.
+ */
+static void
+remote_sync_delta_sync_subscriptions (cmsg_client *client, remote_sync_peer *peer,
+                                      uint32_t from_seq)
+{
+    cmsg_psd_delta_sync_data send_msg = CMSG_PSD_DELTA_SYNC_DATA_INIT;
+    cmsg_psd_subscription_delta *deltas = NULL;
+    const remote_sync_change *change = NULL;
+    GList *list = NULL;
+    int i = 0;
+
+    deltas = CMSG_CALLOC (peer->local_seq - from_seq + 1,
+                          sizeof (cmsg_psd_subscription_delta));
+
+    for (list = g_queue_peek_head_link (peer->change_log); list; list = g_list_next (list))
+    {
+        change = (const remote_sync_change *) list->data;
+        if (change->seq > from_seq)
+        {
+            cmsg_psd_subscription_delta_init (&deltas[i]);
+            CMSG_SET_FIELD_VALUE (&deltas[i], added, change->added);
+            CMSG_SET_FIELD_PTR (&deltas[i], info, change->info);
+            CMSG_REPEATED_APPEND (&send_msg, changes, &deltas[i]);
+            i++;
+        }
+    }
+
+    CMSG_SET_FIELD_VALUE (&send_msg, addr, remote_sync_local_ip_addr);
+    CMSG_SET_FIELD_VALUE (&send_msg, epoch, remote_sync_epoch);
+    CMSG_SET_FIELD_VALUE (&send_msg, from_seq, from_seq);
+    CMSG_SET_FIELD_VALUE (&send_msg, seq, peer->local_seq);
+
+    cmsg_psd_remote_sync_api_delta_sync (client, &send_msg);
+    CMSG_REPEATED_FREE (send_msg.changes);
+    CMSG_FREE (deltas);
+}
+
+/**
+ * Answer a sync request from a remote host. If the change log still holds all of the
+ * changes the remote host has missed then only those changes are sent, otherwise
+ * all subscriptions for the remote host are sent.
+ *
+ * @param client - The client to the remote host.
+ * @param peer - The sync state for the remote host.
+ * @param epoch - The epoch of this daemon known by the remote host.
+ * @param seq - The sequence number of the last change the remote host has applied.
+ */
+static void
+remote_sync_answer_request (cmsg_client *client, remote_sync_peer *peer, uint32_t epoch,
+                            uint32_t seq)
+{
+    const remote_sync_change *oldest = NULL;
+    bool delta_possible = false;
+
+    if (epoch == remote_sync_epoch && seq <= peer->local_seq)
+    {
+        oldest = (const remote_sync_change *) g_queue_peek_head (peer->change_log);
+        delta_possible = (seq == peer->local_seq) || (oldest && seq + 1 >= oldest->seq);
+    }
+
+    if (delta_possible)
+    {
+        remote_sync_delta_sync_subscriptions (client, peer, seq);
+    }
+    else
+    {
+        remote_sync_bulk_sync_subscriptions (client);
+    }
+}
+
+/**
+ * A remote host is asking for the changes to the subscriptions for it since
+ * the last change that it has applied.
+ */
+void
+cmsg_psd_remote_sync_impl_sync_request (const void *service,
+                                        const cmsg_psd_sync_request *recv_msg)
+{
+    remote_sync_peer *peer = NULL;
+    cmsg_client *client = NULL;
+
+    peer = remote_sync_peer_get (recv_msg->addr, true);
+    peer->legacy = false;
+    client = remote_sync_client_get (recv_msg->addr);
+    if (client)
+    {
+        remote_sync_answer_request (client, peer, recv_msg->epoch, recv_msg->seq);
+    }
+    else
+    {
+        /* Answer once the server on the remote host is known */
+        peer->request_pending = true;
+        peer->pending_epoch = recv_msg->epoch;
+        peer->pending_seq = recv_msg->seq;
+    }
+
+    cmsg_psd_remote_sync_server_sync_requestSend (service);
+}
+
+/**
+ * Start syncing the subscriptions with a remote host that has just joined. The remote
+ * host is asked for the changes since the last change applied from it, and any sync
+ * request already received from the remote host is answered. A remote host that only
+ * supports the original bulk sync ignores the request, and is instead sent all of the
+ * subscriptions for it once its own bulk sync has been received.
+ *
+ * @param client - The client to the remote host that has just joined.
+ */
+void
+remote_sync_request_subscriptions (cmsg_client *client)
+{
+    uint32_t remote_addr = client->_transport->config.socket.sockaddr.in.sin_addr.s_addr;
+    remote_sync_peer *peer = NULL;
+
+    peer = remote_sync_peer_get (remote_addr, true);
+    remote_sync_request_sync (client, peer);
+
+    if (peer->legacy_sync_pending)
+    {
+        peer->legacy_sync_pending = false;
+        remote_sync_bulk_sync_subscriptions (client);
+    }
+
+    if (peer->request_pending)
+    {
+        peer->request_pending = false;
+        remote_sync_answer_request (client, peer, peer->pending_epoch, peer->pending_seq);
+    }
+}
+
+/**
+ * Remove the subscriptions received from a remote host that has left. The
+ * subscriptions are retained so that only the changes since the last change
+ * applied from the host need to be synced if it rejoins.
+ *
+ * @param remote_addr - The address of the remote host.
+ */
+static void
+remote_sync_host_removed (uint32_t remote_addr)
+{
+    remote_sync_peer *peer = NULL;
+
+    peer = remote_sync_peer_get (remote_addr, false);
+    if (peer && !peer->cached)
+    {
+        peer->cached = data_get_local_subscriptions_for_addr (remote_addr);
+    }
+    if (peer)
+    {
+        peer->synced = false;
+        peer->request_sent = false;
+        peer->request_pending = false;
+
+        /* The remote host may have been upgraded when it rejoins */
+        peer->legacy = false;
+        peer->legacy_sync_pending = false;
+    }
+
+    data_remove_local_subscriptions_for_addr (remote_addr);
+}
+
 /**
  * Helper function called for each client in the GList. Finds the client that
  * matches the input transport.
@@ -220,12 +823,12 @@ remote_sync_sl_event_handler (const cmsg_transport *transport, bool added, void
         new_transport = cmsg_transport_copy (transport);
         client = cmsg_client_new (new_transport, CMSG_DESCRIPTOR (cmsg_psd, remote_sync));
         remote_sync_client_list = g_list_prepend (remote_sync_client_list, client);
-        remote_sync_bulk_sync_subscriptions (client);
+        remote_sync_request_subscriptions (client);
     }
     else
     {
         remote_addr = transport->config.socket.sockaddr.in.sin_addr.s_addr;
-        data_remove_local_subscriptions_for_addr (remote_addr);
+        remote_sync_host_removed (remote_addr);
         link = g_list_find_custom (remote_sync_client_list, transport,
                                    remote_sync_find_client_by_transport);
         if (link)
@@ -267,11 +870,29 @@ remote_sync_address_set (struct in_addr addr)
                                                                              remote_sync));
         remote_sync_local_ip_addr = addr.s_addr;
 
+        do
+        {
+            remote_sync_epoch = g_random_int ();
+        } while (remote_sync_epoch == 0);
+
         remote_sync_sl_init ();
         data_check_remote_entries ();
     }
 }
 
+/**
+ * Free the sync state for all remote hosts.
+ */
+void
+remote_sync_deinit (void)
+{
+    if (remote_sync_peers)
+    {
+        g_hash_table_unref (remote_sync_peers);
+        remote_sync_peers = NULL;
+    }
+}
+
 /**
  * Get the IPv4 address used by the remote sync server on this node.
  *
@@ -318,6 +939,31 @@ data_debug_server_dump (gpointer data, gpointer user_data)
     fprintf (fp, " ");
 }
 
+/**
+ * Helper function called for each remote host with sync state. Prints the
+ * sync state for the remote host.
+ *
+ * @param key - The address of the remote host.
+ * @param value - The 'remote_sync_peer' structure for the remote host.
+ * @param user_data - The file to print to.
+ */
+static void
+remote_sync_peer_dump (gpointer key, gpointer value, gpointer user_data)
+{
+    const remote_sync_peer *peer = (const remote_sync_peer *) value;
+    FILE *fp = (FILE *) user_data;
+    char ip[INET6_ADDRSTRLEN] = { };
+    uint32_t addr = GPOINTER_TO_UINT (key);
+
+    inet_ntop (AF_INET, &addr, ip, INET6_ADDRSTRLEN);
+
+    fprintf (fp,
+             " %s: local seq = %u (%u logged), remote epoch = %u, remote seq = %u%s%s%s\n",
+             ip, peer->local_seq, g_queue_get_length (peer->change_log), peer->remote_epoch,
+             peer->remote_seq, peer->synced ? "" : " (not synced)",
+             peer->cached ? " (cached)" : "", peer->legacy ? " (legacy)" : "");
+}
+
 /**
  * Dump the current information about all known hosts to the debug file.
  *
@@ -342,4 +988,10 @@ remote_sync_debug_dump (FILE *fp)
     g_list_foreach (remote_sync_client_list, data_debug_server_dump, fp);
 
     fprintf (fp, "\n");
+
+    fprintf (fp, "Sync state (epoch %u):\n", remote_sync_epoch);
+    if (remote_sync_peers)
+    {
+        g_hash_table_foreach (remote_sync_peers, remote_sync_peer_dump, fp);
+    }
 }
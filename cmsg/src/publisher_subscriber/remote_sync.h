@@ -21,4 +21,6 @@ void remote_sync_subscription_removed (const cmsg_subscription_info *subscriber_
 bool remote_sync_sl_event_handler (const cmsg_transport *transport, bool added,
                                    void *user_data);
 void remote_sync_bulk_sync_subscriptions (cmsg_client *client);
+void remote_sync_request_subscriptions (cmsg_client *client);
+void remote_sync_deinit (void);
 #endif /* __REMOTE_SYNC_H_ */
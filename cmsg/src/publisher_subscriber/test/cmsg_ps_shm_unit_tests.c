@@ -0,0 +1,210 @@
+/*
+ * Unit tests for the publisher shared memory ring.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <np.h>
+#include "../cmsg_ps_shm_private.h"
+#include "cmsg_server_private.h"
+
+/**
+ * This informs the compiler that the function is, in fact, being used even though it
+ * doesn't look like it. This is useful for static functions that get found by NovaProva
+ * using debug symbols.
+ */
+#define USED __attribute__ ((used))
+
+static cmsg_server *server_test_ptr = (cmsg_server *) 0x15876;
+
+static cmsg_ps_shm_ring *ring = NULL;
+static GList *packets_seen = NULL;
+
+static int32_t
+sm_mock_cmsg_server_packet_process (cmsg_server *server, uint8_t *packet,
+                                    uint32_t packet_len,
+                                    cmsg_server_packet_check_f check_func,
+                                    void *user_data)
+{
+    uint32_t value;
+
+    NP_ASSERT_PTR_EQUAL (server, server_test_ptr);
+    NP_ASSERT_EQUAL (packet_len, sizeof (value));
+
+    memcpy (&value, packet, sizeof (value));
+
+    if (!check_func (user_data))
+    {
+        return CMSG_RET_ERR;
+    }
+
+    packets_seen = g_list_append (packets_seen, GUINT_TO_POINTER (value));
+
+    return CMSG_RET_OK;
+}
+
+static int USED
+set_up (void)
+{
+    ring = (cmsg_ps_shm_ring *) g_malloc (sizeof (cmsg_ps_shm_ring));
+    cmsg_ps_shm_ring_init (ring);
+    packets_seen = NULL;
+
+    np_mock (cmsg_server_packet_process, sm_mock_cmsg_server_packet_process);
+
+    return 0;
+}
+
+static int USED
+tear_down (void)
+{
+    g_list_free (packets_seen);
+    g_free (ring);
+
+    return 0;
+}
+
+/**
+ * Write a test packet containing the given value to the ring.
+ */
+static int32_t
+write_value (uint32_t value, uint64_t consumers, uint64_t *wake)
+{
+    return cmsg_ps_shm_write (ring, (const uint8_t *) &value, sizeof (value), consumers,
+                              wake);
+}
+
+void
+test_cmsg_ps_shm_read_only_processes_records_for_consumer (void)
+{
+    uint64_t wake;
+    int slot_a;
+    int slot_b;
+
+    slot_a = cmsg_ps_shm_consumer_add (ring, "/tmp/a");
+    slot_b = cmsg_ps_shm_consumer_add (ring, "/tmp/b");
+    NP_ASSERT_NOT_EQUAL (slot_a, slot_b);
+
+    write_value (1, CMSG_PS_SHM_CONSUMER_BIT (slot_a), &wake);
+    write_value (2, CMSG_PS_SHM_CONSUMER_BIT (slot_b), &wake);
+    write_value (3, CMSG_PS_SHM_CONSUMER_BIT (slot_a) | CMSG_PS_SHM_CONSUMER_BIT (slot_b),
+                 &wake);
+
+    NP_ASSERT_EQUAL (cmsg_ps_shm_read (ring, slot_a, server_test_ptr), 2);
+    NP_ASSERT_EQUAL (GPOINTER_TO_UINT (g_list_nth_data (packets_seen, 0)), 1);
+    NP_ASSERT_EQUAL (GPOINTER_TO_UINT (g_list_nth_data (packets_seen, 1)), 3);
+
+    NP_ASSERT_EQUAL (cmsg_ps_shm_read (ring, slot_b, server_test_ptr), 2);
+    NP_ASSERT_EQUAL (GPOINTER_TO_UINT (g_list_nth_data (packets_seen, 2)), 2);
+    NP_ASSERT_EQUAL (GPOINTER_TO_UINT (g_list_nth_data (packets_seen, 3)), 3);
+
+    /* Nothing further to read */
+    NP_ASSERT_EQUAL (cmsg_ps_shm_read (ring, slot_a, server_test_ptr), 0);
+}
+
+void
+test_cmsg_ps_shm_write_only_wakes_waiting_consumers (void)
+{
+    uint64_t wake;
+    int slot;
+
+    slot = cmsg_ps_shm_consumer_add (ring, "/tmp/a");
+
+    write_value (1, CMSG_PS_SHM_CONSUMER_BIT (slot), &wake);
+    NP_ASSERT_EQUAL (wake, CMSG_PS_SHM_CONSUMER_BIT (slot));
+
+    /* The consumer has already been woken */
+    write_value (2, CMSG_PS_SHM_CONSUMER_BIT (slot), &wake);
+    NP_ASSERT_EQUAL (wake, 0);
+
+    NP_ASSERT_EQUAL (cmsg_ps_shm_read (ring, slot, server_test_ptr), 2);
+
+    /* The consumer is waiting again once it has read everything */
+    write_value (3, CMSG_PS_SHM_CONSUMER_BIT (slot), &wake);
+    NP_ASSERT_EQUAL (wake, CMSG_PS_SHM_CONSUMER_BIT (slot));
+}
+
+void
+test_cmsg_ps_shm_read_across_end_of_ring (void)
+{
+    uint64_t wake;
+    uint32_t i;
+    uint32_t num_records = 3 * CMSG_PS_SHM_DATA_SIZE / 24;
+    int slot;
+
+    slot = cmsg_ps_shm_consumer_add (ring, "/tmp/a");
+
+    for (i = 0; i < num_records; i++)
+    {
+        write_value (i, CMSG_PS_SHM_CONSUMER_BIT (slot), &wake);
+        NP_ASSERT_EQUAL (cmsg_ps_shm_read (ring, slot, server_test_ptr), 1);
+    }
+
+    NP_ASSERT_EQUAL (g_list_length (packets_seen), num_records);
+    NP_ASSERT_EQUAL (GPOINTER_TO_UINT (g_list_last (packets_seen)->data), num_records - 1);
+    NP_ASSERT_EQUAL (ring->consumers[slot].lagged, 0);
+}
+
+void
+test_cmsg_ps_shm_lapped_consumer_resyncs (void)
+{
+    uint64_t wake;
+    uint32_t i;
+    int slot;
+
+    slot = cmsg_ps_shm_consumer_add (ring, "/tmp/a");
+
+    /* Write more than the ring can hold without the consumer reading */
+    for (i = 0; i < CMSG_PS_SHM_DATA_SIZE / 16; i++)
+    {
+        write_value (i, CMSG_PS_SHM_CONSUMER_BIT (slot), &wake);
+    }
+
+    NP_ASSERT_EQUAL (cmsg_ps_shm_read (ring, slot, server_test_ptr), 0);
+    NP_ASSERT_EQUAL (ring->consumers[slot].lagged, 1);
+
+    /* The consumer continues from the newest record */
+    write_value (100, CMSG_PS_SHM_CONSUMER_BIT (slot), &wake);
+    NP_ASSERT_EQUAL (cmsg_ps_shm_read (ring, slot, server_test_ptr), 1);
+    NP_ASSERT_EQUAL (GPOINTER_TO_UINT (g_list_last (packets_seen)->data), 100);
+}
+
+void
+test_cmsg_ps_shm_write_too_large (void)
+{
+    uint8_t *packet = g_malloc0 (CMSG_PS_SHM_DATA_SIZE / 2);
+    uint64_t wake;
+    int slot;
+
+    slot = cmsg_ps_shm_consumer_add (ring, "/tmp/a");
+
+    NP_ASSERT_EQUAL (cmsg_ps_shm_write (ring, packet, CMSG_PS_SHM_DATA_SIZE / 2,
+                                        CMSG_PS_SHM_CONSUMER_BIT (slot), &wake),
+                     CMSG_RET_ERR);
+    NP_ASSERT_EQUAL (cmsg_ps_shm_read (ring, slot, server_test_ptr), 0);
+
+    g_free (packet);
+}
+
+void
+test_cmsg_ps_shm_consumer_slot_reuse (void)
+{
+    uint32_t generation_a;
+    uint32_t generation_b;
+    int slot_a;
+    int slot_b;
+
+    slot_a = cmsg_ps_shm_consumer_add (ring, "/tmp/a");
+    NP_ASSERT_EQUAL (cmsg_ps_shm_consumer_find (ring, "/tmp/a", &generation_a), slot_a);
+    NP_ASSERT_TRUE (cmsg_ps_shm_consumer_valid (ring, slot_a, generation_a));
+
+    cmsg_ps_shm_consumer_remove (ring, slot_a);
+    NP_ASSERT_EQUAL (cmsg_ps_shm_consumer_find (ring, "/tmp/a", &generation_a), -1);
+    NP_ASSERT_FALSE (cmsg_ps_shm_consumer_valid (ring, slot_a, generation_a));
+
+    slot_b = cmsg_ps_shm_consumer_add (ring, "/tmp/b");
+    NP_ASSERT_EQUAL (slot_b, slot_a);
+    NP_ASSERT_EQUAL (cmsg_ps_shm_consumer_find (ring, "/tmp/b", &generation_b), slot_b);
+    NP_ASSERT_NOT_EQUAL (generation_a, generation_b);
+    NP_ASSERT_FALSE (cmsg_ps_shm_consumer_valid (ring, slot_b, generation_a));
+}
@@ -41,6 +41,12 @@ sm_mock_data_add_subscription_return_false (const cmsg_subscription_info *info)
     return false;
 }
 
+static void
+sm_mock_data_sync_publishers (const char *service)
+{
+    /* Do nothing. */
+}
+
 static int USED
 set_up (void)
 {
@@ -49,6 +55,7 @@ set_up (void)
     np_mock (cmsg_server_app_owns_current_msg_set,
              sm_mock_cmsg_server_app_owns_current_msg_set);
     np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+    np_mock (data_sync_publishers, sm_mock_data_sync_publishers);
 
     return 0;
 }
@@ -7,6 +7,7 @@
 #include <np.h>
 #include "../data.h"
 #include "../remote_sync.h"
+#include "../publisher_update.h"
 #include "transport/cmsg_transport_private.h"
 #include "cmsg_sl.h"
 
@@ -38,9 +39,48 @@ sm_mock_cmsg_service_listener_listen (const char *service_name,
     return NULL;
 }
 
+static int subscription_changes_added = 0;
+static int subscription_changes_removed = 0;
+
+static publisher_update_queue *
+sm_mock_publisher_update_queue_new (cmsg_transport *transport, const char *service)
+{
+    cmsg_transport_destroy (transport);
+    return (publisher_update_queue *) 0x1234;
+}
+
+static void
+sm_mock_publisher_update_queue_destroy (publisher_update_queue *update_queue)
+{
+    /* Do nothing. */
+}
+
+static void
+sm_mock_publisher_update_queue_subscription_change (publisher_update_queue *update_queue,
+                                                    const char *method_name,
+                                                    const cmsg_transport_info
+                                                    *transport_info, bool added)
+{
+    if (added)
+    {
+        subscription_changes_added++;
+    }
+    else
+    {
+        subscription_changes_removed++;
+    }
+}
+
 static int USED
 set_up (void)
 {
+    subscription_changes_added = 0;
+    subscription_changes_removed = 0;
+
+    np_mock (publisher_update_queue_new, sm_mock_publisher_update_queue_new);
+    np_mock (publisher_update_queue_destroy, sm_mock_publisher_update_queue_destroy);
+    np_mock (publisher_update_queue_subscription_change,
+             sm_mock_publisher_update_queue_subscription_change);
     np_mock (remote_sync_subscription_added, sm_mock_remote_sync_subscription_added);
     np_mock (remote_sync_subscription_removed, sm_mock_remote_sync_subscription_removed);
     np_mock (cmsg_service_listener_listen, sm_mock_cmsg_service_listener_listen);
@@ -337,6 +377,79 @@ test_data_remove_subscriber_unknown (void)
     NP_ASSERT_EQUAL (g_list_length (remote_subscriptions), 1);
 }
 
+static cmsg_subscription_info *
+create_remote_subscription (const char *method_name, uint32_t transport_addr)
+{
+    cmsg_subscription_info *sub_info = NULL;
+
+    sub_info = CMSG_MALLOC (sizeof (*sub_info));
+    cmsg_subscription_info_init (sub_info);
+
+    CMSG_SET_FIELD_VALUE (sub_info, remote_addr, 1234);
+    CMSG_SET_FIELD_PTR (sub_info, service, CMSG_STRDUP ("test"));
+    CMSG_SET_FIELD_PTR (sub_info, method_name, CMSG_STRDUP (method_name));
+    CMSG_SET_FIELD_PTR (sub_info, transport_info,
+                        create_tcp_transport_info (transport_addr));
+
+    return sub_info;
+}
+
+void
+test_data_remove_subscriber_remote_multiple_methods (void)
+{
+    cmsg_subscription_info *sub_info = NULL;
+    GList *remote_subscriptions = NULL;
+    cmsg_transport_info *transport_info = NULL;
+
+    data_add_subscription (create_remote_subscription ("test_method_1", 2222));
+    data_add_subscription (create_remote_subscription ("test_method_2", 2222));
+    sub_info = create_remote_subscription ("test_method_1", 3333);
+    data_add_subscription (sub_info);
+
+    remote_subscriptions = data_get_remote_subscriptions ();
+    NP_ASSERT_EQUAL (g_list_length (remote_subscriptions), 3);
+
+    transport_info = create_tcp_transport_info (2222);
+    data_remove_subscriber ("test", transport_info);
+    cmsg_transport_info_free (transport_info);
+
+    /* Only the subscriptions of the other subscriber remain */
+    remote_subscriptions = data_get_remote_subscriptions ();
+    NP_ASSERT_EQUAL (g_list_length (remote_subscriptions), 1);
+    NP_ASSERT_PTR_EQUAL (remote_subscriptions->data, sub_info);
+
+    data_remove_subscription (sub_info);
+    remote_subscriptions = data_get_remote_subscriptions ();
+    NP_ASSERT_EQUAL (g_list_length (remote_subscriptions), 0);
+}
+
+void
+test_data_remove_subscriber_multiple_methods (void)
+{
+    cmsg_subscription_info *sub_info = NULL;
+    cmsg_transport_info *transport_info = NULL;
+
+    sub_info = CMSG_MALLOC (sizeof (*sub_info));
+    cmsg_subscription_info_init (sub_info);
+
+    CMSG_SET_FIELD_PTR (sub_info, service, CMSG_STRDUP ("test"));
+    CMSG_SET_FIELD_PTR (sub_info, method_name, CMSG_STRDUP ("test_method"));
+    CMSG_SET_FIELD_PTR (sub_info, transport_info, create_tcp_transport_info (2222));
+    data_add_subscription (sub_info);
+
+    CMSG_FREE (sub_info->method_name);
+    CMSG_SET_FIELD_PTR (sub_info, method_name, CMSG_STRDUP ("test_method_2"));
+    data_add_subscription (sub_info);
+    CMSG_FREE_RECV_MSG (sub_info);
+    NP_ASSERT_EQUAL (g_hash_table_size (local_subscriptions_table), 1);
+
+    transport_info = create_tcp_transport_info (2222);
+    NP_ASSERT_TRUE (data_remove_subscriber ("test", transport_info));
+    cmsg_transport_info_free (transport_info);
+
+    NP_ASSERT_EQUAL (g_hash_table_size (local_subscriptions_table), 0);
+}
+
 void
 test_data_remove_local_subscriptions_for_addr (void)
 {
@@ -372,6 +485,23 @@ test_data_remove_local_subscriptions_for_addr (void)
     NP_ASSERT_EQUAL (g_hash_table_size (local_subscriptions_table), 1);
 }
 
+static cmsg_subscription_method_entry *
+find_method_entry (cmsg_subscription_methods *subscriptions, const char *method_name)
+{
+    cmsg_subscription_method_entry *entry = NULL;
+    int i;
+
+    CMSG_REPEATED_FOREACH (subscriptions, methods, entry, i)
+    {
+        if (strcmp (entry->method_name, method_name) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
 void
 test_data_get_subscription_info_for_service (void)
 {
@@ -381,6 +511,7 @@ test_data_get_subscription_info_for_service (void)
     const char *method_name_1 = "test_method_1";
     const char *method_name_2 = "test_method_2";
     cmsg_transport_info *transport_info = create_unix_transport_info ();
+    cmsg_subscription_method_entry *method_entry = NULL;
 
     sub_info = CMSG_MALLOC (sizeof (*sub_info));
     cmsg_subscription_info_init (sub_info);
@@ -400,15 +531,135 @@ test_data_get_subscription_info_for_service (void)
     data_get_subscription_info_for_service (service_name, &subscriptions);
 
     NP_ASSERT_EQUAL (subscriptions.n_methods, 2);
-    NP_ASSERT_STR_EQUAL (subscriptions.methods[0]->method_name, method_name_2);
-    NP_ASSERT_EQUAL (subscriptions.methods[0]->n_transports, 1);
-    NP_ASSERT_TRUE (cmsg_transport_info_compare (subscriptions.methods[0]->transports[0],
+    method_entry = find_method_entry (&subscriptions, method_name_1);
+    NP_ASSERT_NOT_NULL (method_entry);
+    NP_ASSERT_EQUAL (method_entry->n_transports, 1);
+    NP_ASSERT_TRUE (cmsg_transport_info_compare (method_entry->transports[0],
                                                  transport_info));
-    NP_ASSERT_STR_EQUAL (subscriptions.methods[1]->method_name, method_name_1);
-    NP_ASSERT_EQUAL (subscriptions.methods[1]->n_transports, 1);
-    NP_ASSERT_TRUE (cmsg_transport_info_compare (subscriptions.methods[1]->transports[0],
+    method_entry = find_method_entry (&subscriptions, method_name_2);
+    NP_ASSERT_NOT_NULL (method_entry);
+    NP_ASSERT_EQUAL (method_entry->n_transports, 1);
+    NP_ASSERT_TRUE (cmsg_transport_info_compare (method_entry->transports[0],
                                                  transport_info));
 
     cmsg_transport_info_free (transport_info);
     data_get_subscription_info_for_service_free (&subscriptions);
 }
+
+static void
+add_test_publisher (const char *service_name)
+{
+    cmsg_transport_info *transport_info = create_unix_transport_info ();
+    char *methods[] = { "link_up", "link_down", "port_up" };
+
+    data_add_publisher (service_name, transport_info, methods, 3);
+    cmsg_transport_info_free (transport_info);
+}
+
+static void
+add_remove_local_subscription (const char *method_name, cmsg_transport_info *transport_info,
+                               bool add)
+{
+    cmsg_subscription_info sub_info = CMSG_SUBSCRIPTION_INFO_INIT;
+
+    CMSG_SET_FIELD_PTR (&sub_info, service, "test");
+    CMSG_SET_FIELD_PTR (&sub_info, method_name, (char *) method_name);
+    CMSG_SET_FIELD_PTR (&sub_info, transport_info, transport_info);
+
+    if (add)
+    {
+        data_add_local_subscription (&sub_info);
+    }
+    else
+    {
+        data_remove_local_subscription (&sub_info);
+    }
+}
+
+void
+test_data_prefix_subscription_expanded_for_publisher (void)
+{
+    cmsg_transport_info *transport_info = create_tcp_transport_info (2222);
+    cmsg_subscription_methods subscriptions = CMSG_SUBSCRIPTION_METHODS_INIT;
+
+    add_test_publisher ("test");
+
+    add_remove_local_subscription ("link_*", transport_info, true);
+    NP_ASSERT_EQUAL (subscription_changes_added, 2);
+
+    data_get_subscription_info_for_service ("test", &subscriptions);
+    NP_ASSERT_EQUAL (subscriptions.n_methods, 2);
+    NP_ASSERT_NOT_NULL (find_method_entry (&subscriptions, "link_up"));
+    NP_ASSERT_NOT_NULL (find_method_entry (&subscriptions, "link_down"));
+    data_get_subscription_info_for_service_free (&subscriptions);
+
+    /* Already subscribed to through the prefix */
+    add_remove_local_subscription ("link_up", transport_info, true);
+    NP_ASSERT_EQUAL (subscription_changes_added, 2);
+
+    /* Still subscribed to "link_up" directly */
+    add_remove_local_subscription ("link_*", transport_info, false);
+    NP_ASSERT_EQUAL (subscription_changes_removed, 1);
+
+    add_remove_local_subscription ("link_up", transport_info, false);
+    NP_ASSERT_EQUAL (subscription_changes_removed, 2);
+
+    cmsg_transport_info_free (transport_info);
+}
+
+void
+test_data_prefix_subscription_all_methods (void)
+{
+    cmsg_transport_info *transport_info = create_tcp_transport_info (2222);
+    cmsg_subscription_methods subscriptions = CMSG_SUBSCRIPTION_METHODS_INIT;
+
+    add_remove_local_subscription ("*", transport_info, true);
+    add_remove_local_subscription ("link_*", transport_info, true);
+    NP_ASSERT_EQUAL (g_hash_table_size (local_subscriptions_table), 1);
+
+    /* The subscriptions are expanded once the published methods are known */
+    add_test_publisher ("test");
+    data_get_subscription_info_for_service ("test", &subscriptions);
+    NP_ASSERT_EQUAL (subscriptions.n_methods, 3);
+    NP_ASSERT_EQUAL (find_method_entry (&subscriptions, "link_up")->n_transports, 1);
+    data_get_subscription_info_for_service_free (&subscriptions);
+
+    data_remove_subscriber ("test", transport_info);
+    NP_ASSERT_EQUAL (subscription_changes_removed, 3);
+
+    cmsg_transport_info_free (transport_info);
+}
+
+void
+test_data_remove_publisher_forgets_methods (void)
+{
+    cmsg_transport_info *transport_info = create_tcp_transport_info (2222);
+    cmsg_transport_info *publisher_1 = create_unix_transport_info ();
+    cmsg_transport_info *publisher_2 = create_tcp_transport_info (3333);
+    cmsg_subscription_methods subscriptions = CMSG_SUBSCRIPTION_METHODS_INIT;
+    char *methods[] = { "link_up" };
+
+    add_remove_local_subscription ("*", transport_info, true);
+    add_test_publisher ("test");
+    data_add_publisher ("test", publisher_2, methods, 1);
+
+    /* "link_up" is still published by the other publisher */
+    data_remove_publisher ("test", publisher_1);
+    data_get_subscription_info_for_service ("test", &subscriptions);
+    NP_ASSERT_EQUAL (subscriptions.n_methods, 1);
+    NP_ASSERT_NOT_NULL (find_method_entry (&subscriptions, "link_up"));
+    data_get_subscription_info_for_service_free (&subscriptions);
+
+    data_remove_publisher ("test", publisher_2);
+    data_get_subscription_info_for_service ("test", &subscriptions);
+    NP_ASSERT_EQUAL (subscriptions.n_methods, 0);
+    data_get_subscription_info_for_service_free (&subscriptions);
+
+    /* The prefix subscription is unaffected */
+    add_remove_local_subscription ("*", transport_info, false);
+    NP_ASSERT_EQUAL (g_hash_table_size (local_subscriptions_table), 0);
+
+    cmsg_transport_info_free (publisher_2);
+    cmsg_transport_info_free (publisher_1);
+    cmsg_transport_info_free (transport_info);
+}
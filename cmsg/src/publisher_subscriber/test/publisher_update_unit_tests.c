@@ -0,0 +1,217 @@
+/*
+ * Unit tests for the publisher update functionality.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <np.h>
+#include <sys/socket.h>
+#include <cmsg/cmsg_private.h>
+#include "transport/cmsg_transport_private.h"
+#include "cmsg_client_private.h"
+#include "../publisher_update.h"
+#include "../data.h"
+
+/**
+ * This informs the compiler that the function is, in fact, being used even though it
+ * doesn't look like it. This is useful for static functions that get found by NovaProva
+ * using debug symbols.
+ */
+#define USED __attribute__ ((used))
+
+static int publisher_sockets[2] = { -1, -1 };
+static GByteArray *publisher_received = NULL;
+static cmsg_subscription_method_entry resync_entry;
+
+static int32_t
+sm_mock_cmsg_client_connect_start (cmsg_client *client)
+{
+    return 0;
+}
+
+static int32_t
+sm_mock_cmsg_client_connect_finish (cmsg_client *client)
+{
+    return 0;
+}
+
+/**
+ * The publisher's client writes to one end of a socket pair that the test reads.
+ */
+static int32_t
+sm_mock_cmsg_client_get_socket (cmsg_client *client)
+{
+    return publisher_sockets[0];
+}
+
+/**
+ * The service always has a single subscribed method when the publisher is resynced.
+ */
+static void
+sm_mock_data_get_subscription_info_for_service (const char *service,
+                                                cmsg_subscription_methods *msg)
+{
+    cmsg_subscription_method_entry_init (&resync_entry);
+    CMSG_SET_FIELD_PTR (&resync_entry, method_name, "resynced_method");
+    CMSG_REPEATED_APPEND (msg, methods, &resync_entry);
+}
+
+static void
+sm_mock_data_get_subscription_info_for_service_free (cmsg_subscription_methods *msg)
+{
+    CMSG_REPEATED_FREE (msg->methods);
+}
+
+static int USED
+set_up (void)
+{
+    NP_ASSERT_EQUAL (socketpair (AF_UNIX, SOCK_STREAM, 0, publisher_sockets), 0);
+    publisher_received = g_byte_array_new ();
+
+    np_mock (cmsg_client_connect_start, sm_mock_cmsg_client_connect_start);
+    np_mock (cmsg_client_connect_finish, sm_mock_cmsg_client_connect_finish);
+    np_mock (cmsg_client_get_socket, sm_mock_cmsg_client_get_socket);
+    np_mock (data_get_subscription_info_for_service,
+             sm_mock_data_get_subscription_info_for_service);
+    np_mock (data_get_subscription_info_for_service_free,
+             sm_mock_data_get_subscription_info_for_service_free);
+
+    return 0;
+}
+
+static int USED
+tear_down (void)
+{
+    np_unmock (cmsg_client_connect_start);
+    np_unmock (cmsg_client_connect_finish);
+    np_unmock (cmsg_client_get_socket);
+    np_unmock (data_get_subscription_info_for_service);
+    np_unmock (data_get_subscription_info_for_service_free);
+
+    if (publisher_sockets[0] >= 0)
+    {
+        close (publisher_sockets[0]);
+    }
+    if (publisher_sockets[1] >= 0)
+    {
+        close (publisher_sockets[1]);
+    }
+    g_byte_array_free (publisher_received, TRUE);
+
+    return 0;
+}
+
+/**
+ * Read everything that has been written to the publisher so far.
+ */
+static void
+read_publisher_updates (void)
+{
+    uint8_t buf[4096];
+    ssize_t ret;
+
+    while ((ret = recv (publisher_sockets[1], buf, sizeof (buf), MSG_DONTWAIT)) > 0)
+    {
+        g_byte_array_append (publisher_received, buf, ret);
+    }
+}
+
+/**
+ * Find where the first update containing the given string was written to the
+ * publisher.
+ *
+ * @returns The offset of the string, or -1 if it has not been written.
+ */
+static int
+find_publisher_update (const char *str)
+{
+    const uint8_t *pos;
+
+    read_publisher_updates ();
+
+    pos = memmem (publisher_received->data, publisher_received->len, str, strlen (str));
+    if (!pos)
+    {
+        return -1;
+    }
+
+    return pos - publisher_received->data;
+}
+
+static const ProtobufCServiceDescriptor test_descriptor = {
+    PROTOBUF_C__SERVICE_DESCRIPTOR_MAGIC,
+    "test",
+    "test",
+    "test",
+    "test",
+    0,
+    NULL,
+    NULL,
+};
+
+static cmsg_transport_info *
+create_unix_transport_info (void)
+{
+    cmsg_transport_info *transport_info = NULL;
+    cmsg_transport *transport = NULL;
+
+    transport = cmsg_create_transport_unix (&test_descriptor, CMSG_TRANSPORT_RPC_UNIX);
+    transport_info = cmsg_transport_info_create (transport);
+    NP_ASSERT_NOT_NULL (transport_info);
+    cmsg_transport_destroy (transport);
+
+    return transport_info;
+}
+
+void
+test_publisher_update_queue_resyncs_after_reconnect (void)
+{
+    publisher_update_queue *update_queue = NULL;
+    cmsg_transport_info *transport_info = NULL;
+    int i;
+
+    update_queue =
+        publisher_update_queue_new (cmsg_create_transport_unix (&test_descriptor,
+                                                                CMSG_TRANSPORT_RPC_UNIX),
+                                    "test");
+    NP_ASSERT_NOT_NULL (update_queue);
+    transport_info = create_unix_transport_info ();
+
+    publisher_update_queue_subscription_change (update_queue, "method_1", transport_info,
+                                                true);
+    NP_ASSERT_TRUE (find_publisher_update ("method_1") >= 0);
+
+    /* The publisher goes away so the next update cannot be written */
+    close (publisher_sockets[1]);
+    publisher_sockets[1] = -1;
+    publisher_update_queue_subscription_change (update_queue, "method_2", transport_info,
+                                                true);
+
+    /* The publisher comes back and is reconnected to after a delay */
+    close (publisher_sockets[0]);
+    NP_ASSERT_EQUAL (socketpair (AF_UNIX, SOCK_STREAM, 0, publisher_sockets), 0);
+    g_byte_array_set_size (publisher_received, 0);
+
+    /* Updates made while waiting to reconnect are covered by the resync */
+    publisher_update_queue_subscription_change (update_queue, "method_3", transport_info,
+                                                true);
+
+    for (i = 0; i < 10 && find_publisher_update ("subscriptions_resync") < 0; i++)
+    {
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+    NP_ASSERT_TRUE (find_publisher_update ("subscriptions_resync") >= 0);
+    NP_ASSERT_TRUE (find_publisher_update ("resynced_method") >= 0);
+    NP_ASSERT_EQUAL (find_publisher_update ("method_2"), -1);
+    NP_ASSERT_EQUAL (find_publisher_update ("method_3"), -1);
+
+    /* Later updates are sent after the resync */
+    publisher_update_queue_subscription_change (update_queue, "method_4", transport_info,
+                                                true);
+    NP_ASSERT_TRUE (find_publisher_update ("method_4") >
+                    find_publisher_update ("subscriptions_resync"));
+
+    cmsg_transport_info_free (transport_info);
+    publisher_update_queue_destroy (update_queue);
+}
@@ -46,18 +46,54 @@ static GList *remote_subscriptions_seen = NULL;
 
 static int cmsg_psd_remote_sync_api_add_subscription_called = 0;
 static int cmsg_psd_remote_sync_api_remove_subscription_called = 0;
+static int cmsg_psd_remote_sync_api_add_subscription_seq_called = 0;
+static int cmsg_psd_remote_sync_api_remove_subscription_seq_called = 0;
+static int cmsg_psd_remote_sync_api_bulk_sync_called = 0;
+static int cmsg_psd_remote_sync_api_delta_sync_called = 0;
+static int cmsg_psd_remote_sync_api_sync_request_called = 0;
+static int delta_sync_changes_seen = 0;
+static int data_add_local_subscription_called = 0;
+static uint32_t last_sent_epoch = 0;
+
+static void
+sm_mock_cmsg_server_send_response (const ProtobufCMessage *send_msg, const void *service)
+{
+    /* Do nothing. */
+}
+
+static void
+sm_mock_data_add_local_subscription (const cmsg_subscription_info *info)
+{
+    data_add_local_subscription_called++;
+}
 
 static int USED
 set_up (void)
 {
     cmsg_psd_remote_sync_api_add_subscription_called = 0;
     cmsg_psd_remote_sync_api_remove_subscription_called = 0;
+    cmsg_psd_remote_sync_api_add_subscription_seq_called = 0;
+    cmsg_psd_remote_sync_api_remove_subscription_seq_called = 0;
+    cmsg_psd_remote_sync_api_bulk_sync_called = 0;
+    cmsg_psd_remote_sync_api_delta_sync_called = 0;
+    cmsg_psd_remote_sync_api_sync_request_called = 0;
+    delta_sync_changes_seen = 0;
+    data_add_local_subscription_called = 0;
+    last_sent_epoch = 0;
     mock_remote_subscriptions_list = NULL;
     remote_subscriptions_seen = NULL;
 
     return 0;
 }
 
+static int USED
+tear_down (void)
+{
+    remote_sync_deinit ();
+
+    return 0;
+}
+
 static cmsg_server *
 sm_mock_cmsg_glib_tcp_server_init_oneway_ptr_return (const char *service_name,
                                                      struct in_addr *addr,
@@ -88,7 +124,7 @@ sm_mock_cmsg_service_listener_remove_server (cmsg_server *server)
 }
 
 static void
-sm_mock_remote_sync_bulk_sync_subscriptions (cmsg_client *client)
+sm_mock_remote_sync_request_subscriptions (cmsg_client *client)
 {
     /* Do nothing. */
 }
@@ -116,6 +152,18 @@ sm_mock_cmsg_api_invoke (cmsg_client *client, const cmsg_api_descriptor *cmsg_de
             cmsg_psd_remote_sync_api_remove_subscription_called++;
             return CMSG_RET_OK;
         }
+        else if (method_index == cmsg_psd_remote_sync_api_add_subscription_seq_index)
+        {
+            last_sent_epoch = ((const cmsg_psd_sync_change *) send_msg)->epoch;
+            cmsg_psd_remote_sync_api_add_subscription_seq_called++;
+            return CMSG_RET_OK;
+        }
+        else if (method_index == cmsg_psd_remote_sync_api_remove_subscription_seq_index)
+        {
+            last_sent_epoch = ((const cmsg_psd_sync_change *) send_msg)->epoch;
+            cmsg_psd_remote_sync_api_remove_subscription_seq_called++;
+            return CMSG_RET_OK;
+        }
         else if (method_index == cmsg_psd_remote_sync_api_bulk_sync_index)
         {
             int i;
@@ -123,12 +171,27 @@ sm_mock_cmsg_api_invoke (cmsg_client *client, const cmsg_api_descriptor *cmsg_de
                 (const cmsg_psd_bulk_sync_data *) send_msg;
             cmsg_subscription_info *info;
 
+            cmsg_psd_remote_sync_api_bulk_sync_called++;
             CMSG_REPEATED_FOREACH (_send_msg, data, info, i)
             {
                 remote_subscriptions_seen = g_list_append (remote_subscriptions_seen, info);
             }
             return CMSG_RET_OK;
         }
+        else if (method_index == cmsg_psd_remote_sync_api_delta_sync_index)
+        {
+            const cmsg_psd_delta_sync_data *_send_msg =
+                (const cmsg_psd_delta_sync_data *) send_msg;
+
+            cmsg_psd_remote_sync_api_delta_sync_called++;
+            delta_sync_changes_seen = _send_msg->n_changes;
+            return CMSG_RET_OK;
+        }
+        else if (method_index == cmsg_psd_remote_sync_api_sync_request_index)
+        {
+            cmsg_psd_remote_sync_api_sync_request_called++;
+            return CMSG_RET_OK;
+        }
     }
 
     return cmsg_api_invoke_real (client, cmsg_desc, method_index, send_msg, recv_msg);
@@ -194,6 +257,21 @@ create_tcp_transport (uint32_t _addr)
     return transport;
 }
 
+static void
+subscription_info_set (cmsg_subscription_info *info, uint32_t remote_addr)
+{
+    cmsg_transport *transport = NULL;
+
+    transport = create_tcp_transport (remote_addr);
+
+    CMSG_SET_FIELD_PTR (info, service, "test");
+    CMSG_SET_FIELD_PTR (info, method_name, "test");
+    CMSG_SET_FIELD_PTR (info, transport_info, cmsg_transport_info_create (transport));
+    CMSG_SET_FIELD_VALUE (info, remote_addr, remote_addr);
+
+    cmsg_transport_destroy (transport);
+}
+
 void
 test_remote_sync_sl_event_handler (void)
 {
@@ -208,8 +286,8 @@ test_remote_sync_sl_event_handler (void)
     test_transport_1 = create_tcp_transport (1111);
     test_transport_2 = create_tcp_transport (2222);
 
-    np_mock_by_name ("remote_sync_bulk_sync_subscriptions",
-                     sm_mock_remote_sync_bulk_sync_subscriptions);
+    np_mock_by_name ("remote_sync_request_subscriptions",
+                     sm_mock_remote_sync_request_subscriptions);
 
     remote_sync_sl_event_handler (test_transport_1, true, NULL);
     NP_ASSERT_EQUAL (g_list_length (remote_sync_client_list), 1);
@@ -246,8 +324,8 @@ test_remote_sync_sl_event_handler_unknown_transport (void)
     test_transport_1 = create_tcp_transport (1111);
     test_transport_2 = create_tcp_transport (2222);
 
-    np_mock_by_name ("remote_sync_bulk_sync_subscriptions",
-                     sm_mock_remote_sync_bulk_sync_subscriptions);
+    np_mock_by_name ("remote_sync_request_subscriptions",
+                     sm_mock_remote_sync_request_subscriptions);
 
     remote_sync_sl_event_handler (test_transport_1, true, NULL);
     NP_ASSERT_EQUAL (g_list_length (remote_sync_client_list), 1);
@@ -322,11 +400,13 @@ test_remote_sync_subscription_added_no_remote_host (void)
 {
     cmsg_subscription_info sub_info = CMSG_SUBSCRIPTION_INFO_INIT;
 
-    CMSG_SET_FIELD_VALUE (&sub_info, remote_addr, 1111);
+    subscription_info_set (&sub_info, 1111);
 
     np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke);
     remote_sync_subscription_added (&sub_info);
-    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_add_subscription_called, 0);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_add_subscription_seq_called, 0);
+
+    cmsg_transport_info_free (sub_info.transport_info);
 }
 
 void
@@ -334,11 +414,13 @@ test_remote_sync_subscription_removed_no_remote_host (void)
 {
     cmsg_subscription_info sub_info = CMSG_SUBSCRIPTION_INFO_INIT;
 
-    CMSG_SET_FIELD_VALUE (&sub_info, remote_addr, 1111);
+    subscription_info_set (&sub_info, 1111);
 
     np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke);
     remote_sync_subscription_removed (&sub_info);
-    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_remove_subscription_called, 0);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_remove_subscription_seq_called, 0);
+
+    cmsg_transport_info_free (sub_info.transport_info);
 }
 
 void
@@ -353,21 +435,22 @@ test_remote_sync_subscription_added_remote_host_no_match (void)
 
     test_transport = create_tcp_transport (1111);
 
-    np_mock_by_name ("remote_sync_bulk_sync_subscriptions",
-                     sm_mock_remote_sync_bulk_sync_subscriptions);
+    np_mock_by_name ("remote_sync_request_subscriptions",
+                     sm_mock_remote_sync_request_subscriptions);
     remote_sync_sl_event_handler (test_transport, true, NULL);
 
-    CMSG_SET_FIELD_VALUE (&sub_info, remote_addr, 2222);
+    subscription_info_set (&sub_info, 2222);
 
     np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke);
     remote_sync_subscription_added (&sub_info);
-    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_add_subscription_called, 0);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_add_subscription_seq_called, 0);
 
     np_mock (cmsg_service_listener_remove_server,
              sm_mock_cmsg_service_listener_remove_server);
     cmsg_destroy_server_and_transport (remote_sync_server);
     remote_sync_server = NULL;
     cmsg_transport_destroy (test_transport);
+    cmsg_transport_info_free (sub_info.transport_info);
 }
 
 void
@@ -382,21 +465,22 @@ test_remote_sync_subscription_removed_remote_host_no_match (void)
 
     test_transport = create_tcp_transport (1111);
 
-    np_mock_by_name ("remote_sync_bulk_sync_subscriptions",
-                     sm_mock_remote_sync_bulk_sync_subscriptions);
+    np_mock_by_name ("remote_sync_request_subscriptions",
+                     sm_mock_remote_sync_request_subscriptions);
     remote_sync_sl_event_handler (test_transport, true, NULL);
 
-    CMSG_SET_FIELD_VALUE (&sub_info, remote_addr, 2222);
+    subscription_info_set (&sub_info, 2222);
 
     np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke);
     remote_sync_subscription_removed (&sub_info);
-    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_remove_subscription_called, 0);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_remove_subscription_seq_called, 0);
 
     np_mock (cmsg_service_listener_remove_server,
              sm_mock_cmsg_service_listener_remove_server);
     cmsg_destroy_server_and_transport (remote_sync_server);
     remote_sync_server = NULL;
     cmsg_transport_destroy (test_transport);
+    cmsg_transport_info_free (sub_info.transport_info);
 }
 
 void
@@ -411,21 +495,23 @@ test_remote_sync_subscription_added_remote_host_match (void)
 
     test_transport = create_tcp_transport (1111);
 
-    np_mock_by_name ("remote_sync_bulk_sync_subscriptions",
-                     sm_mock_remote_sync_bulk_sync_subscriptions);
+    np_mock_by_name ("remote_sync_request_subscriptions",
+                     sm_mock_remote_sync_request_subscriptions);
     remote_sync_sl_event_handler (test_transport, true, NULL);
 
-    CMSG_SET_FIELD_VALUE (&sub_info, remote_addr, 1111);
+    subscription_info_set (&sub_info, 1111);
 
     np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke);
     remote_sync_subscription_added (&sub_info);
-    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_add_subscription_called, 1);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_add_subscription_seq_called, 1);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_add_subscription_seq_called, 0);
 
     np_mock (cmsg_service_listener_remove_server,
              sm_mock_cmsg_service_listener_remove_server);
     cmsg_destroy_server_and_transport (remote_sync_server);
     remote_sync_server = NULL;
     cmsg_transport_destroy (test_transport);
+    cmsg_transport_info_free (sub_info.transport_info);
 }
 
 void
@@ -440,19 +526,220 @@ test_remote_sync_subscription_removed_remote_host_match (void)
 
     test_transport = create_tcp_transport (1111);
 
-    np_mock_by_name ("remote_sync_bulk_sync_subscriptions",
-                     sm_mock_remote_sync_bulk_sync_subscriptions);
+    np_mock_by_name ("remote_sync_request_subscriptions",
+                     sm_mock_remote_sync_request_subscriptions);
     remote_sync_sl_event_handler (test_transport, true, NULL);
 
-    CMSG_SET_FIELD_VALUE (&sub_info, remote_addr, 1111);
+    subscription_info_set (&sub_info, 1111);
 
     np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke);
     remote_sync_subscription_removed (&sub_info);
-    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_remove_subscription_called, 1);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_remove_subscription_seq_called, 1);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_remove_subscription_seq_called, 0);
 
     np_mock (cmsg_service_listener_remove_server,
              sm_mock_cmsg_service_listener_remove_server);
     cmsg_destroy_server_and_transport (remote_sync_server);
     remote_sync_server = NULL;
     cmsg_transport_destroy (test_transport);
+    cmsg_transport_info_free (sub_info.transport_info);
+}
+
+/**
+ * Join a remote host (without syncing) and record a change to the subscriptions
+ * for it.
+ */
+static cmsg_transport *
+join_host_and_add_subscription (cmsg_subscription_info *sub_info, uint32_t addr)
+{
+    cmsg_transport *server_transport = NULL;
+    cmsg_transport *test_transport = NULL;
+
+    server_transport = create_tcp_transport (1234);
+    remote_sync_server = cmsg_server_create (server_transport, &test_service);
+
+    test_transport = create_tcp_transport (addr);
+
+    np_mock_by_name ("remote_sync_request_subscriptions",
+                     sm_mock_remote_sync_request_subscriptions);
+    remote_sync_sl_event_handler (test_transport, true, NULL);
+
+    subscription_info_set (sub_info, addr);
+
+    np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke);
+    remote_sync_subscription_added (sub_info);
+
+    return test_transport;
+}
+
+static void
+leave_host (cmsg_transport *test_transport)
+{
+    np_mock (cmsg_service_listener_remove_server,
+             sm_mock_cmsg_service_listener_remove_server);
+    cmsg_destroy_server_and_transport (remote_sync_server);
+    remote_sync_server = NULL;
+    cmsg_transport_destroy (test_transport);
+}
+
+void
+test_remote_sync_sync_request_sends_delta (void)
+{
+    cmsg_subscription_info sub_info = CMSG_SUBSCRIPTION_INFO_INIT;
+    cmsg_psd_sync_request request = CMSG_PSD_SYNC_REQUEST_INIT;
+    cmsg_transport *test_transport = NULL;
+
+    test_transport = join_host_and_add_subscription (&sub_info, 1111);
+    remote_sync_subscription_removed (&sub_info);
+    remote_sync_subscription_added (&sub_info);
+
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+    CMSG_SET_FIELD_VALUE (&request, addr, 1111);
+    CMSG_SET_FIELD_VALUE (&request, epoch, last_sent_epoch);
+    CMSG_SET_FIELD_VALUE (&request, seq, 1);
+    cmsg_psd_remote_sync_impl_sync_request (NULL, &request);
+
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_delta_sync_called, 1);
+    NP_ASSERT_EQUAL (delta_sync_changes_seen, 2);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_bulk_sync_called, 0);
+
+    leave_host (test_transport);
+    cmsg_transport_info_free (sub_info.transport_info);
+}
+
+void
+test_remote_sync_sync_request_unknown_epoch_sends_bulk (void)
+{
+    cmsg_subscription_info sub_info = CMSG_SUBSCRIPTION_INFO_INIT;
+    cmsg_psd_sync_request request = CMSG_PSD_SYNC_REQUEST_INIT;
+    cmsg_transport *test_transport = NULL;
+
+    test_transport = join_host_and_add_subscription (&sub_info, 1111);
+
+    np_mock (data_get_remote_subscriptions, sm_mock_data_get_remote_subscriptions);
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+    CMSG_SET_FIELD_VALUE (&request, addr, 1111);
+    CMSG_SET_FIELD_VALUE (&request, epoch, last_sent_epoch + 1);
+    CMSG_SET_FIELD_VALUE (&request, seq, 0);
+    cmsg_psd_remote_sync_impl_sync_request (NULL, &request);
+
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_delta_sync_called, 0);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_bulk_sync_called, 1);
+
+    leave_host (test_transport);
+    cmsg_transport_info_free (sub_info.transport_info);
+}
+
+void
+test_remote_sync_change_with_gap_requests_sync (void)
+{
+    cmsg_subscription_info sub_info = CMSG_SUBSCRIPTION_INFO_INIT;
+    cmsg_psd_sync_change change = CMSG_PSD_SYNC_CHANGE_INIT;
+    cmsg_transport *test_transport = NULL;
+
+    test_transport = join_host_and_add_subscription (&sub_info, 1111);
+
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+    np_mock (data_add_local_subscription, sm_mock_data_add_local_subscription);
+    CMSG_SET_FIELD_VALUE (&change, addr, 1111);
+    CMSG_SET_FIELD_VALUE (&change, epoch, 7);
+    CMSG_SET_FIELD_VALUE (&change, seq, 3);
+    CMSG_SET_FIELD_PTR (&change, info, &sub_info);
+    cmsg_psd_remote_sync_impl_add_subscription_seq (NULL, &change);
+
+    NP_ASSERT_EQUAL (data_add_local_subscription_called, 0);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_sync_request_called, 1);
+
+    /* Further changes are covered by the requested sync */
+    CMSG_SET_FIELD_VALUE (&change, seq, 4);
+    cmsg_psd_remote_sync_impl_add_subscription_seq (NULL, &change);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_sync_request_called, 1);
+
+    leave_host (test_transport);
+    cmsg_transport_info_free (sub_info.transport_info);
+}
+
+void
+test_remote_sync_delta_sync_applies_changes (void)
+{
+    cmsg_subscription_info sub_info = CMSG_SUBSCRIPTION_INFO_INIT;
+    cmsg_psd_delta_sync_data delta_msg = CMSG_PSD_DELTA_SYNC_DATA_INIT;
+    cmsg_psd_subscription_delta delta = CMSG_PSD_SUBSCRIPTION_DELTA_INIT;
+    cmsg_psd_sync_change change = CMSG_PSD_SYNC_CHANGE_INIT;
+    cmsg_transport *test_transport = NULL;
+
+    test_transport = join_host_and_add_subscription (&sub_info, 1111);
+
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+    np_mock (data_add_local_subscription, sm_mock_data_add_local_subscription);
+
+    CMSG_SET_FIELD_VALUE (&delta, added, true);
+    CMSG_SET_FIELD_PTR (&delta, info, &sub_info);
+    CMSG_SET_FIELD_VALUE (&delta_msg, addr, 1111);
+    CMSG_SET_FIELD_VALUE (&delta_msg, epoch, 0);
+    CMSG_SET_FIELD_VALUE (&delta_msg, from_seq, 0);
+    CMSG_SET_FIELD_VALUE (&delta_msg, seq, 1);
+    CMSG_REPEATED_APPEND (&delta_msg, changes, &delta);
+    cmsg_psd_remote_sync_impl_delta_sync (NULL, &delta_msg);
+    CMSG_REPEATED_FREE (delta_msg.changes);
+
+    NP_ASSERT_EQUAL (data_add_local_subscription_called, 1);
+
+    /* The next change follows on directly from the delta */
+    CMSG_SET_FIELD_VALUE (&change, addr, 1111);
+    CMSG_SET_FIELD_VALUE (&change, epoch, 0);
+    CMSG_SET_FIELD_VALUE (&change, seq, 2);
+    CMSG_SET_FIELD_PTR (&change, info, &sub_info);
+    cmsg_psd_remote_sync_impl_add_subscription_seq (NULL, &change);
+
+    NP_ASSERT_EQUAL (data_add_local_subscription_called, 2);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_sync_request_called, 0);
+
+    leave_host (test_transport);
+    cmsg_transport_info_free (sub_info.transport_info);
+}
+
+static void
+sm_mock_data_remove_local_subscriptions_for_addr (uint32_t addr)
+{
+    /* Do nothing. */
+}
+
+static uint32_t
+sm_mock_remote_sync_sender_addr_get (const void *service)
+{
+    return 1111;
+}
+
+void
+test_remote_sync_legacy_bulk_sync (void)
+{
+    cmsg_subscription_info sub_info = CMSG_SUBSCRIPTION_INFO_INIT;
+    cmsg_psd_bulk_sync_data bulk_msg = CMSG_PSD_BULK_SYNC_DATA_INIT;
+    cmsg_transport *test_transport = NULL;
+
+    test_transport = join_host_and_add_subscription (&sub_info, 1111);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_add_subscription_seq_called, 1);
+
+    /* A bulk sync without an epoch comes from a daemon without the sequenced sync */
+    np_mock_by_name ("remote_sync_sender_addr_get", sm_mock_remote_sync_sender_addr_get);
+    np_mock (data_get_remote_subscriptions, sm_mock_data_get_remote_subscriptions);
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+    np_mock (data_add_local_subscription, sm_mock_data_add_local_subscription);
+    np_mock (data_remove_local_subscriptions_for_addr,
+             sm_mock_data_remove_local_subscriptions_for_addr);
+    CMSG_REPEATED_APPEND (&bulk_msg, data, &sub_info);
+    cmsg_psd_remote_sync_impl_bulk_sync (NULL, &bulk_msg);
+    CMSG_REPEATED_FREE (bulk_msg.data);
+
+    NP_ASSERT_EQUAL (data_add_local_subscription_called, 1);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_bulk_sync_called, 1);
+
+    /* Further changes use the original methods */
+    remote_sync_subscription_removed (&sub_info);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_remove_subscription_called, 1);
+    NP_ASSERT_EQUAL (cmsg_psd_remote_sync_api_remove_subscription_seq_called, 0);
+
+    leave_host (test_transport);
+    cmsg_transport_info_free (sub_info.transport_info);
 }
@@ -12,8 +12,11 @@
 #include "configuration_api_auto.h"
 #include "cmsg_sl_config.h"
 #include "cmsg_server_private.h"
+#include "cmsg_client_private.h"
 #include "cmsg_sl.h"
 #include "events_impl_auto.h"
+#include "query_api_auto.h"
+#include "cmsg_sl_shm_private.h"
 #include "transport/cmsg_transport_private.h"
 
 struct _cmsg_sl_info_s
@@ -22,384 +25,1505 @@ struct _cmsg_sl_info_s
     cmsg_sl_event_handler_t handler;
     uint32_t id;
     void *user_data;
-    GAsyncQueue *queue;
+    pthread_mutex_t events_mutex;
+    GArray *events;             /* Events waiting to be dispatched */
+    GArray *dispatch;           /* Events being dispatched to the handler */
+    guint dispatch_pos;         /* The next event in 'dispatch' to dispatch */
+    bool signalled;             /* Whether the eventfd has been written to */
     int eventfd;
     void *event_loop_data;
+    GHashTable *servers;        /* The servers the listener has been notified about,
+                                 * mapped to the transport for the server */
+    bool cached;                /* Whether the listener is used for the lookup cache */
+    bool synced;                /* Whether the servers have been looked up */
+    GList *pending;             /* Events received before the servers were looked up */
+    GHashTable *wait_services;  /* For a wait set, service name -> set of servers */
 };
 
+/* The transport of an added server is owned by the 'servers' table of the listener
+ * and shared by every event for the server. The transport of a removed server is
+ * taken from the table and owned by the event. */
 typedef struct _cmsg_sl_event
 {
     bool added;
+    bool owned;
     cmsg_transport *transport;
 } cmsg_sl_event;
 
+typedef struct _cmsg_sl_pending_event
+{
+    bool added;
+    bool resync;                /* The servers replace all of the known servers */
+    GList *transport_infos;
+} cmsg_sl_pending_event;
+
 static cmsg_server *event_server = NULL;
 static pthread_t event_server_thread;
 static GList *listener_list = NULL;
 static pthread_mutex_t listener_list_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t add_remove_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* The maximum number of services whose servers are cached. Once the cache is
+ * full any other service is looked up directly from the cmsg_sld daemon. */
+#define CMSG_SL_CACHE_MAX_SERVICES 64
+
+static GHashTable *sl_cache = NULL;
+static cmsg_client *sld_query_client = NULL;
+
+/* A batch of messages to the cmsg_sld daemon is sent once it grows this large,
+ * even if the batch has not yet been ended. */
+#define CMSG_SL_BATCH_MAX_SIZE (64 * 1024)
+
+static cmsg_client *sld_client = NULL;
+static bool sld_client_connected = false;
+static pthread_mutex_t sld_client_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Each thread batches its own messages so that a batch in one thread never
+ * holds back the messages sent by another thread. */
+static __thread GByteArray *sld_batch = NULL;
+static __thread uint32_t sld_batch_depth = 0;
+
 /**
- * Create a CMSG client to talk to the cmsg_sld daemon.
+ * Get the CMSG client used to talk to the cmsg_sld daemon. The client is created
+ * the first time it is required and is then kept open for the lifetime of the
+ * process. If the daemon restarts the client reconnects on the next send.
  *
- * @returns The CMSG client. This must be destroyed by the caller.
+ * Note - Assumes the 'sld_client_mutex' mutex is held. The mutex is released
+ *        while waiting for the daemon to start.
+ *
+ * @returns The CMSG client. This must not be destroyed by the caller.
  */
 static cmsg_client *
 cmsg_sl_get_client (void)
 {
-    static bool cmsg_sld_running = false;
-    cmsg_client *client = cmsg_create_client_unix_oneway (CMSG_DESCRIPTOR (cmsg_sld,
-                                                                           configuration));
-    if (!cmsg_sld_running)
+    if (!sld_client)
+    {
+        sld_client = cmsg_create_client_unix_oneway (CMSG_DESCRIPTOR (cmsg_sld,
+                                                                      configuration));
+        if (!sld_client)
+        {
+            return NULL;
+        }
+
+        cmsg_client_suppress_error (sld_client, true);
+    }
+
+    while (!sld_client_connected)
     {
-        cmsg_client_suppress_error (client, true);
-        while (cmsg_client_connect (client) != 0)
+        if (cmsg_client_connect (sld_client) == 0)
+        {
+            cmsg_client_suppress_error (sld_client, false);
+            sld_client_connected = true;
+        }
+        else
         {
+            pthread_mutex_unlock (&sld_client_mutex);
             sleep (1);
+            pthread_mutex_lock (&sld_client_mutex);
         }
-        cmsg_client_suppress_error (client, false);
-        cmsg_sld_running = true;
     }
 
-    return client;
+    return sld_client;
 }
 
 /**
- * Get the eventfd descriptor from the 'cmsg_sl_info' structure.
+ * Send any messages that have been batched up by this thread for the cmsg_sld
+ * daemon using a single write to the daemon.
  *
- * @param info - The 'cmsg_sl_info' structure to get the eventfd descriptor for.
+ * Note - Assumes the 'sld_client_mutex' mutex is held.
  *
- * @returns The eventfd descriptor.
+ * @returns CMSG_RET_OK on success, related error code on failure.
  */
-int
-cmsg_service_listener_get_event_fd (const cmsg_sl_info *info)
+static int32_t
+cmsg_sl_batch_flush (void)
 {
-    return info->eventfd;
+    cmsg_client *client = NULL;
+    int32_t ret;
+
+    if (!sld_batch || sld_batch->len == 0)
+    {
+        return CMSG_RET_OK;
+    }
+
+    client = cmsg_sl_get_client ();
+    if (!client)
+    {
+        ret = CMSG_RET_ERR;
+    }
+    else
+    {
+        ret = cmsg_client_send_bytes (client, sld_batch->data, sld_batch->len, "batch");
+    }
+
+    g_byte_array_set_size (sld_batch, 0);
+
+    return ret;
 }
 
 /**
- * Process any events on the event queue of the 'cmsg_sl_info' structure.
+ * Send a message to the cmsg_sld daemon. If a batch is in progress a batchable
+ * message is instead added to the batch and sent when the batch ends. Any other
+ * message first sends the batch so that the daemon sees the messages in order.
  *
- * @param info - The 'cmsg_sl_info' structure to process events for.
+ * @param method_name - The name of the method to invoke on the daemon.
+ * @param msg - The message to send.
+ * @param batchable - Whether the message can be delayed until the batch ends.
  *
- * @returns true if the service listening should keep running, false otherwise.
+ * @returns CMSG_RET_OK on success, related error code on failure.
  */
-bool
-cmsg_service_listener_event_queue_process (const cmsg_sl_info *info)
+static int32_t
+cmsg_sl_send (const char *method_name, const ProtobufCMessage *msg, bool batchable)
 {
-    cmsg_sl_event *event = NULL;
-    eventfd_t value;
-    bool ret = true;
+    cmsg_client *client = NULL;
+    uint8_t *packet = NULL;
+    uint32_t packet_len = 0;
+    int32_t ret;
 
-    /* clear notification */
-    TEMP_FAILURE_RETRY (eventfd_read (info->eventfd, &value));
+    pthread_mutex_lock (&sld_client_mutex);
+
+    client = cmsg_sl_get_client ();
+    if (!client)
+    {
+        pthread_mutex_unlock (&sld_client_mutex);
+        return CMSG_RET_ERR;
+    }
 
-    while ((event = g_async_queue_try_pop (info->queue)))
+    ret = cmsg_client_create_packet (client, method_name, msg, &packet, &packet_len);
+    if (ret != CMSG_RET_OK)
     {
-        ret = info->handler (event->transport, event->added, info->user_data);
-        cmsg_transport_destroy (event->transport);
-        CMSG_FREE (event);
+        pthread_mutex_unlock (&sld_client_mutex);
+        return ret;
+    }
 
-        if (!ret)
+    if (batchable && sld_batch_depth > 0)
+    {
+        g_byte_array_append (sld_batch, packet, packet_len);
+        if (sld_batch->len >= CMSG_SL_BATCH_MAX_SIZE)
         {
-            break;
+            ret = cmsg_sl_batch_flush ();
         }
     }
+    else
+    {
+        cmsg_sl_batch_flush ();
+        ret = cmsg_client_send_bytes (client, packet, packet_len, method_name);
+    }
+
+    pthread_mutex_unlock (&sld_client_mutex);
+    CMSG_FREE (packet);
 
     return ret;
 }
 
 /**
- * Notify the listener of a given service of the event that has occurred.
- *
- * @param recv_msg - The received event message from the service listener daemon.
- * @param added - Whether the service has been added or removed.
+ * Start batching the messages sent to the cmsg_sld daemon by the calling thread.
+ * Any servers added or removed (and any other configuration sent to the daemon)
+ * until the matching call to 'cmsg_service_listener_batch_end' are sent to the
+ * daemon together, rather than with one write each. Batches may be nested.
  */
-static void
-notify_listener (const cmsg_sld_server_event *recv_msg, bool added)
+void
+cmsg_service_listener_batch_begin (void)
 {
-    GList *list;
-    const cmsg_sl_info *entry;
-    cmsg_sl_event *event = NULL;
-    const cmsg_transport_info *transport_info = NULL;
+    if (!sld_batch)
+    {
+        sld_batch = g_byte_array_new ();
+    }
+    sld_batch_depth++;
+}
 
-    pthread_mutex_lock (&listener_list_mutex);
+/**
+ * Finish batching the messages sent to the cmsg_sld daemon by the calling thread.
+ * Once the outermost batch ends all batched messages are sent to the daemon.
+ *
+ * @returns CMSG_RET_OK on success, related error code on failure.
+ */
+int32_t
+cmsg_service_listener_batch_end (void)
+{
+    int32_t ret = CMSG_RET_OK;
 
-    for (list = g_list_first (listener_list); list; list = g_list_next (list))
+    if (sld_batch_depth == 0)
     {
-        entry = (const cmsg_sl_info *) list->data;
+        return ret;
+    }
 
-        if (entry->id == recv_msg->id)
-        {
-            event = CMSG_MALLOC (sizeof (cmsg_sl_event));
-            if (event)
-            {
-                transport_info = recv_msg->service_info->server_info;
+    sld_batch_depth--;
+    if (sld_batch_depth == 0)
+    {
+        pthread_mutex_lock (&sld_client_mutex);
+        ret = cmsg_sl_batch_flush ();
+        pthread_mutex_unlock (&sld_client_mutex);
 
-                event->added = added;
-                event->transport = cmsg_transport_info_to_transport (transport_info);
-                g_async_queue_push (entry->queue, event);
-                TEMP_FAILURE_RETRY (eventfd_write (entry->eventfd, 1));
-            }
-        }
+        g_byte_array_unref (sld_batch);
+        sld_batch = NULL;
     }
 
-    pthread_mutex_unlock (&listener_list_mutex);
+    return ret;
 }
 
 /**
- * Notification from the CMSG service listener daemon that a server for
- * a specific service has been added.
+ * Get the eventfd descriptor from the 'cmsg_sl_info' structure.
+ *
+ * @param info - The 'cmsg_sl_info' structure to get the eventfd descriptor for.
+ *
+ * @returns The eventfd descriptor.
  */
-void
-cmsg_sld_events_impl_server_added (const void *service,
-                                   const cmsg_sld_server_event *recv_msg)
+int
+cmsg_service_listener_get_event_fd (const cmsg_sl_info *info)
 {
-    notify_listener (recv_msg, true);
-    cmsg_sld_events_server_server_addedSend (service);
+    return info->eventfd;
 }
 
 /**
- * Notification from the CMSG service listener daemon that a server for
- * a specific service has been removed.
+ * Empty an array of events, freeing the transports owned by the events. The
+ * memory of the array is kept for reuse.
+ *
+ * @param events - The array of events to empty.
  */
-void
-cmsg_sld_events_impl_server_removed (const void *service,
-                                     const cmsg_sld_server_event *recv_msg)
+static void
+cmsg_sl_events_clear (GArray *events)
 {
-    notify_listener (recv_msg, false);
-    cmsg_sld_events_server_server_removedSend (service);
+    cmsg_sl_event *event = NULL;
+    guint i;
+
+    for (i = 0; i < events->len; i++)
+    {
+        event = &g_array_index (events, cmsg_sl_event, i);
+        if (event->owned)
+        {
+            cmsg_transport_destroy (event->transport);
+        }
+    }
+
+    g_array_set_size (events, 0);
 }
 
 /**
- * Initialise the server for receiving events from the service listener.
+ * Call the handler of a listener for each of the events being dispatched.
+ *
+ * @param info - The listener to dispatch the events for.
+ *
+ * @returns false if the handler requested that listening stop, true otherwise.
  */
-static void
-event_server_init (void)
+static bool
+cmsg_sl_events_dispatch (cmsg_sl_info *info)
 {
-    cmsg_transport *transport = NULL;
+    cmsg_sl_event *event = NULL;
 
-    transport = cmsg_transport_new (CMSG_TRANSPORT_ONEWAY_UNIX);
-    transport->config.socket.family = AF_UNIX;
-    transport->config.socket.sockaddr.un.sun_family = AF_UNIX;
-    snprintf (transport->config.socket.sockaddr.un.sun_path,
-              sizeof (transport->config.socket.sockaddr.un.sun_path) - 1,
-              "/tmp/%s.%u", cmsg_service_name_get (CMSG_DESCRIPTOR (cmsg_sld, events)),
-              getpid ());
+    while (info->dispatch_pos < info->dispatch->len)
+    {
+        event = &g_array_index (info->dispatch, cmsg_sl_event, info->dispatch_pos);
+        info->dispatch_pos++;
 
-    event_server = cmsg_server_new (transport, CMSG_SERVICE (cmsg_sld, events));
-    cmsg_pthread_server_init (&event_server_thread, event_server);
+        if (!info->handler (event->transport, event->added, info->user_data))
+        {
+            return false;
+        }
+    }
+
+    cmsg_sl_events_clear (info->dispatch);
+    info->dispatch_pos = 0;
+
+    return true;
 }
 
 /**
- * Destroy the server used for receiving events from the service listener.
+ * Process any events on the event queue of the 'cmsg_sl_info' structure.
+ *
+ * All of the events received since the last call are taken in one go and
+ * dispatched from an array that is reused between calls.
+ *
+ * @param info - The 'cmsg_sl_info' structure to process events for.
+ *
+ * @returns true if the service listening should keep running, false otherwise.
+ */
+bool
+cmsg_service_listener_event_queue_process (const cmsg_sl_info *info)
+{
+    cmsg_sl_info *_info = (cmsg_sl_info *) info;
+    GArray *events = NULL;
+    eventfd_t value;
+    bool ret;
+
+    /* Finish any events left over from when the handler last stopped */
+    ret = cmsg_sl_events_dispatch (_info);
+
+    pthread_mutex_lock (&_info->events_mutex);
+
+    /* clear notification */
+    TEMP_FAILURE_RETRY (eventfd_read (_info->eventfd, &value));
+    _info->signalled = false;
+
+    if (ret)
+    {
+        events = _info->events;
+        _info->events = _info->dispatch;
+        _info->dispatch = events;
+    }
+
+    pthread_mutex_unlock (&_info->events_mutex);
+
+    if (ret)
+    {
+        ret = cmsg_sl_events_dispatch (_info);
+    }
+
+    return ret;
+}
+
+/**
+ * Free an event that was received for a cached listener before its servers
+ * were looked up.
+ *
+ * @param data - The pending event to free.
  */
 static void
-event_server_deinit (void)
+cmsg_sl_pending_event_free (gpointer data)
 {
-    pthread_cancel (event_server_thread);
-    pthread_join (event_server_thread, NULL);
-    cmsg_destroy_server_and_transport (event_server);
-    event_server = NULL;
+    cmsg_sl_pending_event *pending = (cmsg_sl_pending_event *) data;
+
+    g_list_free_full (pending->transport_infos, (GDestroyNotify) cmsg_transport_info_free);
+    CMSG_FREE (pending);
 }
 
 /**
- * Helper function for calling the API to the CMSG service listener
- * to add/remove a listener for a given service.
+ * Hold on to an event received for a cached listener before its servers have
+ * been looked up. The event is applied once the servers have been looked up.
  *
  * Note - Assumes the 'listener_list_mutex' mutex is held.
  *
- * @param service_name - The name of the service to listen/unlisten for.
- * @param listen - true to listen, false to unlisten.
- * @param id - The numerical ID of the listener.
+ * @param entry - The listener the event is for.
+ * @param transport_infos - GList of the transport information of the servers.
+ * @param added - Whether the servers have been added or removed.
+ * @param resync - Whether the servers replace all of the known servers.
  */
 static void
-_cmsg_service_listener_listen (const char *service_name, bool listen, uint32_t id)
+pend_event (cmsg_sl_info *entry, GList *transport_infos, bool added, bool resync)
 {
-    cmsg_client *client = NULL;
-    cmsg_sld_listener_info send_msg = CMSG_SLD_LISTENER_INFO_INIT;
-    cmsg_transport_info *transport_info = NULL;
-
-    transport_info = cmsg_transport_info_create (event_server->_transport);
+    cmsg_sl_pending_event *pending = NULL;
+    GList *copies = NULL;
+    GList *list = NULL;
 
-    CMSG_SET_FIELD_PTR (&send_msg, service, (char *) service_name);
-    CMSG_SET_FIELD_PTR (&send_msg, transport_info, transport_info);
-    CMSG_SET_FIELD_VALUE (&send_msg, id, id);
-
-    client = cmsg_sl_get_client ();
-
-    if (listen)
+    pending = CMSG_CALLOC (1, sizeof (cmsg_sl_pending_event));
+    if (!pending)
     {
-        CMSG_SET_FIELD_VALUE (&send_msg, pid, getpid ());
-        cmsg_sld_configuration_api_listen (client, &send_msg);
+        return;
     }
-    else
+    pending->added = added;
+    pending->resync = resync;
+
+    for (list = transport_infos; list; list = g_list_next (list))
     {
-        cmsg_sld_configuration_api_unlisten (client, &send_msg);
+        copies = g_list_prepend (copies, cmsg_transport_info_copy (list->data));
     }
+    pending->transport_infos = g_list_reverse (copies);
 
-    cmsg_destroy_client_and_transport (client);
-    cmsg_transport_info_free (transport_info);
+    entry->pending = g_list_append (entry->pending, pending);
 }
 
 /**
- * When destroying the event queue there may still be events on there.
- * Simply free them as required to avoid leaking memory.
+ * Record a set of servers as known (or no longer known) to a listener.
+ *
+ * Note - Assumes the 'listener_list_mutex' mutex is held.
+ *
+ * @param entry - The listener to record the servers for.
+ * @param transport_infos - GList of the transport information of the servers.
+ * @param added - Whether the servers have been added or removed.
  */
 static void
-_clear_event_queue (gpointer data)
+update_servers (cmsg_sl_info *entry, GList *transport_infos, bool added)
 {
-    cmsg_sl_event *info = (cmsg_sl_event *) data;
-    cmsg_transport_destroy (info->transport);
-    CMSG_FREE (info);
+    const cmsg_transport_info *transport_info = NULL;
+    GList *list = NULL;
+
+    for (list = transport_infos; list; list = g_list_next (list))
+    {
+        transport_info = (const cmsg_transport_info *) list->data;
+
+        if (added)
+        {
+            if (!g_hash_table_contains (entry->servers, transport_info))
+            {
+                g_hash_table_insert (entry->servers,
+                                     cmsg_transport_info_copy (transport_info), NULL);
+            }
+        }
+        else
+        {
+            g_hash_table_remove (entry->servers, transport_info);
+        }
+    }
 }
 
 /**
- * Create and initialise a 'cmsg_sl_info' structure.
+ * Get the transport for a server of a listener for an event, recording the server
+ * as known (or no longer known) to the listener. The transport of a known server is
+ * reused rather than creating a new transport for every event.
  *
- * @param service_name - The service name to use.
- * @param handler - The handler to use.
- * @param user_data - The user data to pass into the handler.
+ * Note - Assumes the 'listener_list_mutex' mutex is held.
  *
- * @returns A pointer to the initialised structure on success, NULL otherwise.
+ * @param entry - The listener to get the transport for.
+ * @param transport_info - The transport information of the server.
+ * @param added - Whether the server has been added or removed.
+ * @param event - The event to store the transport in.
+ *
+ * @returns true on success, false if the transport could not be created.
  */
-static cmsg_sl_info *
-cmsg_service_listener_info_create (const char *service_name,
-                                   cmsg_sl_event_handler_t handler, void *user_data)
+static bool
+event_transport_get (cmsg_sl_info *entry, const cmsg_transport_info *transport_info,
+                     bool added, cmsg_sl_event *event)
 {
-    cmsg_sl_info *info = NULL;
-    static uint32_t id = 0;
+    gpointer key = NULL;
+    gpointer value = NULL;
 
-    info = CMSG_CALLOC (1, sizeof (cmsg_sl_info));
-    if (!info)
+    event->added = added;
+
+    if (g_hash_table_lookup_extended (entry->servers, transport_info, &key, &value))
     {
-        return NULL;
+        if (added)
+        {
+            event->owned = false;
+        }
+        else
+        {
+            g_hash_table_steal (entry->servers, transport_info);
+            cmsg_transport_info_free (key);
+            event->owned = true;
+        }
+        event->transport = value;
+        return true;
     }
 
-    info->service_name = CMSG_STRDUP (service_name);
-    if (!info->service_name)
+    event->transport = cmsg_transport_info_to_transport (transport_info);
+    if (!event->transport)
     {
-        CMSG_FREE (info);
-        return NULL;
+        return false;
     }
 
-    info->eventfd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
-    if (info->eventfd < 0)
+    if (added)
     {
-        CMSG_FREE (info->service_name);
-        CMSG_FREE (info);
-        return NULL;
+        g_hash_table_insert (entry->servers, cmsg_transport_info_copy (transport_info),
+                             event->transport);
+        event->owned = false;
     }
-
-    info->queue = g_async_queue_new_full (_clear_event_queue);
-    if (!info->queue)
+    else
     {
-        close (info->eventfd);
-        CMSG_FREE (info->service_name);
-        CMSG_FREE (info);
-        return NULL;
+        event->owned = true;
     }
 
-    info->handler = handler;
+    return true;
+}
+
+/**
+ * Push an event for a set of servers onto the event queue of a listener and
+ * record the servers as known (or no longer known) to the listener. A listener
+ * used for the lookup cache only records the servers.
+ *
+ * Note - Assumes the 'listener_list_mutex' mutex is held.
+ *
+ * @param entry - The listener to push the event for.
+ * @param transport_infos - GList of the transport information of the servers.
+ * @param added - Whether the servers have been added or removed.
+ */
+static void
+push_event (cmsg_sl_info *entry, GList *transport_infos, bool added)
+{
+    cmsg_sl_event event;
+    GList *list = NULL;
+
+    if (!transport_infos)
+    {
+        return;
+    }
+
+    if (entry->cached)
+    {
+        if (entry->synced)
+        {
+            update_servers (entry, transport_infos, added);
+        }
+        else
+        {
+            pend_event (entry, transport_infos, added, false);
+        }
+        return;
+    }
+
+    pthread_mutex_lock (&entry->events_mutex);
+
+    for (list = transport_infos; list; list = g_list_next (list))
+    {
+        if (event_transport_get (entry, list->data, added, &event))
+        {
+            g_array_append_val (entry->events, event);
+        }
+    }
+
+    /* The application is only woken once for all of the events it has not yet
+     * started to process */
+    if (!entry->signalled)
+    {
+        entry->signalled = true;
+        TEMP_FAILURE_RETRY (eventfd_write (entry->eventfd, 1));
+    }
+
+    pthread_mutex_unlock (&entry->events_mutex);
+}
+
+/**
+ * Record a set of servers of a service as added to (or removed from) a wait set
+ * and wake the thread waiting on the set.
+ *
+ * Note - Assumes the 'listener_list_mutex' mutex is held.
+ *
+ * @param entry - The wait set.
+ * @param service - The service the servers are for.
+ * @param transport_infos - GList of the transport information of the servers.
+ * @param added - Whether the servers have been added or removed.
+ */
+static void
+wait_set_update (cmsg_sl_info *entry, const char *service, GList *transport_infos,
+                 bool added)
+{
+    GHashTable *servers = NULL;
+    GList *list = NULL;
+
+    servers = service ? g_hash_table_lookup (entry->wait_services, service) : NULL;
+    if (!servers)
+    {
+        return;
+    }
+
+    for (list = transport_infos; list; list = g_list_next (list))
+    {
+        if (added)
+        {
+            g_hash_table_add (servers, cmsg_transport_info_copy (list->data));
+        }
+        else
+        {
+            g_hash_table_remove (servers, list->data);
+        }
+    }
+
+    TEMP_FAILURE_RETRY (eventfd_write (entry->eventfd, 1));
+}
+
+/**
+ * Replace the servers of a service in a wait set with the full set of servers
+ * that currently exist for the service.
+ *
+ * Note - Assumes the 'listener_list_mutex' mutex is held.
+ *
+ * @param entry - The wait set.
+ * @param recv_msg - The received resync message from the service listener daemon.
+ */
+static void
+wait_set_resync (cmsg_sl_info *entry, const cmsg_sld_server_resync_event *recv_msg)
+{
+    GHashTable *servers = NULL;
+    const char *service = recv_msg->service;
+    cmsg_service_info *service_info = NULL;
+    GList *added = NULL;
+    int i;
+
+    /* Older versions of the daemon do not set the service of a resync */
+    if (!service && recv_msg->n_service_info > 0)
+    {
+        service = recv_msg->service_info[0]->service;
+    }
+
+    servers = service ? g_hash_table_lookup (entry->wait_services, service) : NULL;
+    if (!servers)
+    {
+        return;
+    }
+
+    g_hash_table_remove_all (servers);
+
+    CMSG_REPEATED_FOREACH (recv_msg, service_info, service_info, i)
+    {
+        added = g_list_prepend (added, service_info->server_info);
+    }
+    wait_set_update (entry, service, added, true);
+    g_list_free (added);
+}
+
+/**
+ * Notify the listener of a given service of an event for a set of servers.
+ *
+ * @param id - The ID of the listener.
+ * @param service - The service the servers are for.
+ * @param transport_infos - GList of the transport information of the servers.
+ * @param added - Whether the servers have been added or removed.
+ */
+static void
+notify_listener (uint32_t id, const char *service, GList *transport_infos, bool added)
+{
+    GList *list;
+    cmsg_sl_info *entry;
+
+    pthread_mutex_lock (&listener_list_mutex);
+
+    for (list = g_list_first (listener_list); list; list = g_list_next (list))
+    {
+        entry = (cmsg_sl_info *) list->data;
+
+        if (entry->id == id)
+        {
+            if (entry->wait_services)
+            {
+                wait_set_update (entry, service, transport_infos, added);
+            }
+            else
+            {
+                push_event (entry, transport_infos, added);
+            }
+        }
+    }
+
+    pthread_mutex_unlock (&listener_list_mutex);
+}
+
+/**
+ * Notify the listener of a given service of the event that has occurred.
+ *
+ * @param recv_msg - The received event message from the service listener daemon.
+ * @param added - Whether the service has been added or removed.
+ */
+static void
+notify_listener_server_event (const cmsg_sld_server_event *recv_msg, bool added)
+{
+    GList transport_infos = { };
+
+    transport_infos.data = recv_msg->service_info->server_info;
+    notify_listener (recv_msg->id, recv_msg->service_info->service, &transport_infos,
+                     added);
+}
+
+/**
+ * Bring a listener that fell behind back in line with the full set of servers
+ * for the service. Events are generated for any server that the listener has
+ * not been told about and any server it knows of that no longer exists.
+ *
+ * Note - Assumes the 'listener_list_mutex' mutex is held.
+ *
+ * @param entry - The listener to resynchronise.
+ * @param recv_msg - The received resync message from the service listener daemon.
+ */
+static void
+resync_listener (cmsg_sl_info *entry, const cmsg_sld_server_resync_event *recv_msg)
+{
+    GHashTable *current = NULL;
+    GHashTableIter iter;
+    gpointer key;
+    GList *removed = NULL;
+    GList *added = NULL;
+    cmsg_service_info *service_info = NULL;
+    int i;
+
+    /* The servers have not been looked up yet so there is nothing to compare
+     * against. Apply the full set of servers once the lookup completes. */
+    if (entry->cached && !entry->synced)
+    {
+        CMSG_REPEATED_FOREACH (recv_msg, service_info, service_info, i)
+        {
+            added = g_list_prepend (added, service_info->server_info);
+        }
+        added = g_list_reverse (added);
+        pend_event (entry, added, true, true);
+        g_list_free (added);
+        return;
+    }
+
+    current = g_hash_table_new (cmsg_transport_info_hash, cmsg_transport_info_equal);
+    CMSG_REPEATED_FOREACH (recv_msg, service_info, service_info, i)
+    {
+        g_hash_table_add (current, service_info->server_info);
+    }
+
+    g_hash_table_iter_init (&iter, entry->servers);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        if (!g_hash_table_contains (current, key))
+        {
+            removed = g_list_prepend (removed, cmsg_transport_info_copy (key));
+        }
+    }
+
+    push_event (entry, removed, false);
+    g_list_free_full (removed, (GDestroyNotify) cmsg_transport_info_free);
+
+    CMSG_REPEATED_FOREACH (recv_msg, service_info, service_info, i)
+    {
+        if (!g_hash_table_contains (entry->servers, service_info->server_info))
+        {
+            added = g_list_prepend (added, service_info->server_info);
+        }
+    }
+
+    added = g_list_reverse (added);
+    push_event (entry, added, true);
+    g_list_free (added);
+
+    g_hash_table_unref (current);
+}
+
+/**
+ * Notification from the CMSG service listener daemon that a server for
+ * a specific service has been added.
+ */
+void
+cmsg_sld_events_impl_server_added (const void *service,
+                                   const cmsg_sld_server_event *recv_msg)
+{
+    notify_listener_server_event (recv_msg, true);
+    cmsg_sld_events_server_server_addedSend (service);
+}
+
+/**
+ * Notification from the CMSG service listener daemon that a server for
+ * a specific service has been removed.
+ */
+void
+cmsg_sld_events_impl_server_removed (const void *service,
+                                     const cmsg_sld_server_event *recv_msg)
+{
+    notify_listener_server_event (recv_msg, false);
+    cmsg_sld_events_server_server_removedSend (service);
+}
+
+/**
+ * Notification from the CMSG service listener daemon that events for a listener
+ * were dropped because it fell behind, along with the full set of servers that
+ * currently exist for the service.
+ */
+void
+cmsg_sld_events_impl_server_resync (const void *service,
+                                    const cmsg_sld_server_resync_event *recv_msg)
+{
+    GList *list;
+    cmsg_sl_info *entry;
+
+    pthread_mutex_lock (&listener_list_mutex);
+
+    for (list = g_list_first (listener_list); list; list = g_list_next (list))
+    {
+        entry = (cmsg_sl_info *) list->data;
+
+        if (entry->id == recv_msg->id)
+        {
+            if (entry->wait_services)
+            {
+                wait_set_resync (entry, recv_msg);
+            }
+            else
+            {
+                resync_listener (entry, recv_msg);
+            }
+        }
+    }
+
+    pthread_mutex_unlock (&listener_list_mutex);
+
+    cmsg_sld_events_server_server_resyncSend (service);
+}
+
+/**
+ * Notification from the CMSG service listener daemon that a set of servers for
+ * a specific service have been added or removed.
+ */
+void
+cmsg_sld_events_impl_servers_changed (const void *service,
+                                      const cmsg_sld_servers_changed_event *recv_msg)
+{
+    GList *transport_infos = NULL;
+    cmsg_service_info *service_info = NULL;
+    const char *service_name = NULL;
+    int i;
+
+    CMSG_REPEATED_FOREACH (recv_msg, service_info, service_info, i)
+    {
+        transport_infos = g_list_prepend (transport_infos, service_info->server_info);
+        service_name = service_info->service;
+    }
+    transport_infos = g_list_reverse (transport_infos);
+
+    notify_listener (recv_msg->id, service_name, transport_infos, recv_msg->added);
+    g_list_free (transport_infos);
+
+    cmsg_sld_events_server_servers_changedSend (service);
+}
+
+/**
+ * Initialise the server for receiving events from the service listener.
+ */
+static void
+event_server_init (void)
+{
+    cmsg_transport *transport = NULL;
+
+    transport = cmsg_transport_new (CMSG_TRANSPORT_ONEWAY_UNIX);
+    transport->config.socket.family = AF_UNIX;
+    transport->config.socket.sockaddr.un.sun_family = AF_UNIX;
+    snprintf (transport->config.socket.sockaddr.un.sun_path,
+              sizeof (transport->config.socket.sockaddr.un.sun_path) - 1,
+              "/tmp/%s.%u", cmsg_service_name_get (CMSG_DESCRIPTOR (cmsg_sld, events)),
+              getpid ());
+
+    event_server = cmsg_server_new (transport, CMSG_SERVICE (cmsg_sld, events));
+    cmsg_pthread_server_init (&event_server_thread, event_server);
+}
+
+/**
+ * Destroy the server used for receiving events from the service listener.
+ */
+static void
+event_server_deinit (void)
+{
+    pthread_cancel (event_server_thread);
+    pthread_join (event_server_thread, NULL);
+    cmsg_destroy_server_and_transport (event_server);
+    event_server = NULL;
+}
+
+/**
+ * Helper function for calling the API to the CMSG service listener
+ * to add/remove a listener for a given service.
+ *
+ * Note - Assumes the 'listener_list_mutex' mutex is held.
+ *
+ * @param service_name - The name of the service to listen/unlisten for.
+ * @param listen - true to listen, false to unlisten.
+ * @param id - The numerical ID of the listener.
+ */
+static void
+_cmsg_service_listener_listen (const char *service_name, bool listen, uint32_t id)
+{
+    cmsg_sld_listener_info send_msg = CMSG_SLD_LISTENER_INFO_INIT;
+    cmsg_transport_info *transport_info = NULL;
+
+    transport_info = cmsg_transport_info_create (event_server->_transport);
+
+    CMSG_SET_FIELD_PTR (&send_msg, service, (char *) service_name);
+    CMSG_SET_FIELD_PTR (&send_msg, transport_info, transport_info);
+    CMSG_SET_FIELD_VALUE (&send_msg, id, id);
+
+    if (listen)
+    {
+        CMSG_SET_FIELD_VALUE (&send_msg, pid, getpid ());
+        cmsg_sl_send ("listen", (const ProtobufCMessage *) &send_msg, false);
+    }
+    else
+    {
+        cmsg_sl_send ("unlisten", (const ProtobufCMessage *) &send_msg, false);
+    }
+
+    cmsg_transport_info_free (transport_info);
+}
+
+/**
+ * Helper function for calling the API to the CMSG service listener
+ * to add/remove a listener for each service of a wait set.
+ *
+ * Note - Assumes the 'listener_list_mutex' mutex is held.
+ *
+ * @param info - The wait set.
+ * @param listen - true to listen, false to unlisten.
+ */
+static void
+_cmsg_service_listener_listen_set (const cmsg_sl_info *info, bool listen)
+{
+    cmsg_sld_listener_set_info send_msg = CMSG_SLD_LISTENER_SET_INFO_INIT;
+    cmsg_transport_info *transport_info = NULL;
+    GHashTableIter iter;
+    gpointer key;
+
+    transport_info = cmsg_transport_info_create (event_server->_transport);
+
+    g_hash_table_iter_init (&iter, info->wait_services);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        CMSG_REPEATED_APPEND (&send_msg, services, (char *) key);
+    }
+    CMSG_SET_FIELD_PTR (&send_msg, transport_info, transport_info);
+    CMSG_SET_FIELD_VALUE (&send_msg, id, info->id);
+
+    if (listen)
+    {
+        CMSG_SET_FIELD_VALUE (&send_msg, pid, getpid ());
+        cmsg_sl_send ("listen_set", (const ProtobufCMessage *) &send_msg, false);
+    }
+    else
+    {
+        cmsg_sl_send ("unlisten_set", (const ProtobufCMessage *) &send_msg, false);
+    }
+
+    CMSG_REPEATED_FREE (send_msg.services);
+    cmsg_transport_info_free (transport_info);
+}
+
+/**
+ * Create and initialise a 'cmsg_sl_info' structure.
+ *
+ * @param service_name - The service name to use.
+ * @param handler - The handler to use.
+ * @param user_data - The user data to pass into the handler.
+ *
+ * @returns A pointer to the initialised structure on success, NULL otherwise.
+ */
+static cmsg_sl_info *
+cmsg_service_listener_info_create (const char *service_name,
+                                   cmsg_sl_event_handler_t handler, void *user_data)
+{
+    cmsg_sl_info *info = NULL;
+    static uint32_t id = 0;
+
+    info = CMSG_CALLOC (1, sizeof (cmsg_sl_info));
+    if (!info)
+    {
+        return NULL;
+    }
+
+    info->service_name = CMSG_STRDUP (service_name);
+    if (!info->service_name)
+    {
+        CMSG_FREE (info);
+        return NULL;
+    }
+
+    info->eventfd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (info->eventfd < 0)
+    {
+        CMSG_FREE (info->service_name);
+        CMSG_FREE (info);
+        return NULL;
+    }
+
+    pthread_mutex_init (&info->events_mutex, NULL);
+    info->events = g_array_new (FALSE, FALSE, sizeof (cmsg_sl_event));
+    info->dispatch = g_array_new (FALSE, FALSE, sizeof (cmsg_sl_event));
+    info->servers = g_hash_table_new_full (cmsg_transport_info_hash,
+                                           cmsg_transport_info_equal,
+                                           (GDestroyNotify) cmsg_transport_info_free,
+                                           (GDestroyNotify) cmsg_transport_destroy);
+    info->handler = handler;
     info->user_data = user_data;
     info->id = id++;
 
-    return info;
-}
+    return info;
+}
+
+/**
+ * Destroy a 'cmsg_sl_info' structure and all associated memory.
+ *
+ * @param info - The structure to destroy.
+ */
+static void
+cmsg_service_listener_info_destroy (cmsg_sl_info *info)
+{
+    g_list_free_full (info->pending, cmsg_sl_pending_event_free);
+    cmsg_sl_events_clear (info->dispatch);
+    g_array_free (info->dispatch, TRUE);
+    cmsg_sl_events_clear (info->events);
+    g_array_free (info->events, TRUE);
+    pthread_mutex_destroy (&info->events_mutex);
+    g_hash_table_unref (info->servers);
+    if (info->wait_services)
+    {
+        g_hash_table_unref (info->wait_services);
+    }
+    close (info->eventfd);
+    CMSG_FREE (info->service_name);
+    CMSG_FREE (info);
+}
+
+/**
+ * Add a listener to the list of listeners.
+ *
+ * Note - Assumes the 'add_remove_mutex' and 'listener_list_mutex' mutexes are held.
+ *
+ * @param info - The listener to add.
+ */
+static void
+listener_list_add (cmsg_sl_info *info)
+{
+    listener_list = g_list_prepend (listener_list, info);
+
+    /* If this is the first listener then create the server for receiving
+     * notifications from the service listener daemon. */
+    if (g_list_length (listener_list) == 1)
+    {
+        event_server_init ();
+    }
+}
+
+/**
+ * Remove a listener from the list of listeners and tell the service
+ * listener daemon that it is no longer listening.
+ *
+ * Note - Assumes the 'add_remove_mutex' mutex is held.
+ *
+ * @param info - The listener to remove.
+ */
+static void
+listener_list_remove (cmsg_sl_info *info)
+{
+    pthread_mutex_lock (&listener_list_mutex);
+
+    listener_list = g_list_remove (listener_list, info);
+
+    if (info->wait_services)
+    {
+        _cmsg_service_listener_listen_set (info, false);
+    }
+    else
+    {
+        _cmsg_service_listener_listen (info->service_name, false, info->id);
+    }
+
+    /* If this was the only listener then destroy the server for receiving
+     * notifications from the service listener daemon. */
+    if (g_list_length (listener_list) == 0)
+    {
+        /* Release the list mutex as the server thread may be blocked waiting
+         * to take it. If the lock is not release then the server thread cannot
+         * be cancelled and subsequently joined. */
+        pthread_mutex_unlock (&listener_list_mutex);
+        event_server_deinit ();
+    }
+    else
+    {
+        pthread_mutex_unlock (&listener_list_mutex);
+    }
+}
+
+/**
+ * Listen for events for the given service name.
+ *
+ * @param service_name - The service to listen for.
+ * @param func - The function to call when a server is added or removed
+ *               for the given service.
+ * @param user_data - Pointer to user supplied data that will be passed into the
+ *                    supplied handler function.
+ *
+ * @returns A pointer to the 'cmsg_sl_info' structure for the given service.
+ */
+const cmsg_sl_info *
+cmsg_service_listener_listen (const char *service_name, cmsg_sl_event_handler_t handler,
+                              void *user_data)
+{
+    cmsg_sl_info *info = NULL;
+
+    pthread_mutex_lock (&add_remove_mutex);
+
+    info = cmsg_service_listener_info_create (service_name, handler, user_data);
+    if (!info)
+    {
+        pthread_mutex_unlock (&add_remove_mutex);
+        return NULL;
+    }
+
+    pthread_mutex_lock (&listener_list_mutex);
+
+    listener_list_add (info);
+    _cmsg_service_listener_listen (service_name, true, info->id);
+
+    pthread_mutex_unlock (&listener_list_mutex);
+    pthread_mutex_unlock (&add_remove_mutex);
+
+    return info;
+}
+
+/**
+ * Unlisten from events for the given service name.
+ *
+ * @param service_name - The service to unlisten from.
+ */
+void
+cmsg_service_listener_unlisten (const cmsg_sl_info *info)
+{
+    pthread_mutex_lock (&add_remove_mutex);
+    listener_list_remove ((cmsg_sl_info *) info);
+    pthread_mutex_unlock (&add_remove_mutex);
+
+    cmsg_service_listener_info_destroy ((cmsg_sl_info *) info);
+}
+
+/**
+ * Convert a set of transport information to a list of transports.
+ *
+ * @param servers - Hash table set of the transport information of the servers.
+ *
+ * @returns GList of 'cmsg_transport' structures.
+ */
+static GList *
+servers_to_transports (GHashTable *servers)
+{
+    GHashTableIter iter;
+    gpointer key;
+    GList *transports = NULL;
+
+    g_hash_table_iter_init (&iter, servers);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        transports = g_list_prepend (transports, cmsg_transport_info_to_transport (key));
+    }
+
+    return transports;
+}
+
+/**
+ * Check whether the connection to the cmsg_sld daemon used for lookups is still
+ * open. The daemon only ever writes a reply to a lookup on this connection, so the
+ * socket being readable between lookups means that the daemon has closed it.
+ *
+ * Note - Assumes the 'listener_list_mutex' mutex is held.
+ *
+ * @returns true if the connection is open, false otherwise.
+ */
+static bool
+cmsg_sl_query_client_connected (void)
+{
+    struct pollfd pfd;
+
+    if (!sld_query_client || sld_query_client->state != CMSG_CLIENT_STATE_CONNECTED)
+    {
+        return false;
+    }
+
+    pfd.fd = cmsg_client_get_socket (sld_query_client);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    return poll (&pfd, 1, 0) == 0;
+}
+
+/**
+ * Get the servers for a service from the lookup cache.
+ *
+ * @param service_name - The service to get the servers for.
+ * @param transports - Pointer to store the GList of transports of the servers in.
+ *
+ * @returns true if the servers for the service are cached, false otherwise.
+ */
+static bool
+cmsg_sl_cache_get (const char *service_name, GList **transports)
+{
+    cmsg_sl_info *info = NULL;
+    bool ret = false;
+
+    pthread_mutex_lock (&listener_list_mutex);
+
+    info = sl_cache ? g_hash_table_lookup (sl_cache, service_name) : NULL;
+    if (info && info->synced && cmsg_sl_query_client_connected ())
+    {
+        *transports = servers_to_transports (info->servers);
+        ret = true;
+    }
+
+    pthread_mutex_unlock (&listener_list_mutex);
+
+    return ret;
+}
+
+/**
+ * Look up the servers for a service from the cmsg_sld daemon.
+ *
+ * Note - Assumes the 'add_remove_mutex' mutex is held.
+ *
+ * @param service_name - The service to look up.
+ * @param listener - If not NULL the listener to register for the service
+ *                   with the daemon as part of the lookup.
+ * @param recv_msg - Pointer to store the reply from the daemon in. This should be
+ *                   freed using CMSG_FREE_RECV_MSG by the caller.
+ *
+ * @returns CMSG_RET_OK on success, related error code on failure.
+ */
+static int32_t
+cmsg_sl_query_lookup (const char *service_name, cmsg_sld_listener_info *listener,
+                      cmsg_sld_lookup_reply **recv_msg)
+{
+    cmsg_sld_lookup_request send_msg = CMSG_SLD_LOOKUP_REQUEST_INIT;
+    cmsg_client *client = NULL;
+
+    if (!sld_query_client)
+    {
+        client = cmsg_create_client_unix (CMSG_DESCRIPTOR (cmsg_sld, query));
+        if (!client)
+        {
+            return CMSG_RET_ERR;
+        }
+
+        pthread_mutex_lock (&listener_list_mutex);
+        sld_query_client = client;
+        pthread_mutex_unlock (&listener_list_mutex);
+    }
+
+    CMSG_SET_FIELD_PTR (&send_msg, service, (char *) service_name);
+    if (listener)
+    {
+        CMSG_SET_FIELD_PTR (&send_msg, listener, listener);
+    }
+
+    return cmsg_sld_query_api_lookup (sld_query_client, &send_msg, recv_msg);
+}
+
+/**
+ * Apply the servers looked up for a cached listener, followed by any events
+ * that were received for the listener while the lookup was in progress.
+ *
+ * Note - Assumes the 'listener_list_mutex' mutex is held.
+ *
+ * @param info - The cached listener.
+ * @param recv_msg - The reply to the lookup from the cmsg_sld daemon.
+ */
+static void
+cmsg_sl_cache_sync (cmsg_sl_info *info, const cmsg_sld_lookup_reply *recv_msg)
+{
+    cmsg_service_info *service_info = NULL;
+    cmsg_sl_pending_event *pending = NULL;
+    GList *servers = NULL;
+    GList *list = NULL;
+    int i;
+
+    CMSG_REPEATED_FOREACH (recv_msg, servers, service_info, i)
+    {
+        servers = g_list_prepend (servers, service_info->server_info);
+    }
+    update_servers (info, servers, true);
+    g_list_free (servers);
+
+    for (list = info->pending; list; list = g_list_next (list))
+    {
+        pending = (cmsg_sl_pending_event *) list->data;
+        if (pending->resync)
+        {
+            g_hash_table_remove_all (info->servers);
+        }
+        update_servers (info, pending->transport_infos, pending->added);
+    }
+    g_list_free_full (info->pending, cmsg_sl_pending_event_free);
+    info->pending = NULL;
+
+    info->synced = true;
+}
+
+/**
+ * Look up the servers for a service from the cmsg_sld daemon and add the service
+ * to the lookup cache. The service is listened for as part of the lookup so that
+ * the cache is kept up to date by the events from the daemon from then on.
+ *
+ * Note - Assumes the 'add_remove_mutex' mutex is held.
+ *
+ * @param service_name - The service to look up.
+ * @param transports - Pointer to store the GList of transports of the servers in.
+ *
+ * @returns CMSG_RET_OK on success, related error code on failure.
+ */
+static int32_t
+cmsg_sl_cache_fill (const char *service_name, GList **transports)
+{
+    cmsg_sld_listener_info listener = CMSG_SLD_LISTENER_INFO_INIT;
+    cmsg_sld_lookup_reply *recv_msg = NULL;
+    cmsg_transport_info *transport_info = NULL;
+    cmsg_service_info *service_info = NULL;
+    cmsg_sl_info *info = NULL;
+    bool full;
+    int32_t ret;
+    int i;
+
+    pthread_mutex_lock (&listener_list_mutex);
+    if (!sl_cache)
+    {
+        sl_cache = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+    full = (g_hash_table_size (sl_cache) >= CMSG_SL_CACHE_MAX_SERVICES);
+    pthread_mutex_unlock (&listener_list_mutex);
+
+    /* The cache is full, look the service up without caching it */
+    if (full)
+    {
+        ret = cmsg_sl_query_lookup (service_name, NULL, &recv_msg);
+        if (ret == CMSG_RET_OK)
+        {
+            CMSG_REPEATED_FOREACH (recv_msg, servers, service_info, i)
+            {
+                *transports =
+                    g_list_prepend (*transports,
+                                    cmsg_transport_info_to_transport (service_info->
+                                                                      server_info));
+            }
+            CMSG_FREE_RECV_MSG (recv_msg);
+        }
+        return ret;
+    }
+
+    info = cmsg_service_listener_info_create (service_name, NULL, NULL);
+    if (!info)
+    {
+        return CMSG_RET_ERR;
+    }
+    info->cached = true;
+
+    pthread_mutex_lock (&listener_list_mutex);
+    listener_list_add (info);
+    g_hash_table_insert (sl_cache, info->service_name, info);
+    transport_info = cmsg_transport_info_create (event_server->_transport);
+    pthread_mutex_unlock (&listener_list_mutex);
+
+    CMSG_SET_FIELD_PTR (&listener, service, (char *) service_name);
+    CMSG_SET_FIELD_PTR (&listener, transport_info, transport_info);
+    CMSG_SET_FIELD_VALUE (&listener, id, info->id);
+    CMSG_SET_FIELD_VALUE (&listener, pid, getpid ());
+
+    /* Events for the listener can be received before the reply to the lookup,
+     * these are held on to until the servers from the reply have been applied. */
+    ret = cmsg_sl_query_lookup (service_name, &listener, &recv_msg);
+    cmsg_transport_info_free (transport_info);
+
+    if (ret != CMSG_RET_OK)
+    {
+        pthread_mutex_lock (&listener_list_mutex);
+        g_hash_table_remove (sl_cache, info->service_name);
+        pthread_mutex_unlock (&listener_list_mutex);
+
+        listener_list_remove (info);
+        cmsg_service_listener_info_destroy (info);
+        return ret;
+    }
+
+    pthread_mutex_lock (&listener_list_mutex);
+    cmsg_sl_cache_sync (info, recv_msg);
+    *transports = servers_to_transports (info->servers);
+    pthread_mutex_unlock (&listener_list_mutex);
+
+    CMSG_FREE_RECV_MSG (recv_msg);
 
-/**
- * Destroy a 'cmsg_sl_info' structure and all associated memory.
- *
- * @param info - The structure to destroy.
- */
-static void
-cmsg_service_listener_info_destroy (cmsg_sl_info *info)
-{
-    g_async_queue_unref (info->queue);
-    close (info->eventfd);
-    CMSG_FREE (info->service_name);
-    CMSG_FREE (info);
+    return CMSG_RET_OK;
 }
 
 /**
- * Listen for events for the given service name.
- *
- * @param service_name - The service to listen for.
- * @param func - The function to call when a server is added or removed
- *               for the given service.
- * @param user_data - Pointer to user supplied data that will be passed into the
- *                    supplied handler function.
+ * Drop every service from the lookup cache, along with the connection used to look
+ * them up. This is done once the connection to the cmsg_sld daemon has been lost,
+ * as a restarted daemon knows nothing of the listeners keeping the cache up to date.
  *
- * @returns A pointer to the 'cmsg_sl_info' structure for the given service.
+ * Note - Assumes the 'add_remove_mutex' mutex is held.
  */
-const cmsg_sl_info *
-cmsg_service_listener_listen (const char *service_name, cmsg_sl_event_handler_t handler,
-                              void *user_data)
+static void
+cmsg_sl_cache_drop (void)
 {
-    cmsg_sl_info *info = NULL;
+    cmsg_client *client = NULL;
+    GList *cached = NULL;
+    GList *list = NULL;
+    GHashTableIter iter;
+    gpointer value;
 
-    pthread_mutex_lock (&add_remove_mutex);
+    pthread_mutex_lock (&listener_list_mutex);
 
-    info = cmsg_service_listener_info_create (service_name, handler, user_data);
-    if (!info)
+    if (sl_cache)
     {
-        pthread_mutex_unlock (&add_remove_mutex);
-        return NULL;
+        g_hash_table_iter_init (&iter, sl_cache);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+            cached = g_list_prepend (cached, value);
+        }
+        g_hash_table_remove_all (sl_cache);
     }
 
-    pthread_mutex_lock (&listener_list_mutex);
+    client = sld_query_client;
+    sld_query_client = NULL;
 
-    listener_list = g_list_prepend (listener_list, info);
+    pthread_mutex_unlock (&listener_list_mutex);
 
-    /* If this is the first listener then create the server for receiving
-     * notifications from the service listener daemon. */
-    if (g_list_length (listener_list) == 1)
+    for (list = cached; list; list = g_list_next (list))
     {
-        event_server_init ();
+        listener_list_remove ((cmsg_sl_info *) list->data);
+        cmsg_service_listener_info_destroy ((cmsg_sl_info *) list->data);
     }
+    g_list_free (cached);
 
-    _cmsg_service_listener_listen (service_name, true, info->id);
+    cmsg_destroy_client_and_transport (client);
+}
 
-    pthread_mutex_unlock (&listener_list_mutex);
-    pthread_mutex_unlock (&add_remove_mutex);
+/**
+ * Look up the servers that currently exist for the given service name in the
+ * directory published to shared memory by the service listener daemon. This does
+ * not contact the daemon and rarely makes a system call (once the shared memory has
+ * been attached to read-only by the first lookup).
+ *
+ * @param service_name - The service to look up.
+ * @param transports - Pointer to store the GList of 'cmsg_transport' structures for
+ *                     the servers in. The list should be freed by the caller using
+ *                     'g_list_free_full (list, cmsg_transport_destroy)'.
+ *
+ * @returns true if the servers were looked up, false if the directory is not
+ *          available and 'cmsg_service_listener_lookup' should be used instead.
+ */
+bool
+cmsg_service_listener_directory_lookup (const char *service_name, GList **transports)
+{
+    const cmsg_sl_shm_directory *directory = NULL;
 
-    return info;
+    *transports = NULL;
+
+    directory = cmsg_sl_shm_directory_attach ();
+    if (!directory)
+    {
+        return false;
+    }
+
+    return cmsg_sl_shm_lookup (directory, service_name, transports);
 }
 
 /**
- * Unlisten from events for the given service name.
+ * Look up the servers that currently exist for the given service name.
  *
- * @param service_name - The service to unlisten from.
+ * The servers are read from the directory published to shared memory by the
+ * service listener daemon if it is available. Otherwise the first lookup of a
+ * service queries the daemon, and the servers for the service are then cached
+ * and kept up to date by listening for the service. Later lookups of the same
+ * service are answered from the cache without contacting the daemon. The cache is
+ * dropped if the connection to the daemon is lost.
+ *
+ * @param service_name - The service to look up.
+ *
+ * @returns GList of 'cmsg_transport' structures for the servers of the service, or
+ *          NULL if there are none or the lookup failed. The list should be freed by
+ *          the caller using 'g_list_free_full (list, cmsg_transport_destroy)'.
  */
-void
-cmsg_service_listener_unlisten (const cmsg_sl_info *info)
+GList *
+cmsg_service_listener_lookup (const char *service_name)
 {
-    pthread_mutex_lock (&add_remove_mutex);
-    pthread_mutex_lock (&listener_list_mutex);
+    GList *transports = NULL;
+    bool connected;
 
-    listener_list = g_list_remove (listener_list, info);
+    if (cmsg_service_listener_directory_lookup (service_name, &transports) ||
+        cmsg_sl_cache_get (service_name, &transports))
+    {
+        return transports;
+    }
+
+    pthread_mutex_lock (&add_remove_mutex);
 
-    _cmsg_service_listener_listen (info->service_name, false, info->id);
+    pthread_mutex_lock (&listener_list_mutex);
+    connected = cmsg_sl_query_client_connected ();
+    pthread_mutex_unlock (&listener_list_mutex);
 
-    /* If this was the only listener then destroy the server for receiving
-     * notifications from the service listener daemon. */
-    if (g_list_length (listener_list) == 0)
+    if (!connected)
     {
-        /* Release the list mutex as the server thread may be blocked waiting
-         * to take it. If the lock is not release then the server thread cannot
-         * be cancelled and subsequently joined. */
-        pthread_mutex_unlock (&listener_list_mutex);
-        event_server_deinit ();
-        pthread_mutex_unlock (&add_remove_mutex);
+        cmsg_sl_cache_drop ();
     }
-    else
+
+    /* Another thread may have filled the cache while waiting for the mutex */
+    if (!cmsg_sl_cache_get (service_name, &transports))
     {
-        pthread_mutex_unlock (&listener_list_mutex);
-        pthread_mutex_unlock (&add_remove_mutex);
+        cmsg_sl_cache_fill (service_name, &transports);
     }
 
+    pthread_mutex_unlock (&add_remove_mutex);
 
-    cmsg_service_listener_info_destroy ((cmsg_sl_info *) info);
+    return transports;
 }
 
 /**
@@ -413,22 +1537,11 @@ cmsg_service_listener_unlisten (const cmsg_sl_info *info)
 int32_t
 cmsg_service_listener_address_set (struct in_addr addr)
 {
-    cmsg_client *client = NULL;
     cmsg_sld_address_info send_msg = CMSG_SLD_ADDRESS_INFO_INIT;
-    int ret;
-
-    client = cmsg_sl_get_client ();
-    if (!client)
-    {
-        return CMSG_RET_ERR;
-    }
 
     CMSG_SET_FIELD_VALUE (&send_msg, ip_addr, addr.s_addr);
 
-    ret = cmsg_sld_configuration_api_address_set (client, &send_msg);
-    cmsg_destroy_client_and_transport (client);
-
-    return ret;
+    return cmsg_sl_send ("address_set", (const ProtobufCMessage *) &send_msg, false);
 }
 
 /**
@@ -443,22 +1556,11 @@ cmsg_service_listener_address_set (struct in_addr addr)
 int32_t
 cmsg_service_listener_add_host (struct in_addr addr)
 {
-    cmsg_client *client = NULL;
     cmsg_uint32 send_msg = CMSG_UINT32_INIT;
-    int ret;
-
-    client = cmsg_sl_get_client ();
-    if (!client)
-    {
-        return CMSG_RET_ERR;
-    }
 
     CMSG_SET_FIELD_VALUE (&send_msg, value, addr.s_addr);
 
-    ret = cmsg_sld_configuration_api_add_host (client, &send_msg);
-    cmsg_destroy_client_and_transport (client);
-
-    return ret;
+    return cmsg_sl_send ("add_host", (const ProtobufCMessage *) &send_msg, false);
 }
 
 /**
@@ -473,22 +1575,11 @@ cmsg_service_listener_add_host (struct in_addr addr)
 int32_t
 cmsg_service_listener_delete_host (struct in_addr addr)
 {
-    cmsg_client *client = NULL;
     cmsg_sld_address_info send_msg = CMSG_SLD_ADDRESS_INFO_INIT;
-    int ret;
-
-    client = cmsg_sl_get_client ();
-    if (!client)
-    {
-        return CMSG_RET_ERR;
-    }
 
     CMSG_SET_FIELD_VALUE (&send_msg, ip_addr, addr.s_addr);
 
-    ret = cmsg_sld_configuration_api_delete_host (client, &send_msg);
-    cmsg_destroy_client_and_transport (client);
-
-    return ret;
+    return cmsg_sl_send ("delete_host", (const ProtobufCMessage *) &send_msg, false);
 }
 
 /**
@@ -500,16 +1591,13 @@ cmsg_service_listener_delete_host (struct in_addr addr)
 void
 cmsg_service_listener_add_server (cmsg_server *server)
 {
-    cmsg_client *client = NULL;
     cmsg_service_info *send_msg = NULL;
 
     send_msg = cmsg_server_service_info_create (server);
     if (send_msg)
     {
         CMSG_SET_FIELD_VALUE (send_msg, pid, getpid ());
-        client = cmsg_sl_get_client ();
-        cmsg_sld_configuration_api_add_server (client, send_msg);
-        cmsg_destroy_client_and_transport (client);
+        cmsg_sl_send ("add_server", (const ProtobufCMessage *) send_msg, true);
         cmsg_server_service_info_free (send_msg);
     }
 }
@@ -523,15 +1611,12 @@ cmsg_service_listener_add_server (cmsg_server *server)
 void
 cmsg_service_listener_remove_server (cmsg_server *server)
 {
-    cmsg_client *client = NULL;
     cmsg_service_info *send_msg = NULL;
 
     send_msg = cmsg_server_service_info_create (server);
     if (send_msg)
     {
-        client = cmsg_sl_get_client ();
-        cmsg_sld_configuration_api_remove_server (client, send_msg);
-        cmsg_destroy_client_and_transport (client);
+        cmsg_sl_send ("remove_server", (const ProtobufCMessage *) send_msg, true);
         cmsg_server_service_info_free (send_msg);
     }
 }
@@ -574,6 +1659,20 @@ cmsg_service_listener_wait_for_unix_server (const char *service_name, long secon
     int select_rc;
     struct timeval timeout;
     struct timeval *_timeout = &timeout;
+    GList *transports = NULL;
+    GList *list = NULL;
+
+    /* The server may already be known without needing to wait for it */
+    transports = cmsg_service_listener_lookup (service_name);
+    for (list = transports; list && !ret; list = g_list_next (list))
+    {
+        cmsg_sl_listener_unix_wait_cb (list->data, true, &ret);
+    }
+    g_list_free_full (transports, (GDestroyNotify) cmsg_transport_destroy);
+    if (ret)
+    {
+        return true;
+    }
 
     info = cmsg_service_listener_listen (service_name, cmsg_sl_listener_unix_wait_cb, &ret);
     if (!info)
@@ -654,6 +1753,20 @@ cmsg_service_listener_wait_for_tcp_server (const char *service_name, struct in_a
     long time_to_wait = seconds * 1000;
     bool ret = false;
     int poll_rc;
+    GList *transports = NULL;
+    GList *list = NULL;
+
+    /* The server may already be known without needing to wait for it */
+    transports = cmsg_service_listener_lookup (service_name);
+    for (list = transports; list && !ret; list = g_list_next (list))
+    {
+        ret = !cmsg_sl_listener_tcp_wait_cb (list->data, true, addr);
+    }
+    g_list_free_full (transports, (GDestroyNotify) cmsg_transport_destroy);
+    if (ret)
+    {
+        return true;
+    }
 
     info = cmsg_service_listener_listen (service_name, cmsg_sl_listener_tcp_wait_cb, addr);
     if (!info)
@@ -693,6 +1806,243 @@ cmsg_service_listener_wait_for_tcp_server (const char *service_name, struct in_a
     return ret;
 }
 
+/**
+ * Count the services that have a server available in the directory published
+ * by the service listener daemon.
+ *
+ * @param service_names - The services to count.
+ * @param num_services - The number of services.
+ *
+ * @returns The number of services with a server, or -1 if the directory
+ *          is not available.
+ */
+static int
+wait_set_directory_count (const char *const *service_names, int num_services)
+{
+    GList *transports = NULL;
+    int count = 0;
+    int i;
+
+    for (i = 0; i < num_services; i++)
+    {
+        if (!cmsg_service_listener_directory_lookup (service_names[i], &transports))
+        {
+            return -1;
+        }
+
+        if (transports)
+        {
+            count++;
+        }
+        g_list_free_full (transports, (GDestroyNotify) cmsg_transport_destroy);
+    }
+
+    return count;
+}
+
+/**
+ * Count the services of a wait set that have a server available.
+ *
+ * @param info - The wait set.
+ *
+ * @returns The number of services with a server.
+ */
+static int
+wait_set_count (const cmsg_sl_info *info)
+{
+    GHashTableIter iter;
+    gpointer value;
+    int count = 0;
+
+    pthread_mutex_lock (&listener_list_mutex);
+
+    g_hash_table_iter_init (&iter, info->wait_services);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        if (g_hash_table_size ((GHashTable *) value) > 0)
+        {
+            count++;
+        }
+    }
+
+    pthread_mutex_unlock (&listener_list_mutex);
+
+    return count;
+}
+
+/**
+ * Create a wait set for the given services and register it with the service
+ * listener daemon. All of the services are listened for with a single listener
+ * and a single message to the daemon.
+ *
+ * @param service_names - The services to wait for.
+ * @param num_services - The number of services.
+ *
+ * @returns A pointer to the wait set on success, NULL otherwise.
+ */
+static cmsg_sl_info *
+wait_set_create (const char *const *service_names, int num_services)
+{
+    cmsg_sl_info *info = NULL;
+    GHashTable *servers = NULL;
+    int i;
+
+    info = cmsg_service_listener_info_create ("", NULL, NULL);
+    if (!info)
+    {
+        return NULL;
+    }
+
+    info->wait_services = g_hash_table_new_full (g_str_hash, g_str_equal, cmsg_free,
+                                                 (GDestroyNotify) g_hash_table_unref);
+    for (i = 0; i < num_services; i++)
+    {
+        servers = g_hash_table_new_full (cmsg_transport_info_hash,
+                                         cmsg_transport_info_equal,
+                                         (GDestroyNotify) cmsg_transport_info_free, NULL);
+        g_hash_table_replace (info->wait_services, CMSG_STRDUP (service_names[i]),
+                              servers);
+    }
+
+    pthread_mutex_lock (&add_remove_mutex);
+    pthread_mutex_lock (&listener_list_mutex);
+
+    listener_list_add (info);
+    _cmsg_service_listener_listen_set (info, true);
+
+    pthread_mutex_unlock (&listener_list_mutex);
+    pthread_mutex_unlock (&add_remove_mutex);
+
+    return info;
+}
+
+/**
+ * Remove any service that is named more than once from a set of services.
+ *
+ * @param service_names - The services.
+ * @param num_services - The number of services.
+ *
+ * @returns Array of the distinct services, in the order they were first named. The
+ *          names are not copied. The array should be freed with 'g_ptr_array_free'.
+ */
+static GPtrArray *
+wait_set_unique_services (const char *const *service_names, int num_services)
+{
+    GHashTable *seen = NULL;
+    GPtrArray *unique = NULL;
+    int i;
+
+    seen = g_hash_table_new (g_str_hash, g_str_equal);
+    unique = g_ptr_array_sized_new (num_services > 0 ? num_services : 0);
+
+    for (i = 0; i < num_services; i++)
+    {
+        if (!g_hash_table_contains (seen, service_names[i]))
+        {
+            g_hash_table_add (seen, (gpointer) service_names[i]);
+            g_ptr_array_add (unique, (gpointer) service_names[i]);
+        }
+    }
+
+    g_hash_table_destroy (seen);
+
+    return unique;
+}
+
+/**
+ * Blocks until servers have been started for a set of services, or for a quorum
+ * of them. Will exit early if a timeout has been specified.
+ *
+ * A service is available once it has a server of any transport type. Rather than
+ * waiting for each service in turn all of the services are waited for together,
+ * using a single listener registered with the service listener daemon.
+ *
+ * @param service_names - The services to wait for.
+ * @param num_services - The number of services.
+ * @param quorum - How many of the services must be available. Zero (or a value
+ *                 larger than the number of services) waits for all of them.
+ * @param seconds - How many seconds to wait for the services.
+ *                  Special values are 0 for a poll and -1 for indefinitely.
+ * @returns The number of services that are available. This is less than the
+ *          quorum if the timeout expired.
+ */
+int
+cmsg_service_listener_wait_for_services (const char *const *service_names,
+                                         int num_services, int quorum, long seconds)
+{
+    cmsg_sl_info *info = NULL;
+    GPtrArray *unique = NULL;
+    const char *const *names = NULL;
+    struct pollfd pfd = {
+        .events = POLLIN,
+    };
+    struct timespec start;
+    struct timespec current;
+    long time_to_wait = seconds * 1000;
+    eventfd_t value;
+    int num_unique;
+    int required;
+    int count;
+    int poll_rc;
+
+    /* A service named more than once only counts once towards the quorum */
+    unique = wait_set_unique_services (service_names, num_services);
+    names = (const char *const *) unique->pdata;
+    num_unique = unique->len;
+
+    required = (quorum <= 0 || quorum > num_unique) ? num_unique : quorum;
+
+    /* The services may already be known without needing to wait for them */
+    count = wait_set_directory_count (names, num_unique);
+    if (count >= required)
+    {
+        g_ptr_array_free (unique, TRUE);
+        return count;
+    }
+
+    info = wait_set_create (names, num_unique);
+    g_ptr_array_free (unique, TRUE);
+    if (!info)
+    {
+        return count < 0 ? 0 : count;
+    }
+
+    pfd.fd = info->eventfd;
+    clock_gettime (CLOCK_MONOTONIC_RAW, &start);
+
+    while (true)
+    {
+        count = wait_set_count (info);
+        if (count >= required || (seconds != -1 && time_to_wait <= 0))
+        {
+            break;
+        }
+
+        poll_rc = TEMP_FAILURE_RETRY (poll (&pfd, 1, seconds == -1 ? -1 : time_to_wait));
+        if (poll_rc < 0)
+        {
+            break;
+        }
+        if (poll_rc > 0)
+        {
+            TEMP_FAILURE_RETRY (eventfd_read (info->eventfd, &value));
+        }
+
+        clock_gettime (CLOCK_MONOTONIC_RAW, &current);
+        time_to_wait = seconds * 1000;
+        time_to_wait -= (current.tv_sec - start.tv_sec) * 1000;
+        time_to_wait -= (current.tv_nsec - start.tv_nsec) / 1000000;
+    }
+
+    pthread_mutex_lock (&add_remove_mutex);
+    listener_list_remove (info);
+    pthread_mutex_unlock (&add_remove_mutex);
+
+    cmsg_service_listener_info_destroy (info);
+
+    return count;
+}
+
 /**
  * Set the event loop data for the service listener subscription.
  *
@@ -0,0 +1,599 @@
+/**
+ * cmsg_sl_shm.c
+ *
+ * Implements the shared memory directory of servers that is published by the
+ * service listener daemon so that other processes can look up the servers for
+ * a service without contacting the daemon.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/shm.h>
+#include <simple_shm.h>
+#include "cmsg_sl_shm_private.h"
+#include "cmsg_error.h"
+
+/* The number of times a lookup retries while the directory is being changed
+ * before giving up and leaving the caller to query cmsg_sld instead. */
+#define CMSG_SL_SHM_READ_RETRIES 1000
+
+#define CMSG_SL_SHM_MAX_USED (CMSG_SL_SHM_NUM_SLOTS / 4 * 3)
+
+/* How often a reader checks that the process publishing the directory still
+ * exists. The check is also made whenever the directory is published again. */
+#define CMSG_SL_SHM_LIVENESS_INTERVAL_MS 1000
+
+typedef struct
+{
+    cmsg_transport_type type;
+    cmsg_socket socket;
+} cmsg_sl_shm_server;
+
+static simple_shm_info shm_info = {
+    .shared_data = NULL,
+    .shared_data_size = sizeof (cmsg_sl_shm_directory),
+    .shared_mem_key = 0x436d536c,   /* Hex value of "CmSl" */
+    .shared_sem_key = 0x436d536c,   /* Hex value of "CmSl" */
+    .shared_sem_num = 1,
+    .shm_id = -1,
+    .sem_id = -1,
+    .init_func = cmsg_sl_shm_directory_init,
+};
+
+static cmsg_sl_shm_directory *attached = NULL;
+static const cmsg_sl_shm_directory *attached_readonly = NULL;
+static pthread_mutex_t attach_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The result of the last check each thread made that the publisher exists */
+static __thread uint32_t liveness_generation = 0;
+static __thread bool liveness_alive = false;
+static __thread struct timespec liveness_checked;
+
+/**
+ * Initialise the directory. Called once when the shared memory for the directory
+ * is first created (or directly on a directory allocated in process memory for
+ * testing).
+ *
+ * @param _directory - The directory to initialise.
+ */
+void
+cmsg_sl_shm_directory_init (void *_directory)
+{
+    memset (_directory, 0, sizeof (cmsg_sl_shm_directory));
+}
+
+/**
+ * Get the directory, attaching to (and creating if required) the shared memory
+ * for it. The mapping is never detached so after the first call this does not
+ * make any system calls.
+ *
+ * @returns A pointer to the directory on success, NULL otherwise.
+ */
+cmsg_sl_shm_directory *
+cmsg_sl_shm_directory_get (void)
+{
+    cmsg_sl_shm_directory *directory = __atomic_load_n (&attached, __ATOMIC_ACQUIRE);
+
+    if (directory)
+    {
+        return directory;
+    }
+
+    pthread_mutex_lock (&attach_mutex);
+
+    if (!attached)
+    {
+        directory = (cmsg_sl_shm_directory *) get_shared_memory (&shm_info);
+        if (!directory)
+        {
+            CMSG_LOG_GEN_ERROR ("Unable to attach to service listener shared memory.");
+        }
+        __atomic_store_n (&attached, directory, __ATOMIC_RELEASE);
+    }
+    directory = attached;
+
+    pthread_mutex_unlock (&attach_mutex);
+
+    return directory;
+}
+
+/**
+ * Get the directory for reading, attaching to the shared memory for it read-only.
+ * Unlike 'cmsg_sl_shm_directory_get' the shared memory is never created, so this
+ * fails until cmsg_sld has created it. Once attached the mapping is never detached
+ * so from then on this does not make any system calls.
+ *
+ * @returns A pointer to the directory on success, NULL otherwise.
+ */
+const cmsg_sl_shm_directory *
+cmsg_sl_shm_directory_attach (void)
+{
+    const cmsg_sl_shm_directory *directory = NULL;
+    void *addr;
+    int shm_id;
+
+    directory = __atomic_load_n (&attached_readonly, __ATOMIC_ACQUIRE);
+    if (directory)
+    {
+        return directory;
+    }
+
+    pthread_mutex_lock (&attach_mutex);
+
+    if (!attached_readonly)
+    {
+        shm_id = shmget (shm_info.shared_mem_key, shm_info.shared_data_size, 0);
+        if (shm_id >= 0)
+        {
+            addr = shmat (shm_id, NULL, SHM_RDONLY);
+            if (addr != (void *) -1)
+            {
+                __atomic_store_n (&attached_readonly, addr, __ATOMIC_RELEASE);
+            }
+        }
+    }
+    directory = attached_readonly;
+
+    pthread_mutex_unlock (&attach_mutex);
+
+    return directory;
+}
+
+/**
+ * Start changing the directory. Readers retry any lookup that overlaps a change.
+ *
+ * @param directory - The directory being changed.
+ */
+static void
+cmsg_sl_shm_write_begin (cmsg_sl_shm_directory *directory)
+{
+    __atomic_store_n (&directory->seq, directory->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+static void
+cmsg_sl_shm_write_end (cmsg_sl_shm_directory *directory)
+{
+    __atomic_store_n (&directory->seq, directory->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check whether the name of a service fits in the directory.
+ *
+ * @param service - The name of the service.
+ *
+ * @returns true if the servers for the service can be published, false otherwise.
+ */
+static bool
+cmsg_sl_shm_service_name_fits (const char *service)
+{
+    return strlen (service) < CMSG_SL_SHM_SERVICE_NAME_LEN;
+}
+
+/**
+ * Convert the information about a server to the form it is stored in the directory.
+ *
+ * @param service_info - The server to convert.
+ * @param server - The structure to store the converted server in.
+ *
+ * @returns true on success, false if the server cannot be stored in the directory.
+ */
+static bool
+cmsg_sl_shm_server_get (const cmsg_service_info *service_info, cmsg_sl_shm_server *server)
+{
+    cmsg_transport *transport = NULL;
+
+    transport = cmsg_transport_info_to_transport (service_info->server_info);
+    if (!transport)
+    {
+        return false;
+    }
+
+    /* Servers are compared as raw memory so clear any padding */
+    memset (server, 0, sizeof (*server));
+    server->type = transport->type;
+    server->socket = transport->config.socket;
+    cmsg_transport_destroy (transport);
+
+    return true;
+}
+
+/**
+ * Store a server in the first free slot for its service.
+ *
+ * @param directory - The directory to store the server in.
+ * @param service - The name of the service.
+ * @param hash - The hash of the service name.
+ * @param server - The server to store.
+ */
+static void
+cmsg_sl_shm_slot_insert (cmsg_sl_shm_directory *directory, const char *service,
+                         uint32_t hash, const cmsg_sl_shm_server *server)
+{
+    cmsg_sl_shm_slot *slot = NULL;
+    uint32_t i = hash & (CMSG_SL_SHM_NUM_SLOTS - 1);
+
+    while (directory->slots[i].state == CMSG_SL_SHM_SLOT_USED)
+    {
+        i = (i + 1) & (CMSG_SL_SHM_NUM_SLOTS - 1);
+    }
+
+    slot = &directory->slots[i];
+    if (slot->state == CMSG_SL_SHM_SLOT_DELETED)
+    {
+        directory->deleted--;
+    }
+
+    memset (slot->service, 0, sizeof (slot->service));
+    strcpy (slot->service, service);
+    slot->hash = hash;
+    slot->type = server->type;
+    slot->socket = server->socket;
+    slot->state = CMSG_SL_SHM_SLOT_USED;
+    directory->used++;
+}
+
+/**
+ * Rebuild the table without the slots of deleted servers so that the chains of
+ * slots searched by lookups stay short.
+ *
+ * Note - Assumes the directory is being changed.
+ *
+ * @param directory - The directory to rebuild.
+ */
+static void
+cmsg_sl_shm_rebuild (cmsg_sl_shm_directory *directory)
+{
+    cmsg_sl_shm_slot *slots = NULL;
+    cmsg_sl_shm_server server;
+    uint32_t num_slots = 0;
+    uint32_t i;
+
+    if (directory->used > 0)
+    {
+        slots = CMSG_CALLOC (directory->used, sizeof (cmsg_sl_shm_slot));
+        if (!slots)
+        {
+            return;
+        }
+    }
+
+    for (i = 0; i < CMSG_SL_SHM_NUM_SLOTS; i++)
+    {
+        if (directory->slots[i].state == CMSG_SL_SHM_SLOT_USED)
+        {
+            slots[num_slots++] = directory->slots[i];
+        }
+    }
+
+    memset (directory->slots, 0, sizeof (directory->slots));
+    directory->used = 0;
+    directory->deleted = 0;
+
+    for (i = 0; i < num_slots; i++)
+    {
+        memset (&server, 0, sizeof (server));
+        server.type = slots[i].type;
+        server.socket = slots[i].socket;
+        cmsg_sl_shm_slot_insert (directory, slots[i].service, slots[i].hash, &server);
+    }
+
+    CMSG_FREE (slots);
+}
+
+/**
+ * Start publishing the directory. Any servers left over from a previous
+ * instance of the daemon are removed.
+ *
+ * @param directory - The directory to publish.
+ */
+void
+cmsg_sl_shm_publish_start (cmsg_sl_shm_directory *directory)
+{
+    cmsg_sl_shm_write_begin (directory);
+
+    memset (directory->slots, 0, sizeof (directory->slots));
+    directory->used = 0;
+    directory->deleted = 0;
+    memset (directory->overflow, 0, sizeof (directory->overflow));
+    directory->pid = getpid ();
+    directory->generation++;
+    directory->valid = 1;
+
+    cmsg_sl_shm_write_end (directory);
+}
+
+/**
+ * Stop publishing the directory. Lookups fall back to querying the daemon.
+ *
+ * @param directory - The directory to stop publishing.
+ */
+void
+cmsg_sl_shm_publish_stop (cmsg_sl_shm_directory *directory)
+{
+    cmsg_sl_shm_write_begin (directory);
+    directory->valid = 0;
+    cmsg_sl_shm_write_end (directory);
+}
+
+/**
+ * Add a server to the directory. A server that does not fit is counted against
+ * the hash of its service name so that lookups for that service (and only the
+ * few others sharing the count) fall back to querying cmsg_sld.
+ *
+ * @param directory - The directory to add the server to.
+ * @param service_info - The server to add.
+ */
+void
+cmsg_sl_shm_server_add (cmsg_sl_shm_directory *directory,
+                        const cmsg_service_info *service_info)
+{
+    cmsg_sl_shm_server server;
+    uint32_t hash;
+
+    /* Lookups for the service never use the directory */
+    if (!cmsg_sl_shm_service_name_fits (service_info->service))
+    {
+        return;
+    }
+
+    hash = g_str_hash (service_info->service);
+
+    cmsg_sl_shm_write_begin (directory);
+
+    if (!cmsg_sl_shm_server_get (service_info, &server))
+    {
+        directory->overflow[CMSG_SL_SHM_OVERFLOW_BUCKET (hash)]++;
+        cmsg_sl_shm_write_end (directory);
+        return;
+    }
+
+    if (directory->used + directory->deleted >= CMSG_SL_SHM_MAX_USED)
+    {
+        cmsg_sl_shm_rebuild (directory);
+    }
+
+    if (directory->used >= CMSG_SL_SHM_MAX_USED)
+    {
+        directory->overflow[CMSG_SL_SHM_OVERFLOW_BUCKET (hash)]++;
+    }
+    else
+    {
+        cmsg_sl_shm_slot_insert (directory, service_info->service, hash, &server);
+    }
+
+    cmsg_sl_shm_write_end (directory);
+}
+
+/**
+ * Remove a server from the directory.
+ *
+ * @param directory - The directory to remove the server from.
+ * @param service_info - The server to remove.
+ */
+void
+cmsg_sl_shm_server_remove (cmsg_sl_shm_directory *directory,
+                           const cmsg_service_info *service_info)
+{
+    cmsg_sl_shm_slot *slot = NULL;
+    cmsg_sl_shm_server server;
+    uint32_t probes;
+    uint32_t hash;
+    uint32_t i;
+
+    if (!cmsg_sl_shm_service_name_fits (service_info->service))
+    {
+        return;
+    }
+
+    hash = g_str_hash (service_info->service);
+
+    cmsg_sl_shm_write_begin (directory);
+
+    if (cmsg_sl_shm_server_get (service_info, &server))
+    {
+        i = hash & (CMSG_SL_SHM_NUM_SLOTS - 1);
+
+        for (probes = 0; probes < CMSG_SL_SHM_NUM_SLOTS; probes++)
+        {
+            slot = &directory->slots[i];
+            if (slot->state == CMSG_SL_SHM_SLOT_EMPTY)
+            {
+                break;
+            }
+
+            if (slot->state == CMSG_SL_SHM_SLOT_USED && slot->hash == hash &&
+                strcmp (slot->service, service_info->service) == 0 &&
+                slot->type == server.type &&
+                memcmp (&slot->socket, &server.socket, sizeof (server.socket)) == 0)
+            {
+                slot->state = CMSG_SL_SHM_SLOT_DELETED;
+                directory->used--;
+                directory->deleted++;
+                cmsg_sl_shm_write_end (directory);
+                return;
+            }
+
+            i = (i + 1) & (CMSG_SL_SHM_NUM_SLOTS - 1);
+        }
+    }
+
+    /* The only servers removed that are not stored are those that did not fit */
+    if (directory->overflow[CMSG_SL_SHM_OVERFLOW_BUCKET (hash)] > 0)
+    {
+        directory->overflow[CMSG_SL_SHM_OVERFLOW_BUCKET (hash)]--;
+    }
+
+    cmsg_sl_shm_write_end (directory);
+}
+
+/**
+ * Check whether the process publishing the directory still exists. The result is
+ * remembered by the calling thread for a short time so that most lookups do not
+ * make a system call, but is checked again straight away if the directory has
+ * since been published by a new instance of the daemon.
+ *
+ * @param pid - The process publishing the directory.
+ * @param generation - The generation of the directory.
+ *
+ * @returns true if the publisher exists, false otherwise.
+ */
+static bool
+cmsg_sl_shm_publisher_alive (pid_t pid, uint32_t generation)
+{
+    struct timespec now;
+    int64_t elapsed_ms;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    elapsed_ms = (now.tv_sec - liveness_checked.tv_sec) * 1000;
+    elapsed_ms += (now.tv_nsec - liveness_checked.tv_nsec) / 1000000;
+
+    if (generation != liveness_generation ||
+        elapsed_ms >= CMSG_SL_SHM_LIVENESS_INTERVAL_MS)
+    {
+        liveness_alive = (kill (pid, 0) == 0 || errno == EPERM);
+        liveness_generation = generation;
+        liveness_checked = now;
+    }
+
+    return liveness_alive;
+}
+
+/**
+ * Copy the servers for a service out of the directory.
+ *
+ * @param directory - The directory to read.
+ * @param service_name - The service to copy the servers for.
+ * @param hash - The hash of the service name.
+ * @param servers - Array to append the servers to.
+ * @param pid - Pointer to store the process publishing the directory in.
+ * @param generation - Pointer to store the generation of the directory in.
+ *
+ * @returns false if the directory is not being published or is missing servers
+ *          that may be for the service, true otherwise.
+ */
+static bool
+cmsg_sl_shm_read (const cmsg_sl_shm_directory *directory, const char *service_name,
+                  uint32_t hash, GArray *servers, pid_t *pid, uint32_t *generation)
+{
+    const cmsg_sl_shm_slot *slot = NULL;
+    cmsg_sl_shm_server server;
+    uint32_t probes;
+    uint32_t i;
+
+    if (!directory->valid || directory->overflow[CMSG_SL_SHM_OVERFLOW_BUCKET (hash)])
+    {
+        return false;
+    }
+
+    *pid = directory->pid;
+    *generation = directory->generation;
+
+    i = hash & (CMSG_SL_SHM_NUM_SLOTS - 1);
+    for (probes = 0; probes < CMSG_SL_SHM_NUM_SLOTS; probes++)
+    {
+        slot = &directory->slots[i];
+        if (slot->state == CMSG_SL_SHM_SLOT_EMPTY)
+        {
+            break;
+        }
+
+        if (slot->state == CMSG_SL_SHM_SLOT_USED && slot->hash == hash &&
+            strncmp (slot->service, service_name, CMSG_SL_SHM_SERVICE_NAME_LEN) == 0)
+        {
+            server.type = slot->type;
+            server.socket = slot->socket;
+            g_array_append_val (servers, server);
+        }
+
+        i = (i + 1) & (CMSG_SL_SHM_NUM_SLOTS - 1);
+    }
+
+    return true;
+}
+
+/**
+ * Look up the servers for a service in the directory. The daemon is not contacted,
+ * and other than an occasional check that the daemon still exists no system calls
+ * are made.
+ *
+ * @param directory - The directory to read.
+ * @param service_name - The service to look up.
+ * @param transports - Pointer to store the GList of 'cmsg_transport' structures for
+ *                     the servers in. The list should be freed by the caller using
+ *                     'g_list_free_full (list, cmsg_transport_destroy)'.
+ *
+ * @returns true if the servers were read from the directory, false if the directory
+ *          could not be used and the daemon must be queried instead.
+ */
+bool
+cmsg_sl_shm_lookup (const cmsg_sl_shm_directory *directory, const char *service_name,
+                    GList **transports)
+{
+    cmsg_sl_shm_server *server = NULL;
+    cmsg_transport *transport = NULL;
+    GArray *servers = NULL;
+    uint32_t hash;
+    uint32_t retries;
+    uint32_t seq;
+    uint32_t generation = 0;
+    pid_t pid = 0;
+    bool read = false;
+    guint i;
+
+    *transports = NULL;
+
+    if (!cmsg_sl_shm_service_name_fits (service_name))
+    {
+        return false;
+    }
+    hash = g_str_hash (service_name);
+
+    servers = g_array_new (FALSE, FALSE, sizeof (cmsg_sl_shm_server));
+
+    for (retries = 0; retries < CMSG_SL_SHM_READ_RETRIES; retries++)
+    {
+        seq = __atomic_load_n (&directory->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            continue;
+        }
+
+        g_array_set_size (servers, 0);
+        read = cmsg_sl_shm_read (directory, service_name, hash, servers, &pid,
+                                 &generation);
+
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (__atomic_load_n (&directory->seq, __ATOMIC_RELAXED) == seq)
+        {
+            break;
+        }
+        read = false;
+    }
+
+    /* The daemon exited without stopping publishing the directory */
+    if (read && !cmsg_sl_shm_publisher_alive (pid, generation))
+    {
+        read = false;
+    }
+
+    if (read)
+    {
+        for (i = 0; i < servers->len; i++)
+        {
+            server = &g_array_index (servers, cmsg_sl_shm_server, i);
+            transport = cmsg_transport_new (server->type);
+            if (transport)
+            {
+                transport->config.socket = server->socket;
+                *transports = g_list_prepend (*transports, transport);
+            }
+        }
+    }
+
+    g_array_free (servers, TRUE);
+
+    return read;
+}
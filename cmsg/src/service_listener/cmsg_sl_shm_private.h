@@ -0,0 +1,77 @@
+/**
+ * cmsg_sl_shm_private.h
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#ifndef __CMSG_SL_SHM_PRIVATE_H_
+#define __CMSG_SL_SHM_PRIVATE_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <glib.h>
+#include "cmsg_types_auto.h"
+#include "transport/cmsg_transport_private.h"
+
+/* The number of servers the directory can hold. This must be a power of two. Once
+ * the directory is three quarters full any further servers are not published and
+ * lookups for their services fall back to querying cmsg_sld. */
+#define CMSG_SL_SHM_NUM_SLOTS 4096
+
+/* Services with longer names are not published, lookups for them always query
+ * cmsg_sld */
+#define CMSG_SL_SHM_SERVICE_NAME_LEN 128
+
+/* The servers that did not fit are counted by the hash of their service name, so
+ * only lookups for services sharing a count fall back to querying cmsg_sld. This
+ * must be a power of two. */
+#define CMSG_SL_SHM_OVERFLOW_BUCKETS 256
+#define CMSG_SL_SHM_OVERFLOW_BUCKET(hash) ((hash) & (CMSG_SL_SHM_OVERFLOW_BUCKETS - 1))
+
+typedef enum _cmsg_sl_shm_slot_state_e
+{
+    CMSG_SL_SHM_SLOT_EMPTY = 0,
+    CMSG_SL_SHM_SLOT_USED,
+    CMSG_SL_SHM_SLOT_DELETED,
+} cmsg_sl_shm_slot_state;
+
+typedef struct
+{
+    uint32_t state;
+    uint32_t hash;              /* Hash of the service name */
+    char service[CMSG_SL_SHM_SERVICE_NAME_LEN];
+    cmsg_transport_type type;
+    cmsg_socket socket;
+} cmsg_sl_shm_slot;
+
+/* A directory of the servers known to cmsg_sld, published by the daemon for other
+ * processes to read without contacting it. The servers are stored in an open
+ * addressed table keyed by service name. cmsg_sld is the only writer and makes the
+ * sequence number odd while changing the table, readers retry if the sequence number
+ * was odd or changed while they were reading. As 'valid' is left set if cmsg_sld
+ * exits without stopping, readers also check that the publishing process exists. */
+typedef struct
+{
+    uint32_t seq;
+    uint32_t valid;             /* Set while cmsg_sld is publishing the directory */
+    pid_t pid;                  /* The process publishing the directory */
+    uint32_t generation;        /* Incremented each time publishing starts */
+    uint32_t used;              /* Number of used slots */
+    uint32_t deleted;           /* Number of deleted slots */
+    uint32_t overflow[CMSG_SL_SHM_OVERFLOW_BUCKETS];    /* Servers that did not fit */
+    cmsg_sl_shm_slot slots[CMSG_SL_SHM_NUM_SLOTS];
+} cmsg_sl_shm_directory;
+
+void cmsg_sl_shm_directory_init (void *_directory);
+cmsg_sl_shm_directory *cmsg_sl_shm_directory_get (void);
+const cmsg_sl_shm_directory *cmsg_sl_shm_directory_attach (void);
+void cmsg_sl_shm_publish_start (cmsg_sl_shm_directory *directory);
+void cmsg_sl_shm_publish_stop (cmsg_sl_shm_directory *directory);
+void cmsg_sl_shm_server_add (cmsg_sl_shm_directory *directory,
+                             const cmsg_service_info *service_info);
+void cmsg_sl_shm_server_remove (cmsg_sl_shm_directory *directory,
+                                const cmsg_service_info *service_info);
+bool cmsg_sl_shm_lookup (const cmsg_sl_shm_directory *directory, const char *service_name,
+                         GList **transports);
+
+#endif /* __CMSG_SL_SHM_PRIVATE_H_ */
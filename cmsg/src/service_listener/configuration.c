@@ -88,6 +88,57 @@ cmsg_sld_configuration_impl_unlisten (const void *service,
     cmsg_sld_configuration_server_unlistenSend (service);
 }
 
+/**
+ * Convert a listener for a set of services to the listener for one of the services.
+ *
+ * @param recv_msg - The listener for the set of services.
+ * @param service - The service to get the listener for.
+ * @param info - The message to store the listener for the service in.
+ */
+static void
+listener_set_info_to_listener_info (const cmsg_sld_listener_set_info *recv_msg,
+                                    const char *service, cmsg_sld_listener_info *info)
+{
+    CMSG_SET_FIELD_PTR (info, service, (char *) service);
+    CMSG_SET_FIELD_PTR (info, transport_info, recv_msg->transport_info);
+    CMSG_SET_FIELD_VALUE (info, id, recv_msg->id);
+    CMSG_SET_FIELD_VALUE (info, pid, recv_msg->pid);
+}
+
+/**
+ * Tell the service listener daemon that a listener wishes to receive
+ * events about each service in a set of services.
+ */
+void
+cmsg_sld_configuration_impl_listen_set (const void *service,
+                                        const cmsg_sld_listener_set_info *recv_msg)
+{
+    data_add_listener_set (recv_msg);
+
+    cmsg_sld_configuration_server_listen_setSend (service);
+}
+
+/**
+ * Tell the service listener daemon that a listener no longer wishes to receive
+ * events about a set of services.
+ */
+void
+cmsg_sld_configuration_impl_unlisten_set (const void *service,
+                                          const cmsg_sld_listener_set_info *recv_msg)
+{
+    cmsg_sld_listener_info info = CMSG_SLD_LISTENER_INFO_INIT;
+    char *service_name = NULL;
+    int i;
+
+    CMSG_REPEATED_FOREACH (recv_msg, services, service_name, i)
+    {
+        listener_set_info_to_listener_info (recv_msg, service_name, &info);
+        data_remove_listener (&info);
+    }
+
+    cmsg_sld_configuration_server_unlisten_setSend (service);
+}
+
 /**
  * Tell the service listener daemon that a server implementing a specific service
  * is now running.
@@ -15,15 +15,37 @@
 #include "transport/cmsg_transport_private.h"
 #include "data.h"
 #include "process_watch.h"
+#include "cmsg_sl_shm_private.h"
 
-typedef struct _service_lookup_data
+typedef struct _pid_data_entry
 {
-    GList *list;
-    uint32_t addr;
-} service_lookup_data;
+    GHashTable *servers;
+    GHashTable *listeners;
+} pid_data_entry;
 
 GHashTable *hash_table = NULL;
 
+/* Secondary indexes so that the servers and listeners removed when a host leaves or a
+ * process exits can be found without walking every service. The index entries are
+ * sets of the 'cmsg_service_info' and 'listener_data' structures stored in the
+ * service entries of 'hash_table'. */
+GHashTable *addr_table = NULL;  /* IPv4 address -> set of TCP servers */
+GHashTable *pid_table = NULL;   /* PID -> 'pid_data_entry' of local servers/listeners */
+
+/* The notifications produced by a single operation are batched so that each listener
+ * and remote host is sent one message for all of the servers the operation changed.
+ * Removed servers are kept until the batch has been sent as the pending
+ * notifications refer to them. */
+static uint32_t batch_depth = 0;
+static GList *batch_listeners = NULL;   /* Listeners with notifications pending */
+static GList *batch_remote = NULL;      /* Servers pending sync to remote hosts */
+static bool batch_remote_added = false;
+static GList *batch_free_list = NULL;   /* Servers removed by the batch */
+
+/* The shared memory directory the servers are published to, NULL if the
+ * directory is not being published. */
+static cmsg_sl_shm_directory *directory = NULL;
+
 /**
  * Called for each entry in the servers list of a service entry.
  * Simply frees all memory used by the server entry.
@@ -48,7 +70,8 @@ service_entry_free_listeners (gpointer data)
 {
     listener_data *listener_info = (listener_data *) data;
 
-    cmsg_destroy_client_and_transport (listener_info->client);
+    listener_queue_service_remove (listener_info->queue, listener_info->service);
+    CMSG_FREE (listener_info->service);
     CMSG_FREE (listener_info);
 }
 
@@ -93,9 +116,226 @@ get_service_entry_or_create (const char *service, bool create)
     return entry;
 }
 
+/**
+ * Frees all memory used by the given PID index entry.
+ *
+ * @param data - The PID index entry to free.
+ */
+static void
+pid_data_entry_free (gpointer data)
+{
+    pid_data_entry *pid_entry = (pid_data_entry *) data;
+
+    g_hash_table_unref (pid_entry->servers);
+    g_hash_table_unref (pid_entry->listeners);
+    CMSG_FREE (pid_entry);
+}
+
+/**
+ * Gets the PID index entry for the given process or potentially creates one
+ * if it doesn't already exist.
+ *
+ * @param pid - The process ID.
+ * @param create - Whether to create an entry if one didn't already exist or not.
+ *
+ * @returns A pointer to the related 'pid_data_entry' structure.
+ */
+static pid_data_entry *
+get_pid_entry_or_create (uint32_t pid, bool create)
+{
+    pid_data_entry *pid_entry = NULL;
+
+    pid_entry = (pid_data_entry *) g_hash_table_lookup (pid_table, GUINT_TO_POINTER (pid));
+    if (!pid_entry && create)
+    {
+        pid_entry = CMSG_CALLOC (1, sizeof (pid_data_entry));
+        pid_entry->servers = g_hash_table_new (g_direct_hash, g_direct_equal);
+        pid_entry->listeners = g_hash_table_new (g_direct_hash, g_direct_equal);
+        g_hash_table_insert (pid_table, GUINT_TO_POINTER (pid), pid_entry);
+    }
+
+    return pid_entry;
+}
+
+/**
+ * Remove the PID index entry for the given process if it no longer
+ * has any servers or listeners.
+ *
+ * @param pid_entry - The PID index entry.
+ * @param pid - The process ID.
+ */
+static void
+pid_entry_remove_if_empty (pid_data_entry *pid_entry, uint32_t pid)
+{
+    if (g_hash_table_size (pid_entry->servers) == 0 &&
+        g_hash_table_size (pid_entry->listeners) == 0)
+    {
+        g_hash_table_remove (pid_table, GUINT_TO_POINTER (pid));
+    }
+}
+
+/**
+ * Get the IPv4 address of a server if it uses an IPv4 TCP transport.
+ *
+ * @param service_info - The server.
+ * @param addr - Pointer to store the address in.
+ *
+ * @returns true if the server has an IPv4 address, false otherwise.
+ */
+static bool
+server_addr_get (const cmsg_service_info *service_info, uint32_t *addr)
+{
+    const cmsg_transport_info *transport_info = service_info->server_info;
+    const cmsg_tcp_transport_info *tcp_info = NULL;
+
+    if (!transport_info || transport_info->type != CMSG_TRANSPORT_INFO_TYPE_TCP)
+    {
+        return false;
+    }
+
+    tcp_info = transport_info->tcp_info;
+    if (!tcp_info->ipv4 || tcp_info->addr.len != sizeof (*addr))
+    {
+        return false;
+    }
+
+    memcpy (addr, tcp_info->addr.data, sizeof (*addr));
+    return true;
+}
+
+/**
+ * Add a server to the address and PID indexes and the published directory.
+ *
+ * @param service_info - The server being stored.
+ */
+static void
+data_index_server (cmsg_service_info *service_info)
+{
+    GHashTable *servers = NULL;
+    pid_data_entry *pid_entry = NULL;
+    uint32_t addr;
+
+    if (server_addr_get (service_info, &addr))
+    {
+        servers = (GHashTable *) g_hash_table_lookup (addr_table, GUINT_TO_POINTER (addr));
+        if (!servers)
+        {
+            servers = g_hash_table_new (g_direct_hash, g_direct_equal);
+            g_hash_table_insert (addr_table, GUINT_TO_POINTER (addr), servers);
+        }
+        g_hash_table_add (servers, service_info);
+    }
+
+    if (service_info->local)
+    {
+        pid_entry = get_pid_entry_or_create (service_info->pid, true);
+        g_hash_table_add (pid_entry->servers, service_info);
+    }
+
+    if (directory)
+    {
+        cmsg_sl_shm_server_add (directory, service_info);
+    }
+}
+
+/**
+ * Remove a server from the address and PID indexes and the published directory.
+ *
+ * @param service_info - The server being removed.
+ */
+static void
+data_unindex_server (cmsg_service_info *service_info)
+{
+    GHashTable *servers = NULL;
+    pid_data_entry *pid_entry = NULL;
+    uint32_t addr;
+
+    if (server_addr_get (service_info, &addr))
+    {
+        servers = (GHashTable *) g_hash_table_lookup (addr_table, GUINT_TO_POINTER (addr));
+        if (servers)
+        {
+            g_hash_table_remove (servers, service_info);
+            if (g_hash_table_size (servers) == 0)
+            {
+                g_hash_table_remove (addr_table, GUINT_TO_POINTER (addr));
+            }
+        }
+    }
+
+    if (service_info->local)
+    {
+        pid_entry = get_pid_entry_or_create (service_info->pid, false);
+        if (pid_entry)
+        {
+            g_hash_table_remove (pid_entry->servers, service_info);
+            pid_entry_remove_if_empty (pid_entry, service_info->pid);
+        }
+    }
+
+    if (directory)
+    {
+        cmsg_sl_shm_server_remove (directory, service_info);
+    }
+}
+
+/**
+ * Remove a listener from its service entry and the PID index and free it.
+ *
+ * @param entry - The 'service_data_entry' the listener is stored in.
+ * @param listener_info - The listener to remove.
+ */
+static void
+data_listener_delete (service_data_entry *entry, listener_data *listener_info)
+{
+    pid_data_entry *pid_entry = NULL;
+
+    entry->listeners = g_list_remove (entry->listeners, listener_info);
+
+    if (listener_info->in_batch)
+    {
+        batch_listeners = g_list_remove (batch_listeners, listener_info);
+        g_list_free (listener_info->pending);
+    }
+
+    pid_entry = get_pid_entry_or_create (listener_info->pid, false);
+    if (pid_entry)
+    {
+        g_hash_table_remove (pid_entry->listeners, listener_info);
+        pid_entry_remove_if_empty (pid_entry, listener_info->pid);
+    }
+
+    service_entry_free_listeners (listener_info);
+}
+
+static void
+data_remove_service_data_entry_if_empty (service_data_entry *entry, const char *key)
+{
+    if (!entry->servers && !entry->listeners)
+    {
+        g_hash_table_remove (hash_table, key);
+    }
+}
+
+/**
+ * Queue the notifications pending for a listener to be sent as a single event.
+ *
+ * @param listener_info - The listener.
+ */
+static void
+listener_batch_send (listener_data *listener_info)
+{
+    listener_info->pending = g_list_reverse (listener_info->pending);
+    listener_queue_servers_changed (listener_info->queue, listener_info->pending,
+                                    listener_info->pending_added);
+    g_list_free (listener_info->pending);
+    listener_info->pending = NULL;
+}
+
 /**
  * Notify all listeners of a given service about a server that has been added
- * or removed for that service.
+ * or removed for that service. The notification is sent to each listener when
+ * the current batch ends.
  *
  * @param server_info - The information about the server that has been added/removed.
  * @param entry - The 'service_data_entry' containing the list of listeners.
@@ -106,45 +346,141 @@ notify_listeners (const cmsg_service_info *server_info, service_data_entry *entr
                   bool added)
 {
     GList *list = NULL;
-    cmsg_client *client = NULL;
-    GList *removal_list = NULL;
     listener_data *listener_info = NULL;
-    int ret;
-    cmsg_sld_server_event send_msg = CMSG_SLD_SERVER_EVENT_INIT;
 
     for (list = g_list_first (entry->listeners); list; list = g_list_next (list))
     {
         listener_info = (listener_data *) list->data;
-        client = listener_info->client;
 
-        CMSG_SET_FIELD_PTR (&send_msg, service_info, (void *) server_info);
-        CMSG_SET_FIELD_VALUE (&send_msg, id, listener_info->id);
+        /* Events of different types are sent in the order they occurred */
+        if (listener_info->pending && listener_info->pending_added != added)
+        {
+            listener_batch_send (listener_info);
+        }
 
-        if (added)
+        if (!listener_info->in_batch)
         {
-            ret = cmsg_sld_events_api_server_added (client, &send_msg);
+            listener_info->in_batch = true;
+            batch_listeners = g_list_prepend (batch_listeners, listener_info);
         }
-        else
+
+        listener_info->pending = g_list_prepend (listener_info->pending,
+                                                 (gpointer) server_info);
+        listener_info->pending_added = added;
+    }
+}
+
+/**
+ * Notify all remote hosts about a local server that has been added or removed.
+ * The notification is sent to the remote hosts when the current batch ends.
+ *
+ * @param server_info - The information about the server that has been added/removed.
+ * @param added - Whether the server has been added or removed.
+ */
+static void
+notify_remote_hosts (const cmsg_service_info *server_info, bool added)
+{
+    if (batch_remote && batch_remote_added != added)
+    {
+        batch_remote = g_list_reverse (batch_remote);
+        remote_sync_servers_changed (batch_remote, batch_remote_added);
+        g_list_free (batch_remote);
+        batch_remote = NULL;
+    }
+
+    batch_remote = g_list_prepend (batch_remote, (gpointer) server_info);
+    batch_remote_added = added;
+}
+
+/**
+ * Start a batch of changes. The listeners and remote hosts are notified about
+ * all of the servers added or removed before the matching 'data_batch_end'
+ * using a single message each. Batches may be nested.
+ */
+void
+data_batch_begin (void)
+{
+    batch_depth++;
+}
+
+/**
+ * End a batch of changes, sending the notifications for the servers that were
+ * added or removed during it.
+ */
+void
+data_batch_end (void)
+{
+    GList *list = NULL;
+    GList *removal_list = NULL;
+    listener_data *listener_info = NULL;
+    gpointer key;
+    gpointer value;
+
+    if (--batch_depth > 0)
+    {
+        return;
+    }
+
+    for (list = g_list_first (batch_listeners); list; list = g_list_next (list))
+    {
+        listener_info = (listener_data *) list->data;
+
+        if (listener_info->pending)
         {
-            ret = cmsg_sld_events_api_server_removed (client, &send_msg);
+            listener_batch_send (listener_info);
         }
+        listener_info->in_batch = false;
 
-        if (ret != CMSG_RET_OK)
+        if (listener_queue_failed (listener_info->queue))
         {
             removal_list = g_list_prepend (removal_list, listener_info);
         }
     }
+    g_list_free (batch_listeners);
+    batch_listeners = NULL;
 
-    /* Remove any clients that we failed to send events to */
+    if (batch_remote)
+    {
+        batch_remote = g_list_reverse (batch_remote);
+        remote_sync_servers_changed (batch_remote, batch_remote_added);
+        g_list_free (batch_remote);
+        batch_remote = NULL;
+    }
+
+    /* Remove any listeners that we failed to send events to */
     for (list = g_list_first (removal_list); list; list = g_list_next (list))
     {
         listener_info = (listener_data *) list->data;
 
-        entry->listeners = g_list_remove (entry->listeners, listener_info);
-        cmsg_destroy_client_and_transport (listener_info->client);
-        CMSG_FREE (listener_info);
+        if (g_hash_table_lookup_extended (hash_table, listener_info->service, &key, &value))
+        {
+            data_listener_delete ((service_data_entry *) value, listener_info);
+            data_remove_service_data_entry_if_empty ((service_data_entry *) value, key);
+        }
     }
     g_list_free (removal_list);
+
+    g_list_free_full (batch_free_list, service_entry_free_servers);
+    batch_free_list = NULL;
+}
+
+/**
+ * Remove a server from its service entry and the indexes and notify the listeners
+ * and remote hosts that it has gone. The server is freed when the batch ends.
+ *
+ * @param entry - The 'service_data_entry' the server is stored in.
+ * @param service_info - The server to remove.
+ */
+static void
+data_server_delete (service_data_entry *entry, cmsg_service_info *service_info)
+{
+    entry->servers = g_list_remove (entry->servers, service_info);
+    data_unindex_server (service_info);
+
+    notify_listeners (service_info, entry, false);
+    notify_remote_hosts (service_info, false);
+
+    batch_free_list = g_list_prepend (batch_free_list, service_info);
 }
 
 /**
@@ -162,6 +498,8 @@ data_add_server (cmsg_service_info *server_info, bool local)
 
     CMSG_SET_FIELD_VALUE (server_info, local, local);
 
+    data_batch_begin ();
+
     /* Remove the server in case it already exists. This should only
      * occur if the server was previously removed without notifying the
      * service listener daemon (i.e. process crash). This ensures listeners
@@ -170,14 +508,17 @@ data_add_server (cmsg_service_info *server_info, bool local)
 
     entry = get_service_entry_or_create (server_info->service, true);
     entry->servers = g_list_prepend (entry->servers, (gpointer) server_info);
+    data_index_server (server_info);
 
     notify_listeners (server_info, entry, true);
-    remote_sync_server_added (server_info);
+    notify_remote_hosts (server_info, true);
 
     if (local)
     {
         process_watch_add (server_info->pid);
     }
+
+    data_batch_end ();
 }
 
 /**
@@ -198,15 +539,6 @@ find_server (gconstpointer a, gconstpointer b)
     return (ret ? 0 : -1);
 }
 
-static void
-data_remove_service_data_entry_if_empty (service_data_entry *entry, const char *key)
-{
-    if (!entry->servers && !entry->listeners)
-    {
-        g_hash_table_remove (hash_table, key);
-    }
-}
-
 /**
  * Remove a server from the database of servers running for services.
  *
@@ -226,11 +558,8 @@ data_remove_server (const cmsg_service_info *server_info, bool local)
         list_entry = g_list_find_custom (entry->servers, server_info, find_server);
         if (list_entry)
         {
-            CMSG_FREE_RECV_MSG (list_entry->data);
-            entry->servers = g_list_delete_link (entry->servers, list_entry);
-
-            notify_listeners (server_info, entry, false);
-            remote_sync_server_removed (server_info);
+            data_batch_begin ();
+            data_server_delete (entry, (cmsg_service_info *) list_entry->data);
 
             if (local)
             {
@@ -238,141 +567,142 @@ data_remove_server (const cmsg_service_info *server_info, bool local)
             }
 
             data_remove_service_data_entry_if_empty (entry, server_info->service);
+            data_batch_end ();
         }
     }
 }
 
 /**
- * Helper function called for each entry in the hash table. Finds any
- * servers for a service that match an IP address and deletes them.
- *
- * @param key - The key from the hash table (service name)
- * @param value - The value associated with the key (service_data_entry structure)
- * @param user_data - The address to match against.
+ * Remove any servers from the hash table that match the given addressing information.
  *
- * @returns TRUE if the service data entry is now empty and should be removed from the
- *          hash table, FALSE otherwise.
+ * @param addr    - The IP address to match against.
  */
-static gboolean
-_delete_server_by_addr (gpointer key, gpointer value, gpointer user_data)
+void
+data_remove_servers_by_addr (struct in_addr addr)
 {
-    service_lookup_data *lookup_data = (service_lookup_data *) user_data;
-    service_data_entry *entry = (service_data_entry *) value;
+    GHashTable *servers = NULL;
+    GList *removal_list = NULL;
     GList *list = NULL;
     cmsg_service_info *service_info = NULL;
-    GList *removal_list = NULL;
+    gpointer key;
+    gpointer value;
 
-    for (list = g_list_first (entry->servers); list; list = g_list_next (list))
+    servers = (GHashTable *) g_hash_table_lookup (addr_table,
+                                                  GUINT_TO_POINTER (addr.s_addr));
+    if (!servers)
     {
-        service_info = (cmsg_service_info *) list->data;
+        return;
+    }
 
-        if (service_info->server_info->type == CMSG_TRANSPORT_INFO_TYPE_TCP)
-        {
-            cmsg_tcp_transport_info *info = service_info->server_info->tcp_info;
+    /* Removing the servers updates the index so work from a copy of them */
+    removal_list = g_hash_table_get_keys (servers);
 
-            if (info->ipv4 && !memcmp (info->addr.data, &lookup_data->addr, info->addr.len))
-            {
-                removal_list = g_list_append (removal_list, service_info);
-            }
-        }
-    }
+    data_batch_begin ();
 
     for (list = g_list_first (removal_list); list; list = g_list_next (list))
     {
         service_info = (cmsg_service_info *) list->data;
 
-        entry->servers = g_list_remove (entry->servers, service_info);
-        notify_listeners (service_info, entry, false);
-        remote_sync_server_removed (service_info);
-        CMSG_FREE_RECV_MSG (service_info);
+        if (g_hash_table_lookup_extended (hash_table, service_info->service, &key, &value))
+        {
+            data_server_delete ((service_data_entry *) value, service_info);
+            data_remove_service_data_entry_if_empty ((service_data_entry *) value, key);
+        }
     }
     g_list_free (removal_list);
 
-    if (entry->servers || entry->listeners)
-    {
-        return FALSE;
-    }
-
-    return TRUE;
+    data_batch_end ();
 }
 
 /**
- * Remove any servers from the hash table that match the given addressing information.
+ * Remove all entries associated with the given process id.
  *
- * @param addr    - The IP address to match against.
+ * @param pid - The process ID
  */
 void
-data_remove_servers_by_addr (struct in_addr addr)
+data_remove_by_pid (int pid)
 {
-    service_lookup_data lookup_data;
+    pid_data_entry *pid_entry = NULL;
+    GList *listeners = NULL;
+    GList *servers = NULL;
+    GList *list = NULL;
+    listener_data *listener_info = NULL;
+    cmsg_service_info *service_info = NULL;
+    gpointer key;
+    gpointer value;
 
-    lookup_data.list = NULL;
-    lookup_data.addr = addr.s_addr;
+    pid_entry = get_pid_entry_or_create (pid, false);
+    if (!pid_entry)
+    {
+        return;
+    }
 
-    g_hash_table_foreach_remove (hash_table, _delete_server_by_addr, &lookup_data);
-}
+    /* Removing the entries updates (and may free) the index entry so work
+     * from a copy of them */
+    listeners = g_hash_table_get_keys (pid_entry->listeners);
+    servers = g_hash_table_get_keys (pid_entry->servers);
 
-/**
- * Helper function called for each entry in the hash table. Finds any
- * servers and listeners that match a process ID and deletes them.
- *
- * @param key - The key from the hash table (service name)
- * @param value - The value associated with the key (service_data_entry structure)
- * @param user_data - The PID to match against.
- *
- * @returns TRUE if the service data entry is now empty and should be removed from the
- *          hash table, FALSE otherwise.
- */
-static gboolean
-remove_by_pid (gpointer key, gpointer value, gpointer user_data)
-{
-    uint32_t pid = GPOINTER_TO_UINT (user_data);
-    service_data_entry *entry = (service_data_entry *) value;
-    GList *l = NULL;
+    data_batch_begin ();
 
-    /* First iterate the listeners */
-    l = entry->listeners;
-    while (l != NULL)
+    /* Remove the listeners first so they aren't notified about the removal
+     * of servers in their own process */
+    for (list = g_list_first (listeners); list; list = g_list_next (list))
     {
-        GList *next = g_list_next (l);
-        listener_data *listener_info = (listener_data *) l->data;
-        if (listener_info->pid == pid)
+        listener_info = (listener_data *) list->data;
+
+        if (g_hash_table_lookup_extended (hash_table, listener_info->service, &key, &value))
         {
-            cmsg_destroy_client_and_transport (listener_info->client);
-            entry->listeners = g_list_delete_link (entry->listeners, l);
-            CMSG_FREE (listener_info);
+            data_listener_delete ((service_data_entry *) value, listener_info);
+            data_remove_service_data_entry_if_empty ((service_data_entry *) value, key);
         }
-        l = next;
     }
+    g_list_free (listeners);
 
-    /* Now iterate the servers */
-    l = entry->servers;
-    while (l != NULL)
+    for (list = g_list_first (servers); list; list = g_list_next (list))
     {
-        GList *next = g_list_next (l);
-        cmsg_service_info *service_info = (cmsg_service_info *) l->data;
-        if (service_info->local && service_info->pid == pid)
+        service_info = (cmsg_service_info *) list->data;
+
+        if (g_hash_table_lookup_extended (hash_table, service_info->service, &key, &value))
         {
-            notify_listeners (service_info, entry, false);
-            remote_sync_server_removed (service_info);
-            entry->servers = g_list_delete_link (entry->servers, l);
-            CMSG_FREE_RECV_MSG (service_info);
+            data_server_delete ((service_data_entry *) value, service_info);
+            data_remove_service_data_entry_if_empty ((service_data_entry *) value, key);
         }
-        l = next;
     }
+    g_list_free (servers);
 
-    return (entry->servers == NULL && entry->listeners == NULL);
+    data_batch_end ();
 }
 
 /**
- * Remove all entries associated with the given process id.
+ * Create a listener for a service and add it to the service entry and the PID index.
  *
- * @param pid - The process ID
+ * @param entry - The 'service_data_entry' of the service.
+ * @param service - The service the listener is listening for.
+ * @param id - The ID of the listener.
+ * @param pid - The PID of the process the listener is in.
+ * @param queue - The queue used to send events to the listener.
+ *
+ * @returns The listener.
  */
-void
-data_remove_by_pid (int pid)
+static listener_data *
+data_listener_create (service_data_entry *entry, const char *service, uint32_t id,
+                      uint32_t pid, listener_queue *queue)
 {
-    g_hash_table_foreach_remove (hash_table, remove_by_pid, GUINT_TO_POINTER (pid));
+    listener_data *listener_info = NULL;
+    pid_data_entry *pid_entry = NULL;
+
+    listener_info = CMSG_CALLOC (1, sizeof (listener_data));
+    listener_info->queue = queue;
+    listener_info->service = CMSG_STRDUP (service);
+    listener_info->id = id;
+    listener_info->pid = pid;
+
+    entry->listeners = g_list_prepend (entry->listeners, listener_info);
+    pid_entry = get_pid_entry_or_create (listener_info->pid, true);
+    g_hash_table_add (pid_entry->listeners, listener_info);
+    process_watch_add (listener_info->pid);
+
+    return listener_info;
 }
 
 /**
@@ -386,44 +716,122 @@ data_add_listener (const cmsg_sld_listener_info *info)
 {
     service_data_entry *entry = NULL;
     cmsg_transport *transport = NULL;
-    GList *list = NULL;
-    cmsg_service_info *server_info = NULL;
     cmsg_client *client = NULL;
     listener_data *listener_info = NULL;
-    cmsg_sld_server_event send_msg = CMSG_SLD_SERVER_EVENT_INIT;
+    listener_queue *queue = NULL;
 
     entry = get_service_entry_or_create (info->service, true);
     transport = cmsg_transport_info_to_transport (info->transport_info);
     client = cmsg_client_new (transport, CMSG_DESCRIPTOR (cmsg_sld, events));
 
-    listener_info = CMSG_CALLOC (1, sizeof (listener_data));
-    listener_info->client = client;
-    listener_info->id = info->id;
-    listener_info->pid = info->pid;
+    queue = listener_queue_new (client, info->service, info->id);
+    if (!queue)
+    {
+        data_remove_service_data_entry_if_empty (entry, info->service);
+        return;
+    }
 
-    entry->listeners = g_list_prepend (entry->listeners, listener_info);
-    process_watch_add (listener_info->pid);
+    listener_info = data_listener_create (entry, info->service, info->id, info->pid,
+                                          queue);
 
-    for (list = g_list_first (entry->servers); list; list = g_list_next (list))
+    /* Tell the listener about the existing servers in a single event */
+    if (!listener_queue_servers_changed (queue, entry->servers, true))
     {
-        server_info = (cmsg_service_info *) list->data;
+        process_watch_remove (listener_info->pid);
+        data_listener_delete (entry, listener_info);
+    }
+}
 
-        CMSG_SET_FIELD_PTR (&send_msg, service_info, server_info);
-        CMSG_SET_FIELD_VALUE (&send_msg, id, listener_info->id);
+/**
+ * Add a listener for each service of a set of services. The listeners share a
+ * single queue (and so a single connection) to the event server of the process.
+ *
+ * @param info - Information about the listener and the services
+ *               they are listening for.
+ */
+void
+data_add_listener_set (const cmsg_sld_listener_set_info *info)
+{
+    service_data_entry *entry = NULL;
+    cmsg_transport *transport = NULL;
+    cmsg_client *client = NULL;
+    listener_data *listener_info = NULL;
+    listener_queue *queue = NULL;
+    GHashTable *services = NULL;
+    GList *listeners = NULL;
+    GList *list = NULL;
+    gpointer key;
+    gpointer value;
+    char *service_name = NULL;
+    int i;
+
+    if (info->n_services == 0)
+    {
+        return;
+    }
+
+    transport = cmsg_transport_info_to_transport (info->transport_info);
+    client = cmsg_client_new (transport, CMSG_DESCRIPTOR (cmsg_sld, events));
+
+    queue = listener_queue_new (client, info->services[0], info->id);
+    if (!queue)
+    {
+        return;
+    }
+
+    services = g_hash_table_new (g_str_hash, g_str_equal);
+    CMSG_REPEATED_FOREACH (info, services, service_name, i)
+    {
+        if (g_hash_table_contains (services, service_name))
+        {
+            continue;
+        }
+        g_hash_table_add (services, service_name);
+
+        /* The queue was created for the first service */
+        if (i > 0)
+        {
+            listener_queue_service_add (queue, service_name);
+        }
+
+        entry = get_service_entry_or_create (service_name, true);
+        listener_info = data_listener_create (entry, service_name, info->id, info->pid,
+                                              queue);
+        listeners = g_list_prepend (listeners, listener_info);
+    }
+    g_hash_table_destroy (services);
+    listeners = g_list_reverse (listeners);
 
-        if (cmsg_sld_events_api_server_added (client, &send_msg) != CMSG_RET_OK)
+    /* Tell the listener about the existing servers of each service */
+    for (list = listeners; list; list = g_list_next (list))
+    {
+        listener_info = (listener_data *) list->data;
+        entry = get_service_entry_or_create (listener_info->service, false);
+        listener_queue_servers_changed (queue, entry->servers, true);
+    }
+
+    if (listener_queue_failed (queue))
+    {
+        for (list = listeners; list; list = g_list_next (list))
         {
-            entry->listeners = g_list_remove (entry->listeners, listener_info);
-            cmsg_destroy_client_and_transport (listener_info->client);
+            listener_info = (listener_data *) list->data;
             process_watch_remove (listener_info->pid);
-            CMSG_FREE (listener_info);
-            break;
+            if (g_hash_table_lookup_extended (hash_table, listener_info->service, &key,
+                                              &value))
+            {
+                data_listener_delete ((service_data_entry *) value, listener_info);
+                data_remove_service_data_entry_if_empty ((service_data_entry *) value,
+                                                         key);
+            }
         }
     }
+    g_list_free (listeners);
 }
 
 /**
- * Remove a listener for a service.
+ * Remove a listener for a service. A process can have several listeners for the
+ * same service (all using the same transport) so the listener is matched on both
+ * its ID and its transport.
  *
  * @param info - Information about the listener and the service
  *               they are unlistening from.
@@ -435,6 +843,7 @@ data_remove_listener (const cmsg_sld_listener_info *info)
     GList *list = NULL;
     cmsg_transport_info *transport_info = NULL;
     listener_data *listener_info = NULL;
+    const cmsg_client *client = NULL;
 
     entry = get_service_entry_or_create (info->service, false);
     if (!entry)
@@ -446,9 +855,11 @@ data_remove_listener (const cmsg_sld_listener_info *info)
     {
         listener_info = (listener_data *) list->data;
 
-        transport_info = cmsg_transport_info_create (listener_info->client->_transport);
+        client = listener_queue_client_get (listener_info->queue);
+        transport_info = cmsg_transport_info_create (client->_transport);
 
-        if (cmsg_transport_info_compare (info->transport_info, transport_info))
+        if (listener_info->id == info->id &&
+            cmsg_transport_info_compare (info->transport_info, transport_info))
         {
             cmsg_transport_info_free (transport_info);
             break;
@@ -459,48 +870,12 @@ data_remove_listener (const cmsg_sld_listener_info *info)
 
     if (listener_info)
     {
-        entry->listeners = g_list_remove (entry->listeners, listener_info);
-        cmsg_destroy_client_and_transport (listener_info->client);
         process_watch_remove (listener_info->pid);
-        CMSG_FREE (listener_info);
+        data_listener_delete (entry, listener_info);
         data_remove_service_data_entry_if_empty (entry, info->service);
     }
 }
 
-/**
- * Helper function called for each entry in the hash table. Finds any
- * servers for a service that match an IP address and stores them in a
- * GList.
- *
- * @param key - The key from the hash table (service name)
- * @param value - The value associated with the key (service_data_entry structure)
- * @param user_data - Pointer to a 'service_lookup_data' structure containing the
- *                    list to store the servers in and the address to match against.
- */
-static void
-_get_servers_by_addr (gpointer key, gpointer value, gpointer user_data)
-{
-    service_lookup_data *lookup_data = (service_lookup_data *) user_data;
-    service_data_entry *entry = (service_data_entry *) value;
-    GList *list = NULL;
-    cmsg_service_info *service_info = NULL;
-
-    for (list = g_list_first (entry->servers); list; list = g_list_next (list))
-    {
-        service_info = (cmsg_service_info *) list->data;
-
-        if (service_info->server_info->type == CMSG_TRANSPORT_INFO_TYPE_TCP)
-        {
-            cmsg_tcp_transport_info *info = service_info->server_info->tcp_info;
-
-            if (info->ipv4 && !memcmp (info->addr.data, &lookup_data->addr, info->addr.len))
-            {
-                lookup_data->list = g_list_prepend (lookup_data->list, service_info);
-            }
-        }
-    }
-}
-
 /**
  * Get a list of all servers for given addressing information.
  *
@@ -512,14 +887,15 @@ _get_servers_by_addr (gpointer key, gpointer value, gpointer user_data)
 GList *
 data_get_servers_by_addr (uint32_t addr)
 {
-    service_lookup_data lookup_data;
-
-    lookup_data.list = NULL;
-    lookup_data.addr = addr;
+    GHashTable *servers = NULL;
 
-    g_hash_table_foreach (hash_table, _get_servers_by_addr, &lookup_data);
+    servers = (GHashTable *) g_hash_table_lookup (addr_table, GUINT_TO_POINTER (addr));
+    if (!servers)
+    {
+        return NULL;
+    }
 
-    return lookup_data.list;
+    return g_hash_table_get_keys (servers);
 }
 
 /**
@@ -535,6 +911,56 @@ data_init (void)
         syslog (LOG_ERR, "Failed to initialize hash table");
         return;
     }
+
+    addr_table = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                        (GDestroyNotify) g_hash_table_unref);
+    pid_table = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                       pid_data_entry_free);
+}
+
+/**
+ * Start publishing the servers to the shared memory directory, so that other
+ * processes can look them up without contacting the daemon.
+ */
+void
+data_directory_init (void)
+{
+    service_data_entry *entry = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    GList *list = NULL;
+
+    directory = cmsg_sl_shm_directory_get ();
+    if (!directory)
+    {
+        syslog (LOG_ERR, "Failed to initialize server directory");
+        return;
+    }
+
+    cmsg_sl_shm_publish_start (directory);
+
+    g_hash_table_iter_init (&iter, hash_table);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        entry = (service_data_entry *) value;
+        for (list = g_list_first (entry->servers); list; list = g_list_next (list))
+        {
+            cmsg_sl_shm_server_add (directory, (cmsg_service_info *) list->data);
+        }
+    }
+}
+
+/**
+ * Stop publishing the servers to the shared memory directory.
+ */
+void
+data_directory_deinit (void)
+{
+    if (directory)
+    {
+        cmsg_sl_shm_publish_stop (directory);
+        directory = NULL;
+    }
 }
 
 /**
@@ -543,6 +969,18 @@ data_init (void)
 void
 data_deinit (void)
 {
+    if (addr_table)
+    {
+        g_hash_table_unref (addr_table);
+        addr_table = NULL;
+    }
+
+    if (pid_table)
+    {
+        g_hash_table_unref (pid_table);
+        pid_table = NULL;
+    }
+
     if (hash_table)
     {
         g_hash_table_remove_all (hash_table);
@@ -555,7 +993,7 @@ data_deinit (void)
  * Helper function called for each listener associated with a service. Prints the
  * information about each individual listener for a service.
  *
- * @param data - The client connected to the listener.
+ * @param data - The 'listener_data' structure for the listener.
  * @param user_data - The file to print to.
  */
 static void
@@ -563,11 +1001,13 @@ data_debug_listener_dump (gpointer data, gpointer user_data)
 {
     FILE *fp = (FILE *) user_data;
     const listener_data *listener_info = (const listener_data *) data;
-    const cmsg_client *client = listener_info->client;
+    const cmsg_client *client = listener_queue_client_get (listener_info->queue);
 
-    fprintf (fp, "   %s (ID: %u) (pid: %u)\n",
+    fprintf (fp, "   %s (ID: %u) (pid: %u) ",
              client->_transport->config.socket.sockaddr.un.sun_path, listener_info->id,
              listener_info->pid);
+    listener_queue_debug_dump (listener_info->queue, fp);
+    fprintf (fp, "\n");
 }
 
 /**
@@ -13,12 +13,17 @@
 #include <cmsg/cmsg_client.h>
 #include "cmsg_types_auto.h"
 #include "configuration_types_auto.h"
+#include "listener_queue.h"
 
 typedef struct _listener_data
 {
-    cmsg_client *client;
+    listener_queue *queue;
+    char *service;
     uint32_t id;
     uint32_t pid;
+    bool in_batch;
+    bool pending_added;
+    GList *pending;             /* Servers changed by the current batch */
 } listener_data;
 
 typedef struct _service_data_entry_s
@@ -29,13 +34,18 @@ typedef struct _service_data_entry_s
 
 void data_init (void);
 void data_deinit (void);
+void data_directory_init (void);
+void data_directory_deinit (void);
 void data_debug_dump (FILE *fp);
+void data_batch_begin (void);
+void data_batch_end (void);
 void data_add_server (cmsg_service_info *server_info, bool local);
 void data_remove_server (const cmsg_service_info *server_info, bool local);
 void data_remove_servers_by_addr (struct in_addr addr);
 GList *data_get_servers_by_addr (uint32_t addr);
 void data_remove_by_pid (int pid);
 void data_add_listener (const cmsg_sld_listener_info *info);
+void data_add_listener_set (const cmsg_sld_listener_set_info *info);
 void data_remove_listener (const cmsg_sld_listener_info *info);
 service_data_entry *get_service_entry_or_create (const char *service, bool create);
 
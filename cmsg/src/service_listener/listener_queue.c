@@ -0,0 +1,745 @@
+/**
+ * listener_queue.c
+ *
+ * Implements the non-blocking delivery of server events to the listeners registered
+ * with the daemon. Each listener has a bounded queue of packed events that is only
+ * written to the listener's socket while the socket is writable, so a listener that
+ * is slow to drain its events never blocks the daemon (or the events for any other
+ * listener). A listener that overflows its queue has the pending events dropped and
+ * is sent the full set of servers for the service once it has caught up instead.
+ * The same queues are used to send to the daemons on remote hosts, which supply
+ * their own resync function. Connecting never blocks the daemon either: the connect
+ * is completed once the socket becomes writable, and a queue that is set to reconnect
+ * retries a failed connection with an increasing delay rather than failing.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <cmsg/cmsg_private.h>
+#include "cmsg_client_private.h"
+#include "events_api_auto.h"
+#include "listener_queue.h"
+#include "data.h"
+
+/* The delay in milliseconds before the first and (at most) any later reconnect */
+#define LISTENER_QUEUE_RETRY_MIN_MS 100
+#define LISTENER_QUEUE_RETRY_MAX_MS 10000
+
+typedef struct
+{
+    uint8_t *packet;
+    uint32_t packet_len;
+} queued_event;
+
+struct _listener_queue_s
+{
+    cmsg_client *client;
+    GList *services;            /* The services of the listeners sharing the queue */
+    uint32_t refcount;          /* The number of listeners sharing the queue */
+    uint32_t id;
+    GQueue *queue;
+    uint32_t offset;            /* Bytes of the event at the head already written */
+    guint source;               /* Writability watch, 0 if not waiting to write */
+    guint retry_source;         /* Reconnect timer, 0 if not waiting to reconnect */
+    uint32_t retry_delay;       /* Milliseconds to wait before the next reconnect */
+    bool reconnect;             /* Reconnect rather than fail if the connection fails */
+    bool resync_pending;
+    bool failed;
+    uint32_t resyncs;
+    uint32_t reconnects;
+    listener_queue_resync_f resync_func;
+    void *resync_data;
+};
+
+/**
+ * Free all memory used by a queued event.
+ *
+ * @param data - The queued event to free.
+ */
+static void
+queued_event_free (gpointer data)
+{
+    queued_event *event = (queued_event *) data;
+
+    CMSG_FREE (event->packet);
+    CMSG_FREE (event);
+}
+
+/**
+ * Pack an event message and add it to the end of the queue.
+ *
+ * @param queue - The queue for the listener.
+ * @param method_name - The name of the events method to invoke on the listener.
+ * @param msg - The message to send.
+ */
+static void
+listener_queue_push (listener_queue *queue, const char *method_name,
+                     const ProtobufCMessage *msg)
+{
+    queued_event *event = NULL;
+
+    event = CMSG_CALLOC (1, sizeof (queued_event));
+    if (!event)
+    {
+        return;
+    }
+
+    if (cmsg_client_create_packet (queue->client, method_name, msg, &event->packet,
+                                   &event->packet_len) != CMSG_RET_OK)
+    {
+        CMSG_FREE (event);
+        return;
+    }
+
+    g_queue_push_tail (queue->queue, event);
+}
+
+/**
+ * Pack a message and add it to the end of the queue without sending it.
+ * This is for use by a resync function set with 'listener_queue_resync_func_set'.
+ *
+ * @param queue - The queue to add the message to.
+ * @param method_name - The name of the method to invoke on the receiver.
+ * @param msg - The message to send.
+ */
+void
+listener_queue_msg_push (listener_queue *queue, const char *method_name,
+                         const ProtobufCMessage *msg)
+{
+    listener_queue_push (queue, method_name, msg);
+}
+
+/**
+ * Get the name of the queue to use in logs, i.e. the first service the queue
+ * was created for.
+ *
+ * @param queue - The queue for the listener.
+ *
+ * @returns The name of the queue.
+ */
+static const char *
+listener_queue_name (const listener_queue *queue)
+{
+    return (const char *) queue->services->data;
+}
+
+/**
+ * Queue the full set of servers for a service the listener is listening to.
+ *
+ * @param queue - The queue for the listener.
+ * @param service - The service to queue the servers of.
+ */
+static void
+listener_queue_push_service_resync (listener_queue *queue, const char *service)
+{
+    cmsg_sld_server_resync_event send_msg = CMSG_SLD_SERVER_RESYNC_EVENT_INIT;
+    service_data_entry *entry = NULL;
+    GList *list = NULL;
+
+    entry = get_service_entry_or_create (service, false);
+    if (entry)
+    {
+        for (list = g_list_first (entry->servers); list; list = g_list_next (list))
+        {
+            CMSG_REPEATED_APPEND (&send_msg, service_info, list->data);
+        }
+    }
+    CMSG_SET_FIELD_VALUE (&send_msg, id, queue->id);
+    CMSG_SET_FIELD_PTR (&send_msg, service, (char *) service);
+
+    listener_queue_push (queue, "server_resync", (const ProtobufCMessage *) &send_msg);
+    CMSG_REPEATED_FREE (send_msg.service_info);
+}
+
+/**
+ * Queue the full set of servers for each service the listener is listening to.
+ * The set is read when the listener is ready to receive it so that it includes
+ * every change made while the listener was behind.
+ *
+ * @param queue - The queue for the listener.
+ */
+static void
+listener_queue_push_resync (listener_queue *queue)
+{
+    GList *list = NULL;
+
+    queue->resync_pending = false;
+
+    if (queue->resync_func)
+    {
+        queue->resync_func (queue, queue->resync_data);
+        return;
+    }
+
+    for (list = queue->services; list; list = g_list_next (list))
+    {
+        listener_queue_push_service_resync (queue, (const char *) list->data);
+    }
+}
+
+/**
+ * Drop the queued events. An event that has been partially written is kept so that
+ * the listener can still parse whatever is sent to it next.
+ *
+ * @param queue - The queue for the listener.
+ */
+static void
+listener_queue_drop_events (listener_queue *queue)
+{
+    queued_event *head = NULL;
+
+    if (queue->offset > 0)
+    {
+        head = (queued_event *) g_queue_pop_head (queue->queue);
+    }
+
+    g_queue_free_full (queue->queue, queued_event_free);
+    queue->queue = g_queue_new ();
+
+    if (head)
+    {
+        g_queue_push_head (queue->queue, head);
+    }
+}
+
+/**
+ * Stop sending to a listener that can no longer be written to. Any further events
+ * for the listener are discarded until it is removed.
+ *
+ * @param queue - The queue for the listener.
+ */
+static void
+listener_queue_fail (listener_queue *queue)
+{
+    queue->failed = true;
+    queue->resync_pending = false;
+    queue->offset = 0;
+    listener_queue_drop_events (queue);
+
+    if (queue->source)
+    {
+        g_source_remove (queue->source);
+        queue->source = 0;
+    }
+}
+
+static void listener_queue_send (listener_queue *queue);
+
+/**
+ * Called when it is time to try reconnecting to the receiver.
+ */
+static gboolean
+listener_queue_retry_timeout (gpointer data)
+{
+    listener_queue *queue = (listener_queue *) data;
+
+    queue->retry_source = 0;
+    listener_queue_send (queue);
+
+    return FALSE;
+}
+
+/**
+ * Handle the connection to the receiver failing. A queue that is set to reconnect
+ * drops the queued messages, closes the connection and tries to reconnect after a
+ * delay that doubles with each failure. The receiver is resynchronised once it has
+ * been reconnected. Any other queue fails.
+ *
+ * @param queue - The queue for the receiver.
+ */
+static void
+listener_queue_disconnected (listener_queue *queue)
+{
+    if (!queue->reconnect)
+    {
+        listener_queue_fail (queue);
+        return;
+    }
+
+    if (queue->source)
+    {
+        g_source_remove (queue->source);
+        queue->source = 0;
+    }
+
+    cmsg_client_close (queue->client);
+    queue->offset = 0;
+    listener_queue_drop_events (queue);
+    queue->resync_pending = true;
+
+    if (queue->retry_delay == 0)
+    {
+        syslog (LOG_ERR, "Lost connection to receiver for %s, reconnecting",
+                listener_queue_name (queue));
+        queue->retry_delay = LISTENER_QUEUE_RETRY_MIN_MS;
+    }
+    else
+    {
+        queue->retry_delay = MIN (queue->retry_delay * 2, LISTENER_QUEUE_RETRY_MAX_MS);
+    }
+
+    queue->reconnects++;
+    queue->retry_source = g_timeout_add (queue->retry_delay, listener_queue_retry_timeout,
+                                         queue);
+}
+
+/**
+ * Check whether the queue has stopped sending, either because it has failed
+ * or because it is waiting to reconnect.
+ *
+ * @param queue - The queue for the listener.
+ *
+ * @returns true if the queue is not sending, false otherwise.
+ */
+static bool
+listener_queue_stopped (const listener_queue *queue)
+{
+    return queue->failed || queue->retry_source;
+}
+
+/**
+ * Write as many of the queued events to the listener as its (connected) socket will
+ * accept without blocking.
+ *
+ * @param queue - The queue for the listener.
+ *
+ * @returns true if all of the queued events have been written, false otherwise.
+ */
+static bool
+listener_queue_flush (listener_queue *queue)
+{
+    queued_event *event = NULL;
+    ssize_t ret;
+    int sock;
+
+    sock = cmsg_client_get_socket (queue->client);
+
+    while (true)
+    {
+        event = (queued_event *) g_queue_peek_head (queue->queue);
+        if (!event)
+        {
+            if (!queue->resync_pending)
+            {
+                return true;
+            }
+            listener_queue_push_resync (queue);
+            continue;
+        }
+
+        ret = send (sock, event->packet + queue->offset, event->packet_len - queue->offset,
+                    MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                syslog (LOG_ERR, "Failed to send event to receiver for %s (%s)",
+                        listener_queue_name (queue), strerror (errno));
+                listener_queue_disconnected (queue);
+            }
+            return false;
+        }
+
+        queue->offset += ret;
+        if (queue->offset == event->packet_len)
+        {
+            g_queue_pop_head (queue->queue);
+            queued_event_free (event);
+            queue->offset = 0;
+        }
+    }
+}
+
+/**
+ * Called when the socket to the listener is writable (or has failed). Completes
+ * the connection if it is in progress and then writes the queued events until the
+ * socket would block again.
+ */
+static gboolean
+listener_queue_writable (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    listener_queue *queue = (listener_queue *) data;
+    guint watch = queue->source;
+    int32_t ret;
+
+    /* The watch is removed by returning FALSE rather than by failing the queue */
+    queue->source = 0;
+
+    /* A connection in progress reports its own failure */
+    ret = cmsg_client_connect_finish (queue->client);
+    if (ret == -EINPROGRESS)
+    {
+        queue->source = watch;
+        return TRUE;
+    }
+
+    if (ret < 0 || (condition & (G_IO_ERR | G_IO_HUP)))
+    {
+        listener_queue_disconnected (queue);
+        return FALSE;
+    }
+    queue->retry_delay = 0;
+
+    if (listener_queue_flush (queue) || listener_queue_stopped (queue))
+    {
+        return FALSE;
+    }
+
+    queue->source = watch;
+    return TRUE;
+}
+
+/**
+ * Write the queued events to the listener, connecting to the listener first if
+ * required. Waits for the socket to become writable if the connection is still in
+ * progress or the socket cannot accept all of the events now.
+ *
+ * @param queue - The queue for the listener.
+ */
+static void
+listener_queue_send (listener_queue *queue)
+{
+    GIOChannel *channel = NULL;
+    int32_t ret;
+
+    /* Already waiting for the socket to become writable or to reconnect */
+    if (queue->source || listener_queue_stopped (queue))
+    {
+        return;
+    }
+
+    ret = cmsg_client_connect_start (queue->client);
+    if (ret < 0 && ret != -EINPROGRESS)
+    {
+        listener_queue_disconnected (queue);
+        return;
+    }
+
+    if (ret == 0)
+    {
+        queue->retry_delay = 0;
+        if (listener_queue_flush (queue) || listener_queue_stopped (queue))
+        {
+            return;
+        }
+    }
+
+    channel = g_io_channel_unix_new (cmsg_client_get_socket (queue->client));
+    queue->source = g_io_add_watch (channel, G_IO_OUT, listener_queue_writable, queue);
+    g_io_channel_unref (channel);
+}
+
+/**
+ * Create the queue used to send server events to a listener.
+ *
+ * @param client - The client for the listener's event server. The queue takes
+ *                 ownership of the client.
+ * @param service - The service the listener is listening to.
+ * @param id - The ID of the listener.
+ *
+ * @returns A pointer to the queue on success, NULL otherwise.
+ */
+listener_queue *
+listener_queue_new (cmsg_client *client, const char *service, uint32_t id)
+{
+    listener_queue *queue = NULL;
+
+    queue = CMSG_CALLOC (1, sizeof (listener_queue));
+    if (!queue)
+    {
+        cmsg_destroy_client_and_transport (client);
+        return NULL;
+    }
+
+    queue->client = client;
+    queue->services = g_list_prepend (NULL, CMSG_STRDUP (service));
+    queue->refcount = 1;
+    queue->id = id;
+    queue->queue = g_queue_new ();
+
+    return queue;
+}
+
+/**
+ * Share the queue with the listener for another service. This lets a process that
+ * listens for a set of services receive the events for all of them over a single
+ * connection. The queue is destroyed once each service has been removed from it.
+ *
+ * @param queue - The queue to share.
+ * @param service - The service the other listener is listening to.
+ */
+void
+listener_queue_service_add (listener_queue *queue, const char *service)
+{
+    queue->services = g_list_append (queue->services, CMSG_STRDUP (service));
+    queue->refcount++;
+}
+
+/**
+ * Stop sharing the queue with the listener for a service, destroying the queue
+ * if no other listener shares it.
+ *
+ * @param queue - The queue.
+ * @param service - The service the listener is listening to.
+ */
+void
+listener_queue_service_remove (listener_queue *queue, const char *service)
+{
+    GList *list = NULL;
+
+    if (--queue->refcount == 0)
+    {
+        listener_queue_destroy (queue);
+        return;
+    }
+
+    list = g_list_find_custom (queue->services, service, (GCompareFunc) strcmp);
+    if (list)
+    {
+        CMSG_FREE (list->data);
+        queue->services = g_list_delete_link (queue->services, list);
+    }
+}
+
+/**
+ * Destroy the queue used to send server events to a listener. Any events that
+ * have not yet been sent are dropped.
+ *
+ * @param queue - The queue to destroy.
+ */
+void
+listener_queue_destroy (listener_queue *queue)
+{
+    if (queue->source)
+    {
+        g_source_remove (queue->source);
+    }
+    if (queue->retry_source)
+    {
+        g_source_remove (queue->retry_source);
+    }
+    g_queue_free_full (queue->queue, queued_event_free);
+    cmsg_destroy_client_and_transport (queue->client);
+    g_list_free_full (queue->services, cmsg_free);
+    CMSG_FREE (queue);
+}
+
+/**
+ * Check whether another event can be queued for the listener. If the listener
+ * already has the maximum number of events waiting then the waiting events are
+ * dropped and the listener is resynchronised once it catches up instead.
+ *
+ * @param queue - The queue for the listener.
+ *
+ * @returns true if the event should be queued, false if it should be dropped.
+ */
+static bool
+listener_queue_has_room (listener_queue *queue)
+{
+    /* The resync sent once the listener catches up includes any further changes */
+    if (queue->failed || queue->resync_pending)
+    {
+        return false;
+    }
+
+    if (g_queue_get_length (queue->queue) >= LISTENER_QUEUE_MAX_EVENTS)
+    {
+        syslog (LOG_ERR, "Receiver for %s is not keeping up with events, resyncing",
+                listener_queue_name (queue));
+        listener_queue_drop_events (queue);
+        queue->resync_pending = true;
+        queue->resyncs++;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Queue an event for a server that has been added or removed to be sent to the
+ * listener. If the listener already has the maximum number of events waiting
+ * then the waiting events are dropped and the listener is resynchronised instead.
+ *
+ * @param queue - The queue for the listener.
+ * @param server_info - The information about the server that has been added/removed.
+ * @param added - Whether the server has been added or removed.
+ *
+ * @returns true if the event will be delivered, false if the listener has failed
+ *          and should be removed.
+ */
+bool
+listener_queue_server_event (listener_queue *queue, const cmsg_service_info *server_info,
+                             bool added)
+{
+    cmsg_sld_server_event send_msg = CMSG_SLD_SERVER_EVENT_INIT;
+
+    if (!listener_queue_has_room (queue))
+    {
+        return !queue->failed;
+    }
+
+    CMSG_SET_FIELD_PTR (&send_msg, service_info, (void *) server_info);
+    CMSG_SET_FIELD_VALUE (&send_msg, id, queue->id);
+
+    listener_queue_push (queue, added ? "server_added" : "server_removed",
+                         (const ProtobufCMessage *) &send_msg);
+    listener_queue_send (queue);
+
+    return !queue->failed;
+}
+
+/**
+ * Queue a message to be sent on the queue. If the maximum number of messages are
+ * already waiting then the waiting messages are dropped and the receiver is
+ * resynchronised instead.
+ *
+ * @param queue - The queue to send on.
+ * @param method_name - The name of the method to invoke on the receiver.
+ * @param msg - The message to send.
+ *
+ * @returns true if the message will be delivered (or replaced by a resync), false
+ *          if sending on the queue has failed.
+ */
+bool
+listener_queue_msg_send (listener_queue *queue, const char *method_name,
+                         const ProtobufCMessage *msg)
+{
+    if (!listener_queue_has_room (queue))
+    {
+        return !queue->failed;
+    }
+
+    listener_queue_push (queue, method_name, msg);
+    listener_queue_send (queue);
+
+    return !queue->failed;
+}
+
+/**
+ * Queue a single event for a set of servers that have been added or removed to
+ * be sent to the listener. The event counts as one event towards the limit of
+ * events that can be waiting for the listener.
+ *
+ * @param queue - The queue for the listener.
+ * @param servers - GList of 'cmsg_service_info' for the servers added/removed.
+ * @param added - Whether the servers have been added or removed.
+ *
+ * @returns true if the event will be delivered, false if the listener has failed
+ *          and should be removed.
+ */
+bool
+listener_queue_servers_changed (listener_queue *queue, GList *servers, bool added)
+{
+    cmsg_sld_servers_changed_event send_msg = CMSG_SLD_SERVERS_CHANGED_EVENT_INIT;
+    GList *list = NULL;
+
+    if (!servers)
+    {
+        return !queue->failed;
+    }
+
+    if (!g_list_next (servers))
+    {
+        return listener_queue_server_event (queue, servers->data, added);
+    }
+
+    if (!listener_queue_has_room (queue))
+    {
+        return !queue->failed;
+    }
+
+    for (list = servers; list; list = g_list_next (list))
+    {
+        CMSG_REPEATED_APPEND (&send_msg, service_info, list->data);
+    }
+    CMSG_SET_FIELD_VALUE (&send_msg, added, added);
+    CMSG_SET_FIELD_VALUE (&send_msg, id, queue->id);
+
+    listener_queue_push (queue, "servers_changed", (const ProtobufCMessage *) &send_msg);
+    CMSG_REPEATED_FREE (send_msg.service_info);
+    listener_queue_send (queue);
+
+    return !queue->failed;
+}
+
+/**
+ * Set the function used to resynchronise the receiver once it has caught up after
+ * overflowing its queue, in place of sending the servers for the service. The function
+ * should queue the messages to send using 'listener_queue_msg_push'.
+ *
+ * @param queue - The queue to set the function for.
+ * @param func - The resync function.
+ * @param user_data - Data to pass to the resync function.
+ */
+void
+listener_queue_resync_func_set (listener_queue *queue, listener_queue_resync_f func,
+                                void *user_data)
+{
+    queue->resync_func = func;
+    queue->resync_data = user_data;
+}
+
+/**
+ * Set the queue to reconnect (with an increasing delay between attempts) if the
+ * connection to the receiver fails, rather than failing. The receiver is
+ * resynchronised once it has been reconnected.
+ *
+ * @param queue - The queue to set to reconnect.
+ */
+void
+listener_queue_reconnect_set (listener_queue *queue)
+{
+    queue->reconnect = true;
+}
+
+/**
+ * Check whether sending to the listener has failed.
+ *
+ * @param queue - The queue for the listener.
+ *
+ * @returns true if the listener has failed and should be removed, false otherwise.
+ */
+bool
+listener_queue_failed (const listener_queue *queue)
+{
+    return queue->failed;
+}
+
+/**
+ * Get the client connected to the listener's event server.
+ *
+ * @param queue - The queue for the listener.
+ *
+ * @returns The client.
+ */
+const cmsg_client *
+listener_queue_client_get (const listener_queue *queue)
+{
+    return queue->client;
+}
+
+/**
+ * Print the state of the queue for a listener.
+ *
+ * @param queue - The queue for the listener.
+ * @param fp - The file to print to.
+ */
+void
+listener_queue_debug_dump (const listener_queue *queue, FILE *fp)
+{
+    fprintf (fp, "(pending events: %u) (resyncs: %u)%s%s",
+             g_queue_get_length (queue->queue), queue->resyncs,
+             queue->resync_pending ? " (resync pending)" : "",
+             queue->failed ? " (failed)" : "");
+    if (queue->reconnect)
+    {
+        fprintf (fp, " (reconnects: %u)%s", queue->reconnects,
+                 queue->retry_source ? " (reconnecting)" : "");
+    }
+}
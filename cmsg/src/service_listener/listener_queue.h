@@ -0,0 +1,42 @@
+/**
+ * listener_queue.h
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#ifndef __LISTENER_QUEUE_H_
+#define __LISTENER_QUEUE_H_
+
+#include <stdio.h>
+#include <glib.h>
+#include <cmsg/cmsg_client.h>
+#include "cmsg_types_auto.h"
+
+/* The maximum number of events that can be waiting to be sent to a listener.
+ * A listener that falls this far behind has its pending events dropped and is
+ * sent the full set of servers for the service once it catches up instead. */
+#define LISTENER_QUEUE_MAX_EVENTS 512
+
+typedef struct _listener_queue_s listener_queue;
+
+typedef void (*listener_queue_resync_f) (listener_queue *queue, void *user_data);
+
+listener_queue *listener_queue_new (cmsg_client *client, const char *service, uint32_t id);
+void listener_queue_destroy (listener_queue *queue);
+void listener_queue_service_add (listener_queue *queue, const char *service);
+void listener_queue_service_remove (listener_queue *queue, const char *service);
+bool listener_queue_server_event (listener_queue *queue,
+                                  const cmsg_service_info *server_info, bool added);
+bool listener_queue_servers_changed (listener_queue *queue, GList *servers, bool added);
+bool listener_queue_msg_send (listener_queue *queue, const char *method_name,
+                              const ProtobufCMessage *msg);
+void listener_queue_msg_push (listener_queue *queue, const char *method_name,
+                              const ProtobufCMessage *msg);
+void listener_queue_resync_func_set (listener_queue *queue, listener_queue_resync_f func,
+                                     void *user_data);
+void listener_queue_reconnect_set (listener_queue *queue);
+bool listener_queue_failed (const listener_queue *queue);
+const cmsg_client *listener_queue_client_get (const listener_queue *queue);
+void listener_queue_debug_dump (const listener_queue *queue, FILE *fp);
+
+#endif /* __LISTENER_QUEUE_H_ */
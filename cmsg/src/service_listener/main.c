@@ -12,6 +12,7 @@
 #include <glib-unix.h>
 #include <healthcheck.h>
 #include "configuration.h"
+#include "query.h"
 #include "data.h"
 #include "remote_sync.h"
 #include "process_watch.h"
@@ -75,6 +76,7 @@ debug_handler (gpointer user_data)
 static gboolean
 shutdown_handler (gpointer user_data)
 {
+    data_directory_deinit ();
     g_main_loop_quit (user_data);
     g_main_loop_unref (user_data);
     exit (EXIT_SUCCESS);
@@ -126,7 +128,9 @@ main (int argc, char **argv)
     g_timeout_add_seconds (1, cmsg_sld_healthcheck_init, NULL);
 
     data_init ();
+    data_directory_init ();
     configuration_server_init ();
+    query_server_init ();
     process_watch_init ();
 
     /* Create run file */
@@ -11,6 +11,12 @@
 #include "data.h"
 #include "process_watch.h"
 
+/* Process exits are not processed as they occur but are collected for this long
+ * and then processed together. When a group of processes exit at once (e.g. a
+ * container stopping) the servers and listeners of all of them are removed in a
+ * single pass, and each listener receives a single notification. */
+#define PROCESS_WATCH_COALESCE_MS 50
+
 typedef struct _pidfd_watch_entry
 {
     int pid;
@@ -20,6 +26,8 @@ typedef struct _pidfd_watch_entry
 } pidfd_watch_entry;
 
 static GHashTable *hash_table = NULL;
+static GList *exited_pids = NULL;
+static guint exited_source = 0;
 
 /**
  * Currently glibc does not provide a wrapper for this system call.
@@ -40,6 +48,55 @@ pidfd_open (pid_t pid, unsigned int flags)
 #endif
 }
 
+/**
+ * Remove the servers and listeners of all of the processes that have exited
+ * since this was last called.
+ */
+static int
+process_exits_handle (gpointer data)
+{
+    GList *pids = g_list_reverse (exited_pids);
+    GList *list = NULL;
+    int pid;
+
+    exited_pids = NULL;
+    exited_source = 0;
+
+    data_batch_begin ();
+
+    for (list = g_list_first (pids); list; list = g_list_next (list))
+    {
+        pid = GPOINTER_TO_INT (list->data);
+
+        data_remove_by_pid (pid);
+        g_hash_table_remove (hash_table, &pid);
+    }
+
+    data_batch_end ();
+
+    g_list_free (pids);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Record that a process has exited. The exit is handled along with any other
+ * processes that exit shortly afterwards.
+ *
+ * @param pid - The process ID of the process that exited.
+ */
+static void
+process_exit_add (pid_t pid)
+{
+    exited_pids = g_list_prepend (exited_pids, GINT_TO_POINTER (pid));
+
+    if (!exited_source)
+    {
+        exited_source = g_timeout_add (PROCESS_WATCH_COALESCE_MS, process_exits_handle,
+                                       NULL);
+    }
+}
+
 /**
  * Callback function to read a pidfd (i.e. the process has exited).
  */
@@ -47,9 +104,16 @@ static int
 pidfd_read (GIOChannel *source, GIOCondition condition, gpointer data)
 {
     int pid = GPOINTER_TO_INT (data);
+    pidfd_watch_entry *entry = NULL;
 
-    data_remove_by_pid (pid);
-    g_hash_table_remove (hash_table, &pid);
+    /* The watch is removed by returning FALSE */
+    entry = (pidfd_watch_entry *) g_hash_table_lookup (hash_table, &pid);
+    if (entry)
+    {
+        entry->source = 0;
+    }
+
+    process_exit_add (pid);
 
     return FALSE;
 }
@@ -90,7 +154,7 @@ create_process_watch (pid_t pid)
         {
             /* The process with the given PID does not exist.
              * We assume it has crashed already. */
-            data_remove_by_pid (pid);
+            process_exit_add (pid);
         }
         else
         {
@@ -110,7 +174,10 @@ process_watch_entry_free (gpointer data)
     pidfd_watch_entry *entry = (pidfd_watch_entry *) data;
 
     close (entry->pidfd);
-    g_source_remove (entry->source);
+    if (entry->source)
+    {
+        g_source_remove (entry->source);
+    }
 
     CMSG_FREE (entry);
 }
@@ -183,6 +250,14 @@ process_watch_init (void)
 void
 process_watch_deinit (void)
 {
+    if (exited_source)
+    {
+        g_source_remove (exited_source);
+        exited_source = 0;
+    }
+    g_list_free (exited_pids);
+    exited_pids = NULL;
+
     if (hash_table)
     {
         g_hash_table_remove_all (hash_table);
@@ -0,0 +1,76 @@
+/**
+ * query.c
+ *
+ * Implements the APIs for querying the servers known to the service listener daemon.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <cmsg/cmsg_glib_helpers.h>
+#include "query_impl_auto.h"
+#include "query.h"
+#include "data.h"
+
+static cmsg_server *server = NULL;
+
+/**
+ * Look up the servers currently known for a service, optionally registering
+ * a listener for the service at the same time.
+ */
+void
+cmsg_sld_query_impl_lookup (const void *service, const cmsg_sld_lookup_request *recv_msg)
+{
+    cmsg_sld_lookup_reply send_msg = CMSG_SLD_LOOKUP_REPLY_INIT;
+    service_data_entry *entry = NULL;
+    GList *list = NULL;
+
+    if (recv_msg->listener)
+    {
+        data_add_listener (recv_msg->listener);
+    }
+
+    entry = get_service_entry_or_create (recv_msg->service, false);
+    if (entry)
+    {
+        for (list = g_list_first (entry->servers); list; list = g_list_next (list))
+        {
+            CMSG_REPEATED_APPEND (&send_msg, servers, list->data);
+        }
+    }
+
+    cmsg_sld_query_server_lookupSend (service, &send_msg);
+    CMSG_REPEATED_FREE (send_msg.servers);
+}
+
+/**
+ * Initialise the query functionality.
+ */
+void
+query_server_init (void)
+{
+    cmsg_transport *transport = NULL;
+
+    transport = cmsg_create_transport_unix (CMSG_DESCRIPTOR (cmsg_sld, query),
+                                            CMSG_TRANSPORT_RPC_UNIX);
+    if (transport == NULL)
+    {
+        syslog (LOG_ERR, "Failed to initialize query server");
+        return;
+    }
+
+    /* Use 'cmsg_server_create' directly, rather than 'cmsg_server_new' to avoid
+     * calling the function for sending the service information to the service listener
+     * daemon which would deadlock. */
+    server = cmsg_server_create (transport, CMSG_SERVICE (cmsg_sld, query));
+    if (!server)
+    {
+        syslog (LOG_ERR, "Failed to initialize query server");
+        return;
+    }
+
+    if (cmsg_glib_server_init (server) != CMSG_RET_OK)
+    {
+        syslog (LOG_ERR, "Failed to initialize query server");
+        cmsg_destroy_server_and_transport (server);
+    }
+}
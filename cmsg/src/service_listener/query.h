@@ -0,0 +1,12 @@
+/**
+ * query.h
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#ifndef __QUERY_H_
+#define __QUERY_H_
+
+void query_server_init (void);
+
+#endif /* __QUERY_H_ */
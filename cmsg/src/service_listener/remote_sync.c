@@ -8,20 +8,273 @@
  */
 
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <cmsg/cmsg_glib_helpers.h>
-#include <cmsg/cmsg_composite_client.h>
 #include "remote_sync_api_auto.h"
 #include "remote_sync_impl_auto.h"
 #include "remote_sync.h"
 #include "data.h"
+#include "listener_queue.h"
 #include "transport/cmsg_transport_private.h"
 
+/* The maximum number of changes kept in the change log. A remote host that has
+ * missed more changes than this is sent a bulk sync. */
+#define REMOTE_SYNC_CHANGE_LOG_SIZE 1024
+
+typedef struct
+{
+    uint32_t seq;
+    bool added;
+    GList *servers;             /* Copies of the 'cmsg_service_info' messages */
+} remote_sync_change;
+
+typedef struct
+{
+    uint32_t addr;
+    listener_queue *queue;      /* NULL while the host is not configured */
+
+    /* The state of the servers received from the remote host */
+    uint32_t remote_epoch;
+    uint32_t remote_seq;
+    bool synced;
+    bool request_sent;
+    GList *cached;              /* Servers retained while the host is unavailable */
+
+    /* A sync request from the remote host that could not be answered yet */
+    bool request_pending;
+    uint32_t pending_epoch;
+    uint32_t pending_seq;
+
+    /* The remote host only supports the original bulk sync and unsequenced changes */
+    bool legacy;
+    bool legacy_sync_pending;
+} remote_sync_peer;
+
 cmsg_server *remote_sync_server = NULL;
 uint32_t local_ip_addr = 0;
-cmsg_client *comp_client = NULL;
+uint32_t remote_sync_epoch = 0;
+uint32_t remote_sync_seq = 0;
+GQueue *remote_sync_change_log = NULL;
+GHashTable *remote_sync_peers = NULL;
+
+/**
+ * Free a list of copied 'cmsg_service_info' messages.
+ *
+ * @param servers - The list to free.
+ */
+static void
+remote_sync_servers_free (GList *servers)
+{
+    GList *list = NULL;
+
+    for (list = servers; list; list = g_list_next (list))
+    {
+        CMSG_FREE_RECV_MSG (list->data);
+    }
+    g_list_free (servers);
+}
+
+/**
+ * Free a change in the change log.
+ *
+ * @param data - The change to free.
+ */
+static void
+remote_sync_change_free (gpointer data)
+{
+    remote_sync_change *change = (remote_sync_change *) data;
+
+    remote_sync_servers_free (change->servers);
+    CMSG_FREE (change);
+}
+
+/**
+ * Free the sync state for a remote host.
+ *
+ * @param data - The sync state to free.
+ */
+static void
+remote_sync_peer_free (gpointer data)
+{
+    remote_sync_peer *peer = (remote_sync_peer *) data;
+
+    if (peer->queue)
+    {
+        listener_queue_destroy (peer->queue);
+    }
+    remote_sync_servers_free (peer->cached);
+    CMSG_FREE (peer);
+}
+
+/**
+ * Get the sync state for the remote host with the given address or
+ * potentially create it if it doesn't already exist.
+ *
+ * @param addr - The address of the remote host.
+ * @param create - Whether to create the state if it didn't already exist or not.
+ *
+ * @returns A pointer to the sync state for the remote host.
+ */
+static remote_sync_peer *
+remote_sync_peer_get (uint32_t addr, bool create)
+{
+    remote_sync_peer *peer = NULL;
+
+    if (!remote_sync_peers)
+    {
+        remote_sync_peers = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                                   remote_sync_peer_free);
+    }
+
+    peer = (remote_sync_peer *) g_hash_table_lookup (remote_sync_peers,
+                                                     GUINT_TO_POINTER (addr));
+    if (!peer && create)
+    {
+        peer = CMSG_CALLOC (1, sizeof (remote_sync_peer));
+        peer->addr = addr;
+        g_hash_table_insert (remote_sync_peers, GUINT_TO_POINTER (addr), peer);
+    }
+
+    return peer;
+}
+
+/**
+ * Ask a remote host for the changes to its servers since the last change that
+ * was applied from it.
+ *
+ * @param peer - The sync state for the remote host.
+ * @param send - Whether to start sending the queue or only add the message to it.
+ */
+static void
+remote_sync_request_sync_queue (remote_sync_peer *peer, bool send)
+{
+    cmsg_sld_sync_request send_msg = CMSG_SLD_SYNC_REQUEST_INIT;
+
+    if (!peer->queue)
+    {
+        return;
+    }
+
+    CMSG_SET_FIELD_VALUE (&send_msg, addr, local_ip_addr);
+    CMSG_SET_FIELD_VALUE (&send_msg, epoch, peer->remote_epoch);
+    CMSG_SET_FIELD_VALUE (&send_msg, seq, peer->remote_seq);
+
+    peer->request_sent = true;
+    if (send)
+    {
+        listener_queue_msg_send (peer->queue, "sync_request",
+                                 (const ProtobufCMessage *) &send_msg);
+    }
+    else
+    {
+        listener_queue_msg_push (peer->queue, "sync_request",
+                                 (const ProtobufCMessage *) &send_msg);
+    }
+}
+
+/**
+ * Ask a remote host for the changes to its servers since the last change that
+ * was applied from it.
+ *
+ * @param peer - The sync state for the remote host.
+ */
+static void
+remote_sync_request_sync (remote_sync_peer *peer)
+{
+    remote_sync_request_sync_queue (peer, true);
+}
+
+/**
+ * Add (and take ownership of) the servers retained from a remote host while
+ * it was unavailable.
+ *
+ * @param peer - The sync state for the remote host.
+ */
+static void
+remote_sync_apply_cached (remote_sync_peer *peer)
+{
+    GList *list = NULL;
+
+    for (list = peer->cached; list; list = g_list_next (list))
+    {
+        data_add_server ((cmsg_service_info *) list->data, false);
+    }
+    g_list_free (peer->cached);
+    peer->cached = NULL;
+}
+
+/**
+ * Apply a set of servers that have been added or removed on a remote host.
+ * Added servers are taken from the message so that they are not freed with it.
+ *
+ * @param recv_data - The message containing the servers.
+ */
+static void
+remote_sync_apply_servers_changed (cmsg_sld_servers_changed_data *recv_data)
+{
+    int index = 0;
+    cmsg_service_info *info = NULL;
+
+    for (index = 0; index < recv_data->n_data; index++)
+    {
+        info = recv_data->data[index];
+
+        /* Ensure we only change remote TCP servers */
+        if (info->server_info->type != CMSG_TRANSPORT_INFO_TYPE_TCP)
+        {
+            continue;
+        }
+
+        if (recv_data->added)
+        {
+            data_add_server (info, false);
+            /* Set to NULL so that the memory is not freed */
+            recv_data->data[index] = NULL;
+        }
+        else
+        {
+            data_remove_server (info, false);
+        }
+    }
+}
+
+/**
+ * Get the address of the remote host that sent the message being processed.
+ *
+ * @param service - The service the message was received on.
+ *
+ * @returns The IPv4 address of the remote host, or zero if it is not known.
+ */
+static uint32_t
+remote_sync_sender_addr_get (const void *service)
+{
+    const cmsg_server_closure_info *closure_info = service;
+    const cmsg_server_closure_data *closure_data = NULL;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof (addr);
+
+    if (!closure_info)
+    {
+        return 0;
+    }
+
+    closure_data = closure_info->closure_data;
+    if (getpeername (closure_data->reply_socket, (struct sockaddr *) &addr, &len) < 0 ||
+        addr.sin_family != AF_INET)
+    {
+        return 0;
+    }
+
+    return addr.sin_addr.s_addr;
+}
+
+static void remote_sync_bulk_sync_services (listener_queue *queue, bool send);
 
 /**
  * Tell the service listener daemon about all servers running on a remote host.
+ * Any servers previously received from the remote host are replaced. A remote host
+ * running an older software version sends this (without its address) whenever it
+ * adds this host, so it is sent all of the local servers in return.
  */
 void
 cmsg_sld_remote_sync_impl_bulk_sync (const void *service,
@@ -30,11 +283,54 @@ cmsg_sld_remote_sync_impl_bulk_sync (const void *service,
     int index = 0;
     cmsg_service_info *info = NULL;
     cmsg_sld_bulk_sync_data *recv_data = NULL;
+    remote_sync_peer *peer = NULL;
+    struct in_addr addr;
 
     /* Cast away the const so that we can modify the message to keep
      * some internal memory */
     recv_data = (cmsg_sld_bulk_sync_data *) recv_msg;
 
+    data_batch_begin ();
+
+    /* Stack members running older software versions do not send their address */
+    if (recv_data->addr)
+    {
+        peer = remote_sync_peer_get (recv_data->addr, true);
+        remote_sync_servers_free (peer->cached);
+        peer->cached = NULL;
+
+        addr.s_addr = recv_data->addr;
+        data_remove_servers_by_addr (addr);
+
+        peer->remote_epoch = recv_data->epoch;
+        peer->remote_seq = recv_data->seq;
+        peer->synced = true;
+        peer->request_sent = false;
+        peer->legacy = false;
+    }
+    else
+    {
+        addr.s_addr = remote_sync_sender_addr_get (service);
+        if (addr.s_addr)
+        {
+            peer = remote_sync_peer_get (addr.s_addr, true);
+            remote_sync_servers_free (peer->cached);
+            peer->cached = NULL;
+            data_remove_servers_by_addr (addr);
+
+            peer->legacy = true;
+            if (peer->queue)
+            {
+                remote_sync_bulk_sync_services (peer->queue, true);
+            }
+            else
+            {
+                /* Sync once the remote host is added */
+                peer->legacy_sync_pending = true;
+            }
+        }
+    }
+
     for (index = 0; index < recv_data->n_data; index++)
     {
         info = recv_data->data[index];
@@ -49,11 +345,119 @@ cmsg_sld_remote_sync_impl_bulk_sync (const void *service,
         }
     }
 
+    data_batch_end ();
+
     cmsg_sld_remote_sync_server_bulk_syncSend (service);
 }
 
+/**
+ * Tell the service listener daemon about the changes to the servers on a remote
+ * host since the last change applied from that host.
+ */
+void
+cmsg_sld_remote_sync_impl_delta_sync (const void *service,
+                                      const cmsg_sld_delta_sync_data *recv_msg)
+{
+    int i;
+    cmsg_sld_servers_changed_data *change = NULL;
+    remote_sync_peer *peer = NULL;
+
+    peer = remote_sync_peer_get (recv_msg->addr, true);
+    peer->legacy = false;
+
+    if (recv_msg->epoch != peer->remote_epoch || recv_msg->from_seq > peer->remote_seq)
+    {
+        /* The delta does not follow on from the state we hold. */
+        peer->synced = false;
+        remote_sync_request_sync (peer);
+        cmsg_sld_remote_sync_server_delta_syncSend (service);
+        return;
+    }
+
+    data_batch_begin ();
+
+    remote_sync_apply_cached (peer);
+
+    CMSG_REPEATED_FOREACH (recv_msg, changes, change, i)
+    {
+        if (change->seq > peer->remote_seq)
+        {
+            remote_sync_apply_servers_changed (change);
+        }
+    }
+
+    data_batch_end ();
+
+    peer->remote_seq = recv_msg->seq;
+    peer->synced = true;
+    peer->request_sent = false;
+
+    cmsg_sld_remote_sync_server_delta_syncSend (service);
+}
+
+/**
+ * Tell the service listener daemon that a set of servers on a remote host
+ * have started or are no longer running. If the change does not directly follow
+ * the last change applied from the host then the host is asked for the changes
+ * that have been missed.
+ */
+void
+cmsg_sld_remote_sync_impl_servers_changed (const void *service,
+                                           const cmsg_sld_servers_changed_data *recv_msg)
+{
+    cmsg_sld_servers_changed_data *recv_data = NULL;
+    remote_sync_peer *peer = NULL;
+
+    /* Cast away the const so that we can modify the message to keep
+     * some internal memory */
+    recv_data = (cmsg_sld_servers_changed_data *) recv_msg;
+
+    /* Stack members running older software versions do not send their address */
+    if (!recv_data->addr)
+    {
+        data_batch_begin ();
+        remote_sync_apply_servers_changed (recv_data);
+        data_batch_end ();
+        cmsg_sld_remote_sync_server_servers_changedSend (service);
+        return;
+    }
+
+    peer = remote_sync_peer_get (recv_data->addr, true);
+    peer->legacy = false;
+
+    if (peer->synced && recv_data->epoch == peer->remote_epoch)
+    {
+        if (recv_data->seq == peer->remote_seq + 1)
+        {
+            data_batch_begin ();
+            remote_sync_apply_servers_changed (recv_data);
+            data_batch_end ();
+            peer->remote_seq = recv_data->seq;
+            cmsg_sld_remote_sync_server_servers_changedSend (service);
+            return;
+        }
+
+        if (recv_data->seq <= peer->remote_seq)
+        {
+            /* Already applied */
+            cmsg_sld_remote_sync_server_servers_changedSend (service);
+            return;
+        }
+    }
+
+    /* Any change received while waiting for a sync is included in the sync. */
+    if (!peer->request_sent)
+    {
+        peer->synced = false;
+        remote_sync_request_sync (peer);
+    }
+
+    cmsg_sld_remote_sync_server_servers_changedSend (service);
+}
+
 /**
  * Tell the service listener daemon that a server on a remote host has started.
+ * This is only sent by stack members running older software versions.
  */
 void
 cmsg_sld_remote_sync_impl_add_server (const void *service,
@@ -73,7 +477,8 @@ cmsg_sld_remote_sync_impl_add_server (const void *service,
 
 /**
  * Tell the service listener daemon that a server running on a remote host
- * is no longer running.
+ * is no longer running. This is only sent by stack members running older
+ * software versions.
  */
 void
 cmsg_sld_remote_sync_impl_remove_server (const void *service,
@@ -90,26 +495,18 @@ cmsg_sld_remote_sync_impl_remove_server (const void *service,
 }
 
 /**
- * Helper function to notify remote hosts when a server is added or removed.
+ * Check whether a server should be synced to remote hosts.
  *
  * @param server_info - The 'cmsg_service_info' message describing the server.
- * @param added - Whether the server has been added or removed.
  *
- * @returns true if we sent the server information to the remote hosts,
- *          false otherwise.
+ * @returns true if the server should be synced, false otherwise.
  */
 static bool
-remote_sync_server_added_removed (const cmsg_service_info *server_info, bool added)
+remote_sync_server_syncable (const cmsg_service_info *server_info)
 {
     uint32_t addr;
     cmsg_transport_info *transport_info = server_info->server_info;
 
-    /* Don't sync if the composite client is not created, i.e. no remote hosts yet */
-    if (!comp_client)
-    {
-        return false;
-    }
-
     /* Don't sync if the servers transport type is not supported */
     if (transport_info->type != CMSG_TRANSPORT_INFO_TYPE_TCP)
     {
@@ -134,13 +531,129 @@ remote_sync_server_added_removed (const cmsg_service_info *server_info, bool add
         }
     }
 
-    if (added)
+    return true;
+}
+
+/**
+ * Fill a 'cmsg_sld_servers_changed_data' message with a change from the change log.
+ * The repeated field of the message must be freed by the caller.
+ *
+ * @param send_msg - The message to fill.
+ * @param change - The change to fill the message with.
+ */
+static void
+remote_sync_servers_changed_msg_fill (cmsg_sld_servers_changed_data *send_msg,
+                                      const remote_sync_change *change)
+{
+    GList *list = NULL;
+
+    for (list = change->servers; list; list = g_list_next (list))
     {
-        cmsg_sld_remote_sync_api_add_server (comp_client, server_info);
+        CMSG_REPEATED_APPEND (send_msg, data, list->data);
     }
-    else
+    CMSG_SET_FIELD_VALUE (send_msg, added, change->added);
+    CMSG_SET_FIELD_VALUE (send_msg, addr, local_ip_addr);
+    CMSG_SET_FIELD_VALUE (send_msg, epoch, remote_sync_epoch);
+    CMSG_SET_FIELD_VALUE (send_msg, seq, change->seq);
+}
+
+/**
+ * Queue a change to the local servers for a remote host running an older software
+ * version, which only supports a message for each server added or removed.
+ *
+ * @param peer - The sync state for the remote host.
+ * @param change - The change to send.
+ */
+static void
+remote_sync_legacy_change_send (remote_sync_peer *peer, const remote_sync_change *change)
+{
+    const char *method_name = change->added ? "add_server" : "remove_server";
+    GList *list = NULL;
+
+    for (list = change->servers; list; list = g_list_next (list))
+    {
+        listener_queue_msg_send (peer->queue, method_name,
+                                 (const ProtobufCMessage *) list->data);
+    }
+}
+
+/**
+ * Record a change to the local servers in the change log and queue it to be sent
+ * to all remote hosts. Sending does not wait for the remote hosts.
+ *
+ * @param servers - GList of the 'cmsg_service_info' messages describing the servers.
+ * @param added - Whether the servers have been added or removed.
+ *
+ * @returns true if the change is synced to remote hosts, false otherwise.
+ */
+static bool
+remote_sync_change_record (GList *servers, bool added)
+{
+    cmsg_sld_servers_changed_data send_msg = CMSG_SLD_SERVERS_CHANGED_DATA_INIT;
+    remote_sync_change *change = NULL;
+    remote_sync_peer *peer = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    GList *list = NULL;
+
+    change = CMSG_CALLOC (1, sizeof (remote_sync_change));
+    if (!change)
+    {
+        return false;
+    }
+
+    for (list = servers; list; list = g_list_next (list))
+    {
+        if (remote_sync_server_syncable (list->data))
+        {
+            change->servers = g_list_prepend (change->servers,
+                                              CMSG_CLONE_RECV_MSG (cmsg_service_info,
+                                                                   list->data));
+        }
+    }
+
+    if (!change->servers)
+    {
+        CMSG_FREE (change);
+        return false;
+    }
+
+    change->servers = g_list_reverse (change->servers);
+    change->seq = ++remote_sync_seq;
+    change->added = added;
+
+    if (!remote_sync_change_log)
+    {
+        remote_sync_change_log = g_queue_new ();
+    }
+    g_queue_push_tail (remote_sync_change_log, change);
+
+    if (remote_sync_peers)
     {
-        cmsg_sld_remote_sync_api_remove_server (comp_client, server_info);
+        remote_sync_servers_changed_msg_fill (&send_msg, change);
+
+        g_hash_table_iter_init (&iter, remote_sync_peers);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+            peer = (remote_sync_peer *) value;
+            if (peer->queue && peer->legacy)
+            {
+                remote_sync_legacy_change_send (peer, change);
+            }
+            else if (peer->queue)
+            {
+                listener_queue_msg_send (peer->queue, "servers_changed",
+                                         (const ProtobufCMessage *) &send_msg);
+            }
+        }
+
+        CMSG_REPEATED_FREE (send_msg.data);
+    }
+
+    /* Trim after sending, the change may be the only entry in the log */
+    while (g_queue_get_length (remote_sync_change_log) > REMOTE_SYNC_CHANGE_LOG_SIZE)
+    {
+        remote_sync_change_free (g_queue_pop_head (remote_sync_change_log));
     }
 
     return true;
@@ -152,7 +665,10 @@ remote_sync_server_added_removed (const cmsg_service_info *server_info, bool add
 bool
 remote_sync_server_added (const cmsg_service_info *server_info)
 {
-    return remote_sync_server_added_removed (server_info, true);
+    GList servers = { };
+
+    servers.data = (gpointer) server_info;
+    return remote_sync_change_record (&servers, true);
 }
 
 /**
@@ -161,7 +677,26 @@ remote_sync_server_added (const cmsg_service_info *server_info)
 bool
 remote_sync_server_removed (const cmsg_service_info *server_info)
 {
-    return remote_sync_server_added_removed (server_info, false);
+    GList servers = { };
+
+    servers.data = (gpointer) server_info;
+    return remote_sync_change_record (&servers, false);
+}
+
+/**
+ * Notify all remote hosts of a set of servers that have been added or removed
+ * locally, using a single message for all of them.
+ *
+ * @param servers - GList of the 'cmsg_service_info' messages describing the servers.
+ * @param added - Whether the servers have been added or removed.
+ */
+void
+remote_sync_servers_changed (GList *servers, bool added)
+{
+    if (servers)
+    {
+        remote_sync_change_record (servers, added);
+    }
 }
 
 /**
@@ -179,6 +714,11 @@ remote_sync_address_set (struct in_addr addr)
                                                                CMSG_SERVICE (cmsg_sld,
                                                                              remote_sync));
         local_ip_addr = addr.s_addr;
+
+        do
+        {
+            remote_sync_epoch = g_random_int ();
+        } while (remote_sync_epoch == 0);
     }
 }
 
@@ -198,12 +738,14 @@ fill_bulk_sync_msg (gpointer data, gpointer user_data)
 }
 
 /**
- * Bulk sync all servers running on the local remote sync IP address to a remote node.
+ * Queue a bulk sync of all servers running on the local remote sync IP address
+ * for a remote host.
  *
- * @param client - The CMSG client connected to the remote host to sync to.
+ * @param queue - The queue to the remote host to sync to.
+ * @param send - Whether to start sending the queue or only add the message to it.
  */
 static void
-remote_sync_bulk_sync_services (cmsg_client *client)
+remote_sync_bulk_sync_services (listener_queue *queue, bool send)
 {
     cmsg_sld_bulk_sync_data send_msg = CMSG_SLD_BULK_SYNC_DATA_INIT;
     GList *services_list = NULL;
@@ -211,57 +753,261 @@ remote_sync_bulk_sync_services (cmsg_client *client)
     services_list = data_get_servers_by_addr (local_ip_addr);
     g_list_foreach (services_list, fill_bulk_sync_msg, &send_msg);
 
-    cmsg_sld_remote_sync_api_bulk_sync (client, &send_msg);
+    CMSG_SET_FIELD_VALUE (&send_msg, addr, local_ip_addr);
+    CMSG_SET_FIELD_VALUE (&send_msg, epoch, remote_sync_epoch);
+    CMSG_SET_FIELD_VALUE (&send_msg, seq, remote_sync_seq);
+
+    if (send)
+    {
+        listener_queue_msg_send (queue, "bulk_sync", (const ProtobufCMessage *) &send_msg);
+    }
+    else
+    {
+        listener_queue_msg_push (queue, "bulk_sync", (const ProtobufCMessage *) &send_msg);
+    }
     CMSG_REPEATED_FREE (send_msg.data);
     g_list_free (services_list);
 }
 
 /**
- * Add a remote host to synchronise the local service information to.
+ * Resynchronise a remote host that fell too far behind on the changes sent to it
+ * (or has been reconnected) once it has caught up, by sending it all of the local
+ * servers. The remote host is also asked again for its own servers if they have not
+ * been synced, as the earlier request may have been dropped.
  *
- * @param addr - The address of the remote host.
+ * @param queue - The queue to the remote host.
+ * @param user_data - The sync state for the remote host.
  */
-void
-remote_sync_add_host (struct in_addr addr)
+static void
+remote_sync_peer_resync (listener_queue *queue, void *user_data)
+{
+    remote_sync_peer *peer = (remote_sync_peer *) user_data;
+
+    remote_sync_bulk_sync_services (queue, false);
+
+    if (!peer->synced && !peer->legacy)
+    {
+        remote_sync_request_sync_queue (peer, false);
+    }
+}
+
+/**
+ * Queue the changes to the local servers since the given sequence number
+ * for a remote host.
+ *
+ * @param peer - The sync state for the remote host.
+ * @param from_seq - The sequence number of the last change the remote host has applied.
+ */
+static void
+remote_sync_delta_sync_services (remote_sync_peer *peer, uint32_t from_seq)
+{
+    cmsg_sld_delta_sync_data send_msg = CMSG_SLD_DELTA_SYNC_DATA_INIT;
+    cmsg_sld_servers_changed_data *changes = NULL;
+    const remote_sync_change *change = NULL;
+    GList *list = NULL;
+    int i = 0;
+
+    changes = CMSG_CALLOC (remote_sync_seq - from_seq + 1,
+                           sizeof (cmsg_sld_servers_changed_data));
+
+    for (list = g_queue_peek_head_link (remote_sync_change_log); list;
+         list = g_list_next (list))
+    {
+        change = (const remote_sync_change *) list->data;
+        if (change->seq > from_seq)
+        {
+            cmsg_sld_servers_changed_data_init (&changes[i]);
+            remote_sync_servers_changed_msg_fill (&changes[i], change);
+            CMSG_REPEATED_APPEND (&send_msg, changes, &changes[i]);
+            i++;
+        }
+    }
+
+    CMSG_SET_FIELD_VALUE (&send_msg, addr, local_ip_addr);
+    CMSG_SET_FIELD_VALUE (&send_msg, epoch, remote_sync_epoch);
+    CMSG_SET_FIELD_VALUE (&send_msg, from_seq, from_seq);
+    CMSG_SET_FIELD_VALUE (&send_msg, seq, remote_sync_seq);
+
+    listener_queue_msg_send (peer->queue, "delta_sync",
+                             (const ProtobufCMessage *) &send_msg);
+
+    while (i > 0)
+    {
+        i--;
+        CMSG_REPEATED_FREE (changes[i].data);
+    }
+    CMSG_REPEATED_FREE (send_msg.changes);
+    CMSG_FREE (changes);
+}
+
+/**
+ * Answer a sync request from a remote host. If the change log still holds all of the
+ * changes the remote host has missed then only those changes are sent, otherwise
+ * all local servers are sent.
+ *
+ * @param peer - The sync state for the remote host.
+ * @param epoch - The epoch of this daemon known by the remote host.
+ * @param seq - The sequence number of the last change the remote host has applied.
+ */
+static void
+remote_sync_answer_request (remote_sync_peer *peer, uint32_t epoch, uint32_t seq)
+{
+    const remote_sync_change *oldest = NULL;
+    bool delta_possible = false;
+
+    if (epoch == remote_sync_epoch && seq <= remote_sync_seq)
+    {
+        oldest = (const remote_sync_change *) g_queue_peek_head (remote_sync_change_log);
+        delta_possible = (seq == remote_sync_seq) || (oldest && seq + 1 >= oldest->seq);
+    }
+
+    if (delta_possible)
+    {
+        remote_sync_delta_sync_services (peer, seq);
+    }
+    else
+    {
+        remote_sync_bulk_sync_services (peer->queue, true);
+    }
+}
+
+/**
+ * Create the queue used to send to a remote host. The queue connects to the
+ * remote host without blocking, and reconnects if the connection fails.
+ *
+ * @param peer - The sync state for the remote host.
+ */
+static void
+remote_sync_peer_queue_create (remote_sync_peer *peer)
 {
     cmsg_client *client = NULL;
+    struct in_addr addr;
 
+    addr.s_addr = peer->addr;
     client = cmsg_create_client_tcp_ipv4_oneway ("cmsg_sld_sync", &addr, NULL,
                                                  CMSG_DESCRIPTOR (cmsg_sld, remote_sync));
+    if (!client)
+    {
+        return;
+    }
 
-    if (!comp_client)
+    peer->queue = listener_queue_new (client, "cmsg_sld_sync", 0);
+    if (peer->queue)
     {
-        comp_client = cmsg_composite_client_new (CMSG_DESCRIPTOR (cmsg_sld, remote_sync));
+        listener_queue_resync_func_set (peer->queue, remote_sync_peer_resync, peer);
+        listener_queue_reconnect_set (peer->queue);
+    }
+}
+
+/**
+ * A remote host is asking for the changes to the local servers since the last
+ * change that it has applied.
+ */
+void
+cmsg_sld_remote_sync_impl_sync_request (const void *service,
+                                        const cmsg_sld_sync_request *recv_msg)
+{
+    remote_sync_peer *peer = NULL;
+
+    peer = remote_sync_peer_get (recv_msg->addr, true);
+    peer->legacy = false;
+
+    if (peer->queue)
+    {
+        remote_sync_answer_request (peer, recv_msg->epoch, recv_msg->seq);
+    }
+    else
+    {
+        /* Answer once the remote host is added */
+        peer->request_pending = true;
+        peer->pending_epoch = recv_msg->epoch;
+        peer->pending_seq = recv_msg->seq;
+    }
+
+    cmsg_sld_remote_sync_server_sync_requestSend (service);
+}
+
+/**
+ * Add a remote host to synchronise the local service information to. The remote
+ * host is asked for the changes to its servers since the last change applied from
+ * it, and any sync request already received from the remote host is answered. A
+ * remote host running an older software version ignores the request, and is instead
+ * sent all of the local servers once its own bulk sync has been received.
+ *
+ * @param addr - The address of the remote host.
+ */
+void
+remote_sync_add_host (struct in_addr addr)
+{
+    remote_sync_peer *peer = NULL;
+
+    peer = remote_sync_peer_get (addr.s_addr, true);
+    if (!peer->queue)
+    {
+        remote_sync_peer_queue_create (peer);
+    }
+
+    remote_sync_request_sync (peer);
+
+    if (peer->request_pending && peer->queue)
+    {
+        peer->request_pending = false;
+        remote_sync_answer_request (peer, peer->pending_epoch, peer->pending_seq);
+    }
+
+    if (peer->legacy_sync_pending && peer->queue)
+    {
+        peer->legacy_sync_pending = false;
+        remote_sync_bulk_sync_services (peer->queue, true);
     }
-    cmsg_composite_client_add_child (comp_client, client);
-    remote_sync_bulk_sync_services (client);
 }
 
 /**
  * Remove a remote host from the list of remote hosts to synchronise
- * the local service information to.
+ * the local service information to. The servers received from the host
+ * are retained so that only the changes since the last change applied
+ * from the host need to be synced if it is added again.
  *
  * @param addr - The address of the remote host.
  */
 void
 remote_sync_delete_host (struct in_addr addr)
 {
-    cmsg_client *child_client = NULL;
+    remote_sync_peer *peer = NULL;
+    GList *servers = NULL;
+    GList *list = NULL;
 
-    if (!comp_client)
+    peer = remote_sync_peer_get (addr.s_addr, false);
+    if (!peer)
     {
         return;
     }
 
-    child_client = cmsg_composite_client_lookup_by_tcp_ipv4_addr (comp_client, addr);
-    cmsg_composite_client_delete_child (comp_client, child_client);
-    cmsg_destroy_client_and_transport (child_client);
+    if (peer->queue)
+    {
+        listener_queue_destroy (peer->queue);
+        peer->queue = NULL;
+    }
 
-    if (cmsg_composite_client_num_children (comp_client) == 0)
+    if (peer->synced && !peer->cached)
     {
-        cmsg_client_destroy (comp_client);
-        comp_client = NULL;
+        servers = data_get_servers_by_addr (addr.s_addr);
+        for (list = servers; list; list = g_list_next (list))
+        {
+            peer->cached = g_list_prepend (peer->cached,
+                                           CMSG_CLONE_RECV_MSG (cmsg_service_info,
+                                                                list->data));
+        }
+        g_list_free (servers);
     }
+
+    peer->synced = false;
+    peer->request_sent = false;
+    peer->request_pending = false;
+
+    /* The remote host may have been upgraded when it is added again */
+    peer->legacy = false;
+    peer->legacy_sync_pending = false;
 }
 
 /**
@@ -282,23 +1028,6 @@ remote_sync_debug_print_transport_ip (FILE *fp, cmsg_transport *transport)
     fprintf (fp, "%s", ip);
 }
 
-/**
- * Helper function called for each client to a remote host. Prints the
- * IP address of the remote host.
- *
- * @param data - The cmsg client.
- * @param user_data - The file to print to.
- */
-static void
-data_debug_server_dump (gpointer data, gpointer user_data)
-{
-    const cmsg_client *client = (const cmsg_client *) data;
-    FILE *fp = (FILE *) user_data;
-
-    remote_sync_debug_print_transport_ip (fp, client->_transport);
-    fprintf (fp, " ");
-}
-
 /**
  * Dump the current information about all known hosts to the debug file.
  *
@@ -307,13 +1036,19 @@ data_debug_server_dump (gpointer data, gpointer user_data)
 void
 remote_sync_debug_dump (FILE *fp)
 {
-    GList *child_clients = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    remote_sync_peer *peer = NULL;
+    char ip[INET6_ADDRSTRLEN] = { };
 
     fprintf (fp, "Hosts:\n");
     fprintf (fp, " local: ");
     if (remote_sync_server)
     {
         remote_sync_debug_print_transport_ip (fp, remote_sync_server->_transport);
+        fprintf (fp, " (epoch %u, seq %u, change log %u)", remote_sync_epoch,
+                 remote_sync_seq,
+                 remote_sync_change_log ? g_queue_get_length (remote_sync_change_log) : 0);
     }
     else
     {
@@ -321,12 +1056,23 @@ remote_sync_debug_dump (FILE *fp)
     }
     fprintf (fp, "\n");
 
-    fprintf (fp, " remote: ");
-    if (comp_client)
+    fprintf (fp, " remote:\n");
+    if (remote_sync_peers)
     {
-        child_clients = cmsg_composite_client_get_children (comp_client);
-        g_list_foreach (child_clients, data_debug_server_dump, fp);
+        g_hash_table_iter_init (&iter, remote_sync_peers);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+            peer = (remote_sync_peer *) value;
+            inet_ntop (AF_INET, &peer->addr, ip, INET6_ADDRSTRLEN);
+            fprintf (fp, "  %s (epoch %u, seq %u)%s%s%s ", ip, peer->remote_epoch,
+                     peer->remote_seq, peer->synced ? "" : " (not synced)",
+                     peer->queue ? "" : " (not configured)",
+                     peer->legacy ? " (legacy)" : "");
+            if (peer->queue)
+            {
+                listener_queue_debug_dump (peer->queue, fp);
+            }
+            fprintf (fp, "\n");
+        }
     }
-
-    fprintf (fp, "\n");
 }
@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <netinet/in.h>
+#include <glib.h>
 #include "cmsg_types_auto.h"
 
 void remote_sync_debug_dump (FILE *fp);
@@ -17,5 +18,6 @@ void remote_sync_add_host (struct in_addr addr);
 void remote_sync_delete_host (struct in_addr addr);
 bool remote_sync_server_added (const cmsg_service_info *server_info);
 bool remote_sync_server_removed (const cmsg_service_info *server_info);
+void remote_sync_servers_changed (GList *servers, bool added);
 
 #endif /* __REMOTE_SYNC_H_ */
@@ -0,0 +1,271 @@
+/*
+ * Unit tests for the service listener shared memory directory.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <np.h>
+#include <sys/wait.h>
+#include "../cmsg_sl_shm_private.h"
+
+/**
+ * This informs the compiler that the function is, in fact, being used even though it
+ * doesn't look like it. This is useful for static functions that get found by NovaProva
+ * using debug symbols.
+ */
+#define USED __attribute__ ((used))
+
+static cmsg_sl_shm_directory *directory = NULL;
+
+static int USED
+set_up (void)
+{
+    directory = (cmsg_sl_shm_directory *) g_malloc (sizeof (cmsg_sl_shm_directory));
+    cmsg_sl_shm_directory_init (directory);
+    cmsg_sl_shm_publish_start (directory);
+
+    return 0;
+}
+
+static int USED
+tear_down (void)
+{
+    g_free (directory);
+
+    return 0;
+}
+
+/**
+ * Create the information for a unix server of the given service.
+ */
+static cmsg_service_info *
+create_server (const char *service, const char *path)
+{
+    cmsg_service_info *service_info = CMSG_MALLOC (sizeof (cmsg_service_info));
+    cmsg_transport_info *transport_info = CMSG_MALLOC (sizeof (cmsg_transport_info));
+    cmsg_unix_transport_info *unix_info = CMSG_MALLOC (sizeof (cmsg_unix_transport_info));
+
+    cmsg_service_info_init (service_info);
+    cmsg_transport_info_init (transport_info);
+    cmsg_unix_transport_info_init (unix_info);
+
+    CMSG_SET_FIELD_PTR (unix_info, path, CMSG_STRDUP (path));
+    CMSG_SET_FIELD_VALUE (transport_info, type, CMSG_TRANSPORT_INFO_TYPE_UNIX);
+    CMSG_SET_FIELD_VALUE (transport_info, one_way, false);
+    CMSG_SET_FIELD_ONEOF (transport_info, unix_info, unix_info, data,
+                          CMSG_TRANSPORT_INFO_DATA_UNIX_INFO);
+    CMSG_SET_FIELD_PTR (service_info, service, CMSG_STRDUP (service));
+    CMSG_SET_FIELD_PTR (service_info, server_info, transport_info);
+
+    return service_info;
+}
+
+static void
+free_server (cmsg_service_info *service_info)
+{
+    CMSG_FREE (service_info->service);
+    cmsg_transport_info_free (service_info->server_info);
+    CMSG_FREE (service_info);
+}
+
+/**
+ * Look up a service and return the number of servers found.
+ */
+static int
+lookup_count (const char *service)
+{
+    GList *transports = NULL;
+    int count;
+
+    NP_ASSERT_TRUE (cmsg_sl_shm_lookup (directory, service, &transports));
+    count = g_list_length (transports);
+    g_list_free_full (transports, (GDestroyNotify) cmsg_transport_destroy);
+
+    return count;
+}
+
+/**
+ * Get the number of servers that did not fit counted against the hash of a service.
+ */
+static uint32_t
+overflow_count (const char *service)
+{
+    return directory->overflow[CMSG_SL_SHM_OVERFLOW_BUCKET (g_str_hash (service))];
+}
+
+void
+test_cmsg_sl_shm_lookup_returns_servers_of_service (void)
+{
+    cmsg_service_info *server_1 = create_server ("test_1", "/tmp/test_1.1");
+    cmsg_service_info *server_2 = create_server ("test_1", "/tmp/test_1.2");
+    cmsg_service_info *server_3 = create_server ("test_2", "/tmp/test_2");
+    GList *transports = NULL;
+    cmsg_transport *transport = NULL;
+
+    cmsg_sl_shm_server_add (directory, server_1);
+    cmsg_sl_shm_server_add (directory, server_2);
+    cmsg_sl_shm_server_add (directory, server_3);
+
+    NP_ASSERT_EQUAL (lookup_count ("test_1"), 2);
+    NP_ASSERT_EQUAL (lookup_count ("test_3"), 0);
+
+    NP_ASSERT_TRUE (cmsg_sl_shm_lookup (directory, "test_2", &transports));
+    NP_ASSERT_EQUAL (g_list_length (transports), 1);
+    transport = (cmsg_transport *) transports->data;
+    NP_ASSERT_EQUAL (transport->type, CMSG_TRANSPORT_RPC_UNIX);
+    NP_ASSERT_STR_EQUAL (transport->config.socket.sockaddr.un.sun_path, "/tmp/test_2");
+    g_list_free_full (transports, (GDestroyNotify) cmsg_transport_destroy);
+
+    free_server (server_1);
+    free_server (server_2);
+    free_server (server_3);
+}
+
+void
+test_cmsg_sl_shm_removed_server_is_not_returned (void)
+{
+    cmsg_service_info *server_1 = create_server ("test", "/tmp/test.1");
+    cmsg_service_info *server_2 = create_server ("test", "/tmp/test.2");
+
+    cmsg_sl_shm_server_add (directory, server_1);
+    cmsg_sl_shm_server_add (directory, server_2);
+
+    /* The server after the removed one is still found */
+    cmsg_sl_shm_server_remove (directory, server_1);
+    NP_ASSERT_EQUAL (lookup_count ("test"), 1);
+
+    cmsg_sl_shm_server_remove (directory, server_2);
+    NP_ASSERT_EQUAL (lookup_count ("test"), 0);
+    NP_ASSERT_EQUAL (directory->used, 0);
+
+    free_server (server_1);
+    free_server (server_2);
+}
+
+void
+test_cmsg_sl_shm_deleted_slots_are_reclaimed (void)
+{
+    cmsg_service_info *server = create_server ("test", "/tmp/test");
+    int i;
+
+    for (i = 0; i < CMSG_SL_SHM_NUM_SLOTS; i++)
+    {
+        cmsg_sl_shm_server_add (directory, server);
+        cmsg_sl_shm_server_remove (directory, server);
+    }
+
+    cmsg_sl_shm_server_add (directory, server);
+    NP_ASSERT_EQUAL (lookup_count ("test"), 1);
+    NP_ASSERT_EQUAL (overflow_count ("test"), 0);
+    NP_ASSERT_TRUE (directory->deleted < CMSG_SL_SHM_NUM_SLOTS);
+
+    free_server (server);
+}
+
+void
+test_cmsg_sl_shm_lookup_fails_when_full (void)
+{
+    cmsg_service_info *server = NULL;
+    GList *transports = NULL;
+    char path[64];
+    int i;
+
+    for (i = 0; i <= CMSG_SL_SHM_NUM_SLOTS / 4 * 3; i++)
+    {
+        snprintf (path, sizeof (path), "/tmp/test.%d", i);
+        server = create_server ("test", path);
+        cmsg_sl_shm_server_add (directory, server);
+        free_server (server);
+    }
+
+    NP_ASSERT_EQUAL (overflow_count ("test"), 1);
+    NP_ASSERT_FALSE (cmsg_sl_shm_lookup (directory, "test", &transports));
+
+    /* Lookups for a service that does not share the count still use the directory */
+    NP_ASSERT_NOT_EQUAL (CMSG_SL_SHM_OVERFLOW_BUCKET (g_str_hash ("other")),
+                         CMSG_SL_SHM_OVERFLOW_BUCKET (g_str_hash ("test")));
+    NP_ASSERT_EQUAL (lookup_count ("other"), 0);
+
+    /* Removing the server that did not fit makes the directory complete again */
+    server = create_server ("test", path);
+    cmsg_sl_shm_server_remove (directory, server);
+    free_server (server);
+
+    NP_ASSERT_EQUAL (overflow_count ("test"), 0);
+    NP_ASSERT_EQUAL (lookup_count ("test"), CMSG_SL_SHM_NUM_SLOTS / 4 * 3);
+}
+
+void
+test_cmsg_sl_shm_long_service_name_only_fails_its_own_lookup (void)
+{
+    char long_name[CMSG_SL_SHM_SERVICE_NAME_LEN + 1];
+    cmsg_service_info *long_server = NULL;
+    cmsg_service_info *server = create_server ("test", "/tmp/test");
+    GList *transports = NULL;
+
+    memset (long_name, 'a', CMSG_SL_SHM_SERVICE_NAME_LEN);
+    long_name[CMSG_SL_SHM_SERVICE_NAME_LEN] = '\0';
+    long_server = create_server (long_name, "/tmp/long");
+
+    cmsg_sl_shm_server_add (directory, long_server);
+    cmsg_sl_shm_server_add (directory, server);
+
+    NP_ASSERT_EQUAL (lookup_count ("test"), 1);
+    NP_ASSERT_FALSE (cmsg_sl_shm_lookup (directory, long_name, &transports));
+
+    cmsg_sl_shm_server_remove (directory, long_server);
+    NP_ASSERT_EQUAL (lookup_count ("test"), 1);
+
+    free_server (long_server);
+    free_server (server);
+}
+
+void
+test_cmsg_sl_shm_lookup_fails_when_not_published (void)
+{
+    GList *transports = NULL;
+
+    cmsg_sl_shm_publish_stop (directory);
+
+    NP_ASSERT_FALSE (cmsg_sl_shm_lookup (directory, "test", &transports));
+    NP_ASSERT_NULL (transports);
+}
+
+void
+test_cmsg_sl_shm_lookup_fails_while_being_changed (void)
+{
+    GList *transports = NULL;
+
+    /* The writer never finishes changing the directory */
+    directory->seq++;
+
+    NP_ASSERT_FALSE (cmsg_sl_shm_lookup (directory, "test", &transports));
+    NP_ASSERT_NULL (transports);
+}
+
+void
+test_cmsg_sl_shm_lookup_fails_when_publisher_has_exited (void)
+{
+    GList *transports = NULL;
+    pid_t pid;
+
+    pid = fork ();
+    if (pid == 0)
+    {
+        _exit (0);
+    }
+    waitpid (pid, NULL, 0);
+
+    /* The publisher exited without stopping publishing the directory */
+    cmsg_sl_shm_publish_start (directory);
+    directory->pid = pid;
+
+    NP_ASSERT_FALSE (cmsg_sl_shm_lookup (directory, "test", &transports));
+    NP_ASSERT_NULL (transports);
+
+    /* A new instance of the publisher is seen straight away */
+    cmsg_sl_shm_publish_start (directory);
+
+    NP_ASSERT_TRUE (cmsg_sl_shm_lookup (directory, "test", &transports));
+    NP_ASSERT_NULL (transports);
+}
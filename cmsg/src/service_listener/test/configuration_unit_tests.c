@@ -18,6 +18,8 @@
 static bool cmsg_server_app_owns_current_msg_set_called = false;
 static bool data_add_server_called = false;
 static bool data_remove_server_called = false;
+static int data_add_listener_count = 0;
+static int data_remove_listener_count = 0;
 
 static void
 sm_mock_cmsg_server_app_owns_current_msg_set (cmsg_server *server)
@@ -37,6 +39,20 @@ sm_mock_data_remove_server (const cmsg_service_info *server_info, bool local)
     data_remove_server_called = true;
 }
 
+static void
+sm_mock_data_add_listener (const cmsg_sld_listener_info *info)
+{
+    NP_ASSERT_EQUAL (info->id, 5);
+    data_add_listener_count++;
+}
+
+static void
+sm_mock_data_remove_listener (const cmsg_sld_listener_info *info)
+{
+    NP_ASSERT_EQUAL (info->id, 5);
+    data_remove_listener_count++;
+}
+
 static void
 sm_mock_cmsg_server_send_response (const ProtobufCMessage *send_msg, const void *service)
 {
@@ -48,11 +64,15 @@ set_up (void)
     cmsg_server_app_owns_current_msg_set_called = false;
     data_add_server_called = false;
     data_remove_server_called = false;
+    data_add_listener_count = 0;
+    data_remove_listener_count = 0;
 
     np_mock (cmsg_server_app_owns_current_msg_set,
              sm_mock_cmsg_server_app_owns_current_msg_set);
     np_mock (data_remove_server, sm_mock_data_remove_server);
     np_mock (data_add_server, sm_mock_data_add_server);
+    np_mock (data_add_listener, sm_mock_data_add_listener);
+    np_mock (data_remove_listener, sm_mock_data_remove_listener);
     np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
 
     return 0;
@@ -121,3 +141,41 @@ test_cmsg_sld_configuration_impl_remove_server_unix (void)
     NP_ASSERT_TRUE (data_remove_server_called);
     NP_ASSERT_FALSE (data_add_server_called);
 }
+
+void
+test_cmsg_sld_configuration_impl_listen_set (void)
+{
+    cmsg_sld_listener_set_info listener_set_info = CMSG_SLD_LISTENER_SET_INFO_INIT;
+    cmsg_transport_info transport_info = CMSG_TRANSPORT_INFO_INIT;
+    char *services[] = { "test_1", "test_2", "test_3" };
+
+    CMSG_SET_FIELD_VALUE (&transport_info, type, CMSG_TRANSPORT_INFO_TYPE_UNIX);
+    CMSG_SET_FIELD_PTR (&listener_set_info, transport_info, &transport_info);
+    CMSG_SET_FIELD_VALUE (&listener_set_info, id, 5);
+    listener_set_info.services = services;
+    listener_set_info.n_services = 3;
+
+    cmsg_sld_configuration_impl_listen_set (NULL, &listener_set_info);
+
+    NP_ASSERT_EQUAL (data_add_listener_count, 3);
+    NP_ASSERT_EQUAL (data_remove_listener_count, 0);
+}
+
+void
+test_cmsg_sld_configuration_impl_unlisten_set (void)
+{
+    cmsg_sld_listener_set_info listener_set_info = CMSG_SLD_LISTENER_SET_INFO_INIT;
+    cmsg_transport_info transport_info = CMSG_TRANSPORT_INFO_INIT;
+    char *services[] = { "test_1", "test_2" };
+
+    CMSG_SET_FIELD_VALUE (&transport_info, type, CMSG_TRANSPORT_INFO_TYPE_UNIX);
+    CMSG_SET_FIELD_PTR (&listener_set_info, transport_info, &transport_info);
+    CMSG_SET_FIELD_VALUE (&listener_set_info, id, 5);
+    listener_set_info.services = services;
+    listener_set_info.n_services = 2;
+
+    cmsg_sld_configuration_impl_unlisten_set (NULL, &listener_set_info);
+
+    NP_ASSERT_EQUAL (data_add_listener_count, 0);
+    NP_ASSERT_EQUAL (data_remove_listener_count, 2);
+}
@@ -5,10 +5,12 @@
  */
 
 #include <np.h>
+#include <sys/socket.h>
 #include "../data.h"
 #include "../process_watch.h"
 #include <cmsg/cmsg_private.h>
 #include "transport/cmsg_transport_private.h"
+#include "cmsg_client_private.h"
 #include "../events_api_auto.h"
 
 /**
@@ -19,8 +21,13 @@
 #define USED __attribute__ ((used))
 
 extern GHashTable *hash_table;
+extern GHashTable *addr_table;
+extern GHashTable *pid_table;
 
-static int cmsg_sld_events_api_server_added_called = 0;
+static int cmsg_client_connect_called = 0;
+static int cmsg_client_connect_fail_on_call = 0;
+static int listener_sockets[2] = { -1, -1 };
+static GByteArray *listener_received = NULL;
 
 static void
 sm_mock_process_watch_add (int pid)
@@ -32,13 +39,52 @@ sm_mock_process_watch_remove (int pid)
 {
 }
 
+/**
+ * Connecting a listener's client fails on the call set in
+ * 'cmsg_client_connect_fail_on_call', or never if it is 0.
+ */
+static int32_t
+sm_mock_cmsg_client_connect_start (cmsg_client *client)
+{
+    cmsg_client_connect_called++;
+
+    if (cmsg_client_connect_called == cmsg_client_connect_fail_on_call)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int32_t
+sm_mock_cmsg_client_connect_finish (cmsg_client *client)
+{
+    return 0;
+}
+
+/**
+ * Every listener's client writes to one end of a socket pair that the test reads.
+ */
+static int32_t
+sm_mock_cmsg_client_get_socket (cmsg_client *client)
+{
+    return listener_sockets[0];
+}
+
 static int USED
 set_up (void)
 {
-    cmsg_sld_events_api_server_added_called = 0;
+    cmsg_client_connect_called = 0;
+    cmsg_client_connect_fail_on_call = 0;
+
+    NP_ASSERT_EQUAL (socketpair (AF_UNIX, SOCK_STREAM, 0, listener_sockets), 0);
+    listener_received = g_byte_array_new ();
 
     np_mock (process_watch_add, sm_mock_process_watch_add);
     np_mock (process_watch_remove, sm_mock_process_watch_remove);
+    np_mock (cmsg_client_connect_start, sm_mock_cmsg_client_connect_start);
+    np_mock (cmsg_client_connect_finish, sm_mock_cmsg_client_connect_finish);
+    np_mock (cmsg_client_get_socket, sm_mock_cmsg_client_get_socket);
 
     data_init ();
 
@@ -53,9 +99,57 @@ tear_down (void)
 
     data_deinit ();
 
+    np_unmock (cmsg_client_connect_start);
+    np_unmock (cmsg_client_connect_finish);
+    np_unmock (cmsg_client_get_socket);
+
+    close (listener_sockets[0]);
+    close (listener_sockets[1]);
+    g_byte_array_free (listener_received, TRUE);
+
     return 0;
 }
 
+/**
+ * Read everything that has been written to the listeners so far.
+ */
+static void
+read_listener_events (void)
+{
+    uint8_t buf[4096];
+    ssize_t ret;
+
+    while ((ret = recv (listener_sockets[1], buf, sizeof (buf), MSG_DONTWAIT)) > 0)
+    {
+        g_byte_array_append (listener_received, buf, ret);
+    }
+}
+
+/**
+ * Count the number of events for the given method that have been written
+ * to the listeners so far.
+ */
+static int
+count_listener_events (const char *method_name)
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+    size_t len = strlen (method_name) + 1;
+    int count = 0;
+
+    read_listener_events ();
+
+    pos = listener_received->data;
+    end = pos + listener_received->len;
+    while ((pos = memmem (pos, end - pos, method_name, len)) != NULL)
+    {
+        count++;
+        pos += len;
+    }
+
+    return count;
+}
+
 static cmsg_transport_info *
 create_unix_transport_info (void)
 {
@@ -106,58 +200,6 @@ create_tcp_transport_info (uint32_t _addr)
     return transport_info;
 }
 
-static int
-sm_mock_cmsg_api_invoke_ok (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
-                            int method_index, const ProtobufCMessage *send_msg,
-                            ProtobufCMessage **recv_msg)
-{
-    if (cmsg_desc->service_desc == &cmsg_sld_events_descriptor &&
-        method_index == cmsg_sld_events_api_server_added_index)
-    {
-        cmsg_sld_events_api_server_added_called++;
-    }
-
-    return CMSG_RET_OK;
-}
-
-static int
-sm_mock_cmsg_api_invoke_fail (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
-                              int method_index, const ProtobufCMessage *send_msg,
-                              ProtobufCMessage **recv_msg)
-{
-    if (cmsg_desc->service_desc == &cmsg_sld_events_descriptor &&
-        method_index == cmsg_sld_events_api_server_added_index)
-    {
-        cmsg_sld_events_api_server_added_called++;
-    }
-
-    return CMSG_RET_ERR;
-}
-
-static int
-sm_mock_cmsg_api_invoke_fail_on_first_call (cmsg_client *client,
-                                            const cmsg_api_descriptor *cmsg_desc,
-                                            int method_index,
-                                            const ProtobufCMessage *send_msg,
-                                            ProtobufCMessage **recv_msg)
-{
-    if (cmsg_desc->service_desc == &cmsg_sld_events_descriptor &&
-        method_index == cmsg_sld_events_api_server_added_index)
-    {
-        cmsg_sld_events_api_server_added_called++;
-        if (cmsg_sld_events_api_server_added_called == 1)
-        {
-            return CMSG_RET_ERR;
-        }
-        else
-        {
-            return CMSG_RET_OK;
-        }
-    }
-
-    return cmsg_api_invoke_real (client, cmsg_desc, method_index, send_msg, recv_msg);
-}
-
 void
 test_data_add_server (void)
 {
@@ -485,6 +527,8 @@ test_data_remove_servers_by_addr (void)
     data_remove_servers_by_addr (addr);
 
     NP_ASSERT_EQUAL (g_hash_table_size (hash_table), 2);
+    NP_ASSERT_NULL (g_hash_table_lookup (addr_table, GUINT_TO_POINTER (123)));
+    NP_ASSERT_EQUAL (g_hash_table_size (addr_table), 1);
 
     entry = get_service_entry_or_create ("test_service1", false);
     NP_ASSERT_NOT_NULL (entry);
@@ -568,6 +612,7 @@ test_data_add_listener (void)
     cmsg_transport_info *transport_info = NULL;
     service_data_entry *entry = NULL;
     listener_data *listener_entry = NULL;
+    const cmsg_client *client = NULL;
     uint32_t addr;
 
     transport_info = create_tcp_transport_info (999);
@@ -586,9 +631,10 @@ test_data_add_listener (void)
 
     listener_entry = (listener_data *) entry->listeners->data;
     NP_ASSERT_EQUAL (listener_entry->id, 5);
-    NP_ASSERT_EQUAL (listener_entry->client->_transport->type, CMSG_TRANSPORT_ONEWAY_TCP);
+    client = listener_queue_client_get (listener_entry->queue);
+    NP_ASSERT_EQUAL (client->_transport->type, CMSG_TRANSPORT_ONEWAY_TCP);
 
-    addr = listener_entry->client->_transport->config.socket.sockaddr.in.sin_addr.s_addr;
+    addr = client->_transport->config.socket.sockaddr.in.sin_addr.s_addr;
     NP_ASSERT_EQUAL (addr, 999);
 }
 
@@ -611,6 +657,36 @@ test_data_remove_listener (void)
     NP_ASSERT_EQUAL (g_hash_table_size (hash_table), 0);
 }
 
+void
+test_data_remove_listener_matches_id (void)
+{
+    cmsg_sld_listener_info listener_info = CMSG_SLD_LISTENER_INFO_INIT;
+    cmsg_transport_info *transport_info = NULL;
+    service_data_entry *entry = NULL;
+    listener_data *listener_entry = NULL;
+
+    transport_info = create_tcp_transport_info (999);
+
+    CMSG_SET_FIELD_PTR (&listener_info, service, "test_service");
+    CMSG_SET_FIELD_PTR (&listener_info, transport_info, transport_info);
+    CMSG_SET_FIELD_VALUE (&listener_info, id, 5);
+    data_add_listener (&listener_info);
+
+    CMSG_SET_FIELD_VALUE (&listener_info, id, 6);
+    data_add_listener (&listener_info);
+
+    CMSG_SET_FIELD_VALUE (&listener_info, id, 5);
+    data_remove_listener (&listener_info);
+    cmsg_transport_info_free (transport_info);
+
+    entry = get_service_entry_or_create ("test_service", false);
+    NP_ASSERT_NOT_NULL (entry);
+    NP_ASSERT_EQUAL (g_list_length (entry->listeners), 1);
+
+    listener_entry = (listener_data *) entry->listeners->data;
+    NP_ASSERT_EQUAL (listener_entry->id, 6);
+}
+
 void
 test_data_add_listener_with_existing_server (void)
 {
@@ -632,8 +708,6 @@ test_data_add_listener_with_existing_server (void)
     CMSG_SET_FIELD_PTR (&listener_info, transport_info, transport_info);
     CMSG_SET_FIELD_VALUE (&listener_info, id, 5);
 
-    np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke_ok);
-
     data_add_listener (&listener_info);
     cmsg_transport_info_free (transport_info);
 
@@ -641,7 +715,7 @@ test_data_add_listener_with_existing_server (void)
     entry = get_service_entry_or_create ("test_service1", false);
     NP_ASSERT_NOT_NULL (entry);
     NP_ASSERT_EQUAL (g_list_length (entry->listeners), 1);
-    NP_ASSERT_EQUAL (cmsg_sld_events_api_server_added_called, 1);
+    NP_ASSERT_EQUAL (count_listener_events ("server_added"), 1);
 }
 
 void
@@ -665,7 +739,7 @@ test_data_add_listener_with_existing_server_rpc_failure (void)
     CMSG_SET_FIELD_PTR (&listener_info, transport_info, transport_info);
     CMSG_SET_FIELD_VALUE (&listener_info, id, 5);
 
-    np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke_fail);
+    cmsg_client_connect_fail_on_call = 1;
 
     data_add_listener (&listener_info);
     cmsg_transport_info_free (transport_info);
@@ -674,7 +748,8 @@ test_data_add_listener_with_existing_server_rpc_failure (void)
     entry = get_service_entry_or_create ("test_service1", false);
     NP_ASSERT_NOT_NULL (entry);
     NP_ASSERT_EQUAL (g_list_length (entry->listeners), 0);
-    NP_ASSERT_EQUAL (cmsg_sld_events_api_server_added_called, 1);
+    NP_ASSERT_EQUAL (cmsg_client_connect_called, 1);
+    NP_ASSERT_EQUAL (count_listener_events ("server_added"), 0);
 }
 
 void
@@ -709,11 +784,12 @@ test_data_add_server_with_existing_listeners_rpc_failure (void)
     NP_ASSERT_NOT_NULL (entry);
     NP_ASSERT_EQUAL (g_list_length (entry->listeners), 2);
 
-    np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke_fail_on_first_call);
+    cmsg_client_connect_fail_on_call = 1;
     data_add_server (service_info_1, true);
 
     NP_ASSERT_EQUAL (g_list_length (entry->listeners), 1);
-    NP_ASSERT_EQUAL (cmsg_sld_events_api_server_added_called, 2);
+    NP_ASSERT_EQUAL (cmsg_client_connect_called, 2);
+    NP_ASSERT_EQUAL (count_listener_events ("server_added"), 1);
 }
 
 void
@@ -725,8 +801,6 @@ test_data_remove_by_pid (void)
     cmsg_sld_listener_info listener_info = CMSG_SLD_LISTENER_INFO_INIT;
     cmsg_transport_info *transport_info = NULL;
 
-    np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke_ok);
-
     /* Add two listeners for different services,
      * one with PID 10, one with PID 11. */
     transport_info = create_tcp_transport_info (999);
@@ -767,6 +841,7 @@ test_data_remove_by_pid (void)
     NP_ASSERT_EQUAL (g_hash_table_size (hash_table), 1);
 
     NP_ASSERT_NULL (get_service_entry_or_create ("test_service1", false));
+    NP_ASSERT_NULL (g_hash_table_lookup (pid_table, GUINT_TO_POINTER (10)));
     entry = get_service_entry_or_create ("test_service2", false);
     NP_ASSERT_NOT_NULL (entry);
     NP_ASSERT_EQUAL (g_list_length (entry->servers), 0);
@@ -775,4 +850,140 @@ test_data_remove_by_pid (void)
     /* Remove by PID 11, the hash table should now be empty. */
     data_remove_by_pid (11);
     NP_ASSERT_EQUAL (g_hash_table_size (hash_table), 0);
+    NP_ASSERT_EQUAL (g_hash_table_size (pid_table), 0);
+}
+
+void
+test_data_listener_overflow_resyncs (void)
+{
+    cmsg_sld_listener_info listener_info = CMSG_SLD_LISTENER_INFO_INIT;
+    cmsg_transport_info *transport_info = NULL;
+    service_data_entry *entry = NULL;
+    cmsg_service_info *service_info = NULL;
+    int sndbuf = 4096;
+    uint32_t i;
+
+    /* Keep the socket to the listener small so that it fills quickly */
+    setsockopt (listener_sockets[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof (sndbuf));
+
+    transport_info = create_tcp_transport_info (999);
+    CMSG_SET_FIELD_PTR (&listener_info, service, "test_service1");
+    CMSG_SET_FIELD_PTR (&listener_info, transport_info, transport_info);
+    CMSG_SET_FIELD_VALUE (&listener_info, id, 5);
+    data_add_listener (&listener_info);
+    cmsg_transport_info_free (transport_info);
+
+    /* The listener never reads while the servers are added */
+    for (i = 1; i <= LISTENER_QUEUE_MAX_EVENTS * 2; i++)
+    {
+        service_info = CMSG_MALLOC (sizeof (*service_info));
+        cmsg_service_info_init (service_info);
+        CMSG_SET_FIELD_PTR (service_info, service, CMSG_STRDUP ("test_service1"));
+        CMSG_SET_FIELD_PTR (service_info, server_info, create_tcp_transport_info (i));
+        data_add_server (service_info, true);
+    }
+
+    /* The listener is still registered, it is only resynchronised */
+    entry = get_service_entry_or_create ("test_service1", false);
+    NP_ASSERT_NOT_NULL (entry);
+    NP_ASSERT_EQUAL (g_list_length (entry->listeners), 1);
+    NP_ASSERT_TRUE (count_listener_events ("server_added") < LISTENER_QUEUE_MAX_EVENTS * 2);
+
+    /* Let the listener catch up */
+    for (i = 0; i < 1000 && count_listener_events ("server_resync") == 0; i++)
+    {
+        g_main_context_iteration (NULL, FALSE);
+    }
+
+    NP_ASSERT_EQUAL (count_listener_events ("server_resync"), 1);
+    NP_ASSERT_EQUAL (g_list_length (entry->listeners), 1);
+}
+
+void
+test_data_remove_by_pid_batches_listener_events (void)
+{
+    cmsg_sld_listener_info listener_info = CMSG_SLD_LISTENER_INFO_INIT;
+    cmsg_transport_info *transport_info = NULL;
+    cmsg_service_info *service_info = NULL;
+    uint32_t i;
+
+    transport_info = create_tcp_transport_info (999);
+    CMSG_SET_FIELD_PTR (&listener_info, service, "test_service1");
+    CMSG_SET_FIELD_PTR (&listener_info, transport_info, transport_info);
+    CMSG_SET_FIELD_VALUE (&listener_info, id, 5);
+    CMSG_SET_FIELD_VALUE (&listener_info, pid, 11);
+    data_add_listener (&listener_info);
+    cmsg_transport_info_free (transport_info);
+
+    /* Add three servers for the service, all with PID 10. */
+    for (i = 1; i <= 3; i++)
+    {
+        service_info = CMSG_MALLOC (sizeof (*service_info));
+        cmsg_service_info_init (service_info);
+        CMSG_SET_FIELD_PTR (service_info, service, CMSG_STRDUP ("test_service1"));
+        CMSG_SET_FIELD_PTR (service_info, server_info, create_tcp_transport_info (i));
+        CMSG_SET_FIELD_VALUE (service_info, pid, 10);
+        data_add_server (service_info, true);
+    }
+
+    NP_ASSERT_EQUAL (count_listener_events ("server_added"), 3);
+
+    /* Removing the servers is a single operation so the listener
+     * should be sent a single batched event. */
+    data_remove_by_pid (10);
+
+    NP_ASSERT_EQUAL (count_listener_events ("servers_changed"), 1);
+    NP_ASSERT_EQUAL (count_listener_events ("server_removed"), 0);
+}
+
+void
+test_data_add_listener_set_shares_queue (void)
+{
+    cmsg_sld_listener_set_info set_info = CMSG_SLD_LISTENER_SET_INFO_INIT;
+    cmsg_sld_listener_info listener_info = CMSG_SLD_LISTENER_INFO_INIT;
+    cmsg_transport_info *transport_info = NULL;
+    service_data_entry *entry_1 = NULL;
+    service_data_entry *entry_2 = NULL;
+    listener_data *listener_1 = NULL;
+    listener_data *listener_2 = NULL;
+    cmsg_service_info *service_info = NULL;
+
+    transport_info = create_tcp_transport_info (999);
+    CMSG_REPEATED_APPEND (&set_info, services, "test_service1");
+    CMSG_REPEATED_APPEND (&set_info, services, "test_service2");
+    CMSG_REPEATED_APPEND (&set_info, services, "test_service1");
+    CMSG_SET_FIELD_PTR (&set_info, transport_info, transport_info);
+    CMSG_SET_FIELD_VALUE (&set_info, id, 5);
+    CMSG_SET_FIELD_VALUE (&set_info, pid, 11);
+    data_add_listener_set (&set_info);
+    CMSG_REPEATED_FREE (set_info.services);
+
+    /* A listener for each distinct service, sharing a single queue */
+    entry_1 = get_service_entry_or_create ("test_service1", false);
+    entry_2 = get_service_entry_or_create ("test_service2", false);
+    NP_ASSERT_NOT_NULL (entry_1);
+    NP_ASSERT_NOT_NULL (entry_2);
+    NP_ASSERT_EQUAL (g_list_length (entry_1->listeners), 1);
+    NP_ASSERT_EQUAL (g_list_length (entry_2->listeners), 1);
+
+    listener_1 = (listener_data *) entry_1->listeners->data;
+    listener_2 = (listener_data *) entry_2->listeners->data;
+    NP_ASSERT_PTR_EQUAL (listener_1->queue, listener_2->queue);
+
+    /* The queue is kept for the remaining listener of the set */
+    CMSG_SET_FIELD_PTR (&listener_info, service, "test_service1");
+    CMSG_SET_FIELD_PTR (&listener_info, transport_info, transport_info);
+    CMSG_SET_FIELD_VALUE (&listener_info, id, 5);
+    data_remove_listener (&listener_info);
+    cmsg_transport_info_free (transport_info);
+
+    NP_ASSERT_NULL (get_service_entry_or_create ("test_service1", false));
+
+    service_info = CMSG_MALLOC (sizeof (*service_info));
+    cmsg_service_info_init (service_info);
+    CMSG_SET_FIELD_PTR (service_info, service, CMSG_STRDUP ("test_service2"));
+    CMSG_SET_FIELD_PTR (service_info, server_info, create_tcp_transport_info (1));
+    data_add_server (service_info, true);
+
+    NP_ASSERT_EQUAL (count_listener_events ("server_added"), 1);
 }
@@ -0,0 +1,136 @@
+/*
+ * Unit tests for the process watch functionality.
+ *
+ * Copyright 2020, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <np.h>
+#include <sys/wait.h>
+#include "../process_watch.h"
+#include "../data.h"
+
+/**
+ * This informs the compiler that the function is, in fact, being used even though it
+ * doesn't look like it. This is useful for static functions that get found by NovaProva
+ * using debug symbols.
+ */
+#define USED __attribute__ ((used))
+
+static GList *removed_pids = NULL;
+static int batch_depth = 0;
+static int batch_count = 0;
+
+static void
+sm_mock_data_remove_by_pid (int pid)
+{
+    NP_ASSERT_EQUAL (batch_depth, 1);
+
+    removed_pids = g_list_append (removed_pids, GINT_TO_POINTER (pid));
+}
+
+static void
+sm_mock_data_batch_begin (void)
+{
+    batch_depth++;
+}
+
+static void
+sm_mock_data_batch_end (void)
+{
+    batch_depth--;
+    if (batch_depth == 0)
+    {
+        batch_count++;
+    }
+}
+
+static int USED
+set_up (void)
+{
+    removed_pids = NULL;
+    batch_depth = 0;
+    batch_count = 0;
+
+    np_mock (data_remove_by_pid, sm_mock_data_remove_by_pid);
+    np_mock (data_batch_begin, sm_mock_data_batch_begin);
+    np_mock (data_batch_end, sm_mock_data_batch_end);
+
+    process_watch_init ();
+
+    return 0;
+}
+
+static int USED
+tear_down (void)
+{
+    process_watch_deinit ();
+    g_list_free (removed_pids);
+
+    return 0;
+}
+
+/**
+ * Create a child process that exits immediately. The child is not reaped
+ * so that its PID remains valid to watch.
+ */
+static pid_t
+create_exited_child (void)
+{
+    pid_t pid = fork ();
+
+    if (pid == 0)
+    {
+        _exit (0);
+    }
+
+    NP_ASSERT_TRUE (pid > 0);
+
+    return pid;
+}
+
+void
+test_process_watch_exits_are_handled_together (void)
+{
+    pid_t pid_1 = create_exited_child ();
+    pid_t pid_2 = create_exited_child ();
+    int i;
+
+    process_watch_add (pid_1);
+    process_watch_add (pid_2);
+
+    for (i = 0; i < 100 && g_list_length (removed_pids) < 2; i++)
+    {
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+    NP_ASSERT_EQUAL (g_list_length (removed_pids), 2);
+    NP_ASSERT_NOT_NULL (g_list_find (removed_pids, GINT_TO_POINTER (pid_1)));
+    NP_ASSERT_NOT_NULL (g_list_find (removed_pids, GINT_TO_POINTER (pid_2)));
+    NP_ASSERT_EQUAL (batch_count, 1);
+
+    waitpid (pid_1, NULL, 0);
+    waitpid (pid_2, NULL, 0);
+}
+
+void
+test_process_watch_removed_watch_is_not_handled (void)
+{
+    pid_t pid_1 = create_exited_child ();
+    pid_t pid_2 = create_exited_child ();
+    int i;
+
+    process_watch_add (pid_1);
+    process_watch_add (pid_2);
+    process_watch_remove (pid_1);
+
+    for (i = 0; i < 100 && g_list_length (removed_pids) < 1; i++)
+    {
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+    NP_ASSERT_EQUAL (g_list_length (removed_pids), 1);
+    NP_ASSERT_EQUAL (GPOINTER_TO_INT (removed_pids->data), pid_2);
+
+    waitpid (pid_1, NULL, 0);
+    waitpid (pid_2, NULL, 0);
+}
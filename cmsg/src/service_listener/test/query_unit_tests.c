@@ -0,0 +1,97 @@
+/*
+ * Unit tests for the query functionality.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <np.h>
+#include "../query_impl_auto.h"
+#include "../data.h"
+
+/**
+ * This informs the compiler that the function is, in fact, being used even though it
+ * doesn't look like it. This is useful for static functions that get found by NovaProva
+ * using debug symbols.
+ */
+#define USED __attribute__ ((used))
+
+static service_data_entry test_entry;
+static bool data_add_listener_called = false;
+static size_t servers_sent = 0;
+
+static void
+sm_mock_data_add_listener (const cmsg_sld_listener_info *info)
+{
+    data_add_listener_called = true;
+}
+
+static service_data_entry *
+sm_mock_get_service_entry_or_create (const char *service, bool create)
+{
+    NP_ASSERT_FALSE (create);
+
+    return &test_entry;
+}
+
+static void
+sm_mock_cmsg_server_send_response (const ProtobufCMessage *send_msg, const void *service)
+{
+    const cmsg_sld_lookup_reply *reply = (const cmsg_sld_lookup_reply *) send_msg;
+
+    servers_sent = reply->n_servers;
+}
+
+static int USED
+set_up (void)
+{
+    test_entry.servers = NULL;
+    test_entry.listeners = NULL;
+    data_add_listener_called = false;
+    servers_sent = 0;
+
+    np_mock (data_add_listener, sm_mock_data_add_listener);
+    np_mock (get_service_entry_or_create, sm_mock_get_service_entry_or_create);
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+
+    return 0;
+}
+
+static int USED
+tear_down (void)
+{
+    g_list_free (test_entry.servers);
+
+    return 0;
+}
+
+void
+test_cmsg_sld_query_impl_lookup_returns_servers (void)
+{
+    cmsg_sld_lookup_request request = CMSG_SLD_LOOKUP_REQUEST_INIT;
+    cmsg_service_info server_1 = CMSG_SERVICE_INFO_INIT;
+    cmsg_service_info server_2 = CMSG_SERVICE_INFO_INIT;
+
+    test_entry.servers = g_list_append (test_entry.servers, &server_1);
+    test_entry.servers = g_list_append (test_entry.servers, &server_2);
+    CMSG_SET_FIELD_PTR (&request, service, "test");
+
+    cmsg_sld_query_impl_lookup (NULL, &request);
+
+    NP_ASSERT_EQUAL (servers_sent, 2);
+    NP_ASSERT_FALSE (data_add_listener_called);
+}
+
+void
+test_cmsg_sld_query_impl_lookup_with_listener (void)
+{
+    cmsg_sld_lookup_request request = CMSG_SLD_LOOKUP_REQUEST_INIT;
+    cmsg_sld_listener_info listener = CMSG_SLD_LISTENER_INFO_INIT;
+
+    CMSG_SET_FIELD_PTR (&request, service, "test");
+    CMSG_SET_FIELD_PTR (&request, listener, &listener);
+
+    cmsg_sld_query_impl_lookup (NULL, &request);
+
+    NP_ASSERT_EQUAL (servers_sent, 0);
+    NP_ASSERT_TRUE (data_add_listener_called);
+}
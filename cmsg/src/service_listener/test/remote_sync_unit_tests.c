@@ -9,7 +9,8 @@
 #include "../remote_sync_impl_auto.h"
 #include "../remote_sync_api_auto.h"
 #include <cmsg/cmsg_glib_helpers.h>
-#include <cmsg/cmsg_composite_client.h>
+#include "../data.h"
+#include "../listener_queue.h"
 
 /**
  * This informs the compiler that the function is, in fact, being used even though it
@@ -20,19 +21,50 @@
 
 extern cmsg_server *remote_sync_server;
 extern uint32_t local_ip_addr;
-extern cmsg_client *comp_client;
+extern uint32_t remote_sync_epoch;
+extern uint32_t remote_sync_seq;
+extern GQueue *remote_sync_change_log;
+extern GHashTable *remote_sync_peers;
 
 static cmsg_server *server_test_ptr = (cmsg_server *) 0x15876;
-static cmsg_client *remote_client = NULL;
+
+static int bulk_sync_sent = 0;
+static int delta_sync_sent = 0;
+static int delta_sync_changes_seen = 0;
+static int sync_request_sent = 0;
+static int servers_changed_sent = 0;
+static int add_server_sent = 0;
 
 static int USED
 set_up (void)
 {
     remote_sync_server = NULL;
     local_ip_addr = 0;
-    comp_client = NULL;
+    remote_sync_epoch = 0;
+    remote_sync_seq = 0;
+    remote_sync_change_log = NULL;
+    remote_sync_peers = NULL;
+
+    bulk_sync_sent = 0;
+    delta_sync_sent = 0;
+    delta_sync_changes_seen = 0;
+    sync_request_sent = 0;
+    servers_changed_sent = 0;
+    add_server_sent = 0;
 
-    remote_client = NULL;
+    data_init ();
+
+    return 0;
+}
+
+static int USED
+tear_down (void)
+{
+    if (remote_sync_peers)
+    {
+        g_hash_table_destroy (remote_sync_peers);
+    }
+    data_deinit ();
 
     return 0;
 }
@@ -54,46 +86,79 @@ sm_mock_cmsg_glib_tcp_server_init_oneway_fail (const char *service_name,
     return NULL;
 }
 
-static void
-sm_mock_remote_sync_bulk_sync_services (cmsg_client *client)
-{
-
-}
-
 static cmsg_client *
 sm_mock_cmsg_create_client_tcp_ipv4_oneway (const char *service_name,
                                             struct in_addr *addr, const char *vrf_bind_dev,
                                             const ProtobufCServiceDescriptor *descriptor)
 {
-    remote_client = cmsg_create_client_loopback (CMSG_SERVICE (cmsg_sld, remote_sync));
-    return remote_client;
+    return cmsg_create_client_loopback (CMSG_SERVICE (cmsg_sld, remote_sync));
 }
 
-static cmsg_client *
-sm_mock_cmsg_composite_client_lookup_by_tcp_ipv4_addr (cmsg_client *_composite_client,
-                                                       struct in_addr addr)
+static bool
+sm_mock_listener_queue_msg_send (listener_queue *queue, const char *method_name,
+                                 const ProtobufCMessage *msg)
 {
-    return remote_client;
+    if (strcmp (method_name, "bulk_sync") == 0)
+    {
+        bulk_sync_sent++;
+    }
+    else if (strcmp (method_name, "delta_sync") == 0)
+    {
+        delta_sync_sent++;
+        delta_sync_changes_seen = ((const cmsg_sld_delta_sync_data *) msg)->n_changes;
+    }
+    else if (strcmp (method_name, "sync_request") == 0)
+    {
+        sync_request_sent++;
+    }
+    else if (strcmp (method_name, "servers_changed") == 0)
+    {
+        servers_changed_sent++;
+    }
+    else if (strcmp (method_name, "add_server") == 0)
+    {
+        add_server_sent++;
+    }
+
+    return true;
 }
 
-static int
-sm_mock_cmsg_api_invoke (cmsg_client *client, const cmsg_api_descriptor *cmsg_desc,
-                         int method_index, const ProtobufCMessage *send_msg,
-                         ProtobufCMessage **recv_msg)
+static void
+sm_mock_cmsg_server_send_response (const ProtobufCMessage *send_msg, const void *service)
 {
-    if (cmsg_desc->service_desc == &cmsg_sld_remote_sync_descriptor)
-    {
-        switch (method_index)
-        {
-        case cmsg_sld_remote_sync_api_add_server_index:
-        case cmsg_sld_remote_sync_api_remove_server_index:
-            return CMSG_RET_OK;
-        default:
-            break;
-        }
-    }
+    /* Do nothing. */
+}
+
+/**
+ * Set up a service info message for a TCP server using the given IPv4 address.
+ */
+static void
+service_info_set (cmsg_service_info *service_info, cmsg_transport_info *transport_info,
+                  cmsg_tcp_transport_info *tcp_info, uint32_t *addr)
+{
+    CMSG_SET_FIELD_VALUE (tcp_info, ipv4, true);
+    CMSG_SET_FIELD_BYTES (tcp_info, addr, (void *) addr, sizeof (*addr));
+    CMSG_SET_FIELD_VALUE (transport_info, type, CMSG_TRANSPORT_INFO_TYPE_TCP);
+    CMSG_SET_FIELD_ONEOF (transport_info, tcp_info, tcp_info,
+                          data, CMSG_TRANSPORT_INFO_DATA_TCP_INFO);
+    CMSG_SET_FIELD_PTR (service_info, service, "test_service");
+    CMSG_SET_FIELD_PTR (service_info, server_info, transport_info);
+}
+
+/**
+ * Add a remote host with the sending to it mocked.
+ */
+static void
+add_test_host (uint32_t remote_addr)
+{
+    struct in_addr addr;
 
-    return cmsg_api_invoke_real (client, cmsg_desc, method_index, send_msg, recv_msg);
+    addr.s_addr = remote_addr;
+
+    np_mock (cmsg_create_client_tcp_ipv4_oneway,
+             sm_mock_cmsg_create_client_tcp_ipv4_oneway);
+    np_mock (listener_queue_msg_send, sm_mock_listener_queue_msg_send);
+    remote_sync_add_host (addr);
 }
 
 void
@@ -138,31 +203,32 @@ test_remote_sync_add_delete_host (void)
 {
     struct in_addr addr = { };
 
-    np_mock_by_name ("remote_sync_bulk_sync_services",
-                     sm_mock_remote_sync_bulk_sync_services);
-
-    np_mock (cmsg_create_client_tcp_ipv4_oneway,
-             sm_mock_cmsg_create_client_tcp_ipv4_oneway);
-    remote_sync_add_host (addr);
+    addr.s_addr = 1111;
+    add_test_host (addr.s_addr);
 
-    np_mock (cmsg_composite_client_lookup_by_tcp_ipv4_addr,
-             sm_mock_cmsg_composite_client_lookup_by_tcp_ipv4_addr);
+    /* The remote host is asked for its servers */
+    NP_ASSERT_EQUAL (sync_request_sent, 1);
+    NP_ASSERT_EQUAL (g_hash_table_size (remote_sync_peers), 1);
 
+    /* The sync state is kept once the host is deleted */
     remote_sync_delete_host (addr);
-    NP_ASSERT_NULL (comp_client);
+    NP_ASSERT_EQUAL (g_hash_table_size (remote_sync_peers), 1);
 }
 
 void
-test_remote_sync_server_added_no_comp_client (void)
+test_remote_sync_server_added_no_remote_host (void)
 {
     cmsg_service_info service_info = CMSG_SERVICE_INFO_INIT;
     cmsg_transport_info transport_info = CMSG_TRANSPORT_INFO_INIT;
+    cmsg_tcp_transport_info tcp_info = CMSG_TCP_TRANSPORT_INFO_INIT;
 
-    comp_client = NULL;
-
-    CMSG_SET_FIELD_PTR (&service_info, server_info, &transport_info);
+    local_ip_addr = 1234;
+    service_info_set (&service_info, &transport_info, &tcp_info, &local_ip_addr);
 
-    NP_ASSERT_FALSE (remote_sync_server_added (&service_info));
+    /* The change is still recorded for hosts that join later */
+    NP_ASSERT_TRUE (remote_sync_server_added (&service_info));
+    NP_ASSERT_EQUAL (remote_sync_seq, 1);
+    NP_ASSERT_EQUAL (g_queue_get_length (remote_sync_change_log), 1);
 }
 
 void
@@ -171,12 +237,11 @@ test_remote_sync_server_added_tport_not_tcp (void)
     cmsg_service_info service_info = CMSG_SERVICE_INFO_INIT;
     cmsg_transport_info transport_info = CMSG_TRANSPORT_INFO_INIT;
 
-    comp_client = (cmsg_client *) 0x1;
-
     CMSG_SET_FIELD_VALUE (&transport_info, type, CMSG_TRANSPORT_INFO_TYPE_UNIX);
     CMSG_SET_FIELD_PTR (&service_info, server_info, &transport_info);
 
     NP_ASSERT_FALSE (remote_sync_server_added (&service_info));
+    NP_ASSERT_EQUAL (remote_sync_seq, 0);
 }
 
 void
@@ -186,8 +251,6 @@ test_remote_sync_server_added_tport_not_ipv4 (void)
     cmsg_transport_info transport_info = CMSG_TRANSPORT_INFO_INIT;
     cmsg_tcp_transport_info tcp_info = CMSG_TCP_TRANSPORT_INFO_INIT;
 
-    comp_client = (cmsg_client *) 0x1;
-
     CMSG_SET_FIELD_VALUE (&tcp_info, ipv4, false);
     CMSG_SET_FIELD_VALUE (&transport_info, type, CMSG_TRANSPORT_INFO_TYPE_TCP);
     CMSG_SET_FIELD_ONEOF (&transport_info, tcp_info, &tcp_info,
@@ -205,17 +268,9 @@ test_remote_sync_server_added_address_not_local (void)
     cmsg_tcp_transport_info tcp_info = CMSG_TCP_TRANSPORT_INFO_INIT;
     uint32_t non_local_ip_addr;
 
-    comp_client = (cmsg_client *) 0x1;
     local_ip_addr = 1234;
     non_local_ip_addr = local_ip_addr + 1;
-
-    CMSG_SET_FIELD_VALUE (&tcp_info, ipv4, true);
-    CMSG_SET_FIELD_BYTES (&tcp_info, addr, (void *) &non_local_ip_addr,
-                          sizeof (non_local_ip_addr));
-    CMSG_SET_FIELD_VALUE (&transport_info, type, CMSG_TRANSPORT_INFO_TYPE_TCP);
-    CMSG_SET_FIELD_ONEOF (&transport_info, tcp_info, &tcp_info,
-                          data, CMSG_TRANSPORT_INFO_DATA_TCP_INFO);
-    CMSG_SET_FIELD_PTR (&service_info, server_info, &transport_info);
+    service_info_set (&service_info, &transport_info, &tcp_info, &non_local_ip_addr);
 
     NP_ASSERT_FALSE (remote_sync_server_added (&service_info));
 }
@@ -227,19 +282,12 @@ test_remote_sync_server_added_address_local (void)
     cmsg_transport_info transport_info = CMSG_TRANSPORT_INFO_INIT;
     cmsg_tcp_transport_info tcp_info = CMSG_TCP_TRANSPORT_INFO_INIT;
 
-    np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke);
-
-    comp_client = (cmsg_client *) 0x1;
     local_ip_addr = 1234;
-
-    CMSG_SET_FIELD_VALUE (&tcp_info, ipv4, true);
-    CMSG_SET_FIELD_BYTES (&tcp_info, addr, (void *) &local_ip_addr, sizeof (local_ip_addr));
-    CMSG_SET_FIELD_VALUE (&transport_info, type, CMSG_TRANSPORT_INFO_TYPE_TCP);
-    CMSG_SET_FIELD_ONEOF (&transport_info, tcp_info, &tcp_info,
-                          data, CMSG_TRANSPORT_INFO_DATA_TCP_INFO);
-    CMSG_SET_FIELD_PTR (&service_info, server_info, &transport_info);
+    service_info_set (&service_info, &transport_info, &tcp_info, &local_ip_addr);
+    add_test_host (1111);
 
     NP_ASSERT_TRUE (remote_sync_server_added (&service_info));
+    NP_ASSERT_EQUAL (servers_changed_sent, 1);
 }
 
 void
@@ -249,17 +297,141 @@ test_remote_sync_server_removed_address_local (void)
     cmsg_transport_info transport_info = CMSG_TRANSPORT_INFO_INIT;
     cmsg_tcp_transport_info tcp_info = CMSG_TCP_TRANSPORT_INFO_INIT;
 
-    np_mock (cmsg_api_invoke, sm_mock_cmsg_api_invoke);
+    local_ip_addr = 1234;
+    service_info_set (&service_info, &transport_info, &tcp_info, &local_ip_addr);
+    add_test_host (1111);
+
+    NP_ASSERT_TRUE (remote_sync_server_removed (&service_info));
+    NP_ASSERT_EQUAL (servers_changed_sent, 1);
+}
+
+void
+test_remote_sync_sync_request_sends_delta (void)
+{
+    cmsg_service_info service_info = CMSG_SERVICE_INFO_INIT;
+    cmsg_transport_info transport_info = CMSG_TRANSPORT_INFO_INIT;
+    cmsg_tcp_transport_info tcp_info = CMSG_TCP_TRANSPORT_INFO_INIT;
+    cmsg_sld_sync_request request = CMSG_SLD_SYNC_REQUEST_INIT;
 
-    comp_client = (cmsg_client *) 0x1;
     local_ip_addr = 1234;
+    remote_sync_epoch = 5;
+    service_info_set (&service_info, &transport_info, &tcp_info, &local_ip_addr);
+    add_test_host (1111);
+
+    remote_sync_server_added (&service_info);
+    remote_sync_server_removed (&service_info);
+    remote_sync_server_added (&service_info);
+
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+    CMSG_SET_FIELD_VALUE (&request, addr, 1111);
+    CMSG_SET_FIELD_VALUE (&request, epoch, 5);
+    CMSG_SET_FIELD_VALUE (&request, seq, 1);
+    cmsg_sld_remote_sync_impl_sync_request (NULL, &request);
+
+    NP_ASSERT_EQUAL (delta_sync_sent, 1);
+    NP_ASSERT_EQUAL (delta_sync_changes_seen, 2);
+    NP_ASSERT_EQUAL (bulk_sync_sent, 0);
+}
 
-    CMSG_SET_FIELD_VALUE (&tcp_info, ipv4, true);
-    CMSG_SET_FIELD_BYTES (&tcp_info, addr, (void *) &local_ip_addr, sizeof (local_ip_addr));
-    CMSG_SET_FIELD_VALUE (&transport_info, type, CMSG_TRANSPORT_INFO_TYPE_TCP);
-    CMSG_SET_FIELD_ONEOF (&transport_info, tcp_info, &tcp_info,
-                          data, CMSG_TRANSPORT_INFO_DATA_TCP_INFO);
-    CMSG_SET_FIELD_PTR (&service_info, server_info, &transport_info);
+void
+test_remote_sync_sync_request_unknown_epoch_sends_bulk (void)
+{
+    cmsg_sld_sync_request request = CMSG_SLD_SYNC_REQUEST_INIT;
 
-    NP_ASSERT_TRUE (remote_sync_server_removed (&service_info));
+    local_ip_addr = 1234;
+    remote_sync_epoch = 5;
+    add_test_host (1111);
+
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+    CMSG_SET_FIELD_VALUE (&request, addr, 1111);
+    CMSG_SET_FIELD_VALUE (&request, epoch, 0);
+    CMSG_SET_FIELD_VALUE (&request, seq, 0);
+    cmsg_sld_remote_sync_impl_sync_request (NULL, &request);
+
+    NP_ASSERT_EQUAL (delta_sync_sent, 0);
+    NP_ASSERT_EQUAL (bulk_sync_sent, 1);
+}
+
+void
+test_remote_sync_sync_request_before_host_added (void)
+{
+    cmsg_sld_sync_request request = CMSG_SLD_SYNC_REQUEST_INIT;
+
+    local_ip_addr = 1234;
+    remote_sync_epoch = 5;
+
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+    np_mock (listener_queue_msg_send, sm_mock_listener_queue_msg_send);
+    CMSG_SET_FIELD_VALUE (&request, addr, 1111);
+    cmsg_sld_remote_sync_impl_sync_request (NULL, &request);
+    NP_ASSERT_EQUAL (bulk_sync_sent, 0);
+
+    /* The request is answered once the host is added */
+    add_test_host (1111);
+    NP_ASSERT_EQUAL (sync_request_sent, 1);
+    NP_ASSERT_EQUAL (bulk_sync_sent, 1);
+}
+
+void
+test_remote_sync_change_with_gap_requests_sync (void)
+{
+    cmsg_sld_bulk_sync_data bulk = CMSG_SLD_BULK_SYNC_DATA_INIT;
+    cmsg_sld_servers_changed_data change = CMSG_SLD_SERVERS_CHANGED_DATA_INIT;
+
+    add_test_host (1111);
+    NP_ASSERT_EQUAL (sync_request_sent, 1);
+
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+
+    /* The remote host answers the sync request */
+    CMSG_SET_FIELD_VALUE (&bulk, addr, 1111);
+    CMSG_SET_FIELD_VALUE (&bulk, epoch, 7);
+    CMSG_SET_FIELD_VALUE (&bulk, seq, 3);
+    cmsg_sld_remote_sync_impl_bulk_sync (NULL, &bulk);
+
+    /* A change that directly follows is applied */
+    CMSG_SET_FIELD_VALUE (&change, addr, 1111);
+    CMSG_SET_FIELD_VALUE (&change, epoch, 7);
+    CMSG_SET_FIELD_VALUE (&change, seq, 4);
+    cmsg_sld_remote_sync_impl_servers_changed (NULL, &change);
+    NP_ASSERT_EQUAL (sync_request_sent, 1);
+
+    /* A change after a missed change asks for the changes since the last one */
+    CMSG_SET_FIELD_VALUE (&change, seq, 6);
+    cmsg_sld_remote_sync_impl_servers_changed (NULL, &change);
+    NP_ASSERT_EQUAL (sync_request_sent, 2);
+}
+
+static uint32_t
+sm_mock_remote_sync_sender_addr_get (const void *service)
+{
+    return 1111;
+}
+
+void
+test_remote_sync_legacy_bulk_sync (void)
+{
+    cmsg_service_info service_info = CMSG_SERVICE_INFO_INIT;
+    cmsg_transport_info transport_info = CMSG_TRANSPORT_INFO_INIT;
+    cmsg_tcp_transport_info tcp_info = CMSG_TCP_TRANSPORT_INFO_INIT;
+    cmsg_sld_bulk_sync_data bulk = CMSG_SLD_BULK_SYNC_DATA_INIT;
+
+    local_ip_addr = 1234;
+    service_info_set (&service_info, &transport_info, &tcp_info, &local_ip_addr);
+
+    /* A bulk sync without an address comes from an older software version */
+    np_mock_by_name ("remote_sync_sender_addr_get", sm_mock_remote_sync_sender_addr_get);
+    np_mock (cmsg_server_send_response, sm_mock_cmsg_server_send_response);
+    np_mock (listener_queue_msg_send, sm_mock_listener_queue_msg_send);
+    cmsg_sld_remote_sync_impl_bulk_sync (NULL, &bulk);
+    NP_ASSERT_EQUAL (bulk_sync_sent, 0);
+
+    /* The local servers are sent once the host is added */
+    add_test_host (1111);
+    NP_ASSERT_EQUAL (bulk_sync_sent, 1);
+
+    /* Further changes use the original methods */
+    remote_sync_server_added (&service_info);
+    NP_ASSERT_EQUAL (add_server_sent, 1);
+    NP_ASSERT_EQUAL (servers_changed_sent, 0);
 }
@@ -7,6 +7,7 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 
 /* Limit the size of message read */
 #define CMSG_RECV_ALL_CHUNK_SIZE  (16 * 1024)
@@ -19,7 +20,8 @@
  * @param addr - The address to connect to.
  * @param addrlen - The size of the 'addr' argument.
  * @param timeout - The timeout value in seconds (or zero to use the default
- *                  timeout value for the socket type).
+ *                  timeout value for the socket type, or a negative value to
+ *                  return EINPROGRESS rather than wait for the connection).
  */
 int
 connect_nb (int sockfd, const struct sockaddr *addr, socklen_t addrlen, int timeout)
@@ -55,6 +57,14 @@ connect_nb (int sockfd, const struct sockaddr *addr, socklen_t addrlen, int time
         return 0;
     }
 
+    if (timeout < 0)
+    {
+        /* The caller waits for the socket to become writable */
+        fcntl (sockfd, F_SETFL, flags);
+        errno = EINPROGRESS;
+        return -1;
+    }
+
     FD_ZERO (&rset);
     FD_SET (sockfd, &rset);
     wset = rset;
@@ -277,6 +287,18 @@ cmsg_transport_write_id (cmsg_transport *tport, const char *parent_obj_id)
             break;
         }
 
+    case CMSG_TRANSPORT_ONEWAY_MULTICAST:
+        {
+            char ip[INET_ADDRSTRLEN] = { };
+            uint16_t port;
+
+            port = ntohs (tport->config.socket.sockaddr.in.sin_port);
+            inet_ntop (AF_INET, &tport->config.socket.sockaddr.in.sin_addr, ip,
+                       INET_ADDRSTRLEN);
+            snprintf (tport->tport_id, CMSG_MAX_TPORT_ID_LEN, ".mcast[%s:%u]", ip, port);
+            break;
+        }
+
     case CMSG_TRANSPORT_LOOPBACK:
         {
             strncpy (tport->tport_id, ".lpb", CMSG_MAX_TPORT_ID_LEN);
@@ -331,6 +353,9 @@ cmsg_transport_new (cmsg_transport_type type)
     case CMSG_TRANSPORT_BROADCAST:
         cmsg_transport_tipc_broadcast_init (transport);
         break;
+    case CMSG_TRANSPORT_ONEWAY_MULTICAST:
+        cmsg_transport_udp_multicast_init (transport);
+        break;
 
     case CMSG_TRANSPORT_LOOPBACK:
         cmsg_transport_loopback_init (transport);
@@ -848,6 +873,71 @@ cmsg_transport_connect (cmsg_transport *transport)
     return ret;
 }
 
+/**
+ * Start connecting the transport without waiting for a connection in progress
+ * to complete.
+ *
+ * @param transport - The transport to connect.
+ *
+ * @returns 0 if connected, -EINPROGRESS if the connection is in progress (in which
+ *          case 'cmsg_transport_connect_finish' should be called once the socket is
+ *          writable), or another negative integer on failure.
+ */
+int32_t
+cmsg_transport_connect_start (cmsg_transport *transport)
+{
+    int32_t ret;
+
+    transport->connect_no_wait = true;
+    ret = cmsg_transport_connect (transport);
+    transport->connect_no_wait = false;
+
+    return ret;
+}
+
+/**
+ * Complete a connection started with 'cmsg_transport_connect_start'.
+ *
+ * @param transport - The transport being connected.
+ *
+ * @returns 0 if connected, -EINPROGRESS if the connection is still in progress,
+ *          or another negative integer if the connection failed (in which case
+ *          the socket is closed).
+ */
+int32_t
+cmsg_transport_connect_finish (cmsg_transport *transport)
+{
+    struct pollfd pfd = { };
+    int error = 0;
+    socklen_t len = sizeof (error);
+
+    pfd.fd = transport->socket;
+    pfd.events = POLLOUT;
+
+    if (poll (&pfd, 1, 0) == 0)
+    {
+        return -EINPROGRESS;
+    }
+
+    if (getsockopt (transport->socket, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+    {
+        error = errno;
+    }
+
+    if (error)
+    {
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Failed to connect to remote host. Error:%s",
+                                  strerror (error));
+        transport->tport_funcs.socket_close (transport);
+        return -error;
+    }
+
+    transport->tport_funcs.apply_send_timeout (transport, transport->socket);
+    transport->tport_funcs.apply_recv_timeout (transport, transport->socket);
+
+    return CMSG_RET_OK;
+}
+
 int32_t
 cmsg_transport_accept (cmsg_transport *transport)
 {
@@ -979,6 +1069,72 @@ cmsg_transport_compare (const cmsg_transport *one, const cmsg_transport *two)
     return false;
 }
 
+/**
+ * Hash a cmsg transport. The hash is consistent with 'cmsg_transport_compare'
+ * so that the transport can be used as the key of a GHashTable (along with
+ * 'cmsg_transport_equal').
+ *
+ * @param key - The transport to hash.
+ *
+ * @returns The hash value for the transport.
+ */
+guint
+cmsg_transport_hash (gconstpointer key)
+{
+    const cmsg_transport *transport = (const cmsg_transport *) key;
+    const cmsg_socket *sock = &transport->config.socket;
+    guint hash = transport->type;
+    const uint8_t *addr = NULL;
+    size_t addr_len = 0;
+    size_t i;
+
+    switch (transport->type)
+    {
+    case CMSG_TRANSPORT_RPC_TCP:
+    case CMSG_TRANSPORT_ONEWAY_TCP:
+        if (sock->family == AF_INET)
+        {
+            addr = (const uint8_t *) &sock->sockaddr.in.sin_addr;
+            addr_len = sizeof (struct in_addr);
+        }
+        else if (sock->family == AF_INET6)
+        {
+            addr = (const uint8_t *) &sock->sockaddr.in6.sin6_addr;
+            addr_len = sizeof (struct in6_addr);
+        }
+        for (i = 0; i < addr_len; i++)
+        {
+            hash = (hash << 5) + hash + addr[i];
+        }
+        hash = (hash << 5) + hash + sock->sockaddr.in.sin_port;
+        break;
+    case CMSG_TRANSPORT_RPC_UNIX:
+    case CMSG_TRANSPORT_ONEWAY_UNIX:
+        hash = (hash << 5) + hash + g_str_hash (sock->sockaddr.un.sun_path);
+        break;
+    default:
+        break;
+    }
+
+    return hash;
+}
+
+/**
+ * GEqualFunc wrapper around 'cmsg_transport_compare' for use with
+ * GHashTables keyed by cmsg transports.
+ *
+ * @param a - The first transport to compare.
+ * @param b - The second transport to compare.
+ *
+ * @returns TRUE if they are equal, FALSE otherwise.
+ */
+gboolean
+cmsg_transport_equal (gconstpointer a, gconstpointer b)
+{
+    return cmsg_transport_compare ((const cmsg_transport *) a,
+                                   (const cmsg_transport *) b);
+}
+
 /**
  * Create a 'cmsg_tcp_transport_info' message for the given tcp transport.
  *
@@ -1284,6 +1440,59 @@ cmsg_transport_info_compare (const cmsg_transport_info *transport_info_a,
     return false;
 }
 
+/**
+ * Hash a 'cmsg_transport_info' message. The hash is consistent with
+ * 'cmsg_transport_info_compare' so that the message can be used as the
+ * key of a GHashTable (along with 'cmsg_transport_info_equal').
+ *
+ * @param key - The 'cmsg_transport_info' message to hash.
+ *
+ * @returns The hash value for the message.
+ */
+guint
+cmsg_transport_info_hash (gconstpointer key)
+{
+    const cmsg_transport_info *transport_info = (const cmsg_transport_info *) key;
+    guint hash = (transport_info->type << 1) | (transport_info->one_way ? 1 : 0);
+    uint32_t i;
+
+    if (transport_info->type == CMSG_TRANSPORT_INFO_TYPE_TCP)
+    {
+        const cmsg_tcp_transport_info *tcp_info = transport_info->tcp_info;
+
+        for (i = 0; i < tcp_info->addr.len; i++)
+        {
+            hash = (hash << 5) + hash + tcp_info->addr.data[i];
+        }
+        for (i = 0; i < tcp_info->port.len; i++)
+        {
+            hash = (hash << 5) + hash + tcp_info->port.data[i];
+        }
+    }
+    else if (transport_info->type == CMSG_TRANSPORT_INFO_TYPE_UNIX)
+    {
+        hash = (hash << 5) + hash + g_str_hash (transport_info->unix_info->path);
+    }
+
+    return hash;
+}
+
+/**
+ * GEqualFunc wrapper around 'cmsg_transport_info_compare' for use with
+ * GHashTables keyed by 'cmsg_transport_info' messages.
+ *
+ * @param a - The first 'cmsg_transport_info' message to compare.
+ * @param b - The second 'cmsg_transport_info' message to compare.
+ *
+ * @returns TRUE if they are equal, FALSE otherwise.
+ */
+gboolean
+cmsg_transport_info_equal (gconstpointer a, gconstpointer b)
+{
+    return cmsg_transport_info_compare ((const cmsg_transport_info *) a,
+                                        (const cmsg_transport_info *) b);
+}
+
 /**
  * Returns a copy of the given cmsg transport.
  *
@@ -120,6 +120,7 @@ typedef enum _cmsg_transport_type_e
     CMSG_TRANSPORT_RPC_UNIX,
     CMSG_TRANSPORT_ONEWAY_UNIX,
     CMSG_TRANSPORT_FORWARDING,
+    CMSG_TRANSPORT_ONEWAY_MULTICAST,
 } cmsg_transport_type;
 
 #define CMSG_MAX_TPORT_ID_LEN 128
@@ -140,6 +141,9 @@ struct cmsg_transport
     // connect timeout in seconds
     uint32_t connect_timeout;
 
+    // don't wait for a connection in progress to complete when connecting
+    bool connect_no_wait;
+
     // maximum time to wait peeking for a received header
     uint32_t receive_peek_timeout;
 
@@ -167,6 +171,7 @@ void cmsg_transport_tipc_broadcast_init (cmsg_transport *transport);
 void cmsg_transport_rpc_unix_init (cmsg_transport *transport);
 void cmsg_transport_oneway_unix_init (cmsg_transport *transport);
 void cmsg_transport_forwarding_init (cmsg_transport *transport);
+void cmsg_transport_udp_multicast_init (cmsg_transport *transport);
 
 int connect_nb (int sockfd, const struct sockaddr *addr, socklen_t addrlen, int timeout);
 ssize_t cmsg_transport_socket_send (int sockfd, const void *buf, size_t len, int flags);
@@ -177,6 +182,8 @@ cmsg_status_code cmsg_transport_client_recv (cmsg_transport *transport,
                                              ProtobufCMessage **messagePtPt);
 
 int32_t cmsg_transport_connect (cmsg_transport *transport);
+int32_t cmsg_transport_connect_start (cmsg_transport *transport);
+int32_t cmsg_transport_connect_finish (cmsg_transport *transport);
 int32_t cmsg_transport_accept (cmsg_transport *transport);
 int32_t cmsg_transport_set_connect_timeout (cmsg_transport *transport, uint32_t timeout);
 int32_t cmsg_transport_set_send_timeout (cmsg_transport *transport, uint32_t timeout);
@@ -191,6 +198,8 @@ cmsg_transport *cmsg_transport_info_to_transport (const cmsg_transport_info
 bool cmsg_transport_info_compare (const cmsg_transport_info *transport_info_a,
                                   const cmsg_transport_info *transport_info_b);
 cmsg_transport_info *cmsg_transport_info_copy (const cmsg_transport_info *transport_info);
+guint cmsg_transport_info_hash (gconstpointer key);
+gboolean cmsg_transport_info_equal (gconstpointer a, gconstpointer b);
 void cmsg_transport_tcp_cache_set (struct in_addr *address, bool present);
 
 void cmsg_transport_forwarding_func_set (cmsg_transport *transport,
@@ -198,6 +207,9 @@ void cmsg_transport_forwarding_func_set (cmsg_transport *transport,
 void cmsg_transport_forwarding_user_data_set (cmsg_transport *transport, void *user_data);
 void *cmsg_transport_forwarding_user_data_get (cmsg_transport *transport);
 
+void cmsg_transport_multicast_interface_set (cmsg_transport *transport,
+                                             struct in_addr interface);
+
 cmsg_transport *cmsg_create_transport_unix (const ProtobufCServiceDescriptor *descriptor,
                                             cmsg_transport_type transport_type);
 
@@ -219,6 +231,8 @@ cmsg_transport_peek_for_header (cmsg_recv_func recv_wrapper, cmsg_transport *tra
 cmsg_status_code cmsg_transport_peek_to_status_code (cmsg_peek_code peek_code);
 
 bool cmsg_transport_compare (const cmsg_transport *one, const cmsg_transport *two);
+guint cmsg_transport_hash (gconstpointer key);
+gboolean cmsg_transport_equal (gconstpointer a, gconstpointer b);
 
 cmsg_transport *cmsg_create_transport_tcp_ipv4 (const char *service_name,
                                                 struct in_addr *addr,
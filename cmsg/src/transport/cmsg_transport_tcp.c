@@ -189,11 +189,13 @@ cmsg_transport_tcp_connect (cmsg_transport *transport)
         }
     }
 
-    if (connect_nb (transport->socket, addr, addr_len, transport->connect_timeout) < 0)
+    if (connect_nb (transport->socket, addr, addr_len,
+                    transport->connect_no_wait ? -1 : (int) transport->connect_timeout) < 0)
     {
-        if (errno == EINPROGRESS)
+        if (errno == EINPROGRESS && transport->connect_no_wait)
         {
-            //?
+            /* Completed by 'cmsg_transport_connect_finish' */
+            return -EINPROGRESS;
         }
 
         ret = -errno;
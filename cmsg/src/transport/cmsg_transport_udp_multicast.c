@@ -0,0 +1,847 @@
+/**
+ * The multicast transport sends oneway messages to every member of a UDP multicast
+ * group with a single datagram, so the cost of sending does not depend on the number
+ * of receivers.
+ *
+ * Every datagram is prefixed with a small header carrying a sequence number. A receiver
+ * that sees a gap in the sequence numbers from a sender sends a NACK for the missing
+ * datagrams back to the sender, which resends them to the group from a short history of
+ * the datagrams it has sent. Receivers only process a resent datagram if they NACKed it,
+ * so it is processed exactly once and out of order. As several receivers may share the
+ * group port on one host, resending to the group is the only way to be sure the receiver
+ * that NACKed gets the datagram.
+ *
+ * Each sender runs a thread that services NACKs as they arrive and, after it has sent a
+ * datagram, sends a few heartbeats carrying the last sequence number sent. This lets a
+ * receiver detect the loss of the final datagram in a burst. Receivers forget senders
+ * they have not heard from for a while. As with the TIPC broadcast transport each
+ * message must fit in a single datagram.
+ *
+ * Copyright 2021, Allied Telesis Labs New Zealand, Ltd
+ */
+#include "cmsg_private.h"
+#include "cmsg_transport_private.h"
+#include "cmsg_error.h"
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+
+#define CMSG_MULTICAST_MAGIC 0x434d4d43
+
+/* The number of sent datagrams kept by a sender to resend */
+#define CMSG_MULTICAST_HISTORY 256
+
+/* The number of heartbeats sent after the last datagram, and the interval between them */
+#define CMSG_MULTICAST_HEARTBEATS 3
+#define CMSG_MULTICAST_HEARTBEAT_MS 100
+
+/* How long a receiver keeps the state of a sender it has not heard from */
+#define CMSG_MULTICAST_SENDER_EXPIRY_US (60 * G_USEC_PER_SEC)
+
+typedef enum _cmsg_multicast_type_e
+{
+    CMSG_MULTICAST_DATA = 1,
+    CMSG_MULTICAST_RESEND,
+    CMSG_MULTICAST_NACK,
+    CMSG_MULTICAST_HEARTBEAT,
+} cmsg_multicast_type;
+
+/* Prefixed to every datagram, all fields are in network byte order */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t type;
+    uint32_t epoch;             /* Identifies the instance of the sender */
+    uint32_t seq;               /* Sequence number, the first missing for a NACK or the
+                                 * last sent for a heartbeat */
+    uint32_t seq_end;           /* The last missing sequence number for a NACK */
+} cmsg_multicast_header;
+
+/* The state kept by a receiver for each sender it has received from */
+typedef struct
+{
+    gint64 key;
+    uint32_t epoch;
+    uint32_t next_seq;
+    GHashTable *missing;        /* Sequence numbers NACKed and not yet received */
+    gint64 last_seen;           /* Monotonic time of the last datagram from the sender */
+} cmsg_multicast_sender;
+
+typedef struct
+{
+    struct in_addr interface;
+
+    /* Sender state, protected by 'lock' as it is shared with the sender thread */
+    pthread_mutex_t lock;
+    uint32_t epoch;
+    uint32_t next_seq;
+    uint32_t history_seq[CMSG_MULTICAST_HISTORY];
+    uint32_t history_len[CMSG_MULTICAST_HISTORY];
+    uint8_t *history[CMSG_MULTICAST_HISTORY];
+    uint32_t heartbeats;        /* Heartbeats still to send after the last datagram */
+    pthread_t thread;
+    bool thread_running;
+    bool thread_stop;
+    int wake_fd;                /* eventfd used to wake the sender thread */
+
+    /* Receiver state */
+    GHashTable *senders;
+    gint64 senders_expired;     /* Monotonic time the senders were last expired */
+} cmsg_multicast_info;
+
+static void cmsg_transport_multicast_thread_start (cmsg_transport *transport);
+
+static void
+cmsg_transport_multicast_sender_free (gpointer data)
+{
+    cmsg_multicast_sender *sender = data;
+
+    g_hash_table_destroy (sender->missing);
+    CMSG_FREE (sender);
+}
+
+/**
+ * Send a datagram with the multicast header prefixed to it.
+ */
+static ssize_t
+cmsg_transport_multicast_sendmsg (int sock, const struct sockaddr_in *dest,
+                                  cmsg_multicast_type type, uint32_t epoch, uint32_t seq,
+                                  uint32_t seq_end, void *buff, int length)
+{
+    cmsg_multicast_header header;
+    struct iovec iov[2];
+    struct msghdr msg = { };
+
+    header.magic = htonl (CMSG_MULTICAST_MAGIC);
+    header.type = htonl (type);
+    header.epoch = htonl (epoch);
+    header.seq = htonl (seq);
+    header.seq_end = htonl (seq_end);
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof (header);
+    iov[1].iov_base = buff;
+    iov[1].iov_len = length;
+
+    msg.msg_name = (void *) dest;
+    msg.msg_namelen = sizeof (struct sockaddr_in);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = length > 0 ? 2 : 1;
+
+    return sendmsg (sock, &msg, MSG_DONTWAIT);
+}
+
+/**
+ * Creates the socket used to send messages to the multicast group.
+ * Returns 0 on success or a negative integer on failure.
+ */
+static int32_t
+cmsg_transport_multicast_connect (cmsg_transport *transport)
+{
+    cmsg_multicast_info *info = transport->user_data;
+    unsigned char ttl = 1;
+    unsigned char loop = 1;
+    int ret;
+
+    transport->socket = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (transport->socket < 0)
+    {
+        ret = -errno;
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Unable to create socket. Error:%s",
+                                  strerror (errno));
+        return ret;
+    }
+
+    if (setsockopt (transport->socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+                    sizeof (ttl)) < 0 ||
+        setsockopt (transport->socket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+                    sizeof (loop)) < 0 ||
+        setsockopt (transport->socket, IPPROTO_IP, IP_MULTICAST_IF, &info->interface,
+                    sizeof (info->interface)) < 0)
+    {
+        ret = -errno;
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Unable to set multicast options. Error:%s",
+                                  strerror (errno));
+        close (transport->socket);
+        transport->socket = -1;
+        return ret;
+    }
+
+    cmsg_transport_multicast_thread_start (transport);
+
+    return 0;
+}
+
+/**
+ * Creates the socket used to receive messages sent to the multicast group.
+ */
+static int32_t
+cmsg_transport_multicast_listen (cmsg_transport *transport)
+{
+    cmsg_multicast_info *info = transport->user_data;
+    struct sockaddr_in addr = { };
+    struct ip_mreq mreq = { };
+    int32_t listening_socket;
+    int yes = 1;
+
+    listening_socket = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (listening_socket == -1)
+    {
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Failed to create socket. Error:%s",
+                                  strerror (errno));
+        return -1;
+    }
+
+    /* Allow several receivers of the group on one host */
+    if (setsockopt (listening_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof (yes)) < 0)
+    {
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Unable to set SO_REUSEADDR. Error:%s",
+                                  strerror (errno));
+        close (listening_socket);
+        return -1;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_ANY);
+    addr.sin_port = transport->config.socket.sockaddr.in.sin_port;
+
+    if (bind (listening_socket, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Unable to bind socket. Error:%s",
+                                  strerror (errno));
+        close (listening_socket);
+        return -1;
+    }
+
+    mreq.imr_multiaddr = transport->config.socket.sockaddr.in.sin_addr;
+    mreq.imr_interface = info->interface;
+
+    if (setsockopt (listening_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                    sizeof (mreq)) < 0)
+    {
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Unable to join multicast group. Error:%s",
+                                  strerror (errno));
+        close (listening_socket);
+        return -1;
+    }
+
+    transport->socket = listening_socket;
+
+    return 0;
+}
+
+static int
+cmsg_transport_multicast_recv_wrapper (cmsg_transport *transport, int sock, void *buff,
+                                       int len, int flags)
+{
+    return recv (sock, buff, len, flags);
+}
+
+/**
+ * Multicast clients do not receive a reply to their messages. This function therefore
+ * returns NULL. It should not be called by the client, but it prevents a null pointer
+ * exception from occurring if no function is defined.
+ */
+static cmsg_status_code
+cmsg_transport_multicast_client_recv (cmsg_transport *transport,
+                                      const ProtobufCServiceDescriptor *descriptor,
+                                      ProtobufCMessage **messagePtPt)
+{
+    *messagePtPt = NULL;
+    return CMSG_STATUS_CODE_SUCCESS;
+}
+
+/**
+ * Resend the datagrams requested by any NACKs the receivers have sent to the group.
+ * Datagrams that are no longer in the history are not resent. Must be called with
+ * the lock held.
+ */
+static void
+cmsg_transport_multicast_nacks_process (cmsg_transport *transport)
+{
+    cmsg_multicast_info *info = transport->user_data;
+    cmsg_multicast_header nack;
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof (from);
+    uint32_t first;
+    uint32_t last;
+    uint32_t seq;
+    uint32_t slot;
+
+    while (recvfrom (transport->socket, &nack, sizeof (nack), MSG_DONTWAIT,
+                     (struct sockaddr *) &from, &fromlen) == sizeof (nack))
+    {
+        fromlen = sizeof (from);
+
+        if (ntohl (nack.magic) != CMSG_MULTICAST_MAGIC ||
+            ntohl (nack.type) != CMSG_MULTICAST_NACK || ntohl (nack.epoch) != info->epoch)
+        {
+            continue;
+        }
+
+        first = ntohl (nack.seq);
+        last = ntohl (nack.seq_end);
+        if (last - first >= CMSG_MULTICAST_HISTORY)
+        {
+            first = last - CMSG_MULTICAST_HISTORY + 1;
+        }
+
+        for (seq = first; seq != last + 1; seq++)
+        {
+            slot = seq % CMSG_MULTICAST_HISTORY;
+            if (!info->history[slot] || info->history_seq[slot] != seq)
+            {
+                CMSG_DEBUG (CMSG_INFO, "[TRANSPORT] Unable to resend seq %u\n", seq);
+                continue;
+            }
+
+            cmsg_transport_multicast_sendmsg (transport->socket,
+                                              &transport->config.socket.sockaddr.in,
+                                              CMSG_MULTICAST_RESEND, info->epoch, seq, 0,
+                                              info->history[slot],
+                                              info->history_len[slot]);
+        }
+    }
+}
+
+/**
+ * Services NACKs as they arrive and sends the heartbeats that follow each datagram,
+ * until asked to stop.
+ */
+static void *
+cmsg_transport_multicast_thread (void *arg)
+{
+    cmsg_transport *transport = arg;
+    cmsg_multicast_info *info = transport->user_data;
+    struct pollfd pfds[2];
+    eventfd_t value;
+    int timeout;
+    int ret;
+
+    pfds[0].fd = transport->socket;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = info->wake_fd;
+    pfds[1].events = POLLIN;
+
+    pthread_mutex_lock (&info->lock);
+    while (!info->thread_stop)
+    {
+        timeout = info->heartbeats > 0 ? CMSG_MULTICAST_HEARTBEAT_MS : -1;
+        pthread_mutex_unlock (&info->lock);
+
+        ret = poll (pfds, 2, timeout);
+
+        pthread_mutex_lock (&info->lock);
+        if (ret < 0)
+        {
+            if (errno != EINTR)
+            {
+                CMSG_LOG_TRANSPORT_ERROR (transport, "Multicast poll failed. Error:%s",
+                                          strerror (errno));
+                break;
+            }
+            continue;
+        }
+
+        if (pfds[1].revents & POLLIN)
+        {
+            eventfd_read (info->wake_fd, &value);
+        }
+        if (pfds[0].revents & (POLLIN | POLLERR))
+        {
+            cmsg_transport_multicast_nacks_process (transport);
+        }
+        if (ret == 0 && info->heartbeats > 0)
+        {
+            info->heartbeats--;
+            cmsg_transport_multicast_sendmsg (transport->socket,
+                                              &transport->config.socket.sockaddr.in,
+                                              CMSG_MULTICAST_HEARTBEAT, info->epoch,
+                                              info->next_seq - 1, 0, NULL, 0);
+        }
+    }
+    pthread_mutex_unlock (&info->lock);
+
+    return NULL;
+}
+
+/**
+ * Start the thread that services NACKs and sends heartbeats for a sender. If the
+ * thread cannot be started NACKs are only serviced each time a datagram is sent,
+ * and no heartbeats are sent.
+ */
+static void
+cmsg_transport_multicast_thread_start (cmsg_transport *transport)
+{
+    cmsg_multicast_info *info = transport->user_data;
+
+    info->wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (info->wake_fd < 0)
+    {
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Unable to create eventfd. Error:%s",
+                                  strerror (errno));
+        return;
+    }
+
+    info->thread_stop = false;
+    if (pthread_create (&info->thread, NULL, cmsg_transport_multicast_thread,
+                        transport) != 0)
+    {
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Unable to create multicast sender thread");
+        close (info->wake_fd);
+        info->wake_fd = -1;
+        return;
+    }
+
+    cmsg_pthread_setname (info->thread, NULL, "mcast_");
+    info->thread_running = true;
+}
+
+/**
+ * Stop the sender thread, if it is running.
+ */
+static void
+cmsg_transport_multicast_thread_stop (cmsg_transport *transport)
+{
+    cmsg_multicast_info *info = transport->user_data;
+
+    if (!info->thread_running)
+    {
+        return;
+    }
+
+    pthread_mutex_lock (&info->lock);
+    info->thread_stop = true;
+    pthread_mutex_unlock (&info->lock);
+    eventfd_write (info->wake_fd, 1);
+
+    pthread_join (info->thread, NULL);
+    info->thread_running = false;
+    close (info->wake_fd);
+    info->wake_fd = -1;
+}
+
+static void
+cmsg_transport_multicast_socket_close (cmsg_transport *transport)
+{
+    cmsg_transport_multicast_thread_stop (transport);
+    cmsg_transport_socket_close (transport);
+}
+
+/**
+ * Send the data in buff to the multicast group with a single datagram, keeping a
+ * copy of it to resend to any receivers that miss it.
+ */
+static int32_t
+cmsg_transport_multicast_client_send (cmsg_transport *transport, void *buff, int length,
+                                      int flag)
+{
+    cmsg_multicast_info *info = transport->user_data;
+    uint32_t seq;
+    uint32_t slot;
+    ssize_t ret;
+
+    pthread_mutex_lock (&info->lock);
+
+    if (!info->thread_running)
+    {
+        cmsg_transport_multicast_nacks_process (transport);
+    }
+
+    seq = info->next_seq;
+    slot = seq % CMSG_MULTICAST_HISTORY;
+
+    ret = cmsg_transport_multicast_sendmsg (transport->socket,
+                                            &transport->config.socket.sockaddr.in,
+                                            CMSG_MULTICAST_DATA, info->epoch, seq, 0,
+                                            buff, length);
+    if (ret != (ssize_t) (sizeof (cmsg_multicast_header) + length))
+    {
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Failed to send multicast message. Error:%s",
+                                  strerror (errno));
+        pthread_mutex_unlock (&info->lock);
+        return -1;
+    }
+
+    info->next_seq++;
+
+    if (info->history_len[slot] < (uint32_t) length)
+    {
+        CMSG_FREE (info->history[slot]);
+        info->history[slot] = CMSG_MALLOC (length);
+        info->history_len[slot] = info->history[slot] ? length : 0;
+    }
+    if (info->history[slot])
+    {
+        memcpy (info->history[slot], buff, length);
+        info->history_len[slot] = length;
+        info->history_seq[slot] = seq;
+    }
+
+    info->heartbeats = CMSG_MULTICAST_HEARTBEATS;
+    pthread_mutex_unlock (&info->lock);
+
+    if (info->thread_running)
+    {
+        /* Restart the heartbeat interval */
+        eventfd_write (info->wake_fd, 1);
+    }
+
+    return length;
+}
+
+static gboolean
+cmsg_transport_multicast_missing_expired (gpointer key, gpointer value, gpointer user_data)
+{
+    cmsg_multicast_sender *sender = user_data;
+
+    return (int32_t) (sender->next_seq - GPOINTER_TO_UINT (key)) > CMSG_MULTICAST_HISTORY;
+}
+
+static gboolean
+cmsg_transport_multicast_sender_expired (gpointer key, gpointer value, gpointer user_data)
+{
+    cmsg_multicast_sender *sender = value;
+    gint64 now = *(gint64 *) user_data;
+
+    return now - sender->last_seen > CMSG_MULTICAST_SENDER_EXPIRY_US;
+}
+
+/**
+ * Forget the senders that have not been heard from for a while. The senders are
+ * checked at most once per expiry period.
+ */
+static void
+cmsg_transport_multicast_senders_expire (cmsg_multicast_info *info)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    if (now - info->senders_expired < CMSG_MULTICAST_SENDER_EXPIRY_US)
+    {
+        return;
+    }
+
+    info->senders_expired = now;
+    g_hash_table_foreach_remove (info->senders, cmsg_transport_multicast_sender_expired,
+                                 &now);
+}
+
+/**
+ * NACK the datagrams from a sender between its next expected sequence number and
+ * 'last', remembering them as missing.
+ *
+ * @param sender - The sender the datagrams were missed from.
+ * @param sock - The socket to send the NACK on.
+ * @param from - The address of the sender.
+ * @param last - The last sequence number missed.
+ */
+static void
+cmsg_transport_multicast_gap_nack (cmsg_multicast_sender *sender, int sock,
+                                   const struct sockaddr_in *from, uint32_t last)
+{
+    uint32_t first = sender->next_seq;
+    uint32_t i;
+
+    if (last - first >= CMSG_MULTICAST_HISTORY)
+    {
+        first = last - CMSG_MULTICAST_HISTORY + 1;
+    }
+
+    for (i = first; i != last + 1; i++)
+    {
+        g_hash_table_add (sender->missing, GUINT_TO_POINTER (i));
+    }
+    sender->next_seq = last + 1;
+    g_hash_table_foreach_remove (sender->missing,
+                                 cmsg_transport_multicast_missing_expired, sender);
+
+    CMSG_DEBUG (CMSG_INFO, "[TRANSPORT] Missed multicast seq %u to %u\n", first, last);
+    cmsg_transport_multicast_sendmsg (sock, from, CMSG_MULTICAST_NACK, sender->epoch,
+                                      first, last, NULL, 0);
+}
+
+/**
+ * Check the sequence number of a datagram received from a sender, NACKing any
+ * datagrams that have been missed. A resent datagram is only processed if this
+ * receiver NACKed it, as resends are sent to every receiver in the group.
+ *
+ * @param transport - The transport the datagram was received on.
+ * @param sock - The socket the datagram was received on.
+ * @param from - The address the datagram was received from.
+ * @param header - The multicast header of the datagram.
+ *
+ * @returns true if the datagram should be processed, false if it is a duplicate.
+ */
+static bool
+cmsg_transport_multicast_seq_check (cmsg_transport *transport, int sock,
+                                    const struct sockaddr_in *from,
+                                    const cmsg_multicast_header *header)
+{
+    cmsg_multicast_info *info = transport->user_data;
+    cmsg_multicast_sender *sender;
+    gint64 key = ((gint64) from->sin_addr.s_addr << 16) | from->sin_port;
+    uint32_t epoch = ntohl (header->epoch);
+    uint32_t seq = ntohl (header->seq);
+
+    sender = g_hash_table_lookup (info->senders, &key);
+
+    if (ntohl (header->type) == CMSG_MULTICAST_RESEND)
+    {
+        return sender && sender->epoch == epoch &&
+            g_hash_table_remove (sender->missing, GUINT_TO_POINTER (seq));
+    }
+
+    if (!sender)
+    {
+        sender = CMSG_CALLOC (1, sizeof (cmsg_multicast_sender));
+        if (!sender)
+        {
+            return true;
+        }
+        sender->key = key;
+        sender->epoch = epoch;
+        sender->next_seq = seq;
+        sender->missing = g_hash_table_new (g_direct_hash, g_direct_equal);
+        g_hash_table_insert (info->senders, &sender->key, sender);
+    }
+    else if (sender->epoch != epoch)
+    {
+        /* The sender has restarted */
+        sender->epoch = epoch;
+        sender->next_seq = seq;
+        g_hash_table_remove_all (sender->missing);
+    }
+
+    sender->last_seen = g_get_monotonic_time ();
+
+    if (seq == sender->next_seq)
+    {
+        sender->next_seq++;
+        return true;
+    }
+
+    if ((int32_t) (seq - sender->next_seq) < 0)
+    {
+        /* Only process an older datagram if it was missed */
+        return g_hash_table_remove (sender->missing, GUINT_TO_POINTER (seq));
+    }
+
+    cmsg_transport_multicast_gap_nack (sender, sock, from, seq - 1);
+    sender->next_seq = seq + 1;
+
+    return true;
+}
+
+/**
+ * Process a heartbeat from a sender, NACKing any datagrams up to the last one it
+ * has sent that have been missed. Heartbeats from unknown senders are ignored, as
+ * the receiver may have joined the group after they were sent.
+ *
+ * @param transport - The transport the heartbeat was received on.
+ * @param sock - The socket the heartbeat was received on.
+ * @param from - The address the heartbeat was received from.
+ * @param header - The multicast header of the heartbeat.
+ */
+static void
+cmsg_transport_multicast_heartbeat_process (cmsg_transport *transport, int sock,
+                                            const struct sockaddr_in *from,
+                                            const cmsg_multicast_header *header)
+{
+    cmsg_multicast_info *info = transport->user_data;
+    cmsg_multicast_sender *sender;
+    gint64 key = ((gint64) from->sin_addr.s_addr << 16) | from->sin_port;
+    uint32_t last = ntohl (header->seq);
+
+    sender = g_hash_table_lookup (info->senders, &key);
+    if (!sender || sender->epoch != ntohl (header->epoch))
+    {
+        return;
+    }
+
+    sender->last_seen = g_get_monotonic_time ();
+
+    if ((int32_t) (last - sender->next_seq) >= 0)
+    {
+        cmsg_transport_multicast_gap_nack (sender, sock, from, last);
+    }
+}
+
+/**
+ * Receive a datagram sent or resent to the multicast group. Datagrams that are
+ * invalid or duplicates, and heartbeats, are discarded, returning success with
+ * nbytes set to zero.
+ */
+static int32_t
+cmsg_transport_multicast_server_recv (int32_t server_socket, cmsg_transport *transport,
+                                      uint8_t **recv_buffer, cmsg_header *processed_header,
+                                      int *nbytes)
+{
+    cmsg_multicast_header header;
+    struct sockaddr_in from;
+    struct iovec iov[2];
+    struct msghdr msg = { };
+    uint32_t packet_len;
+    uint32_t type;
+    ssize_t len;
+
+    *nbytes = 0;
+
+    cmsg_transport_multicast_senders_expire (transport->user_data);
+
+    /* Find the size of the datagram */
+    len = recv (server_socket, NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+    if (len < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            return CMSG_RET_OK;
+        }
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Failed to receive datagram. Error:%s",
+                                  strerror (errno));
+        return CMSG_RET_ERR;
+    }
+
+    if (len < (ssize_t) sizeof (header))
+    {
+        recv (server_socket, NULL, 0, MSG_DONTWAIT);
+        return CMSG_RET_OK;
+    }
+
+    packet_len = len - sizeof (header);
+    if (packet_len > CMSG_RECV_BUFFER_SZ)
+    {
+        *recv_buffer = (uint8_t *) CMSG_CALLOC (1, packet_len);
+        if (*recv_buffer == NULL)
+        {
+            CMSG_LOG_TRANSPORT_ERROR (transport,
+                                      "Failed to allocate memory for received message");
+            recv (server_socket, NULL, 0, MSG_DONTWAIT);
+            return CMSG_RET_OK;
+        }
+    }
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof (header);
+    iov[1].iov_base = *recv_buffer;
+    iov[1].iov_len = packet_len;
+
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof (from);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    if (recvmsg (server_socket, &msg, MSG_DONTWAIT) != len)
+    {
+        return CMSG_RET_OK;
+    }
+
+    type = ntohl (header.type);
+    if (ntohl (header.magic) != CMSG_MULTICAST_MAGIC)
+    {
+        return CMSG_RET_OK;
+    }
+
+    if (type == CMSG_MULTICAST_HEARTBEAT)
+    {
+        cmsg_transport_multicast_heartbeat_process (transport, server_socket, &from,
+                                                    &header);
+        return CMSG_RET_OK;
+    }
+
+    if ((type != CMSG_MULTICAST_DATA && type != CMSG_MULTICAST_RESEND) ||
+        packet_len < sizeof (cmsg_header))
+    {
+        return CMSG_RET_OK;
+    }
+
+    if (cmsg_header_process ((cmsg_header *) *recv_buffer, processed_header) !=
+        CMSG_RET_OK ||
+        processed_header->header_length + processed_header->message_length != packet_len)
+    {
+        CMSG_LOG_TRANSPORT_ERROR (transport, "Discarding invalid multicast message");
+        return CMSG_RET_OK;
+    }
+
+    if (!cmsg_transport_multicast_seq_check (transport, server_socket, &from, &header))
+    {
+        return CMSG_RET_OK;
+    }
+
+    *nbytes = packet_len;
+
+    return CMSG_RET_OK;
+}
+
+static void
+cmsg_transport_multicast_destroy (cmsg_transport *transport)
+{
+    cmsg_multicast_info *info = transport->user_data;
+    int i;
+
+    cmsg_transport_multicast_thread_stop (transport);
+    pthread_mutex_destroy (&info->lock);
+
+    for (i = 0; i < CMSG_MULTICAST_HISTORY; i++)
+    {
+        CMSG_FREE (info->history[i]);
+    }
+    g_hash_table_destroy (info->senders);
+    CMSG_FREE (info);
+    transport->user_data = NULL;
+}
+
+/**
+ * Set the address of the interface used to send and receive multicast messages.
+ *
+ * @param transport - The multicast transport.
+ * @param interface - The address of the interface.
+ */
+void
+cmsg_transport_multicast_interface_set (cmsg_transport *transport,
+                                        struct in_addr interface)
+{
+    cmsg_multicast_info *info = transport->user_data;
+
+    info->interface = interface;
+}
+
+/**
+ * Setup the transport structure with the appropriate function pointers for
+ * UDP multicast, and transport family.
+ */
+void
+cmsg_transport_udp_multicast_init (cmsg_transport *transport)
+{
+    cmsg_multicast_info *info;
+
+    if (transport == NULL)
+    {
+        return;
+    }
+
+    info = CMSG_CALLOC (1, sizeof (cmsg_multicast_info));
+    info->interface.s_addr = htonl (INADDR_ANY);
+    info->epoch = g_random_int ();
+    info->next_seq = 1;
+    info->wake_fd = -1;
+    pthread_mutex_init (&info->lock, NULL);
+    info->senders = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL,
+                                           cmsg_transport_multicast_sender_free);
+    transport->user_data = info;
+
+    transport->config.socket.family = AF_INET;
+    transport->config.socket.sockaddr.in.sin_family = AF_INET;
+
+    transport->tport_funcs.recv_wrapper = cmsg_transport_multicast_recv_wrapper;
+    transport->tport_funcs.connect = cmsg_transport_multicast_connect;
+    transport->tport_funcs.listen = cmsg_transport_multicast_listen;
+    transport->tport_funcs.server_recv = cmsg_transport_multicast_server_recv;
+    transport->tport_funcs.client_recv = cmsg_transport_multicast_client_recv;
+    transport->tport_funcs.client_send = cmsg_transport_multicast_client_send;
+    transport->tport_funcs.server_send = cmsg_transport_oneway_server_send;
+    transport->tport_funcs.socket_close = cmsg_transport_multicast_socket_close;
+    transport->tport_funcs.get_socket = cmsg_transport_get_socket;
+
+    transport->tport_funcs.destroy = cmsg_transport_multicast_destroy;
+    transport->tport_funcs.apply_send_timeout = cmsg_transport_apply_send_timeout;
+    transport->tport_funcs.apply_recv_timeout = cmsg_transport_apply_recv_timeout;
+}
@@ -133,3 +133,108 @@ test_broadcast_client__servers_up_before_client_init (void)
 
     stop_servers_and_wait ();
 }
+
+/**
+ * Start a couple of servers and a broadcast client that connects to them in the
+ * background. Confirm that the children are connected without any method being
+ * invoked on the broadcast client.
+ */
+void
+test_broadcast_client__background_connect (void)
+{
+    cmsg_client *broadcast_client = NULL;
+    struct in_addr addr5 = inet_makeaddr (LOOPBACK_ADDR_PREFIX, 5);
+    GList *l;
+    cmsg_client *child;
+    int ret;
+
+    broadcast_client = cmsg_broadcast_client_new (CMSG_DESCRIPTOR (cmsg, test), "cmsg-test",
+                                                  addr5, false, false, NULL);
+    NP_ASSERT_NOT_NULL (broadcast_client);
+
+    ret = cmsg_broadcast_client_set_connect_policy (broadcast_client,
+                                                    CMSG_BROADCAST_CONNECT_BACKGROUND_SKIP);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+
+    create_servers ();
+    sleep (2);
+
+    NP_ASSERT_EQUAL (cmsg_composite_client_num_children (broadcast_client), 2);
+    for (l = cmsg_composite_client_get_children (broadcast_client); l; l = l->next)
+    {
+        child = (cmsg_client *) l->data;
+        NP_ASSERT_EQUAL (child->state, CMSG_CLIENT_STATE_CONNECTED);
+    }
+
+    cmsg_broadcast_client_destroy (broadcast_client);
+
+    stop_servers_and_wait ();
+}
+
+static void
+broadcast_event_handler (struct in_addr node_addr, bool joined)
+{
+}
+
+/**
+ * Return the number of events in the given array that match 'joined',
+ * and then free the array.
+ */
+static int
+count_events_and_free (GArray *events, bool joined)
+{
+    cmsg_broadcast_client_event *event = NULL;
+    int count = 0;
+    guint i;
+
+    for (i = 0; i < events->len; i++)
+    {
+        event = &g_array_index (events, cmsg_broadcast_client_event, i);
+        if (event->joined == joined)
+        {
+            count++;
+        }
+    }
+    g_array_free (events, TRUE);
+
+    return count;
+}
+
+/**
+ * Start a couple of servers and confirm that draining the event queue of the
+ * broadcast client returns a join event for each. Then restart the servers
+ * before draining again and confirm that the leave and join of each server
+ * cancel out.
+ */
+void
+test_broadcast_client__event_queue_drain (void)
+{
+    cmsg_client *broadcast_client = NULL;
+    struct in_addr addr5 = inet_makeaddr (LOOPBACK_ADDR_PREFIX, 5);
+    GArray *events = NULL;
+
+    broadcast_client = cmsg_broadcast_client_new (CMSG_DESCRIPTOR (cmsg, test), "cmsg-test",
+                                                  addr5, false, true,
+                                                  broadcast_event_handler);
+    NP_ASSERT_NOT_NULL (broadcast_client);
+
+    create_servers ();
+    sleep (2);
+
+    events = cmsg_broadcast_event_queue_drain (broadcast_client);
+    NP_ASSERT_EQUAL (events->len, 2);
+    NP_ASSERT_EQUAL (count_events_and_free (events, true), 2);
+
+    stop_servers_and_wait ();
+    sleep (1);
+    create_servers ();
+    sleep (2);
+
+    events = cmsg_broadcast_event_queue_drain (broadcast_client);
+    NP_ASSERT_EQUAL (events->len, 0);
+    g_array_free (events, TRUE);
+
+    cmsg_broadcast_client_destroy (broadcast_client);
+
+    stop_servers_and_wait ();
+}
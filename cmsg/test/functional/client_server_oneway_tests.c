@@ -7,13 +7,24 @@
 #include <arpa/inet.h>
 #include <np.h>
 #include <stdint.h>
+#include <sys/syscall.h>
 #include "cmsg_functional_tests_api_auto.h"
 #include "cmsg_functional_tests_impl_auto.h"
+#include "cmsg_broadcast_client.h"
 #include "setup.h"
 
+#define MULTICAST_GROUP_ADDR    0xefff0001  /* 239.255.0.1 */
+
+/* The type field of the multicast transport header, and the type of a data datagram */
+#define MULTICAST_HEADER_TYPE   1
+#define MULTICAST_TYPE_DATA     1
+
 static cmsg_server *server = NULL;
 static pthread_t server_thread;
 static bool message_received = false;
+static int messages_received = 0;
+static int data_datagrams_sent = 0;
+static int data_datagram_dropped = 0;
 
 /**
  * Common functionality to run before each test case.
@@ -29,6 +40,9 @@ set_up (void)
     cmsg_service_listener_mock_functions ();
 
     message_received = false;
+    messages_received = 0;
+    data_datagrams_sent = 0;
+    data_datagram_dropped = 0;
 
     return 0;
 }
@@ -49,6 +63,7 @@ cmsg_test_impl_simple_oneway_test (const void *service, const cmsg_bool_msg *rec
 {
     NP_ASSERT_TRUE (recv_msg->value);
     message_received = true;
+    messages_received++;
 }
 
 /**
@@ -129,3 +144,171 @@ test_client_server_oneway_tipc_broadcast (void)
 {
     //run_client_server_tests (CMSG_TRANSPORT_BROADCAST, AF_UNSPEC);
 }
+
+/**
+ * Send a message with the given multicast client and wait for the multicast server
+ * to receive it.
+ *
+ * @param client - The client to send the message with.
+ */
+static void
+run_multicast_test (cmsg_client *client)
+{
+    struct in_addr group = { .s_addr = htonl (MULTICAST_GROUP_ADDR) };
+    struct in_addr interface = { .s_addr = htonl (INADDR_LOOPBACK) };
+    cmsg_bool_msg send_msg = CMSG_BOOL_MSG_INIT;
+    int ret;
+    int i;
+
+    server = cmsg_create_server_multicast (CMSG_SERVICE (cmsg, test), "cmsg-test", group,
+                                           interface);
+    NP_ASSERT_NOT_NULL (server);
+
+    CMSG_SET_FIELD_VALUE (&send_msg, value, true);
+    ret = cmsg_test_api_simple_oneway_test (client, &send_msg);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+
+    for (i = 0; i < 100 && !message_received; i++)
+    {
+        cmsg_server_receive (server, cmsg_server_get_socket (server));
+        usleep (1000);
+    }
+    NP_ASSERT_TRUE (message_received);
+
+    cmsg_destroy_server_and_transport (server);
+    server = NULL;
+}
+
+/**
+ * Run the simple client <-> server test case with a UDP multicast transport.
+ */
+void
+test_client_server_oneway_multicast (void)
+{
+    struct in_addr group = { .s_addr = htonl (MULTICAST_GROUP_ADDR) };
+    struct in_addr interface = { .s_addr = htonl (INADDR_LOOPBACK) };
+    cmsg_client *client = NULL;
+
+    client = cmsg_create_client_multicast (CMSG_DESCRIPTOR (cmsg, test), "cmsg-test",
+                                           group, interface);
+    NP_ASSERT_NOT_NULL (client);
+
+    run_multicast_test (client);
+
+    cmsg_destroy_client_and_transport (client);
+}
+
+/**
+ * Run the simple client <-> server test case with a broadcast client that sends
+ * using a UDP multicast transport.
+ */
+void
+test_client_server_oneway_broadcast_multicast (void)
+{
+    struct in_addr group = { .s_addr = htonl (MULTICAST_GROUP_ADDR) };
+    struct in_addr interface = { .s_addr = htonl (INADDR_LOOPBACK) };
+    cmsg_client *broadcast_client = NULL;
+
+    broadcast_client = cmsg_broadcast_client_new_multicast (CMSG_DESCRIPTOR (cmsg, test),
+                                                            "cmsg-test", group, interface);
+    NP_ASSERT_NOT_NULL (broadcast_client);
+
+    run_multicast_test (broadcast_client);
+
+    cmsg_broadcast_client_destroy (broadcast_client);
+}
+
+/**
+ * Drop the data datagram sent by the multicast transport numbered
+ * 'data_datagram_dropped', sending everything else.
+ */
+static ssize_t
+sm_mock_sendmsg_drop (int sockfd, const struct msghdr *msg, int flags)
+{
+    const uint32_t *header = msg->msg_iov[0].iov_base;
+
+    if (msg->msg_iovlen == 2 &&
+        ntohl (header[MULTICAST_HEADER_TYPE]) == MULTICAST_TYPE_DATA &&
+        ++data_datagrams_sent == data_datagram_dropped)
+    {
+        return msg->msg_iov[0].iov_len + msg->msg_iov[1].iov_len;
+    }
+
+    return syscall (SYS_sendmsg, sockfd, msg, flags);
+}
+
+/**
+ * Send several messages with a multicast client while dropping one of them, and
+ * check the dropped message is resent and every message is received exactly once.
+ *
+ * @param messages - The number of messages to send.
+ * @param dropped - The message to drop, counting from one.
+ */
+static void
+run_multicast_resend_test (int messages, int dropped)
+{
+    struct in_addr group = { .s_addr = htonl (MULTICAST_GROUP_ADDR) };
+    struct in_addr interface = { .s_addr = htonl (INADDR_LOOPBACK) };
+    cmsg_bool_msg send_msg = CMSG_BOOL_MSG_INIT;
+    cmsg_client *client = NULL;
+    int ret;
+    int i;
+
+    server = cmsg_create_server_multicast (CMSG_SERVICE (cmsg, test), "cmsg-test", group,
+                                           interface);
+    NP_ASSERT_NOT_NULL (server);
+
+    client = cmsg_create_client_multicast (CMSG_DESCRIPTOR (cmsg, test), "cmsg-test",
+                                           group, interface);
+    NP_ASSERT_NOT_NULL (client);
+
+    data_datagram_dropped = dropped;
+    np_mock (sendmsg, sm_mock_sendmsg_drop);
+
+    CMSG_SET_FIELD_VALUE (&send_msg, value, true);
+    for (i = 0; i < messages; i++)
+    {
+        ret = cmsg_test_api_simple_oneway_test (client, &send_msg);
+        NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    }
+
+    for (i = 0; i < 1000 && messages_received < messages; i++)
+    {
+        cmsg_server_receive (server, cmsg_server_get_socket (server));
+        usleep (1000);
+    }
+    NP_ASSERT_EQUAL (messages_received, messages);
+
+    /* Keep receiving until the heartbeats stop to check nothing is processed twice */
+    for (i = 0; i < 500; i++)
+    {
+        cmsg_server_receive (server, cmsg_server_get_socket (server));
+        usleep (1000);
+    }
+    NP_ASSERT_EQUAL (messages_received, messages);
+    NP_ASSERT_EQUAL (data_datagrams_sent, messages);
+
+    cmsg_destroy_client_and_transport (client);
+    cmsg_destroy_server_and_transport (server);
+    server = NULL;
+}
+
+/**
+ * Check a multicast message that is lost before a later message is sent is NACKed
+ * when the gap is seen, resent to the group and received exactly once.
+ */
+void
+test_client_server_oneway_multicast_resend (void)
+{
+    run_multicast_resend_test (3, 2);
+}
+
+/**
+ * Check a lost multicast message that is the last one sent is NACKed when the
+ * sender's heartbeat is received, resent to the group and received exactly once.
+ */
+void
+test_client_server_oneway_multicast_heartbeat (void)
+{
+    run_multicast_resend_test (2, 2);
+}
@@ -0,0 +1,422 @@
+/*
+ * Functional tests (and a benchmark) for the composite client functionality.
+ *
+ * Copyright 2019, Allied Telesis Labs New Zealand, Ltd
+ */
+
+#include <np.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "cmsg_composite_client.h"
+#include "cmsg_functional_tests_api_auto.h"
+#include "cmsg_functional_tests_impl_auto.h"
+#include "setup.h"
+
+#define NUM_CHILDREN        16
+#define NUM_ITERATIONS      100
+#define NUM_STRINGS         64
+#define STRING_LENGTH       1024
+
+/* The time the benchmark must complete within */
+#define BENCHMARK_MAX_SECONDS   10.0
+
+static cmsg_server *server = NULL;
+static pthread_t server_thread;
+static int messages_received = 0;
+static int child_errors = 0;
+
+/**
+ * Common functionality to run before each test case.
+ */
+static int USED
+set_up (void)
+{
+    np_mock (cmsg_service_port_get, sm_mock_cmsg_service_port_get);
+
+    /* Ignore SIGPIPE signal if it occurs */
+    signal (SIGPIPE, SIG_IGN);
+
+    cmsg_service_listener_mock_functions ();
+
+    messages_received = 0;
+    child_errors = 0;
+
+    return 0;
+}
+
+/**
+ * Common functionality to run at the end of each test case.
+ */
+static int USED
+tear_down (void)
+{
+    NP_ASSERT_NULL (server);
+
+    return 0;
+}
+
+void
+cmsg_test_impl_composite_benchmark_test (const void *service,
+                                         const cmsg_bool_plus_repeated_strings *recv_msg)
+{
+    /* The benchmark messages are marked with a value of 1 */
+    if (recv_msg->value == 1)
+    {
+        NP_ASSERT_EQUAL (recv_msg->n_strings, NUM_STRINGS);
+        NP_ASSERT_EQUAL (strlen (recv_msg->strings[NUM_STRINGS - 1]), STRING_LENGTH);
+    }
+
+    __atomic_add_fetch (&messages_received, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Create a composite client with the given number of unix children of the
+ * given type that all send to the same server.
+ */
+static cmsg_client *
+create_composite_client_type (cmsg_transport_type type, int num_children)
+{
+    cmsg_client *composite_client = NULL;
+    cmsg_client *child = NULL;
+    int i;
+
+    composite_client = cmsg_composite_client_new (CMSG_DESCRIPTOR (cmsg, test));
+    NP_ASSERT_NOT_NULL (composite_client);
+
+    for (i = 0; i < num_children; i++)
+    {
+        child = create_client (type, AF_UNSPEC);
+        NP_ASSERT_EQUAL (cmsg_composite_client_add_child (composite_client, child),
+                         CMSG_RET_OK);
+    }
+
+    return composite_client;
+}
+
+/**
+ * Create a composite client with the given number of one-way unix children
+ * that all send to the same server.
+ */
+static cmsg_client *
+create_composite_client (int num_children)
+{
+    return create_composite_client_type (CMSG_TRANSPORT_ONEWAY_UNIX, num_children);
+}
+
+/**
+ * Send a large message to a composite client with many children a number of times
+ * and check the server receives all of the messages within the time allowed.
+ */
+void
+test_composite_client_large_message_benchmark (void)
+{
+    cmsg_bool_plus_repeated_strings send_msg = CMSG_BOOL_PLUS_REPEATED_STRINGS_INIT;
+    cmsg_client *composite_client = NULL;
+    char string[STRING_LENGTH + 1];
+    struct timespec start;
+    struct timespec end;
+    double elapsed;
+    int ret;
+    int i;
+
+    server = create_server (CMSG_TRANSPORT_ONEWAY_UNIX, AF_UNSPEC, &server_thread);
+    composite_client = create_composite_client (NUM_CHILDREN);
+
+    memset (string, 'a', STRING_LENGTH);
+    string[STRING_LENGTH] = '\0';
+
+    CMSG_SET_FIELD_VALUE (&send_msg, value, 1);
+    for (i = 0; i < NUM_STRINGS; i++)
+    {
+        CMSG_REPEATED_APPEND (&send_msg, strings, string);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < NUM_ITERATIONS; i++)
+    {
+        ret = cmsg_test_api_composite_benchmark_test (composite_client, &send_msg);
+        NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    }
+
+    while (__atomic_load_n (&messages_received, __ATOMIC_SEQ_CST) <
+           NUM_CHILDREN * NUM_ITERATIONS)
+    {
+        usleep (1000);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    NP_ASSERT (elapsed < BENCHMARK_MAX_SECONDS);
+
+    CMSG_REPEATED_FREE (send_msg.strings);
+
+    cmsg_composite_client_destroy_full (composite_client);
+
+    pthread_cancel (server_thread);
+    pthread_join (server_thread, NULL);
+    cmsg_destroy_server_and_transport (server);
+    server = NULL;
+}
+
+static void
+child_error_func (cmsg_client *composite_client, cmsg_client *child,
+                  const char *method_name, int32_t error)
+{
+    NP_ASSERT_STR_EQUAL (method_name, "composite_benchmark_test");
+    NP_ASSERT_NOT_EQUAL (error, CMSG_RET_OK);
+    child_errors++;
+}
+
+/**
+ * Check that the children of a composite client that cannot be reached are
+ * reported while the message is still sent to the other children.
+ */
+void
+test_composite_client_reports_child_errors (void)
+{
+    cmsg_bool_plus_repeated_strings send_msg = CMSG_BOOL_PLUS_REPEATED_STRINGS_INIT;
+    cmsg_client *composite_client = NULL;
+    cmsg_client *child = NULL;
+    int ret;
+
+    np_syslog_ignore (".*");
+
+    server = create_server (CMSG_TRANSPORT_ONEWAY_UNIX, AF_UNSPEC, &server_thread);
+    composite_client = create_composite_client (2);
+    cmsg_composite_client_error_func_set (composite_client, child_error_func);
+
+    /* Point one child at a server that doesn't exist */
+    child = create_client (CMSG_TRANSPORT_ONEWAY_UNIX, AF_UNSPEC);
+    snprintf (child->_transport->config.socket.sockaddr.un.sun_path,
+              sizeof (child->_transport->config.socket.sockaddr.un.sun_path),
+              "/tmp/cmsg_composite_client_tests_missing");
+    cmsg_composite_client_add_child (composite_client, child);
+
+    CMSG_SET_FIELD_VALUE (&send_msg, value, 0);
+    ret = cmsg_test_api_composite_benchmark_test (composite_client, &send_msg);
+    NP_ASSERT_NOT_EQUAL (ret, CMSG_RET_OK);
+    NP_ASSERT_EQUAL (child_errors, 1);
+
+    while (__atomic_load_n (&messages_received, __ATOMIC_SEQ_CST) < 2)
+    {
+        usleep (1000);
+    }
+
+    cmsg_composite_client_destroy_full (composite_client);
+
+    pthread_cancel (server_thread);
+    pthread_join (server_thread, NULL);
+    cmsg_destroy_server_and_transport (server);
+    server = NULL;
+}
+
+/**
+ * Check that the children of a composite client that are slow to connect are
+ * connected in parallel, so that they only delay the invoke by a single connect
+ * timeout, while the message is still sent to the other children.
+ */
+void
+test_composite_client_connects_children_in_parallel (void)
+{
+    cmsg_bool_plus_repeated_strings send_msg = CMSG_BOOL_PLUS_REPEATED_STRINGS_INIT;
+    cmsg_client *composite_client = NULL;
+    cmsg_client *child = NULL;
+    struct timespec start;
+    struct timespec end;
+    int64_t elapsed_ms;
+    int ret;
+    int i;
+
+    np_syslog_ignore (".*");
+
+    server = create_server (CMSG_TRANSPORT_ONEWAY_TCP, AF_INET, &server_thread);
+    composite_client = cmsg_composite_client_new (CMSG_DESCRIPTOR (cmsg, test));
+    cmsg_composite_client_error_func_set (composite_client, child_error_func);
+
+    for (i = 0; i < 4; i++)
+    {
+        child = create_client (CMSG_TRANSPORT_ONEWAY_TCP, AF_INET);
+
+        /* Point half of the children at an address that never answers */
+        if (i % 2)
+        {
+            inet_pton (AF_INET, "192.0.2.1",
+                       &child->_transport->config.socket.sockaddr.in.sin_addr);
+            cmsg_client_set_connect_timeout (child, 1);
+        }
+        cmsg_composite_client_add_child (composite_client, child);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    CMSG_SET_FIELD_VALUE (&send_msg, value, 0);
+    ret = cmsg_test_api_composite_benchmark_test (composite_client, &send_msg);
+    clock_gettime (CLOCK_MONOTONIC, &end);
+
+    elapsed_ms = ((int64_t) (end.tv_sec - start.tv_sec) * 1000 +
+                  (end.tv_nsec - start.tv_nsec) / 1000000);
+
+    NP_ASSERT_NOT_EQUAL (ret, CMSG_RET_OK);
+    NP_ASSERT_EQUAL (child_errors, 2);
+    NP_ASSERT_TRUE (elapsed_ms < 2000);
+
+    while (__atomic_load_n (&messages_received, __ATOMIC_SEQ_CST) < 2)
+    {
+        usleep (1000);
+    }
+
+    cmsg_composite_client_destroy_full (composite_client);
+
+    pthread_cancel (server_thread);
+    pthread_join (server_thread, NULL);
+    cmsg_destroy_server_and_transport (server);
+    server = NULL;
+}
+
+/**
+ * Wait until the server has received the given number of messages in total.
+ */
+static void
+wait_for_messages (int count)
+{
+    while (__atomic_load_n (&messages_received, __ATOMIC_SEQ_CST) < count)
+    {
+        usleep (1000);
+    }
+}
+
+/**
+ * Check that a composite client can still be invoked after all of its children
+ * have been freed, and again once a new child has been added.
+ */
+void
+test_composite_client_invoke_after_free_all_children (void)
+{
+    cmsg_bool_plus_repeated_strings send_msg = CMSG_BOOL_PLUS_REPEATED_STRINGS_INIT;
+    cmsg_client *composite_client = NULL;
+    int ret;
+
+    server = create_server (CMSG_TRANSPORT_ONEWAY_UNIX, AF_UNSPEC, &server_thread);
+    composite_client = create_composite_client (2);
+    CMSG_SET_FIELD_VALUE (&send_msg, value, 0);
+
+    ret = cmsg_test_api_composite_benchmark_test (composite_client, &send_msg);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    wait_for_messages (2);
+
+    /* The freed children are no longer sent to */
+    cmsg_composite_client_free_all_children (composite_client);
+    NP_ASSERT_EQUAL (cmsg_composite_client_num_children (composite_client), 0);
+
+    ret = cmsg_test_api_composite_benchmark_test (composite_client, &send_msg);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+
+    cmsg_composite_client_add_child (composite_client,
+                                     create_client (CMSG_TRANSPORT_ONEWAY_UNIX,
+                                                    AF_UNSPEC));
+
+    ret = cmsg_test_api_composite_benchmark_test (composite_client, &send_msg);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    wait_for_messages (3);
+
+    /* Give any message wrongly sent to a freed child time to arrive */
+    usleep (100000);
+    NP_ASSERT_EQUAL (__atomic_load_n (&messages_received, __ATOMIC_SEQ_CST), 3);
+
+    cmsg_composite_client_destroy_full (composite_client);
+
+    pthread_cancel (server_thread);
+    pthread_join (server_thread, NULL);
+    cmsg_destroy_server_and_transport (server);
+    server = NULL;
+}
+
+/**
+ * Check that the replies from a composite client with more children than fit in
+ * the fixed size array of replies are all returned as a set of replies.
+ */
+void
+test_composite_client_results_unbounded (void)
+{
+    cmsg_bool_msg send_msg = CMSG_BOOL_MSG_INIT;
+    cmsg_client *composite_client = NULL;
+    cmsg_client_results *results = NULL;
+    cmsg_client_results_iter iter;
+    ProtobufCMessage *message = NULL;
+    int num_children = CMSG_MAX_CLIENTS * 2;
+    int count = 0;
+    int ret;
+
+    server = create_server (CMSG_TRANSPORT_RPC_UNIX, AF_UNSPEC, &server_thread);
+    composite_client = create_composite_client_type (CMSG_TRANSPORT_RPC_UNIX,
+                                                     num_children);
+
+    CMSG_SET_FIELD_VALUE (&send_msg, value, true);
+    ret = cmsg_test_api_simple_rpc_test_results (composite_client, &send_msg, &results);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    NP_ASSERT_EQUAL (cmsg_client_results_count (results), num_children);
+
+    cmsg_client_results_iter_init (&iter, results);
+    while (cmsg_client_results_iter_next (&iter, &message))
+    {
+        NP_ASSERT_TRUE (((cmsg_bool_msg *) message)->value);
+        count++;
+    }
+    NP_ASSERT_EQUAL (count, num_children);
+
+    cmsg_client_results_free (results);
+    cmsg_composite_client_destroy_full (composite_client);
+
+    pthread_cancel (server_thread);
+    pthread_join (server_thread, NULL);
+    cmsg_destroy_server_and_transport (server);
+    server = NULL;
+}
+
+/**
+ * Invoke a composite client with a quorum set and check that the invoke returns
+ * as soon as the quorum of children have replied.
+ */
+void
+test_composite_client_quorum (void)
+{
+    cmsg_bool_msg send_msg = CMSG_BOOL_MSG_INIT;
+    cmsg_client *composite_client = NULL;
+    cmsg_client_results *results = NULL;
+    int num_children = 5;
+    int ret;
+
+    server = create_server (CMSG_TRANSPORT_RPC_UNIX, AF_UNSPEC, &server_thread);
+    composite_client = create_composite_client_type (CMSG_TRANSPORT_RPC_UNIX,
+                                                     num_children);
+    CMSG_SET_FIELD_VALUE (&send_msg, value, true);
+
+    cmsg_composite_client_set_quorum (composite_client, 1);
+    ret = cmsg_test_api_simple_rpc_test_results (composite_client, &send_msg, &results);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    NP_ASSERT_EQUAL (cmsg_client_results_count (results), 1);
+    cmsg_client_results_free (results);
+
+    cmsg_composite_client_set_quorum (composite_client,
+                                      CMSG_COMPOSITE_CLIENT_QUORUM_MAJORITY);
+    ret = cmsg_test_api_simple_rpc_test_results (composite_client, &send_msg, &results);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    NP_ASSERT_EQUAL (cmsg_client_results_count (results), num_children / 2 + 1);
+    cmsg_client_results_free (results);
+
+    /* The children that were closed reconnect on the next invoke */
+    cmsg_composite_client_set_quorum (composite_client, CMSG_COMPOSITE_CLIENT_QUORUM_ALL);
+    ret = cmsg_test_api_simple_rpc_test_results (composite_client, &send_msg, &results);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    NP_ASSERT_EQUAL (cmsg_client_results_count (results), num_children);
+    cmsg_client_results_free (results);
+
+    cmsg_composite_client_destroy_full (composite_client);
+
+    pthread_cancel (server_thread);
+    pthread_join (server_thread, NULL);
+    cmsg_destroy_server_and_transport (server);
+    server = NULL;
+}
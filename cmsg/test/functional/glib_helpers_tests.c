@@ -4,6 +4,7 @@
  * Copyright 2020, Allied Telesis Labs New Zealand, Ltd
  */
 
+#include <arpa/inet.h>
 #include <np.h>
 #include <stdint.h>
 #include "cmsg_functional_tests_api_auto.h"
@@ -14,6 +15,15 @@
 static GMainContext *context = NULL;
 static GMainLoop *loop = NULL;
 
+/* A server using the shared accept thread, processed by a main loop of its own */
+typedef struct
+{
+    cmsg_server *server;
+    GMainContext *context;
+    GMainLoop *loop;
+    pthread_t thread;
+} shared_accept_server;
+
 /**
  * Common functionality to run before each test case.
  */
@@ -106,3 +116,160 @@ test_glib_helper (void)
     g_main_context_unref (context);
     cmsg_destroy_client_and_transport (client);
 }
+
+/**
+ * Run the simple client <-> server test case with a UNIX transport, with the
+ * connections to the server accepted by the shared accept thread.
+ */
+void
+test_glib_helper_shared_accept (void)
+{
+    int ret;
+    cmsg_client *client = NULL;
+    cmsg_server *server = NULL;
+    cmsg_bool_msg send_msg = CMSG_BOOL_MSG_INIT;
+    cmsg_bool_msg *recv_msg = NULL;
+    pthread_t thread;
+
+    context = g_main_context_new ();
+    loop = g_main_loop_new (context, FALSE);
+
+    server = cmsg_create_server_unix_rpc (CMSG_SERVICE (cmsg, test));
+
+    ret = cmsg_server_shared_accept_thread_init (server);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+
+    pthread_create (&thread, NULL, server_thread, server);
+
+    client = cmsg_create_client_unix (CMSG_DESCRIPTOR (cmsg, test));
+    ret = cmsg_test_api_glib_helper_test (client, &send_msg, &recv_msg);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    CMSG_FREE_RECV_MSG (recv_msg);
+    cmsg_destroy_client_and_transport (client);
+
+    client = cmsg_create_client_unix (CMSG_DESCRIPTOR (cmsg, test));
+    ret = cmsg_test_api_glib_helper_test (client, &send_msg, &recv_msg);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    CMSG_FREE_RECV_MSG (recv_msg);
+
+    g_main_loop_quit (loop);
+    pthread_join (thread, NULL);
+    g_main_context_unref (context);
+    cmsg_destroy_client_and_transport (client);
+}
+
+static void *
+shared_accept_server_thread (void *_sa_server)
+{
+    shared_accept_server *sa_server = _sa_server;
+
+    _cmsg_glib_server_processing_start (sa_server->server, sa_server->context);
+
+    g_main_loop_run (sa_server->loop);
+
+    cmsg_glib_server_destroy (sa_server->server);
+
+    g_main_loop_unref (sa_server->loop);
+
+    return NULL;
+}
+
+/**
+ * Create a TCP server listening on the given address that uses the shared accept
+ * thread, and start processing it.
+ *
+ * @param sa_server - The server to start.
+ * @param address - The IPv4 address for the server to listen on.
+ */
+static void
+shared_accept_server_start (shared_accept_server *sa_server, const char *address)
+{
+    struct in_addr addr;
+    int ret;
+
+    NP_ASSERT_EQUAL (inet_pton (AF_INET, address, &addr), 1);
+
+    sa_server->server = cmsg_create_server_tcp_ipv4_rpc ("cmsg-test", &addr, NULL,
+                                                         CMSG_SERVICE (cmsg, test));
+    NP_ASSERT_NOT_NULL (sa_server->server);
+
+    ret = cmsg_server_shared_accept_thread_init (sa_server->server);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+
+    sa_server->context = g_main_context_new ();
+    sa_server->loop = g_main_loop_new (sa_server->context, FALSE);
+
+    pthread_create (&sa_server->thread, NULL, shared_accept_server_thread, sa_server);
+}
+
+/**
+ * Stop processing a server started with 'shared_accept_server_start' and destroy
+ * it. The server must have processed a message so its main loop is running.
+ *
+ * @param sa_server - The server to stop.
+ */
+static void
+shared_accept_server_stop (shared_accept_server *sa_server)
+{
+    g_main_loop_quit (sa_server->loop);
+    pthread_join (sa_server->thread, NULL);
+    g_main_context_unref (sa_server->context);
+    sa_server->server = NULL;
+}
+
+/**
+ * Check a new connection to the server listening on the given address is accepted
+ * and a message sent on it is processed.
+ *
+ * @param address - The IPv4 address the server is listening on.
+ */
+static void
+shared_accept_server_check (const char *address)
+{
+    cmsg_client *client = NULL;
+    cmsg_bool_msg send_msg = CMSG_BOOL_MSG_INIT;
+    cmsg_bool_msg *recv_msg = NULL;
+    struct in_addr addr;
+    int ret;
+
+    NP_ASSERT_EQUAL (inet_pton (AF_INET, address, &addr), 1);
+
+    client = cmsg_create_client_tcp_ipv4_rpc ("cmsg-test", &addr, NULL,
+                                              CMSG_DESCRIPTOR (cmsg, test));
+    NP_ASSERT_NOT_NULL (client);
+
+    ret = cmsg_test_api_glib_helper_test (client, &send_msg, &recv_msg);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+    CMSG_FREE_RECV_MSG (recv_msg);
+
+    cmsg_destroy_client_and_transport (client);
+}
+
+/**
+ * Check the shared accept thread keeps accepting connections for one server while
+ * another server using it is destroyed, and that it is started again for a server
+ * created after every server using it has been destroyed.
+ */
+void
+test_glib_helper_shared_accept_several_servers (void)
+{
+    shared_accept_server first = { };
+    shared_accept_server second = { };
+
+    shared_accept_server_start (&first, "127.0.0.1");
+    shared_accept_server_start (&second, "127.0.0.2");
+
+    shared_accept_server_check ("127.0.0.1");
+    shared_accept_server_check ("127.0.0.2");
+
+    shared_accept_server_stop (&first);
+
+    shared_accept_server_check ("127.0.0.2");
+    shared_accept_server_check ("127.0.0.2");
+
+    shared_accept_server_stop (&second);
+
+    shared_accept_server_start (&first, "127.0.0.1");
+    shared_accept_server_check ("127.0.0.1");
+    shared_accept_server_stop (&first);
+}
@@ -89,9 +89,10 @@ publish_message (cmsg_publisher *publisher)
  * check that they were received.
  *
  * @param type - Transport type of the subscriber to create
+ * @param shm - Whether the local publisher and subscriber use shared memory
  */
 static void
-create_sub_before_pub_and_test (cmsg_transport_type type)
+create_sub_before_pub_and_test (cmsg_transport_type type, bool shm)
 {
     pthread_t subscriber_thread;
     cmsg_subscriber *sub = NULL;
@@ -107,7 +108,14 @@ create_sub_before_pub_and_test (cmsg_transport_type type)
                                           CMSG_SERVICE (cmsg, test));
         break;
     case CMSG_TRANSPORT_RPC_UNIX:
-        sub = cmsg_subscriber_create_unix (CMSG_SERVICE (cmsg, test));
+        if (shm)
+        {
+            sub = cmsg_subscriber_create_unix_shm (CMSG_SERVICE (cmsg, test));
+        }
+        else
+        {
+            sub = cmsg_subscriber_create_unix (CMSG_SERVICE (cmsg, test));
+        }
         break;
     default:
         NP_FAIL;
@@ -121,7 +129,14 @@ create_sub_before_pub_and_test (cmsg_transport_type type)
     NP_ASSERT_TRUE (cmsg_pthread_server_init (&subscriber_thread,
                                               cmsg_sub_unix_server_get (sub)));
 
-    publisher = cmsg_publisher_create (CMSG_DESCRIPTOR (cmsg, test));
+    if (shm)
+    {
+        publisher = cmsg_publisher_create_shm (CMSG_DESCRIPTOR (cmsg, test));
+    }
+    else
+    {
+        publisher = cmsg_publisher_create (CMSG_DESCRIPTOR (cmsg, test));
+    }
     NP_ASSERT_NOT_NULL (publisher);
 
     publish_message (publisher);
@@ -143,7 +158,7 @@ create_sub_before_pub_and_test (cmsg_transport_type type)
 void
 test_publisher_subscriber_tcp (void)
 {
-    create_sub_before_pub_and_test (CMSG_TRANSPORT_RPC_TCP);
+    create_sub_before_pub_and_test (CMSG_TRANSPORT_RPC_TCP, false);
 }
 
 /**
@@ -152,7 +167,17 @@ test_publisher_subscriber_tcp (void)
 void
 test_publisher_subscriber_unix (void)
 {
-    create_sub_before_pub_and_test (CMSG_TRANSPORT_RPC_UNIX);
+    create_sub_before_pub_and_test (CMSG_TRANSPORT_RPC_UNIX, false);
+}
+
+/**
+ * Run the publisher <-> subscriber test case with a UNIX transport where the
+ * published message is received from shared memory.
+ */
+void
+test_publisher_subscriber_unix_shm (void)
+{
+    create_sub_before_pub_and_test (CMSG_TRANSPORT_RPC_UNIX, true);
 }
 
 /**
@@ -191,6 +191,87 @@ test_cmsg_composite_client_child_remove__already_removed (void)
     cmsg_destroy_client_and_transport (child_3);
 }
 
+void
+test_cmsg_composite_client_delete_and_destroy_child (void)
+{
+    int ret;
+    cmsg_client *comp_client = cmsg_composite_client_new (&dummy_service_descriptor);
+    struct in_addr addr1 = inet_makeaddr (LOOPBACK_ADDR_PREFIX, 1);
+    struct in_addr addr2 = inet_makeaddr (LOOPBACK_ADDR_PREFIX, 2);
+
+    cmsg_client *child_1 = cmsg_create_client_tcp_ipv4_rpc ("test", &addr1, NULL,
+                                                            &dummy_service_descriptor);
+    cmsg_client *child_2 = cmsg_create_client_tcp_ipv4_rpc ("test", &addr2, NULL,
+                                                            &dummy_service_descriptor);
+
+    cmsg_composite_client_add_child (comp_client, child_1);
+    cmsg_composite_client_add_child (comp_client, child_2);
+
+    /* No invoke is in progress so the child is destroyed straight away */
+    ret = cmsg_composite_client_delete_and_destroy_child (comp_client, child_2);
+    NP_ASSERT_EQUAL (ret, 0);
+    NP_ASSERT_EQUAL (cmsg_composite_client_num_children (comp_client), 1);
+    NP_ASSERT_NULL (cmsg_composite_client_lookup_by_tcp_ipv4_addr (comp_client, addr2));
+
+    ret = cmsg_composite_client_delete_and_destroy_child (comp_client, child_1);
+    NP_ASSERT_EQUAL (ret, 0);
+    NP_ASSERT_EQUAL (cmsg_composite_client_num_children (comp_client), 0);
+
+    /* Children that are not in the composite client are left alone */
+    child_1 = cmsg_create_client_tcp_ipv4_rpc ("test", &addr1, NULL,
+                                               &dummy_service_descriptor);
+    ret = cmsg_composite_client_delete_and_destroy_child (comp_client, child_1);
+    NP_ASSERT_EQUAL (ret, -1);
+
+    cmsg_client_destroy (comp_client);
+    cmsg_destroy_client_and_transport (child_1);
+}
+
+void
+test_cmsg_composite_client_lookup_by_transport (void)
+{
+    cmsg_client *comp_client = cmsg_composite_client_new (&dummy_service_descriptor);
+    struct in_addr addr1 = inet_makeaddr (LOOPBACK_ADDR_PREFIX, 1);
+    struct in_addr addr2 = inet_makeaddr (LOOPBACK_ADDR_PREFIX, 2);
+
+    cmsg_client *child_1 = cmsg_create_client_tcp_ipv4_rpc ("test", &addr1, NULL,
+                                                            &dummy_service_descriptor);
+    cmsg_client *child_2 = cmsg_create_client_tcp_ipv4_rpc ("test", &addr2, NULL,
+                                                            &dummy_service_descriptor);
+    cmsg_client *child_3 = cmsg_create_client_tcp_ipv4_rpc ("test", &addr1, NULL,
+                                                            &dummy_service_descriptor);
+
+    cmsg_composite_client_add_child (comp_client, child_1);
+    cmsg_composite_client_add_child (comp_client, child_2);
+    cmsg_composite_client_add_child (comp_client, child_3);
+
+    /* The first child added with a transport is found */
+    NP_ASSERT_PTR_EQUAL (cmsg_composite_client_lookup_by_transport (comp_client,
+                                                                    child_3->_transport),
+                         child_1);
+    NP_ASSERT_PTR_EQUAL (cmsg_composite_client_lookup_by_transport (comp_client,
+                                                                    child_2->_transport),
+                         child_2);
+
+    /* Once it is removed the other child with the same transport is found */
+    cmsg_composite_client_delete_child (comp_client, child_1);
+    NP_ASSERT_PTR_EQUAL (cmsg_composite_client_lookup_by_transport (comp_client,
+                                                                    child_1->_transport),
+                         child_3);
+
+    cmsg_composite_client_delete_child (comp_client, child_3);
+    NP_ASSERT_NULL (cmsg_composite_client_lookup_by_transport (comp_client,
+                                                               child_1->_transport));
+    NP_ASSERT_PTR_EQUAL (cmsg_composite_client_lookup_by_transport (comp_client,
+                                                                    child_2->_transport),
+                         child_2);
+
+    cmsg_client_destroy (comp_client);
+    cmsg_destroy_client_and_transport (child_1);
+    cmsg_destroy_client_and_transport (child_2);
+    cmsg_destroy_client_and_transport (child_3);
+}
+
 void
 test_cmsg_composite_client__sanity_checks (void)
 {
@@ -294,6 +375,18 @@ test_wrong_client_type (void)
     ret = cmsg_composite_client_delete_child (std_client, child_client);
     NP_ASSERT_EQUAL (ret, -1);
 
+    ret = cmsg_composite_client_set_timeout (comp_client, 1);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+
+    ret = cmsg_composite_client_set_timeout (std_client, 1);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_ERR);
+
+    ret = cmsg_composite_client_set_quorum (comp_client, 1);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_OK);
+
+    ret = cmsg_composite_client_set_quorum (std_client, 1);
+    NP_ASSERT_EQUAL (ret, CMSG_RET_ERR);
+
     cmsg_client_destroy (comp_client);
     cmsg_destroy_client_and_transport (std_client);
     cmsg_destroy_client_and_transport (child_client);
@@ -306,6 +306,26 @@ void AtlCodeGenerator::GenerateAtlApiDefinition(const MethodDescriptor &method,
   }
   printer->Print("\n");
 
+  // the results variant collects any number of responses (e.g. from a composite client)
+  if (method.output_type()->field_count() > 0) {
+    printer->Print(vars_, "static inline int\n$lcfullname$_api_$method$_results (cmsg_client *client");
+    if (method.input_type()->field_count() > 0) {
+      printer->Print(vars_, ", const $method_input$ *send_msg");
+    }
+    printer->Print(", cmsg_client_results **results)");
+    if (forHeader) {
+      printer->Print("\n{\n");
+      printer->Indent();
+
+      printer->Print(vars_, "return cmsg_api_invoke_results (client, &$lcfullname$_cmsg_api_descriptor,\n");
+      printer->Print(vars_, "                                $lcfullname$_api_$method$_index,\n");
+      printer->Print(vars_, "                                $send_msg_name$, results);\n");
+
+      printer->Outdent();
+      printer->Print("}\n");
+    }
+    printer->Print("\n");
+  }
 }
 
 void AtlCodeGenerator::GenerateAtlApiImplementation(io::Printer* printer)